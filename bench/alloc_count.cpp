@@ -0,0 +1,49 @@
+#include <stddef.h>
+#include <stdint.h>     // Pulls in <features.h>, which defines __GLIBC__
+
+// Counts malloc/calloc/realloc calls of the whole bench process (operator new goes through malloc too).
+// Kept apart from <stdlib.h>, whose declarations carry exception specifiers these definitions can't match.
+// Only glibc exposes the __libc_* entry points; elsewhere the count stays at zero.
+
+#if defined(__GLIBC__)
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t nmemb, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static size_t alloc_calls = 0;
+
+extern "C" void *malloc(size_t size) {
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t nmemb, size_t size) {
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&alloc_calls, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+bool bench_alloc_counting(void) {
+    return true;
+}
+
+size_t bench_alloc_calls(void) {
+    return __atomic_load_n(&alloc_calls, __ATOMIC_RELAXED);
+}
+
+#else
+
+bool bench_alloc_counting(void) {
+    return false;
+}
+
+size_t bench_alloc_calls(void) {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "differentiator.h"
+#include "io_utils.h"
+#include "util.h"
+#include "base.h"
+
+// Throughput of the nil-padded prefix loader against the infix parser on the same trees.
+// Trees are the inputs and their derivatives, each one written in both formats.
+//
+//     bench/bench [orders] expr/test.tmp expr/test3.tmp ...
+//
+// `bench/bench --scale ...` runs the scaling suite on generated expressions instead (see scale.cpp).
+
+const double MIN_SECONDS  = 0.2;
+const size_t DEFAULT_DIFS = 3;
+
+extern int run_scale(int argc, char *argv[]);
+
+typedef FRONT_COMPIL_T *(*loader_t)(const char *filename, varlist::VarList *vars);
+
+function FRONT_COMPIL_T *load_infix(const char *filename, varlist::VarList *vars) {
+    graph_range_t range = {};
+    return load_tree_from_file(filename, vars, &range);
+}
+
+function FRONT_COMPIL_T *load_prefix(const char *filename, varlist::VarList *vars) {
+    return load_tree_from_prefix_file(filename, vars);
+}
+
+function size_t file_size(const char *filename) {
+    FILE *file = fopen(filename, "r");
+    if (!file) return 0;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size > 0 ? (size_t) size : 0;
+}
+
+// Returns seconds per load, repeating until MIN_SECONDS elapsed; -1 if any load failed.
+function double time_loader(loader_t loader, const char *filename) {
+    size_t runs = 0;
+    double start = now_seconds(), elapsed = 0;
+    do {
+        varlist::VarList vars = {};
+        FRONT_COMPIL_T *tree = loader(filename, &vars);
+        if (!tree) {
+            varlist::destruct(&vars);
+            return -1;
+        }
+        destruct(tree);
+        varlist::destruct(&vars);
+        ++runs;
+        elapsed = now_seconds() - start;
+    } while (elapsed < MIN_SECONDS);
+    return elapsed / (double) runs;
+}
+
+function void bench_tree(const char *label, size_t order, FRONT_COMPIL_T *tree,
+                         const char *infix_path, const char *prefix_path) {
+    FILE *infix  = fopen(infix_path, "w");
+    FILE *prefix = fopen(prefix_path, "w");
+    if (!infix || !prefix) {
+        ERROR_MSG("can't create temporary files\n");
+        if (infix)  fclose(infix);
+        if (prefix) fclose(prefix);
+        return;
+    }
+    print(infix, tree);
+    save_tree_to_prefix_file(prefix, tree);
+    fclose(infix);
+    fclose(prefix);
+
+    size_t nodes = tree->root ? tree->root->elements + 1 : 0;
+    double t_infix  = time_loader(load_infix,  infix_path);
+    double t_prefix = time_loader(load_prefix, prefix_path);
+    if (t_infix < 0 || t_prefix < 0) {
+        ERROR_MSG("%s, order %zu: the %s loader failed to read the tree back\n",
+                  label, order, t_infix < 0 ? "infix" : "prefix");
+        return;
+    }
+    printf("%-24s %5zu %9zu %10zu %10zu %12.1f %12.1f %8.2f\n",
+           label, order, nodes, file_size(infix_path), file_size(prefix_path),
+           t_infix * 1e9 / nodes, t_prefix * 1e9 / nodes, t_infix / t_prefix);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--scale") == 0)
+        return run_scale(argc - 2, argv + 2);
+
+    int first_file = 1;
+    size_t orders = DEFAULT_DIFS;
+    if (argc > 1 && argv[1][0] >= '0' && argv[1][0] <= '9') {
+        orders = strtoul(argv[1], nullptr, 10);
+        ++first_file;
+    }
+    if (first_file >= argc) {
+        ERROR_MSG("bench [orders] path_to_equation...\n");
+        return 1;
+    }
+
+    // mkstemp, not fixed names: parallel runs and other users can't clobber or pre-create them
+    char infix_path[]  = "/tmp/differentiation_bench_infix_XXXXXX";
+    char prefix_path[] = "/tmp/differentiation_bench_prefix_XXXXXX";
+    int infix_fd  = mkstemp(infix_path);
+    int prefix_fd = infix_fd >= 0 ? mkstemp(prefix_path) : -1;
+    if (prefix_fd < 0) {
+        ERROR_MSG("can't create temporary files\n");
+        if (infix_fd >= 0) {
+            close(infix_fd);
+            unlink(infix_path);
+        }
+        return 1;
+    }
+    close(infix_fd);
+    close(prefix_fd);
+
+    printf("%-24s %5s %9s %10s %10s %12s %12s %8s\n",
+           "input", "order", "nodes", "infix_B", "prefix_B", "infix_ns/n", "prefix_ns/n", "speedup");
+    for (int i = first_file; i < argc; ++i) {
+        varlist::VarList vars = {};
+        graph_range_t range = {};
+        FRONT_COMPIL_T *tree = load_tree_from_file(argv[i], &vars, &range);
+        FRONT_COMPIL_T **difs = tree ? differentiate_to_n(nullptr, tree, orders, 0) : nullptr;
+        if (!difs) {
+            ERROR_MSG("can't prepare trees for %s\n", argv[i]);
+            destruct(tree);
+            continue;
+        }
+        for (size_t k = 0; k <= orders; ++k)
+            bench_tree(argv[i], k, difs[k], infix_path, prefix_path);
+        destruct(difs);
+        FREE(difs);
+        destruct(tree);
+        varlist::destruct(&vars);
+    }
+    unlink(infix_path);
+    unlink(prefix_path);
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#include "differentiator.h"
+#include "io_utils.h"
+#include "util.h"
+#include "base.h"
+#include "budget.h"
+#include "gen.h"
+
+// Scaling of load / simplify / differentiate / differentiate_to_n / calc_in_point on generated
+// expressions from 10 nodes up. JSON goes to stdout (or --out), a readable table to stderr.
+//
+//     bench/bench --scale [--seed N] [--max-nodes N] [--orders K] [--shapes pow_log,trig]
+//                         [--budget-nodes N] [--timeout sec] [--out file.json]
+
+extern bool    bench_alloc_counting(void);
+extern size_t  bench_alloc_calls(void);
+
+const double SCALE_MIN_SECONDS      = 0.2;
+const size_t SCALE_MAX_RUNS         = 100000;
+const size_t SCALE_DEFAULT_MAX      = 1000000;
+const size_t SCALE_DEFAULT_ORDERS   = 3;
+const size_t SCALE_DEFAULT_BUDGET   = 20000000;
+const double SCALE_DEFAULT_TIMEOUT  = 30;
+
+typedef enum {
+    OP_LOAD,
+    OP_SIMPLIFY,
+    OP_DIFFERENTIATE,
+    OP_DIFFERENTIATE_TO_N,
+    OP_CALC,
+    OP_COUNT,
+} BENCH_OP;
+
+const char *OP_NAMES[OP_COUNT] = {"load", "simplify", "differentiate", "differentiate_to_n", "calc_in_point"};
+
+typedef struct {
+    uint64_t seed;
+    size_t   max_nodes;
+    size_t   orders;
+    size_t   budget_nodes;
+    double   timeout;
+    bool     shapes[gen::SHAPE_COUNT];
+    FILE    *out;
+} scale_opts_t;
+
+typedef struct {
+    size_t        runs;
+    double        seconds;          // Только измеряемая часть
+    size_t        allocs;
+    size_t        out_nodes;        // Размер результата последнего прогона
+    size_t        nodes_created;    // За все прогоны, по budget_t
+    size_t        peak_node_bytes;
+    long          peak_rss_kb;
+    BUDGET_STATUS status;
+    bool          failed;
+} measure_t;
+
+typedef struct {
+    BENCH_OP              op;
+    const FRONT_COMPIL_T *tree;
+    size_t                orders;
+    double               *point;
+    size_t                vars_count;
+    const char           *infix_path;   // Дерево в инфиксной записи для OP_LOAD
+} op_ctx_t;
+
+function size_t tree_nodes(const FRONT_COMPIL_T *tree) {
+    return tree && tree->root ? tree->root->elements + 1 : 0;
+}
+
+// Linux keeps the peak in VmHWM; writing 5 to clear_refs resets it to the current RSS.
+// Freed heap is handed back first, otherwise the previous row's garbage counts as this row's peak.
+function void reset_peak_rss() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+    if (!file) return;
+    fputs("5", file);
+    fclose(file);
+}
+
+function long peak_rss_kb() {
+    FILE *file = fopen("/proc/self/status", "r");
+    if (file) {
+        char line[256] = "";
+        while (fgets(line, sizeof(line), file)) {
+            if (strncmp(line, "VmHWM:", 6) == 0) {
+                fclose(file);
+                return strtol(line + 6, nullptr, 10);
+            }
+        }
+        fclose(file);
+    }
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// One run: the timed part only; setup (copies) and teardown (destruct) stay outside the clock
+function bool run_once(op_ctx_t *ctx, measure_t *m, size_t run) {
+    FRONT_COMPIL_T *input = ctx->op == OP_SIMPLIFY ? copy_tree(ctx->tree) : nullptr;
+    if (ctx->op == OP_SIMPLIFY && !input) return false;
+
+    varlist::VarList vars = {};
+    graph_range_t range = {};
+    FRONT_COMPIL_T *result = nullptr;
+    FRONT_COMPIL_T **array = nullptr;
+    bool ok = true;
+
+    size_t allocs0 = bench_alloc_calls();
+    double t0 = now_seconds();
+    switch (ctx->op) {
+        case OP_LOAD:
+            result = load_tree_from_file(ctx->infix_path, &vars, &range);
+            ok = result != nullptr;
+            break;
+        case OP_SIMPLIFY:
+            simplify_tree(nullptr, input);
+            break;
+        case OP_DIFFERENTIATE:
+            result = differentiate(nullptr, ctx->tree, 0);
+            ok = result != nullptr;
+            break;
+        case OP_DIFFERENTIATE_TO_N:
+            array = differentiate_to_n(nullptr, ctx->tree, ctx->orders, 0);
+            ok = array != nullptr;
+            break;
+        case OP_CALC: {
+            // Different points each run, so nothing can be hoisted out of the loop
+            ctx->point[0] = 0.25 + 1e-3 * (double) (run % 512);
+            EQ_POINT_T point = {.tree = (FRONT_COMPIL_T *) ctx->tree, .point = ctx->point, .vars_count = ctx->vars_count, .result = 0};
+            calc_in_point(&point);
+            break;
+        }
+        case OP_COUNT:
+        default:
+            ok = false;
+            break;
+    }
+    m->seconds += now_seconds() - t0;
+    m->allocs  += bench_alloc_calls() - allocs0;
+
+    if (ctx->op == OP_SIMPLIFY)           m->out_nodes = tree_nodes(input);
+    else if (result)                      m->out_nodes = tree_nodes(result);
+    else if (array)                       m->out_nodes = tree_nodes(array[ctx->orders]);
+
+    destruct(input);
+    destruct(result);
+    if (array) {
+        destruct(array);
+        FREE(array);
+    }
+    varlist::destruct(&vars);
+    return ok;
+}
+
+function measure_t measure(op_ctx_t *ctx, const scale_opts_t *opts) {
+    measure_t m = {};
+    bool limited = ctx->op == OP_DIFFERENTIATE || ctx->op == OP_DIFFERENTIATE_TO_N;
+
+    reset_peak_rss();
+    while (m.runs < SCALE_MAX_RUNS && (m.runs == 0 || m.seconds < SCALE_MIN_SECONDS)) {
+        // A fresh budget per run: the limits are per operation, the counters are summed below
+        budget_t budget = {};
+        budget_init(&budget, limited ? opts->budget_nodes : 0, 0, limited ? opts->timeout : 0, nullptr);
+        budget_begin(&budget);
+        bool ok = run_once(ctx, &m, m.runs);
+        budget_end(&budget);
+
+        m.nodes_created += budget.nodes;
+        if (budget.peak_bytes > m.peak_node_bytes) m.peak_node_bytes = budget.peak_bytes;
+        m.status = budget.status;
+        if (!ok) {
+            m.failed = true;
+            break;
+        }
+        m.runs++;
+    }
+    m.peak_rss_kb = peak_rss_kb();
+    return m;
+}
+
+function void print_json_row(FILE *out, bool *first, gen::SHAPE shape, size_t target, size_t nodes,
+                             BENCH_OP op, const scale_opts_t *opts, const measure_t *m) {
+    double per_run = m->runs ? m->seconds / (double) m->runs : 0;
+    fprintf(out, "%s\n    {\"shape\": \"%s\", \"target_nodes\": %zu, \"nodes\": %zu, \"op\": \"%s\", ",
+            *first ? "" : ",", gen::shape_name(shape), target, nodes, OP_NAMES[op]);
+    if (op == OP_DIFFERENTIATE_TO_N) fprintf(out, "\"orders\": %zu, ", opts->orders);
+    fprintf(out, "\"status\": \"%s\", \"runs\": %zu, \"ns_per_op\": %.1f, \"ns_per_node\": %.3f, ",
+            m->status != BUDGET_OK ? budget_status_str(m->status) : (m->failed ? "failed" : "ok"),
+            m->runs, per_run * 1e9, nodes ? per_run * 1e9 / (double) nodes : 0);
+    if (bench_alloc_counting())
+        fprintf(out, "\"allocs_per_op\": %.1f, ", m->runs ? (double) m->allocs / (double) m->runs : 0);
+    else
+        fprintf(out, "\"allocs_per_op\": null, ");
+    fprintf(out, "\"nodes_created_per_op\": %.1f, \"out_nodes\": %zu, \"peak_node_bytes\": %zu, \"peak_rss_kb\": %ld}",
+            m->runs ? (double) m->nodes_created / (double) m->runs : 0, m->out_nodes, m->peak_node_bytes, m->peak_rss_kb);
+    *first = false;
+}
+
+function void print_table_row(gen::SHAPE shape, size_t nodes, BENCH_OP op, const measure_t *m) {
+    double per_run = m->runs ? m->seconds / (double) m->runs : 0;
+    fprintf(stderr, "%-9s %9zu %-19s %7zu %12.1f %10.2f %12.1f %11zu %10ld %s\n",
+            gen::shape_name(shape), nodes, OP_NAMES[op], m->runs, per_run * 1e6,
+            nodes ? per_run * 1e9 / (double) nodes : 0,
+            m->runs ? (double) m->allocs / (double) m->runs : 0, m->out_nodes, m->peak_rss_kb,
+            m->status != BUDGET_OK ? budget_status_str(m->status) : (m->failed ? "failed" : ""));
+}
+
+function bool parse_shapes(const char *list, bool *shapes) {
+    char buf[256] = "";
+    snprintf(buf, sizeof(buf), "%s", list);
+    memset(shapes, 0, gen::SHAPE_COUNT * sizeof(bool));
+    for (char *save = nullptr, *name = strtok_r(buf, ",", &save); name; name = strtok_r(nullptr, ",", &save)) {
+        gen::SHAPE shape = gen::SHAPE_COUNT;
+        if (!gen::shape_from_name(name, &shape)) {
+            ERROR_MSG("unknown shape '%s'\n", name);
+            return false;
+        }
+        shapes[shape] = true;
+    }
+    return true;
+}
+
+function bool parse_scale_args(int argc, char *argv[], scale_opts_t *opts) {
+    *opts = {};
+    opts->seed         = 1;
+    opts->max_nodes    = SCALE_DEFAULT_MAX;
+    opts->orders       = SCALE_DEFAULT_ORDERS;
+    opts->budget_nodes = SCALE_DEFAULT_BUDGET;
+    opts->timeout      = SCALE_DEFAULT_TIMEOUT;
+    opts->out          = stdout;
+    for (size_t i = 0; i < gen::SHAPE_COUNT; ++i) opts->shapes[i] = true;
+
+    for (int i = 0; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if      (has_value && strcmp(argv[i], "--seed") == 0)         opts->seed         = strtoull(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--max-nodes") == 0)    opts->max_nodes    = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--orders") == 0)       opts->orders       = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--budget-nodes") == 0) opts->budget_nodes = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--timeout") == 0)      opts->timeout      = strtod(argv[++i], nullptr);
+        else if (has_value && strcmp(argv[i], "--shapes") == 0) {
+            if (!parse_shapes(argv[++i], opts->shapes)) return false;
+        }
+        else if (has_value && strcmp(argv[i], "--out") == 0) {
+            opts->out = fopen(argv[++i], "w");
+            if (!opts->out) {
+                ERROR_MSG("can't open %s\n", argv[i]);
+                return false;
+            }
+        }
+        else {
+            ERROR_MSG("bench --scale [--seed N] [--max-nodes N] [--orders K] [--shapes a,b] "
+                      "[--budget-nodes N] [--timeout sec] [--out file]\n");
+            return false;
+        }
+    }
+    if (!opts->orders) opts->orders = 1;
+    return true;
+}
+
+int run_scale(int argc, char *argv[]) {
+    scale_opts_t opts = {};
+    if (!parse_scale_args(argc, argv, &opts)) return 1;
+
+    FILE *out = opts.out;
+    // mkstemp, not a fixed name: parallel runs and other users can't clobber or pre-create it
+    char infix_path[] = "/tmp/differentiation_bench_scale_XXXXXX";
+    int infix_fd = mkstemp(infix_path);
+    if (infix_fd < 0) {
+        ERROR_MSG("can't create a temporary file\n");
+        if (out != stdout) fclose(out);
+        return 1;
+    }
+    close(infix_fd);
+
+    fprintf(out, "{\n  \"seed\": %llu, \"orders\": %zu, \"budget_nodes\": %zu, \"timeout_s\": %g, \"node_bytes\": %zu,\n"
+                 "  \"results\": [",
+            (unsigned long long) opts.seed, opts.orders, opts.budget_nodes, opts.timeout, sizeof(NODE_T));
+    fprintf(stderr, "%-9s %9s %-19s %7s %12s %10s %12s %11s %10s\n",
+            "shape", "nodes", "op", "runs", "us/op", "ns/node", "allocs/op", "out_nodes", "rss_kb");
+
+    bool first = true;
+    for (size_t s = 0; s < gen::SHAPE_COUNT; ++s) {
+        if (!opts.shapes[s]) continue;
+        gen::SHAPE shape = (gen::SHAPE) s;
+        bool op_stopped[OP_COUNT] = {};
+
+        for (size_t target = 10; target <= opts.max_nodes; target *= 10) {
+            FRONT_COMPIL_T *tree = gen::generate(shape, target, opts.seed);
+            FILE *tmp = tree ? fopen(infix_path, "w") : nullptr;
+            if (!tmp) {
+                ERROR_MSG("can't prepare %s tree of %zu nodes\n", gen::shape_name(shape), target);
+                destruct(tree);
+                break;
+            }
+            print(tmp, tree);
+            fclose(tmp);
+
+            size_t nodes = tree_nodes(tree);
+            double point[2] = {0.25, 0.75};
+            for (size_t o = 0; o < OP_COUNT; ++o) {
+                // Once a size hit the budget the larger ones only would too
+                if (op_stopped[o]) continue;
+                op_ctx_t ctx = {.op = (BENCH_OP) o, .tree = tree, .orders = opts.orders, .point = point, .vars_count = 2,
+                                .infix_path = infix_path};
+                measure_t m = measure(&ctx, &opts);
+                if (m.status != BUDGET_OK || m.failed) op_stopped[o] = true;
+                print_json_row(out, &first, shape, target, nodes, (BENCH_OP) o, &opts, &m);
+                print_table_row(shape, nodes, (BENCH_OP) o, &m);
+            }
+            destruct(tree);
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout) fclose(out);
+    unlink(infix_path);
+    return 0;
+}
@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "differentiator.h"
+#include "io_utils.h"
+#include "util.h"
+#include "base.h"
+#include "budget.h"
+#include "gen.h"
+#include "intern.h"
+#include "compile.h"
+#include "partial.h"
+
+// Differential fuzzer over gen::random_expression. Every case checks that
+//   - print_infix -> load_tree_from_string gives back the same tree,
+//   - differentiate() agrees with a central difference at random points,
+//   - simplify_tree() does not change the value,
+//   - partial::specialize (through partial::Cache, compiled) gives bit for bit the value of the whole
+//     input with the bound variables substituted, and a permuted binding set hits the cache,
+//   - compile::build_multi over the input, its derivative and a duplicate of the input gives
+//     calc_in_point of every root bit for bit.
+// Points where the input is undefined or badly conditioned are redrawn, see eval_strict and draw_point,
+// and an expression with no defined point at all (arccos(3.5) * x) is replaced by another one for
+// the same case; the summary shows per check how many points were compared and how many draws were thrown away.
+// Failures go to stdout with the seed and case number needed to replay them.
+//
+//     fuzz/fuzz [--seed N] [--cases N] [--nodes N] [--depth N] [--vars N] [--points N]
+//               [--budget-nodes N] [--timeout sec] [--emit dir]
+//
+// --emit also writes every case as an input file for ./a.out --batch, so the same
+// seeds double as a regression workload.
+
+extern NODE_T *copy_subtree(const NODE_T *node);
+
+const uint64_t FUZZ_DEFAULT_SEED     = 1;
+const size_t   FUZZ_DEFAULT_CASES    = 1000;
+const size_t   FUZZ_DEFAULT_NODES    = 24;
+const size_t   FUZZ_DEFAULT_DEPTH    = 10;
+const size_t   FUZZ_DEFAULT_VARS     = 2;
+const size_t   FUZZ_DEFAULT_POINTS   = 8;
+const size_t   FUZZ_DEFAULT_BUDGET   = 2000000;
+const double   FUZZ_DEFAULT_TIMEOUT  = 5;
+
+const double FUZZ_POINT_RANGE   = 2.5;
+const double FUZZ_INNER_MIN     = 1e-3;     // Inner draws: (0, 1] is inside ln, sqrt, asin and acos at once
+const double FUZZ_NEAR          = 0.05;     // Near draws: relative spread around the last accepted point
+const size_t FUZZ_DRAWS_PER_POINT = 16;     // Draws allowed per wanted point before a case counts as starved
+const size_t FUZZ_DOMAIN_PROBES = 64;       // Draws looking for a defined point before the expression is replaced
+const size_t FUZZ_EXPR_REDRAWS  = 32;
+const double FUZZ_MAX_VALUE     = 1e6;      // Larger intermediates swallow the terms they are added to
+const double FUZZ_STEPS[]       = {1e-3, 1e-5, 1e-7};
+const double FUZZ_RELIABLE      = 1e-2;   // Larger relative error estimates mean the step doesn't resolve f
+const double FUZZ_ERROR_MARGIN  = 10;     // Multiples of the Richardson error estimate accepted as noise
+const double FUZZ_DIFF_TOL      = 1e-4;
+const double FUZZ_SIMPLIFY_TOL  = 1e-9;
+
+typedef struct {
+    uint64_t               seed;
+    size_t                 cases;
+    gen::random_options_t  gen;
+    size_t                 points;
+    size_t                 budget_nodes;
+    double                 timeout;
+    const char            *emit_dir;
+} fuzz_opts_t;
+
+typedef struct {
+    size_t failed;
+    size_t points_checked;
+    size_t points_skipped;          // Вне области определения или слишком крутые: точка вытянута заново
+    size_t starved;                 // Случаи, где за FUZZ_DRAWS_PER_POINT попыток на точку не набралось --points
+} check_totals_t;
+
+typedef struct {
+    size_t         roundtrip_failed;
+    size_t         redrawn;         // Выражения, нигде не определенные в пробных точках
+    check_totals_t derivative;
+    check_totals_t simplify;
+    check_totals_t specialize;
+    check_totals_t multi;
+    size_t         budget_stops;
+} fuzz_totals_t;
+
+typedef struct {
+    uint64_t rng;
+} fuzz_rng_t;
+
+function uint64_t next(fuzz_rng_t *r) {
+    return xorshift64s(&r->rng);
+}
+
+function double uniform(fuzz_rng_t *r, double lo, double hi) {
+    return lo + (hi - lo) * (double) (next(r) >> 11) * 0x1.0p-53;
+}
+
+// Одна на случай: якорь, найденный при проверке выражения, достается всем проверкам
+typedef struct {
+    fuzz_rng_t  rng;
+    double      anchor[gen::RANDOM_MAX_VARS];    // Последняя принятая точка, рядом с ней область определения точно есть
+    bool        anchored;
+    size_t      draws;
+} sampler_t;
+
+// Nested operators leave the domain for most of [-R, R] (ln(asin(x)) needs 0 < x <= 1), so draws
+// rotate between the whole range, (0, 1] for all variables and a neighbourhood of the last accepted
+// point, which finds narrow domains (arccos(2 * sin(x))) again once one point was hit
+function void draw_point(sampler_t *s, double *point, size_t vars_count) {
+    size_t mode = s->draws++ % 3;
+    for (size_t v = 0; v < vars_count; ++v) {
+        if (mode == 2 && s->anchored)
+            point[v] = s->anchor[v] + uniform(&s->rng, -FUZZ_NEAR, FUZZ_NEAR) * fmax(1.0, fabs(s->anchor[v]));
+        else if (mode == 1)
+            point[v] = uniform(&s->rng, FUZZ_INNER_MIN, 1.0);
+        else
+            point[v] = uniform(&s->rng, -FUZZ_POINT_RANGE, FUZZ_POINT_RANGE);
+    }
+}
+
+function void accept_point(sampler_t *s, const double *point, size_t vars_count) {
+    memcpy(s->anchor, point, vars_count * sizeof(double));
+    s->anchored = true;
+}
+
+function void count_starved(check_totals_t *check, size_t checked, size_t wanted, bool failed) {
+    if (!failed && checked < wanted) check->starved++;
+}
+
+function double eval(const FRONT_COMPIL_T *tree, double *point, size_t vars_count) {
+    EQ_POINT_T calc = {.tree = tree, .point = point, .vars_count = vars_count, .result = 0.0};
+    calc_in_point(&calc);
+    return calc.result;
+}
+
+// Value of the input where every subexpression is finite and moderate; NAN elsewhere. Plain
+// calc_in_point lets 0 / cosh(4 ^ 6) through as 0, and simplify is free to drop such terms;
+// sin(y - 1e47) loses y entirely, which no difference quotient can see
+function bool moderate(double value) {
+    return isfinite(value) && fabs(value) <= FUZZ_MAX_VALUE;
+}
+
+function double eval_strict(const NODE_T *node, const double *point) {
+    if (!node) return NAN;
+    switch (node->type) {
+        case NUM_T: return node->value.num;
+        case VAR_T: return point[node->value.var];
+        case OP_T: {
+            double l = eval_strict(node->left, point);
+            double r = node->right ? eval_strict(node->right, point) : 0;
+            if (!moderate(l) || !moderate(r)) return NAN;
+            // arccot is atan(1 / l): -0 and +0 land on different branches, which folding can't preserve
+            if (node->value.opr == ACTG && l == 0) return NAN;
+            double res = apply_operator(node->value.opr, l, r);
+            return moderate(res) ? res : NAN;
+        }
+        default: return NAN;
+    }
+}
+
+function bool defined_somewhere(const FRONT_COMPIL_T *tree, sampler_t *sampler) {
+    size_t vars_count = varlist::size(tree->vars);
+    double *point = TYPED_CALLOC(vars_count, double);
+    sampler->anchored = false;
+    bool found = false;
+    for (size_t draw = 0; point && !found && draw < FUZZ_DOMAIN_PROBES; ++draw) {
+        draw_point(sampler, point, vars_count);
+        found = isfinite(eval_strict(tree->root, point));
+    }
+    if (found) accept_point(sampler, point, vars_count);
+    FREE(point);
+    return found;
+}
+
+// Compiled and folded paths promise the bits of calc_in_point; NaN payloads are not part of that
+function bool same_value(double a, double b) {
+    if (isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+function bool close_enough(double a, double b, double tol) {
+    double scale = fmax(1.0, fmax(fabs(a), fabs(b)));
+    return fabs(a - b) <= tol * scale;
+}
+
+function char *to_infix(const FRONT_COMPIL_T *tree) {
+    char *text = nullptr;
+    size_t len = 0;
+    FILE *stream = open_memstream(&text, &len);
+    if (!stream) return nullptr;
+    print_infix(stream, tree);
+    fclose(stream);
+    return text;
+}
+
+// Variables are compared by name: the parser numbers them in order of appearance, the generator doesn't
+function bool same_tree(const FRONT_COMPIL_T *ta, const NODE_T *a, const FRONT_COMPIL_T *tb, const NODE_T *b) {
+    if (!a || !b) return a == b;
+    if (a->type != b->type) return false;
+    switch (a->type) {
+        case NUM_T:
+            if (a->value.num != b->value.num) return false;
+            break;
+        case VAR_T: {
+            const mystr::mystr_t *na = varlist::get(ta->vars, a->value.var);
+            const mystr::mystr_t *nb = varlist::get(tb->vars, b->value.var);
+            if (!na || !nb || strcmp(na->str, nb->str) != 0) return false;
+            break;
+        }
+        case OP_T:
+            if (a->value.opr != b->value.opr) return false;
+            break;
+        default:
+            return false;
+    }
+    return same_tree(ta, a->left, tb, b->left) && same_tree(ta, a->right, tb, b->right);
+}
+
+function void format_point(const FRONT_COMPIL_T *tree, const double *point, size_t vars_count, char *buf, size_t size) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (size_t v = 0; v < vars_count && len < size; ++v) {
+        const mystr::mystr_t *name = varlist::get(tree->vars, v);
+        int written = snprintf(buf + len, size - len, "%s%s = %.17g", v ? ", " : "", name ? name->str : "?", point[v]);
+        if (written < 0) break;
+        len += (size_t) written;
+    }
+}
+
+function void report(const char *check, size_t idx, const fuzz_opts_t *opts, const char *expr, const char *fmt, ...)
+    __attribute__((format (printf, 5, 6)));
+
+function void report(const char *check, size_t idx, const fuzz_opts_t *opts, const char *expr, const char *fmt, ...) {
+    printf("FAIL %s: seed %llu case %zu\n  %s\n  ", check, (unsigned long long) opts->seed, idx, expr ? expr : "?");
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+function void check_roundtrip(const FRONT_COMPIL_T *tree, const char *text, size_t idx,
+                              const fuzz_opts_t *opts, fuzz_totals_t *totals) {
+    FRONT_COMPIL_T *parsed = load_tree_from_string(text, strlen(text), "roundtrip");
+    if (!parsed || !same_tree(tree, tree->root, parsed, parsed->root)) {
+        char *again = parsed ? to_infix(parsed) : nullptr;
+        report("roundtrip", idx, opts, text, "parsed back as: %s", again ? again : "(parse error)");
+        free(again);
+        totals->roundtrip_failed++;
+    }
+    destruct(parsed);
+}
+
+typedef struct {
+    double value;
+    double error;                   // |D(h) - D(h/2)|, a bound on the truncation error of value
+    bool   flat;                    // f doesn't change in double at this step; value is 0
+} numeric_t;
+
+// Richardson-extrapolated central difference; false where f is undefined, huge or too wiggly at x
+function bool numeric_derivative(const FRONT_COMPIL_T *tree, double *point, size_t var, double step, numeric_t *out) {
+    double x = point[var];
+    double h = step * fmax(1.0, fabs(x));
+    double f[4] = {};
+    const double offsets[4] = {-h, h, -h / 2, h / 2};
+    for (size_t i = 0; i < 4; ++i) {
+        point[var] = x + offsets[i];
+        f[i] = eval_strict(tree->root, point);
+        if (isnan(f[i])) {
+            point[var] = x;
+            return false;
+        }
+    }
+    point[var] = x;
+    // Flat in double precision (cos(1e-8) == 1): the quotient can't see a slope the symbolic derivative
+    // still has, so only a symbolic zero can be compared with it, see check_derivative
+    if (f[0] == f[1] && f[2] == f[3] && f[0] == f[2]) {
+        *out = (numeric_t) {.value = 0, .error = 0, .flat = true};
+        return true;
+    }
+    double d_h  = (f[1] - f[0]) / (2 * h);
+    double d_h2 = (f[3] - f[2]) / h;
+    out->value = (4 * d_h2 - d_h) / 3;
+    out->error = fabs(d_h - d_h2);
+    return out->error <= FUZZ_RELIABLE * fmax(1.0, fabs(out->value));
+}
+
+// Fast oscillation fools a coarse step and cancellation (arccos(tanh(17))) a fine one, so the point
+// counts only when every step gives the same answer; the middle one is then compared with the symbolic value
+function bool stable_numeric(const FRONT_COMPIL_T *tree, double *point, size_t var, numeric_t *out) {
+    numeric_t estimates[ARRAY_COUNT(FUZZ_STEPS)] = {};
+    for (size_t i = 0; i < ARRAY_COUNT(FUZZ_STEPS); ++i) {
+        if (!numeric_derivative(tree, point, var, FUZZ_STEPS[i], &estimates[i])) return false;
+        if (i && !close_enough(estimates[i].value, estimates[0].value, FUZZ_RELIABLE)) return false;
+        // Flat only at some steps: a slope below the resolution of the finer ones, nothing to compare
+        if (i && estimates[i].flat != estimates[0].flat) return false;
+    }
+    *out = estimates[ARRAY_COUNT(FUZZ_STEPS) / 2];
+    return true;
+}
+
+// Returns the derivative for check_multi; nullptr when it wasn't built
+function FRONT_COMPIL_T *check_derivative(const FRONT_COMPIL_T *tree, const char *text, size_t idx, sampler_t *sampler,
+                                          const fuzz_opts_t *opts, fuzz_totals_t *totals) {
+    size_t vars_count = varlist::size(tree->vars);
+    size_t var = (size_t) (next(&sampler->rng) % vars_count);
+
+    budget_t budget = {};
+    budget_init(&budget, opts->budget_nodes, 0, opts->timeout, nullptr);
+    budget_begin(&budget);
+    FRONT_COMPIL_T *derivative = differentiate(nullptr, tree, var);
+    budget_end(&budget);
+    if (!derivative) {
+        if (budget.status != BUDGET_OK) {
+            totals->budget_stops++;
+            return nullptr;
+        }
+        report("derivative", idx, opts, text, "differentiate returned nullptr");
+        totals->derivative.failed++;
+        return nullptr;
+    }
+
+    check_totals_t *check = &totals->derivative;
+    double *point = TYPED_CALLOC(vars_count, double);
+    size_t checked = 0;
+    bool failed = false;
+    for (size_t draw = 0; point && checked < opts->points && draw < opts->points * FUZZ_DRAWS_PER_POINT; ++draw) {
+        draw_point(sampler, point, vars_count);
+        double symbolic = eval(derivative, point, vars_count);
+        numeric_t numeric = {};
+        if (!isfinite(symbolic) || !stable_numeric(tree, point, var, &numeric) || (numeric.flat && symbolic != 0)) {
+            check->points_skipped++;
+            continue;
+        }
+        check->points_checked++;
+        checked++;
+        accept_point(sampler, point, vars_count);
+        double scale = fmax(1.0, fmax(fabs(symbolic), fabs(numeric.value)));
+        if (fabs(symbolic - numeric.value) > fmax(FUZZ_DIFF_TOL * scale, FUZZ_ERROR_MARGIN * numeric.error)) {
+            const mystr::mystr_t *name = varlist::get(tree->vars, var);
+            char where[256] = "";
+            format_point(tree, point, vars_count, where, sizeof(where));
+            report("derivative", idx, opts, text, "d/d%s at %s: symbolic %.17g, numeric %.17g +- %.3g",
+                   name ? name->str : "?", where, symbolic, numeric.value, numeric.error);
+            check->failed++;
+            failed = true;
+            break;
+        }
+    }
+    count_starved(check, checked, opts->points, failed);
+    FREE(point);
+    return derivative;
+}
+
+function void check_simplify(const FRONT_COMPIL_T *tree, const char *text, size_t idx, sampler_t *sampler,
+                             const fuzz_opts_t *opts, fuzz_totals_t *totals) {
+    FRONT_COMPIL_T simplified = *tree;
+    simplified.root = copy_subtree(tree->root);
+    if (!simplified.root) return;
+    simplify_tree(nullptr, &simplified);
+
+    check_totals_t *check = &totals->simplify;
+    size_t vars_count = varlist::size(tree->vars);
+    double *point = TYPED_CALLOC(vars_count, double);
+    size_t checked = 0;
+    bool failed = false;
+    for (size_t draw = 0; point && checked < opts->points && draw < opts->points * FUZZ_DRAWS_PER_POINT; ++draw) {
+        draw_point(sampler, point, vars_count);
+        double before = eval_strict(tree->root, point);
+        double after  = eval(&simplified, point, vars_count);
+        // Folding may legitimately drop a domain restriction (0 * ln(x) -> 0), so compare only where both are defined
+        if (!isfinite(before) || !isfinite(after)) {
+            check->points_skipped++;
+            continue;
+        }
+        check->points_checked++;
+        checked++;
+        accept_point(sampler, point, vars_count);
+        if (!close_enough(before, after, FUZZ_SIMPLIFY_TOL)) {
+            char *simplified_text = to_infix(&simplified);
+            char where[256] = "";
+            format_point(tree, point, vars_count, where, sizeof(where));
+            report("simplify", idx, opts, text, "simplified to %s at %s: %.17g vs %.17g",
+                   simplified_text ? simplified_text : "?", where, before, after);
+            free(simplified_text);
+            check->failed++;
+            failed = true;
+            break;
+        }
+    }
+    count_starved(check, checked, opts->points, failed);
+    FREE(point);
+    destruct(simplified.root);
+}
+
+function void check_specialize(const FRONT_COMPIL_T *tree, const char *text, size_t idx, sampler_t *sampler,
+                               const fuzz_opts_t *opts, fuzz_totals_t *totals) {
+    check_totals_t *check = &totals->specialize;
+    size_t vars_count = varlist::size(tree->vars);
+    double *point = TYPED_CALLOC(vars_count, double);
+    partial::binding_t *bindings = TYPED_CALLOC(vars_count, partial::binding_t);
+    if (!point || !bindings) {
+        free(point);
+        free(bindings);
+        return;
+    }
+
+    // A random nonempty subset, pinned where the input is defined and listed backwards so the cache has to sort it
+    draw_point(sampler, point, vars_count);
+    const double *at = sampler->anchored ? sampler->anchor : point;
+    uint64_t mask = next(&sampler->rng);
+    if (!(mask & ((1ull << vars_count) - 1))) mask = 1;
+    size_t count = 0;
+    for (size_t v = vars_count; v-- > 0;)
+        if (mask >> v & 1) bindings[count++] = (partial::binding_t) {.var = v, .value = at[v]};
+
+    partial::Cache cache = {};
+    partial::init(&cache, tree, 0);
+    const partial::Specialized *spec = partial::get(&cache, bindings, count);
+    double *stack = TYPED_CALLOC(spec ? spec->prog.max_depth + 1 : 1, double);
+    if (!spec || !stack) {
+        report("specialize", idx, opts, text, stack ? "partial::get returned nullptr" : "no memory for the stack");
+        check->failed++;
+        free(stack);
+        partial::destruct(&cache);
+        free(point);
+        free(bindings);
+        return;
+    }
+
+    for (size_t i = 0; i < count / 2; ++i) {
+        partial::binding_t swap = bindings[i];
+        bindings[i] = bindings[count - 1 - i];
+        bindings[count - 1 - i] = swap;
+    }
+    bool failed = false;
+    if (partial::get(&cache, bindings, count) != spec || cache.hits != 1) {
+        report("specialize", idx, opts, text, "the same bindings in another order missed the cache");
+        check->failed++;
+        failed = true;
+    }
+
+    size_t checked = 0;
+    for (size_t draw = 0; !failed && checked < opts->points && draw < opts->points * FUZZ_DRAWS_PER_POINT; ++draw) {
+        draw_point(sampler, point, vars_count);
+        for (size_t i = 0; i < count; ++i) point[bindings[i].var] = bindings[i].value;
+        double whole    = eval(tree, point, vars_count);
+        double folded   = eval(spec->tree, point, vars_count);
+        double compiled = compile::eval(&spec->prog, point, stack);
+        // Undefined points agree too, but prove nothing about the folding
+        if (!isfinite(whole)) {
+            check->points_skipped++;
+            if (same_value(whole, folded) && same_value(whole, compiled)) continue;
+        }
+        else {
+            check->points_checked++;
+            checked++;
+            if (same_value(whole, folded) && same_value(whole, compiled)) continue;
+        }
+        char *spec_text = to_infix(spec->tree);
+        char where[256] = "";
+        format_point(tree, point, vars_count, where, sizeof(where));
+        report("specialize", idx, opts, text, "specialized to %s at %s: whole %.17g, tree %.17g, program %.17g",
+               spec_text ? spec_text : "?", where, whole, folded, compiled);
+        free(spec_text);
+        check->failed++;
+        failed = true;
+    }
+    count_starved(check, checked, opts->points, failed);
+    free(stack);
+    partial::destruct(&cache);
+    free(point);
+    free(bindings);
+}
+
+// The duplicate makes every register of the input shared, the empty root has to come out as NAN
+function void check_multi(const FRONT_COMPIL_T *tree, const FRONT_COMPIL_T *derivative, const char *text, size_t idx,
+                          sampler_t *sampler, const fuzz_opts_t *opts, fuzz_totals_t *totals) {
+    check_totals_t *check = &totals->multi;
+    FRONT_COMPIL_T duplicate = *tree;
+    duplicate.root = copy_subtree(tree->root);
+    if (!duplicate.root) return;
+    const FRONT_COMPIL_T *roots[] = {tree, derivative, &duplicate, nullptr};
+    const char *names[ARRAY_COUNT(roots)] = {"input", "derivative", "duplicate", "empty"};
+    size_t roots_count = ARRAY_COUNT(roots);
+
+    compile::MultiProgram prog = {};
+    if (!compile::build_multi(&prog, roots, roots_count)) {
+        report("multi", idx, opts, text, "build_multi failed");
+        check->failed++;
+        destruct(duplicate.root);
+        return;
+    }
+
+    // Points where the input is defined go in one batch, so eval_multi_many hoists the constants once
+    size_t vars_count = varlist::size(tree->vars);
+    double *points = TYPED_CALLOC(opts->points * vars_count + 1, double);
+    double *out    = TYPED_CALLOC(opts->points * roots_count + 1, double);
+    size_t n = 0;
+    for (size_t draw = 0; points && n < opts->points && draw < opts->points * FUZZ_DRAWS_PER_POINT; ++draw) {
+        double *point = points + n * vars_count;
+        draw_point(sampler, point, vars_count);
+        if (isfinite(eval(tree, point, vars_count))) n++;
+        else check->points_skipped++;
+    }
+
+    bool failed = false;
+    if (n && out && !compile::eval_multi_many(&prog, points, n, out)) {
+        report("multi", idx, opts, text, "eval_multi_many failed");
+        failed = true;
+    }
+    for (size_t i = 0; out && !failed && i < n; ++i) {
+        double *point = points + i * vars_count;
+        check->points_checked++;
+        for (size_t r = 0; r < roots_count; ++r) {
+            double expected = roots[r] ? eval(roots[r], point, vars_count) : NAN;
+            double got = out[i * roots_count + r];
+            if (same_value(expected, got)) continue;
+            char where[256] = "";
+            format_point(tree, point, vars_count, where, sizeof(where));
+            report("multi", idx, opts, text, "%s root at %s: calc_in_point %.17g, multi %.17g",
+                   names[r], where, expected, got);
+            failed = true;
+            break;
+        }
+    }
+    if (failed) check->failed++;
+    count_starved(check, n, opts->points, failed);
+    free(points);
+    free(out);
+    compile::destruct(&prog);
+    destruct(duplicate.root);
+}
+
+function void emit_case(const fuzz_opts_t *opts, size_t idx, const FRONT_COMPIL_T *tree) {
+    char path[512] = "";
+    snprintf(path, sizeof(path), "%s/%06zu.tmp", opts->emit_dir, idx);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        ERROR_MSG("Can't write %s\n", path);
+        return;
+    }
+    print(file, tree);
+    fclose(file);
+}
+
+function void print_check(const char *name, const check_totals_t *check, size_t points) {
+    printf("  %-10s %zu failed, %zu points checked, %zu draws skipped, %zu cases short of %zu points\n",
+           name, check->failed, check->points_checked, check->points_skipped, check->starved, points);
+}
+
+function bool parse_args(int argc, char *argv[], fuzz_opts_t *opts) {
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if      (has_value && strcmp(argv[i], "--seed") == 0)         opts->seed = strtoull(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--cases") == 0)        opts->cases = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--nodes") == 0)        opts->gen.target_nodes = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--depth") == 0)        opts->gen.max_depth = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--vars") == 0)         opts->gen.vars_count = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--points") == 0)       opts->points = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--budget-nodes") == 0) opts->budget_nodes = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--timeout") == 0)      opts->timeout = strtod(argv[++i], nullptr);
+        else if (has_value && strcmp(argv[i], "--emit") == 0)         opts->emit_dir = argv[++i];
+        else {
+            ERROR_MSG("fuzz [--seed N] [--cases N] [--nodes N] [--depth N] [--vars 1..%zu] [--points N]\n"
+                      "     [--budget-nodes N] [--timeout sec] [--emit dir]\n", gen::RANDOM_MAX_VARS);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    fuzz_opts_t opts = {
+        .seed         = FUZZ_DEFAULT_SEED,
+        .cases        = FUZZ_DEFAULT_CASES,
+        .gen          = {.target_nodes = FUZZ_DEFAULT_NODES, .max_depth = FUZZ_DEFAULT_DEPTH, .vars_count = FUZZ_DEFAULT_VARS},
+        .points       = FUZZ_DEFAULT_POINTS,
+        .budget_nodes = FUZZ_DEFAULT_BUDGET,
+        .timeout      = FUZZ_DEFAULT_TIMEOUT,
+        .emit_dir     = nullptr,
+    };
+    if (!parse_args(argc, argv, &opts)) return 1;
+    if (opts.emit_dir) mkdir(opts.emit_dir, 0755);
+
+    fuzz_totals_t totals = {};
+    for (size_t idx = 0; idx < opts.cases; ++idx) {
+        // Cases derive their seeds from (seed, idx), so a reported failure replays with the same --seed
+        uint64_t case_seed = opts.seed * 1000003ull + idx;
+        sampler_t sampler = {};
+        sampler.rng.rng = case_seed ^ 0x5851F42D4C957F2Dull;
+        if (!sampler.rng.rng) sampler.rng.rng = 1;
+        // Redraws are keyed by the same seed, so replaying a case picks the same expression
+        FRONT_COMPIL_T *tree = nullptr;
+        for (size_t redraw = 0;; ++redraw) {
+            tree = gen::random_expression(&opts.gen, case_seed ^ (redraw * 0x9E3779B97F4A7C15ull));
+            if (!tree) {
+                ERROR_MSG("No memory for case %zu\n", idx);
+                return 1;
+            }
+            if (redraw == FUZZ_EXPR_REDRAWS || defined_somewhere(tree, &sampler)) break;
+            destruct(tree);
+            totals.redrawn++;
+        }
+
+        char *text = to_infix(tree);
+        if (opts.emit_dir) emit_case(&opts, idx, tree);
+        if (text) {
+            check_roundtrip(tree, text, idx, &opts, &totals);
+            FRONT_COMPIL_T *derivative = check_derivative(tree, text, idx, &sampler, &opts, &totals);
+            check_simplify(tree, text, idx, &sampler, &opts, &totals);
+            check_specialize(tree, text, idx, &sampler, &opts, &totals);
+            check_multi(tree, derivative, text, idx, &sampler, &opts, &totals);
+            destruct(derivative);
+        }
+        free(text);
+        destruct(tree);
+    }
+
+    size_t failed = totals.roundtrip_failed + totals.derivative.failed + totals.simplify.failed +
+                    totals.specialize.failed + totals.multi.failed;
+    printf("fuzz: %zu cases, %zu failed, %zu budget stops, %zu undefined expressions redrawn\n",
+           opts.cases, failed, totals.budget_stops, totals.redrawn);
+    printf("  %-10s %zu failed\n", "roundtrip", totals.roundtrip_failed);
+    print_check("derivative", &totals.derivative, opts.points);
+    print_check("simplify", &totals.simplify, opts.points);
+    print_check("specialize", &totals.specialize, opts.points);
+    print_check("multi", &totals.multi, opts.points);
+    intern::reset();
+    return failed ? 1 : 0;
+}
@@ -1,90 +1,209 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "differentiator.h"
 #include "logger.h"
 #include "io_utils.h"
+#include "util.h"
 #include "base.h"
 #include "const_strings.h"
 #include "graph.h"
 #include "article.h"
+#include "intern.h"
+#include "dot_pool.h"
+#include "session.h"
+#include "daemon.h"
+#include "diskcache.h"
+#include "budget.h"
+#include "stats.h"
+#include "trace.h"
+#include "memacct.h"
+#include "growth.h"
 
-const char * LATEX_SOURCE_FILENAME = "logs/report.tex";
+const char * LATEX_SOURCE_BASENAME = "report.tex";
 const char * LATEX_OUTPUT_FILENAME = "logs/report.pdf";
+const char * TRACE_BASENAME        = "trace.json";
 const size_t COUNT_OF_DIFFS = 7;
 
 const double TAILOR_POINT = 1;
 
-int main(int argc, char *argv[]) {
-    srand(time(nullptr));
+const char * BATCH_DEFAULT_OUT_DIR = "batch_out";
 
-    create_folder_if_not_exists("logs/");
-    init_logger("logs/");
+const size_t DAEMON_DEFAULT_CACHE = 256;
 
-    fprintf(logger_get_file(), "<H2>MEOW!</H2>");
+const char * DISK_CACHE_DEFAULT_DIR    = ".diffcache";
+const size_t DISK_CACHE_DEFAULT_MAX_MB = 512;
 
-    if (argc <= 1) {
-        ERROR_MSG(RED("U must provide path to source equation text\n")"eq_calc path_to_equation\n");
-        return 1;
-    }
-    else if (argc > 2) {
-        ERROR_MSG(RED("U must provide only one path to source equation text\n")"eq_calc path_to_equation\n");
-        return 1;
+typedef enum {
+    STAGE_LOAD,
+    STAGE_SIMPLIFY,
+    STAGE_DIFFERENTIATE,
+    STAGE_TAYLOR,
+    STAGE_REPORT,
+    STAGE_COUNT,
+} PIPELINE_STAGE;
+
+const char *STAGE_NAMES[STAGE_COUNT] = {"load", "simplify", "differentiate", "taylor", "report"};
+
+// Ограничения на simplify..Taylor одного выражения, 0 - без ограничения
+typedef struct {
+    size_t max_nodes;
+    size_t max_bytes;
+    double timeout;                 // Секунды
+} pipeline_limits_t;
+
+typedef struct {
+    const char       *input;
+    char              out_dir[512]; // Оканчивается на '/'
+    uint64_t          seed;
+    bool              interactive;  // Прятать вывод парсера в альтернативный экран
+    bool              compile_latex;// Дождаться dot и собрать PDF внутри прогона
+    bool              simplify;     // Упростить дерево перед дифференцированием (статья меняется)
+    pipeline_limits_t limits;
+} pipeline_job_t;
+
+typedef struct {
+    double        seconds[STAGE_COUNT];
+    bool          ok;
+    BUDGET_STATUS stopped;          // Почему прервано вычисление (BUDGET_OK - не прерывалось)
+    int64_t       peak_bytes;       // Пик учтенной памяти (0 - учет выключен)
+} pipeline_times_t;
+
+#define STAGE_END(STAGE)                                            \
+    do {                                                            \
+        double stage_now_ = now_seconds();                          \
+        if (times) times->seconds[STAGE] += stage_now_ - stage_t0;  \
+        stage_t0 = stage_now_;                                      \
+    } while (0)
+
+function int compile_report(void) {
+    char compile_cmd[512] = {};
+    snprintf(compile_cmd, sizeof(compile_cmd),
+             "tectonic --outdir logs --chatter minimal logs/%s > /dev/null",
+             LATEX_SOURCE_BASENAME);
+    stats_timer_t timer = stats_phase_begin(STATS_TECTONIC);
+    trace_span_t span = trace_begin("tectonic");
+    int compile_status = system(compile_cmd);
+    trace_end(&span);
+    stats_phase_end(&timer);
+    if (compile_status == 0) {
+        char open_cmd[256] = {};
+        snprintf(open_cmd, sizeof(open_cmd), "open %s", LATEX_OUTPUT_FILENAME);
+        system(open_cmd);
+    } else {
+        ERROR_MSG(RED("tectonic failed, see logs for details\n"));
     }
+    return compile_status;
+}
 
-    char *equation_filename = argv[1];
+// DIFF_STATS включает счетчики прогона, DIFF_TRACE - трассу; флаг - непустое значение, кроме "0"
+function bool env_flag(const char *name) {
+    const char *env = getenv(name);
+    return env && *env && strcmp(env, "0") != 0;
+}
 
-    TERMINAL_ENTER_ALT_SCREEN();
+// Walking a tree costs O(n), so only with accounting on
+function size_t tree_bytes(const session_t *session, const FRONT_COMPIL_T *tree) {
+    if (!session->mem || !tree) return 0;
+    mem_usage_t usage = {};
+    mem_tree_usage(tree, &usage);
+    return usage.total;
+}
+
+// load -> simplify -> differentiate -> Taylor -> report; всё пишется в job->out_dir
+function int run_pipeline(const pipeline_job_t *job, pipeline_times_t *times) {
+    double stage_t0 = now_seconds();
+    session_t session = {};
+    session_init(&session, job->seed);
+
+    stats_t stats = {};
+    session.stats = env_flag("DIFF_STATS") ? &stats : nullptr;
+    stats_t *prev_stats = stats_attach(session.stats);
+    mem_account_t mem = {};
+    session.mem = session.stats ? &mem : nullptr;
+    mem_account_t *prev_mem = mem_attach(session.mem);
+    growth_report_t growth = {};
+    growth_init(&growth);
+    session.growth = session.stats ? &growth : nullptr;
+
+    create_folder_if_not_exists(job->out_dir);
+    init_logger(&session.logger, job->out_dir);
+
+    logger_printf(&session.logger, "<H2>MEOW!</H2>");
+
+    if (job->interactive) {
+        TERMINAL_ENTER_ALT_SCREEN();
+    }
 
     varlist::VarList var_list = {};
     graph_range_t range = {};
-    FRONT_COMPIL_T *tree = load_tree_from_file(equation_filename, &var_list, &range);
+    FRONT_COMPIL_T *tree = load_tree_from_file(job->input, &var_list, &range);
+    if (job->interactive) {
+        TERMINAL_EXIT_ALT_SCREEN();
+    }
     if (!tree) {
-        printf("Failed to load tree from file\n");
+        ERROR_MSG("Failed to load tree from file %s\n", job->input);
+        varlist::destruct(&var_list);
+        session_destruct(&session);
+        stats_attach(prev_stats);
+        mem_attach(prev_mem);
         return 1;
     }
+    STAGE_END(STAGE_LOAD);
+    mem_stage_mark(session.mem, STAGE_NAMES[STAGE_LOAD], tree_bytes(&session, tree));
 
-//     printf("xrange [%lg:%lg]\n"
-//            "yrange [%lg:%lg]\n",
-//            range.x_min, range.x_max,
-//            range.y_min, range.y_max
-//         );
-//
-//     printf("name is [%s]\n", tree->name);
-//     getchar();
-    TERMINAL_EXIT_ALT_SCREEN();
+    // Runaway growth fails the job with a status instead of eating the machine
+    budget_t budget = {};
+    budget_init(&budget, job->limits.max_nodes, job->limits.max_bytes, job->limits.timeout, nullptr);
+    budget_begin(&budget);
 
-    FILE *latex_article = fopen(LATEX_SOURCE_FILENAME, "w");
+    if (job->simplify) simplify_tree(nullptr, tree);
+    STAGE_END(STAGE_SIMPLIFY);
+    mem_stage_mark(session.mem, STAGE_NAMES[STAGE_SIMPLIFY], tree_bytes(&session, tree));
+
+    char latex_path[768] = "";
+    snprintf(latex_path, sizeof(latex_path), "%s%s", job->out_dir, LATEX_SOURCE_BASENAME);
+    FILE *latex_article = fopen(latex_path, "w");
     if (!latex_article) {
-        ERROR_MSG(RED("Failed to create LaTeX file %s\n"), LATEX_SOURCE_FILENAME);
+        ERROR_MSG(RED("Failed to create LaTeX file %s\n"), latex_path);
+        budget_end(&budget);
         destruct(tree);
         varlist::destruct(&var_list);
-        destruct_logger();
+        session_destruct(&session);
+        stats_attach(prev_stats);
+        mem_attach(prev_mem);
         return 1;
     }
 
     fprintf(latex_article, LATEX_BEGIN, INTRO_STR);
-    differentiate_set_article_file(latex_article);
-    article_log_text("\\tableofcontents");
+    differentiate_set_article_file(&session, latex_article);
+    article_set_async(&session, true);
+    article_log_text(&session, "\\tableofcontents");
 
-    full_dump(tree, "Dump from line %d", 18);
-    simple_dump(tree, "Simple dump from line 20");
+    full_dump(&session, tree, "Dump from line %d", 18);
+    simple_dump(&session, tree, "Simple dump from line 20");
 
     // EQ_POINT_T point = read_point_data(tree);
     // calc_in_point(&point);
     // printf("Result: %.10g\n", point.result);
 
-    article_log_text("\\bigskip\\hrule\\bigskip\n\\section{Посчитаем производную}");
+    article_log_text(&session, "\\bigskip\\hrule\\bigskip\n\\section{Посчитаем производную}");
     // article_log_text("\\bigskip\\hrule\\bigskip\n\\subsection*{Первая производная}");
 
     mystr::mystr_t x_str = mystr::construct("x");
     size_t x_var_idx = varlist::find_index(tree->vars, &x_str);
-    differentiate_set_article_file(nullptr);
-    FRONT_COMPIL_T *first_derivative = differentiate(tree, x_var_idx);
-    differentiate_set_article_file(latex_article);
-    full_dump(first_derivative, "First derivative from line %d", __LINE__);
-    simple_dump(first_derivative, "Simple first derivative from line %d", __LINE__);
+    if (x_var_idx == varlist::NPOS) x_var_idx = 0;
+    differentiate_set_article_file(&session, nullptr);
+    FRONT_COMPIL_T *first_derivative = differentiate(&session, tree, x_var_idx);
+    differentiate_set_article_file(&session, latex_article);
+    full_dump(&session, first_derivative, "First derivative from line %d", __LINE__);
+    simple_dump(&session, first_derivative, "Simple first derivative from line %d", __LINE__);
 
     // printf("Put enter ...\n");
     // getchar();
@@ -98,8 +217,15 @@ int main(int argc, char *argv[]) {
     //                  first_ord ? first_ord : "первой");
     // article_log_with_latex(first_derivative, nullptr);
 
-    FRONT_COMPIL_T **dif_array = differentiate_to_n(tree, COUNT_OF_DIFFS, x_var_idx);
+    FRONT_COMPIL_T **dif_array = differentiate_to_n(&session, tree, COUNT_OF_DIFFS, x_var_idx);
     FRONT_COMPIL_T *tailor = nullptr;
+    STAGE_END(STAGE_DIFFERENTIATE);
+    if (session.mem) {
+        size_t derivatives_bytes = tree_bytes(&session, first_derivative);
+        for (size_t i = 1; dif_array && dif_array[i]; ++i)
+            derivatives_bytes += tree_bytes(&session, dif_array[i]);
+        mem_stage_mark(session.mem, STAGE_NAMES[STAGE_DIFFERENTIATE], derivatives_bytes);
+    }
 
     // article_log_text("\\bigskip\\hrule\\bigskip\n\\section*{Первые %zu производных}", COUNT_OF_DIFFS);
     // for (size_t i = 2; i <= COUNT_OF_DIFFS; ++i) {
@@ -113,16 +239,31 @@ int main(int argc, char *argv[]) {
     //     FREE(latex);
     // }
 
-    article_log_text("\\newpage");
-    article_log_text("\\section{Формула Тейлора}");
-    article_log_text("Разложение функции в окрестности x = %lg:", TAILOR_POINT);
-    tailor = tailor_formula(dif_array, COUNT_OF_DIFFS, TAILOR_POINT, x_var_idx);
+    article_log_text(&session, "\\newpage");
+    article_log_text(&session, "\\section{Формула Тейлора}");
+    article_log_text(&session, "Разложение функции в окрестности x = %lg:", TAILOR_POINT);
+    if (dif_array)
+        tailor = tailor_formula(&session, dif_array, COUNT_OF_DIFFS, TAILOR_POINT, x_var_idx);
     // article_log_with_latex(tailor, nullptr);
 
-    render_graphs(tree, first_derivative, tailor, TAILOR_POINT, x_var_idx, range);
+    STAGE_END(STAGE_TAYLOR);
+    mem_stage_mark(session.mem, STAGE_NAMES[STAGE_TAYLOR], tree_bytes(&session, tailor));
+    budget_end(&budget);
+    bool ok = dif_array != nullptr && budget.status == BUDGET_OK;
 
-    article_log_text("\\section{График}");
-    article_log_text("\\begin{figure}[h]\\centering\\includegraphics[width=0.9\\textwidth]{graphs.png}\\caption{Графики функции и аппроксимаций}\\end{figure}");
+    if (budget.status != BUDGET_OK) {
+        ERROR_MSG("%s: %s after %zu nodes\n", job->input, budget_status_str(budget.status), budget.nodes);
+        article_log_text(&session, "\\bigskip Вычисление прервано: %s.", budget_status_str(budget.status));
+    }
+
+    trace_span_t graphs_span = trace_begin("render_graphs");
+    render_graphs(job->out_dir, tree, first_derivative, tailor, TAILOR_POINT, x_var_idx, range);
+    trace_end(&graphs_span);
+
+    article_log_text(&session, "\\section{График}");
+    article_log_text(&session, "\\begin{figure}[h]\\centering\\includegraphics[width=0.9\\textwidth]{graphs.png}\\caption{Графики функции и аппроксимаций}\\end{figure}");
+
+    article_set_async(&session, false);
 
     if (dif_array) destruct(dif_array);
     if (tailor) destruct(tailor);
@@ -131,26 +272,347 @@ int main(int argc, char *argv[]) {
     destruct(first_derivative);
     destruct(tree);
     varlist::destruct(&var_list);
-    destruct_logger();
 
+    // The worker is joined, so the article is complete once the conclusion is in
     fprintf(latex_article, "\n\\bigskip\\hrule\\bigskip\n%s\n\n\\end{document}\n", CONCLUSION_STR);
     fclose(latex_article);
-    differentiate_set_article_file(nullptr);
+    // dot and tectonic run before the log is closed, so their time makes it into the table
+    if (job->compile_latex) {
+        dot_pool_wait_all();
+        if (ok) compile_report();
+    }
+    STAGE_END(STAGE_REPORT);
+    mem_stage_mark(session.mem, STAGE_NAMES[STAGE_REPORT], 0);
 
-    char compile_cmd[512] = {};
-    snprintf(compile_cmd, sizeof(compile_cmd),
-             "tectonic --outdir logs --chatter minimal %s > /dev/null",
-             LATEX_SOURCE_FILENAME);
-    int compile_status = system(compile_cmd);
-    if (compile_status == 0) {
-        char open_cmd[256] = {};
-        snprintf(open_cmd, sizeof(open_cmd), "open %s", LATEX_OUTPUT_FILENAME);
-        system(open_cmd);
-    } else {
-        ERROR_MSG(RED("tectonic failed, see logs for details\n"));
+    if (session.stats) {
+        char stats_path[768] = "";
+        snprintf(stats_path, sizeof(stats_path), "%sstats.json", job->out_dir);
+        stats_write_html(&stats, &session.logger);
+        if (!stats_write_json(&stats, stats_path))
+            ERROR_MSG("Failed to write %s\n", stats_path);
+        snprintf(stats_path, sizeof(stats_path), "%smemory.json", job->out_dir);
+        mem_write_html(&mem, &session.logger);
+        if (!mem_write_json(&mem, stats_path))
+            ERROR_MSG("Failed to write %s\n", stats_path);
+        snprintf(stats_path, sizeof(stats_path), "%sgrowth.csv", job->out_dir);
+        growth_write_html(&growth, &session.logger);
+        if (!growth_write_csv(&growth, stats_path))
+            ERROR_MSG("Failed to write %s\n", stats_path);
+    }
+    session_destruct(&session);
+    growth_destruct(&growth);
+    stats_attach(prev_stats);
+    mem_attach(prev_mem);
+
+    if (times) {
+        times->ok      = ok;
+        times->stopped = budget.status;
+        times->peak_bytes = mem.peak_total;
+    }
+    return ok ? 0 : 1;
+}
+
+#undef STAGE_END
+
+// ================= Batch mode =================
+
+typedef struct {
+    pipeline_job_t   *jobs;
+    pipeline_times_t *times;
+    size_t            count;
+    size_t            next;         // Следующее невзятое задание (атомарно)
+} batch_t;
+
+function void *batch_worker(void *arg) {
+    batch_t *batch = (batch_t *) arg;
+    trace_thread_name("batch worker");
+    for (;;) {
+        size_t idx = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (idx >= batch->count) break;
+        trace_span_t span = trace_begin_arg("expression", "job", (long long) idx);
+        run_pipeline(&batch->jobs[idx], &batch->times[idx]);
+        trace_end(&span);
+    }
+    return nullptr;
+}
+
+function int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+function bool push_input(char ***inputs, size_t *count, size_t *capacity, const char *path) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        char **grown = (char **) realloc(*inputs, new_capacity * sizeof(char *));
+        if (!grown) return false;
+        *inputs = grown;
+        *capacity = new_capacity;
+    }
+    char *copy = strdup(path);
+    if (!copy) return false;
+    (*inputs)[(*count)++] = copy;
+    return true;
+}
+
+function void free_inputs(char **inputs, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        FREE(inputs[i]);
+    }
+    FREE(inputs);
+}
+
+// Каталог: все обычные файлы в нем (по имени). Иначе манифест: путь на строку, '#' - комментарий
+function char **collect_inputs(const char *source, size_t *count) {
+    char **inputs = nullptr;
+    size_t capacity = 0;
+    *count = 0;
+
+    DIR *dir = opendir(source);
+    if (dir) {
+        size_t source_len = strlen(source);
+        const char *sep = (source_len && source[source_len - 1] == '/') ? "" : "/";
+        for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+            if (entry->d_name[0] == '.') continue;
+            char path[1024] = "";
+            snprintf(path, sizeof(path), "%s%s%s", source, sep, entry->d_name);
+            struct stat st = {};
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            if (!push_input(&inputs, count, &capacity, path)) break;
+        }
+        closedir(dir);
+        if (*count) qsort(inputs, *count, sizeof(char *), compare_strings);
+        return inputs;
+    }
+
+    FILE *manifest = fopen(source, "r");
+    if (!manifest) {
+        ERROR_MSG("Не удалось открыть каталог или манифест %s\n", source);
+        return nullptr;
+    }
+    char line[1024] = "";
+    while (fgets(line, sizeof(line), manifest)) {
+        line[strcspn(line, "\r\n")] = '\0';
+        const char *path = line;
+        while (*path == ' ' || *path == '\t') ++path;
+        if (!*path || *path == '#') continue;
+        if (!push_input(&inputs, count, &capacity, path)) break;
+    }
+    fclose(manifest);
+    return inputs;
+}
+
+// Имя выходного каталога: имя файла без расширения, дубликаты различаются номером
+function void make_job_dir(pipeline_job_t *job, const char *out_root, const char *input, size_t idx) {
+    const char *base = strrchr(input, '/');
+    base = base ? base + 1 : input;
+    size_t base_len = strcspn(base, ".");
+    if (!base_len) base_len = strlen(base);
+    snprintf(job->out_dir, sizeof(job->out_dir), "%s/%04zu_%.*s/", out_root, idx, (int) base_len, base);
+}
+
+function int run_batch(const char *source, const char *out_root, size_t workers, pipeline_limits_t limits) {
+    size_t count = 0;
+    char **inputs = collect_inputs(source, &count);
+    if (!count) {
+        ERROR_MSG(RED("Нет входных файлов в %s\n"), source);
+        FREE(inputs);
+        return 1;
+    }
+
+    create_folder_if_not_exists(out_root);
+    char trace_path[768] = "";
+    snprintf(trace_path, sizeof(trace_path), "%s/%s", out_root, TRACE_BASENAME);
+    if (env_flag("DIFF_TRACE")) trace_open(trace_path);
+
+    batch_t batch = {};
+    batch.count = count;
+    batch.jobs  = TYPED_CALLOC(count, pipeline_job_t);
+    batch.times = TYPED_CALLOC(count, pipeline_times_t);
+    if (!batch.jobs || !batch.times) {
+        ERROR_MSG(RED("Не хватило памяти на %zu заданий\n"), count);
+        FREE(batch.jobs);
+        FREE(batch.times);
+        free_inputs(inputs, count);
+        if (trace_enabled()) trace_close();
+        return 1;
+    }
+
+    uint64_t seed = (uint64_t) time(nullptr);
+    for (size_t i = 0; i < count; ++i) {
+        batch.jobs[i].input = inputs[i];
+        batch.jobs[i].seed   = seed + i;
+        batch.jobs[i].limits = limits;
+        batch.jobs[i].simplify = true;
+        make_job_dir(&batch.jobs[i], out_root, inputs[i], i);
+    }
+
+    if (workers < 1) workers = 1;
+    if (workers > count) workers = count;
+    pthread_t *threads = TYPED_CALLOC(workers, pthread_t);
+
+    // The parser is chatty on stdout; keep it off the main screen like the single-file mode does
+    TERMINAL_ENTER_ALT_SCREEN();
+    double wall_start = now_seconds();
+    size_t started = 0;
+    for (; threads && started < workers; ++started)
+        if (pthread_create(&threads[started], nullptr, batch_worker, &batch) != 0) break;
+    if (!started) batch_worker(&batch);
+    for (size_t i = 0; i < started; ++i)
+        pthread_join(threads[i], nullptr);
+    dot_pool_wait_all();
+    double wall = now_seconds() - wall_start;
+    if (trace_enabled()) trace_close();
+    TERMINAL_EXIT_ALT_SCREEN();
+
+    double stage_total[STAGE_COUNT] = {};
+    double stage_max[STAGE_COUNT] = {};
+    size_t ok_count = 0, peak_idx = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (batch.times[i].peak_bytes > batch.times[peak_idx].peak_bytes) peak_idx = i;
+        if (batch.times[i].ok) ok_count++;
+        else if (batch.times[i].stopped != BUDGET_OK)
+            ERROR_MSG("%s: pipeline stopped: %s\n", inputs[i], budget_status_str(batch.times[i].stopped));
+        else ERROR_MSG("%s: pipeline failed\n", inputs[i]);
+        for (size_t st = 0; st < STAGE_COUNT; ++st) {
+            stage_total[st] += batch.times[i].seconds[st];
+            if (batch.times[i].seconds[st] > stage_max[st]) stage_max[st] = batch.times[i].seconds[st];
+        }
+    }
+
+    printf("batch: %zu expressions (%zu ok) on %zu workers in %.3f s, %.2f expr/s\n",
+           count, ok_count, started ? started : 1, wall, (double) count / wall);
+    printf("%-14s %12s %12s %12s\n", "stage", "total, s", "mean, ms", "max, ms");
+    for (size_t st = 0; st < STAGE_COUNT; ++st)
+        printf("%-14s %12.3f %12.3f %12.3f\n", STAGE_NAMES[st],
+               stage_total[st], stage_total[st] * 1e3 / (double) count, stage_max[st] * 1e3);
+    // With DIFF_STATS the largest job tells how much memory a worker needs
+    if (batch.times[peak_idx].peak_bytes > 0)
+        printf("peak memory: %.1f MB (%s)\n", (double) batch.times[peak_idx].peak_bytes / (1 << 20), inputs[peak_idx]);
+    if (diskcache_enabled()) {
+        diskcache_stats_t cache = diskcache_stats();
+        printf("disk cache: %zu hits, %zu misses, %zu stored, %zu evicted, %.1f MB\n",
+               cache.hits, cache.misses, cache.stores, cache.evictions, (double) cache.bytes / (1 << 20));
+    }
+    printf("output: %s/\n", out_root);
+
+    FREE(threads);
+    FREE(batch.jobs);
+    FREE(batch.times);
+    free_inputs(inputs, count);
+    return ok_count == count ? 0 : 1;
+}
+
+function void print_usage(void) {
+    ERROR_MSG("eq_calc path_to_equation\n"
+              "eq_calc --batch <dir|manifest> [-j workers] [-o out_dir] [--max-nodes N] [--max-mb N] [--timeout sec]\n"
+              "eq_calc --serve [socket_path] [-c cache_entries] [--max-order N] [--max-nodes N] [--max-mb N] [--timeout sec]\n");
+}
+
+// Without a socket path the line protocol runs on stdin/stdout
+function int run_daemon(int argc, char *argv[]) {
+    const char *socket_path = nullptr;
+    long capacity = (long) DAEMON_DEFAULT_CACHE;
+    daemon_limits_t limits = {DAEMON_DEFAULT_MAX_NODES, DAEMON_DEFAULT_MAX_BYTES, DAEMON_DEFAULT_TIMEOUT, DAEMON_DEFAULT_MAX_ORDER};
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)                capacity    = strtol(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--max-order") == 0 && i + 1 < argc) limits.max_order = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--max-nodes") == 0 && i + 1 < argc) limits.max_nodes = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--max-mb") == 0 && i + 1 < argc)    limits.max_bytes = strtoul(argv[++i], nullptr, 10) << 20;
+        else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)   limits.timeout   = strtod(argv[++i], nullptr);
+        else if (!socket_path)                                         socket_path = argv[i];
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    daemon_cache_t cache = {};
+    if (!daemon_cache_init(&cache, capacity > 0 ? (size_t) capacity : DAEMON_DEFAULT_CACHE)) {
+        ERROR_MSG(RED("Failed to allocate daemon cache\n"));
+        return 1;
+    }
+    cache.limits = limits;
+    int status = socket_path ? daemon_serve_socket(&cache, socket_path)
+                             : daemon_serve_stream(&cache, stdin, stdout);
+    daemon_cache_destruct(&cache);
+    intern::reset();
+    return status == 0 ? 0 : 1;
+}
+
+// DIFF_CACHE_DIR overrides the directory (empty disables the cache), DIFF_CACHE_MAX_MB its size
+function void open_disk_cache(void) {
+    const char *dir = getenv("DIFF_CACHE_DIR");
+    if (!dir) dir = DISK_CACHE_DEFAULT_DIR;
+    if (!*dir) return;
+    const char *max_mb_env = getenv("DIFF_CACHE_MAX_MB");
+    long max_mb = max_mb_env ? strtol(max_mb_env, nullptr, 10) : (long) DISK_CACHE_DEFAULT_MAX_MB;
+    diskcache_open(dir, max_mb > 0 ? (size_t) max_mb << 20 : 0);
+}
+
+int main(int argc, char *argv[]) {
+    // The server keeps its own cache in memory and never opens the disk one
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0)
+        return run_daemon(argc, argv);
+
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        const char *source = nullptr;
+        const char *out_root = BATCH_DEFAULT_OUT_DIR;
+        long workers = sysconf(_SC_NPROCESSORS_ONLN);
+        pipeline_limits_t limits = {};
+        for (int i = 2; i < argc; ++i) {
+            if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)               workers  = strtol(argv[++i], nullptr, 10);
+            else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)          out_root = argv[++i];
+            else if (strcmp(argv[i], "--max-nodes") == 0 && i + 1 < argc) limits.max_nodes = strtoul(argv[++i], nullptr, 10);
+            else if (strcmp(argv[i], "--max-mb") == 0 && i + 1 < argc)    limits.max_bytes = strtoul(argv[++i], nullptr, 10) << 20;
+            else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)   limits.timeout   = strtod(argv[++i], nullptr);
+            else if (!source)                                             source   = argv[i];
+            else {
+                print_usage();
+                return 1;
+            }
+        }
+        if (!source) {
+            print_usage();
+            return 1;
+        }
+        open_disk_cache();
+        int status = run_batch(source, out_root, workers > 0 ? (size_t) workers : 1, limits);
+        intern::reset();
+        return status;
+    }
+
+    if (argc <= 1) {
+        ERROR_MSG(RED("U must provide path to source equation text\n"));
+        print_usage();
+        return 1;
+    }
+    else if (argc > 2) {
+        ERROR_MSG(RED("U must provide only one path to source equation text\n"));
+        print_usage();
+        return 1;
+    }
+
+    open_disk_cache();
+    pipeline_job_t job = {};
+    job.input       = argv[1];
+    job.seed        = (uint64_t) time(nullptr);
+    job.interactive   = true;
+    job.compile_latex = true;
+    snprintf(job.out_dir, sizeof(job.out_dir), "logs/");
+
+    // Spans cover both the pipeline and the dot/tectonic tail; open it in Chrome or Perfetto
+    char trace_path[768] = "";
+    snprintf(trace_path, sizeof(trace_path), "%s%s", job.out_dir, TRACE_BASENAME);
+    if (env_flag("DIFF_TRACE")) {
+        trace_open(trace_path);
+        trace_thread_name("main");
     }
+    int status = run_pipeline(&job, nullptr);
+    if (trace_enabled()) trace_close();
+    intern::reset();
+    if (status != 0) return status;
 
     // getchar();
     // getchar();
     return 0;
-}
\ No newline at end of file
+}
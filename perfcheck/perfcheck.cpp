@@ -0,0 +1,435 @@
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "differentiator.h"
+#include "io_utils.h"
+#include "util.h"
+#include "base.h"
+#include "budget.h"
+#include "gen.h"
+
+// Performance regression gate. Runs a fixed workload set (expr/test*.tmp and generated trees)
+// through simplify_tree, differentiate and differentiate_to_n, takes the median of several
+// samples per row and compares it with perfcheck/baseline.json. Exit code 1 on a regression or
+// a baseline row that wasn't measured, 2 if the baseline can't be read.
+//
+//     perfcheck/perfcheck [--baseline file] [--samples N] [--threshold pct] [--filter substr]
+//     perfcheck/perfcheck --update                # measure and overwrite the baseline
+//
+// Run from the repository root. Baselines are per machine: regenerate with --update on the
+// machine that runs the gate.
+
+const char  *PERF_DEFAULT_BASELINE  = "perfcheck/baseline.json";
+const char  *PERF_EXPR_FILES[]      = {"expr/test.tmp", "expr/test2.tmp", "expr/test3.tmp", "expr/test4.tmp"};
+const size_t PERF_GEN_NODES         = 10000;
+const size_t PERF_GEN_LARGE_NODES   = 100000;
+const uint64_t PERF_GEN_SEED        = 1;
+const size_t PERF_ORDERS            = 3;
+const size_t PERF_MAX_WORKLOADS     = 16;
+const size_t PERF_MAX_SAMPLES       = 64;
+const size_t PERF_DEFAULT_SAMPLES   = 9;
+const double PERF_SAMPLE_SECONDS    = 0.02;     // A sample repeats the op at least this long
+const size_t PERF_SAMPLE_MAX_RUNS   = 100000;
+const double PERF_DEFAULT_THRESHOLD = 10;       // Percent over the baseline median
+const double PERF_SE_FACTOR         = 3;        // Noise allowance in standard errors of the median difference
+const double PERF_MAD_TO_SIGMA      = 1.4826;
+const double PERF_MEDIAN_SE         = 1.2533;   // SE of a normal sample's median is sqrt(pi / 2) * sigma / sqrt(n)
+const double PERF_MAX_NOISE         = 20;       // Percent: the noise allowance never grows past this
+const double PERF_MIN_DELTA_NS      = 100;      // Below this a difference is timer noise
+const size_t PERF_BUDGET_NODES      = 20000000;
+const double PERF_BUDGET_TIMEOUT    = 30;
+
+typedef enum {
+    PERF_SIMPLIFY,
+    PERF_DIFFERENTIATE,
+    PERF_DIFFERENTIATE_TO_N,
+    PERF_OP_COUNT,
+} PERF_OP;
+
+const char *PERF_OP_NAMES[PERF_OP_COUNT] = {"simplify", "differentiate", "differentiate_to_n"};
+
+#define PERF_OP_MASK(op) (1u << (op))
+const unsigned PERF_ALL_OPS = PERF_OP_MASK(PERF_OP_COUNT) - 1;
+
+typedef struct {
+    char              name[64];
+    FRONT_COMPIL_T   *tree;
+    varlist::VarList  vars;         // load_tree_from_file keeps a reference to it
+    unsigned          ops;          // Mask of PERF_OP: orders of a generated tree would take the whole run
+} workload_t;
+
+typedef struct {
+    char          name[96];         // "<workload>:<op>"
+    double        median_ns;
+    double        mad_ns;           // Median absolute deviation of the samples
+    size_t        runs;             // Ops per sample
+    BUDGET_STATUS status;
+    bool          failed;
+} perf_row_t;
+
+typedef struct {
+    perf_row_t *rows;
+    size_t      count;
+    size_t      capacity;
+    size_t      samples;        // Samples per row the medians were taken over
+} perf_rows_t;
+
+typedef struct {
+    const char *baseline;
+    size_t      samples;
+    double      threshold;
+    const char *filter;
+    bool        update;
+} perf_opts_t;
+
+// Migrations between cores are the largest noise source on an idle machine
+function void pin_to_current_cpu() {
+    int cpu = sched_getcpu();
+    if (cpu < 0) return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+function size_t load_workloads(workload_t *workloads) {
+    size_t count = 0;
+    for (size_t i = 0; i < ARRAY_COUNT(PERF_EXPR_FILES); ++i) {
+        workload_t *w = &workloads[count];
+        graph_range_t range = {};
+        w->tree = load_tree_from_file(PERF_EXPR_FILES[i], &w->vars, &range);
+        if (!w->tree) {
+            varlist::destruct(&w->vars);
+            continue;
+        }
+        snprintf(w->name, sizeof(w->name), "%s", PERF_EXPR_FILES[i]);
+        w->ops = PERF_ALL_OPS;
+        ++count;
+    }
+
+    for (size_t s = 0; s < gen::SHAPE_COUNT; ++s) {
+        workload_t *w = &workloads[count];
+        w->tree = gen::generate((gen::SHAPE) s, PERF_GEN_NODES, PERF_GEN_SEED);
+        if (!w->tree) continue;
+        snprintf(w->name, sizeof(w->name), "gen/%s/%zu", gen::shape_name((gen::SHAPE) s), PERF_GEN_NODES);
+        w->ops = PERF_OP_MASK(PERF_SIMPLIFY) | PERF_OP_MASK(PERF_DIFFERENTIATE);
+        ++count;
+    }
+    workload_t *w = &workloads[count];
+    w->tree = gen::generate(gen::SHAPE_MIXED, PERF_GEN_LARGE_NODES, PERF_GEN_SEED);
+    if (w->tree) {
+        snprintf(w->name, sizeof(w->name), "gen/mixed/%zu", PERF_GEN_LARGE_NODES);
+        w->ops = PERF_OP_MASK(PERF_SIMPLIFY);
+        ++count;
+    }
+    return count;
+}
+
+function void destruct_workloads(workload_t *workloads, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        destruct(workloads[i].tree);
+        varlist::destruct(&workloads[i].vars);
+    }
+}
+
+// One op under a fresh budget; only the op itself is timed
+function bool run_once(PERF_OP op, const FRONT_COMPIL_T *tree, double *seconds, BUDGET_STATUS *status) {
+    FRONT_COMPIL_T *input = op == PERF_SIMPLIFY ? copy_tree(tree) : nullptr;
+    if (op == PERF_SIMPLIFY && !input) return false;
+    FRONT_COMPIL_T *result = nullptr;
+    FRONT_COMPIL_T **array = nullptr;
+    bool ok = true;
+
+    budget_t budget = {};
+    budget_init(&budget, PERF_BUDGET_NODES, 0, PERF_BUDGET_TIMEOUT, nullptr);
+    budget_begin(&budget);
+    double t0 = now_seconds();
+    switch (op) {
+        case PERF_SIMPLIFY:
+            simplify_tree(nullptr, input);
+            break;
+        case PERF_DIFFERENTIATE:
+            result = differentiate(nullptr, tree, 0);
+            ok = result != nullptr;
+            break;
+        case PERF_DIFFERENTIATE_TO_N:
+            array = differentiate_to_n(nullptr, tree, PERF_ORDERS, 0);
+            ok = array != nullptr;
+            break;
+        case PERF_OP_COUNT:
+        default:
+            ok = false;
+            break;
+    }
+    *seconds += now_seconds() - t0;
+    budget_end(&budget);
+    *status = budget.status;
+
+    destruct(input);
+    destruct(result);
+    if (array) {
+        destruct(array);
+        FREE(array);
+    }
+    return ok && budget.status == BUDGET_OK;
+}
+
+function int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+function double median(double *values, size_t count) {
+    qsort(values, count, sizeof(double), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// Median and MAD over `samples` samples; the run count per sample is fixed by a warm-up run
+function void measure(PERF_OP op, const FRONT_COMPIL_T *tree, size_t samples, perf_row_t *row) {
+    double warmup = 0;
+    if (!run_once(op, tree, &warmup, &row->status)) {
+        row->failed = true;
+        return;
+    }
+    row->runs = warmup > 0 ? (size_t) (PERF_SAMPLE_SECONDS / warmup) + 1 : PERF_SAMPLE_MAX_RUNS;
+    if (row->runs > PERF_SAMPLE_MAX_RUNS) row->runs = PERF_SAMPLE_MAX_RUNS;
+
+    double times[PERF_MAX_SAMPLES] = {};
+    for (size_t s = 0; s < samples; ++s) {
+        double seconds = 0;
+        for (size_t r = 0; r < row->runs; ++r) {
+            if (!run_once(op, tree, &seconds, &row->status)) {
+                row->failed = true;
+                return;
+            }
+        }
+        times[s] = seconds / (double) row->runs * 1e9;
+    }
+    row->median_ns = median(times, samples);
+    for (size_t s = 0; s < samples; ++s) times[s] = fabs(times[s] - row->median_ns);
+    row->mad_ns = median(times, samples);
+}
+
+function perf_row_t *add_row(perf_rows_t *rows) {
+    if (rows->count == rows->capacity) {
+        size_t capacity = rows->capacity ? rows->capacity * 2 : 32;
+        perf_row_t *grown = (perf_row_t *) realloc(rows->rows, capacity * sizeof(perf_row_t));
+        if (!grown) return nullptr;
+        rows->rows = grown;
+        rows->capacity = capacity;
+    }
+    perf_row_t *row = &rows->rows[rows->count++];
+    *row = (perf_row_t) {};
+    return row;
+}
+
+function const perf_row_t *find_row(const perf_rows_t *rows, const char *name) {
+    for (size_t i = 0; i < rows->count; ++i)
+        if (strcmp(rows->rows[i].name, name) == 0) return &rows->rows[i];
+    return nullptr;
+}
+
+function const char *row_status(const perf_row_t *row) {
+    if (row->status != BUDGET_OK) return budget_status_str(row->status);
+    return row->failed ? "failed" : "ok";
+}
+
+// One result per line, so load_baseline can read it back without a JSON parser
+function bool write_baseline(const char *path, const perf_rows_t *rows, const perf_opts_t *opts) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "{\n  \"version\": 1, \"samples\": %zu, \"orders\": %zu,\n  \"results\": [",
+            opts->samples, PERF_ORDERS);
+    for (size_t i = 0; i < rows->count; ++i) {
+        const perf_row_t *row = &rows->rows[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"median_ns\": %.1f, \"mad_ns\": %.1f, \"runs\": %zu, \"status\": \"%s\"}",
+                i ? "," : "", row->name, row->median_ns, row->mad_ns, row->runs, row_status(row));
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+function bool read_json_string(const char *line, const char *key, char *buf, size_t size) {
+    const char *start = strstr(line, key);
+    if (!start) return false;
+    start += strlen(key);
+    const char *end = strchr(start, '"');
+    if (!end || (size_t) (end - start) >= size) return false;
+    memcpy(buf, start, (size_t) (end - start));
+    buf[end - start] = '\0';
+    return true;
+}
+
+function bool read_json_number(const char *line, const char *key, double *value) {
+    const char *start = strstr(line, key);
+    return start && sscanf(start + strlen(key), "%lf", value) == 1;
+}
+
+function bool load_baseline(const char *path, perf_rows_t *rows) {
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    char line[512] = "";
+    while (fgets(line, sizeof(line), file)) {
+        double samples = 0;
+        if (!strstr(line, "\"name\": ") && read_json_number(line, "\"samples\": ", &samples) && samples >= 1)
+            rows->samples = (size_t) samples;
+        char name[sizeof(((perf_row_t *) nullptr)->name)] = "";
+        char status[32] = "";
+        double median_ns = 0, mad_ns = 0;
+        if (!read_json_string(line, "\"name\": \"", name, sizeof(name))) continue;
+        if (!read_json_number(line, "\"median_ns\": ", &median_ns) ||
+            !read_json_number(line, "\"mad_ns\": ", &mad_ns) ||
+            !read_json_string(line, "\"status\": \"", status, sizeof(status))) {
+            ERROR_MSG("%s: malformed result line: %s", path, line);
+            fclose(file);
+            return false;
+        }
+        perf_row_t *row = add_row(rows);
+        if (!row) {
+            fclose(file);
+            return false;
+        }
+        snprintf(row->name, sizeof(row->name), "%s", name);
+        row->median_ns = median_ns;
+        row->mad_ns    = mad_ns;
+        row->failed    = strcmp(status, "ok") != 0;
+    }
+    fclose(file);
+    if (!rows->samples) rows->samples = PERF_DEFAULT_SAMPLES;
+    return true;
+}
+
+// Slower than baseline by more than both the relative threshold and the noise of the two medians.
+// The noise is the standard error of their difference with the spread of the baseline: a noisy
+// current run is what the gate should catch, not a reason to widen it
+function double allowed_delta_ns(const perf_row_t *base, size_t base_samples, size_t samples, double threshold) {
+    double sigma = PERF_MAD_TO_SIGMA * base->mad_ns;
+    double se    = PERF_MEDIAN_SE * sigma * sqrt(1.0 / (double) base_samples + 1.0 / (double) samples);
+    double noise = fmin(PERF_SE_FACTOR * se, base->median_ns * PERF_MAX_NOISE / 100);
+    return fmax(fmax(base->median_ns * threshold / 100, noise), PERF_MIN_DELTA_NS);
+}
+
+function bool regressed(const perf_row_t *base, const perf_row_t *cur, size_t base_samples, size_t samples,
+                        double threshold) {
+    if (cur->failed || cur->status != BUDGET_OK) return !base->failed;
+    if (base->failed) return false;
+    return cur->median_ns - base->median_ns > allowed_delta_ns(base, base_samples, samples, threshold);
+}
+
+function bool parse_args(int argc, char *argv[], perf_opts_t *opts) {
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if      (has_value && strcmp(argv[i], "--baseline") == 0)  opts->baseline = argv[++i];
+        else if (has_value && strcmp(argv[i], "--samples") == 0)   opts->samples = strtoul(argv[++i], nullptr, 10);
+        else if (has_value && strcmp(argv[i], "--threshold") == 0) opts->threshold = strtod(argv[++i], nullptr);
+        else if (has_value && strcmp(argv[i], "--filter") == 0)    opts->filter = argv[++i];
+        else if (strcmp(argv[i], "--update") == 0)                 opts->update = true;
+        else {
+            ERROR_MSG("perfcheck [--baseline file] [--samples N] [--threshold pct] [--filter substr] [--update]\n");
+            return false;
+        }
+    }
+    if (opts->samples < 3) opts->samples = 3;
+    if (opts->samples > PERF_MAX_SAMPLES) opts->samples = PERF_MAX_SAMPLES;
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    perf_opts_t opts = {
+        .baseline  = PERF_DEFAULT_BASELINE,
+        .samples   = PERF_DEFAULT_SAMPLES,
+        .threshold = PERF_DEFAULT_THRESHOLD,
+        .filter    = nullptr,
+        .update    = false,
+    };
+    if (!parse_args(argc, argv, &opts)) return 2;
+
+    perf_rows_t baseline = {};
+    if (!opts.update && !load_baseline(opts.baseline, &baseline)) {
+        ERROR_MSG("Can't read baseline %s (create it with --update)\n", opts.baseline);
+        free(baseline.rows);
+        return 2;
+    }
+
+    pin_to_current_cpu();
+    workload_t workloads[PERF_MAX_WORKLOADS] = {};
+    size_t workloads_count = load_workloads(workloads);
+
+    printf("%-38s %12s %12s %8s %8s  %s\n", "workload:op", "base, us", "now, us", "delta", "allowed", "verdict");
+    perf_rows_t current = {};
+    size_t regressions = 0;
+    for (size_t w = 0; w < workloads_count; ++w) {
+        for (size_t o = 0; o < PERF_OP_COUNT; ++o) {
+            if (!(workloads[w].ops & PERF_OP_MASK(o))) continue;
+            char name[sizeof(((perf_row_t *) nullptr)->name)] = "";
+            snprintf(name, sizeof(name), "%.63s:%.31s", workloads[w].name, PERF_OP_NAMES[o]);
+            if (opts.filter && !strstr(name, opts.filter)) continue;
+
+            perf_row_t *row = add_row(&current);
+            if (!row) {
+                ERROR_MSG("No memory for results\n");
+                break;
+            }
+            snprintf(row->name, sizeof(row->name), "%s", name);
+            measure((PERF_OP) o, workloads[w].tree, opts.samples, row);
+
+            const perf_row_t *base = opts.update ? nullptr : find_row(&baseline, name);
+            // A single slow row is re-measured once: a background burst shouldn't block a merge
+            if (base && regressed(base, row, baseline.samples, opts.samples, opts.threshold)) {
+                perf_row_t retry = *row;
+                measure((PERF_OP) o, workloads[w].tree, opts.samples, &retry);
+                if (!retry.failed && retry.median_ns < row->median_ns) *row = retry;
+            }
+
+            const char *verdict = "new";
+            double delta = 0, allowed = 0;
+            if (base) {
+                delta   = base->median_ns > 0 ? (row->median_ns / base->median_ns - 1) * 100 : 0;
+                allowed = base->median_ns > 0
+                        ? allowed_delta_ns(base, baseline.samples, opts.samples, opts.threshold) / base->median_ns * 100
+                        : 0;
+                if (regressed(base, row, baseline.samples, opts.samples, opts.threshold)) {
+                    verdict = "REGRESSION";
+                    ++regressions;
+                }
+                else verdict = delta < -allowed ? "faster" : "ok";
+            }
+            if (row->failed || row->status != BUDGET_OK) verdict = base && !base->failed ? "REGRESSION" : row_status(row);
+            printf("%-38s %12.1f %12.1f %+7.1f%% %7.1f%%  %s\n", row->name,
+                   base ? base->median_ns * 1e-3 : 0.0, row->median_ns * 1e-3, delta, allowed, verdict);
+        }
+    }
+    destruct_workloads(workloads, workloads_count);
+
+    // A renamed, unloadable or skipped workload must not drop out of the gate unnoticed
+    size_t missing = 0;
+    for (size_t i = 0; !opts.update && i < baseline.count; ++i) {
+        const perf_row_t *base = &baseline.rows[i];
+        if (opts.filter && !strstr(base->name, opts.filter)) continue;
+        if (find_row(&current, base->name)) continue;
+        printf("%-38s %12.1f %12s %8s %8s  %s\n", base->name, base->median_ns * 1e-3, "-", "", "", "MISSING");
+        ++missing;
+    }
+
+    int rc = 0;
+    if (opts.update) {
+        if (!write_baseline(opts.baseline, &current, &opts)) {
+            ERROR_MSG("Can't write baseline %s\n", opts.baseline);
+            rc = 2;
+        }
+        else printf("baseline written to %s (%zu rows)\n", opts.baseline, current.count);
+    }
+    else {
+        printf("perfcheck: %zu rows, %zu regressions, %zu missing (threshold %.1f%%, %zu samples)\n",
+               current.count, regressions, missing, opts.threshold, opts.samples);
+        if (missing) ERROR_MSG("%zu baseline rows were not measured (regenerate with --update if they were removed)\n", missing);
+        rc = regressions || missing ? 1 : 0;
+    }
+    free(current.rows);
+    free(baseline.rows);
+    return rc;
+}
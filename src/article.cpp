@@ -1,25 +1,43 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <math.h>
+#include <pthread.h>
 
 #include "differentiator.h"
 #include "base.h"
 #include "io_utils.h"
 #include "logger.h"
-
-extern const char *get_random_str_to_dif_op(OPERATOR op);
-
-typedef struct {
-    FILE            *file;
-    const FRONT_COMPIL_T *tree;
-} ArticleContext;
-
-global ArticleContext ARTICLE_CONTEXT = {};
-
-size_t g_step_counter = 0;
-size_t g_step_limit = 0;
-size_t g_requested_step_limit = 0;
+#include "latex.h"
+#include "article.h"
+#include "session.h"
+#include "stats.h"
+#include "trace.h"
+
+extern const char *get_random_str_to_dif_op(session_t *session, OPERATOR op);
+extern NODE_T *copy_subtree(const NODE_T *node);
+
+const uint8_t ARTICLE_RULE_LEAF = 0xFF;
+
+typedef enum {
+    ARTICLE_JOB_FORMULA,
+    ARTICLE_JOB_TRACE,
+} ARTICLE_JOB_TYPE;
+
+// Задание фонового рендера владеет всем, что читает: строками, копиями деревьев и трассой
+typedef struct article_job_t {
+    ARTICLE_JOB_TYPE      type;
+    FILE                 *file;
+    char                 *before;
+    char                 *mid;
+    char                 *after;
+    FRONT_COMPIL_T        lhs;     // TRACE: копия исходного дерева
+    FRONT_COMPIL_T        rhs;     // TRACE: сырой результат differentiate_node
+    article_trace_t       trace;
+    struct article_job_t *next;
+} article_job_t;
 
 bool latex_too_long(const char *latex) {
     // if (!latex) return false;
@@ -43,23 +61,236 @@ void log_placeholder(FILE *article_file, const char *message, size_t len) {
         fprintf(article_file, "\\textit{%s.}\n\n", message);
 }
 
-void differentiate_set_article_file(FILE *file) {
-    ARTICLE_CONTEXT.file = file;
+void differentiate_set_article_file(session_t *session, FILE *file) {
+    if (!session) return;
+    session->article.file = file;
+}
+
+// Cached fragments are keyed by node address, so they can't outlive the tree they were rendered from.
+void differentiate_set_article_tree(session_t *session, const FRONT_COMPIL_T *tree) {
+    if (!session) return;
+    session->article.tree = tree;
+    latex_cache_clear(&session->article.cache);
+}
+
+void article_release_cache(session_t *session) {
+    if (!session) return;
+    latex_cache_destroy(&session->article.cache);
+    FREE(session->article.trace.steps);
+    session->article.trace = {};
+}
+
+FILE *differentiate_get_article_stream(session_t *session) {
+    if (!session) return nullptr;
+    return session->article.file ? session->article.file : logger_get_file(&session->logger);
+}
+
+const FRONT_COMPIL_T *differentiate_get_article_tree(session_t *session) {
+    return session ? session->article.tree : nullptr;
+}
+
+function void write_formula(FILE *file, const char *before, const FRONT_COMPIL_T *lhs,
+                            const char *mid, const FRONT_COMPIL_T *rhs, const char *after) {
+    if (before) fputs(before, file);
+    if (lhs && lhs->root) latex_write(file, lhs);
+    if (mid) fputs(mid, file);
+    if (rhs && rhs->root) latex_write(file, rhs);
+    if (after) fputs(after, file);
+}
+
+function void render_trace(session_t *session, FILE *file, const FRONT_COMPIL_T *tree, const article_trace_t *trace, latex_cache_t *cache) {
+    // Steps are in post-order: the children of each node and their results are already in the cache,
+    // so each fragment costs its own glue plus memcpy of the children instead of a full re-walk.
+    stats_timer_t timer = stats_phase_begin(STATS_LATEX);
+    for (size_t i = 0; i < trace->count; ++i) {
+        const article_step_t *step = &trace->steps[i];
+        size_t src_len = 0, res_len = 0;
+        const char *source_latex = latex_fragment(cache, tree, step->node,   &src_len);
+        const char *result_latex = latex_fragment(cache, tree, step->result, &res_len);
+
+        if (latex_too_long(source_latex) || latex_too_long(result_latex)) {
+            log_placeholder(file, "Шаг пропущен: громоздкое выражение", src_len + res_len);
+            continue;
+        }
+
+        const char *phrase = step->rule != ARTICLE_RULE_LEAF ? get_random_str_to_dif_op(session, (OPERATOR) step->rule) : nullptr;
+        if (phrase && phrase[0] != '\0')
+            fprintf(file, "%s\n\n", phrase);
+
+        stats_latex_bytes(src_len + res_len);
+        if (source_latex && result_latex)
+            fprintf(file, "\\begin{dmath*}\n(%s)' = %s\n\\end{dmath*}\n\n", source_latex, result_latex);
+        else if (source_latex)
+            fprintf(file, "\\begin{dmath*}\n(%s)' = ?\n\\end{dmath*}\n\n", source_latex);
+    }
+    if (trace->skipped)
+        log_placeholder(file, "Оставшиеся шаги дифференцирования опущены", 0);
+    stats_phase_end(&timer);
+}
+
+// ================= Background renderer =================
+
+function void free_job(article_job_t *job) {
+    FREE(job->before);
+    FREE(job->mid);
+    FREE(job->after);
+    if (job->lhs.root) destruct(job->lhs.root);
+    if (job->rhs.root) destruct(job->rhs.root);
+    varlist::release(job->lhs.vars);
+    varlist::release(job->rhs.vars);
+    FREE(job->trace.steps);
+    FREE(job);
+}
+
+function void run_job(session_t *session, article_job_t *job, latex_cache_t *cache) {
+    if (job->type == ARTICLE_JOB_TRACE) {
+        latex_cache_clear(cache);
+        render_trace(session, job->file, &job->lhs, &job->trace, cache);
+        latex_cache_clear(cache);
+    }
+    else {
+        write_formula(job->file, job->before, job->lhs.root ? &job->lhs : nullptr,
+                      job->mid, job->rhs.root ? &job->rhs : nullptr, job->after);
+    }
+    fflush(job->file);
+}
+
+function void *article_worker(void *arg) {
+    session_t *session = (session_t *) arg;
+    // Trees copied for jobs are freed here, so the worker feeds the same counters
+    stats_attach(session->stats);
+    mem_attach(session->mem);
+    trace_thread_name("article");
+    latex_cache_t cache = {};
+    latex_cache_init(&cache);
+
+    pthread_mutex_lock(&session->article.lock);
+    for (;;) {
+        while (!session->article.head && !session->article.stop)
+            pthread_cond_wait(&session->article.job_ready, &session->article.lock);
+        article_job_t *job = session->article.head;
+        if (!job) break;
+        session->article.head = job->next;
+        if (!session->article.head) session->article.tail = nullptr;
+        session->article.busy = true;
+        pthread_mutex_unlock(&session->article.lock);
+
+        trace_span_t span = trace_begin(job->type == ARTICLE_JOB_TRACE ? "article trace" : "article formula");
+        run_job(session, job, &cache);
+        trace_end(&span);
+        free_job(job);
+
+        pthread_mutex_lock(&session->article.lock);
+        session->article.busy = false;
+        if (!session->article.head)
+            pthread_cond_broadcast(&session->article.idle);
+    }
+    pthread_mutex_unlock(&session->article.lock);
+
+    latex_cache_destroy(&cache);
+    return nullptr;
+}
+
+function void enqueue_job(session_t *session, article_job_t *job) {
+    pthread_mutex_lock(&session->article.lock);
+    if (session->article.tail) session->article.tail->next = job;
+    else                      session->article.head       = job;
+    session->article.tail = job;
+    pthread_cond_signal(&session->article.job_ready);
+    pthread_mutex_unlock(&session->article.lock);
+}
+
+function char *dup_or_null(const char *str) {
+    return str ? strdup(str) : nullptr;
+}
+
+// A job copy of a formula operand; the source tree may be simplified or freed right after the call.
+function bool copy_operand(FRONT_COMPIL_T *dst, const FRONT_COMPIL_T *src) {
+    if (!src || !src->root) return true;
+    dst->root = copy_subtree(src->root);
+    if (!dst->root) return false;
+    dst->vars = varlist::retain(src->vars);
+    return true;
+}
+
+function bool enqueue_formula(session_t *session, FILE *file, const char *before, const FRONT_COMPIL_T *lhs,
+                              const char *mid, const FRONT_COMPIL_T *rhs, const char *after) {
+    article_job_t *job = TYPED_CALLOC(1, article_job_t);
+    if (!job) return false;
+    job->type   = ARTICLE_JOB_FORMULA;
+    job->file   = file;
+    job->before = dup_or_null(before);
+    job->mid    = dup_or_null(mid);
+    job->after  = dup_or_null(after);
+    if ((before && !job->before) || (mid && !job->mid) || (after && !job->after) ||
+        !copy_operand(&job->lhs, lhs) || !copy_operand(&job->rhs, rhs)) {
+        free_job(job);
+        return false;
+    }
+    enqueue_job(session, job);
+    return true;
 }
 
-void differentiate_set_article_tree(const FRONT_COMPIL_T *tree) {
-    ARTICLE_CONTEXT.tree = tree;
+bool article_set_async(session_t *session, bool enabled) {
+    if (!session) return false;
+    if (enabled == session->article.async) return true;
+
+    if (enabled) {
+        session->article.stop = false;
+        pthread_mutex_init(&session->article.lock, nullptr);
+        pthread_cond_init(&session->article.job_ready, nullptr);
+        pthread_cond_init(&session->article.idle, nullptr);
+        if (pthread_create(&session->article.worker, nullptr, article_worker, session) != 0) {
+            pthread_mutex_destroy(&session->article.lock);
+            pthread_cond_destroy(&session->article.job_ready);
+            pthread_cond_destroy(&session->article.idle);
+            ERROR_MSG("Не удалось запустить поток рендера статьи, остаемся в синхронном режиме\n");
+            return false;
+        }
+        session->article.async = true;
+        return true;
+    }
+
+    pthread_mutex_lock(&session->article.lock);
+    session->article.stop = true;
+    pthread_cond_signal(&session->article.job_ready);
+    pthread_mutex_unlock(&session->article.lock);
+    pthread_join(session->article.worker, nullptr);
+    pthread_mutex_destroy(&session->article.lock);
+    pthread_cond_destroy(&session->article.job_ready);
+    pthread_cond_destroy(&session->article.idle);
+    session->article.async = false;
+    return true;
 }
 
-FILE *differentiate_get_article_stream(void) {
-    return ARTICLE_CONTEXT.file ? ARTICLE_CONTEXT.file : logger_get_file();
+void article_flush(session_t *session) {
+    if (!session) return;
+    if (session->article.async) {
+        pthread_mutex_lock(&session->article.lock);
+        while (session->article.head || session->article.busy)
+            pthread_cond_wait(&session->article.idle, &session->article.lock);
+        pthread_mutex_unlock(&session->article.lock);
+    }
+    FILE *article_file = differentiate_get_article_stream(session);
+    if (article_file) fflush(article_file);
 }
 
-const FRONT_COMPIL_T *differentiate_get_article_tree(void) {
-    return ARTICLE_CONTEXT.tree;
+// ================= Article text =================
+
+void article_log_formula(session_t *session, const char *before, const FRONT_COMPIL_T *lhs,
+                         const char *mid, const FRONT_COMPIL_T *rhs, const char *after) {
+    FILE *article_file = differentiate_get_article_stream(session);
+    if (!article_file) return;
+
+    if (session->article.async) {
+        if (enqueue_formula(session, article_file, before, lhs, mid, rhs, after)) return;
+        article_flush(session);
+    }
+    write_formula(article_file, before, lhs, mid, rhs, after);
+    fflush(article_file);
 }
 
-void article_log_text(const char *fmt, ...) {
+void article_log_text(session_t *session, const char *fmt, ...) {
     char prompt_buf[32768] = "";
     if (fmt && *fmt) {
         va_list ap;
@@ -68,13 +299,11 @@ void article_log_text(const char *fmt, ...) {
         va_end(ap);
     }
 
-    FILE *article_file = differentiate_get_article_stream();
-    if (!article_file || !fmt || !*fmt) return;
-    fprintf(article_file, "%s\n\n", prompt_buf);
-    fflush(article_file);
+    if (!fmt || !*fmt) return;
+    article_log_formula(session, prompt_buf, nullptr, "\n\n", nullptr, nullptr);
 }
 
-void article_log_with_latex(const FRONT_COMPIL_T *tree, const char *fmt, ...) {
+void article_log_with_latex(session_t *session, const FRONT_COMPIL_T *tree, const char *fmt, ...) {
     char prompt_buf[2048] = "";
     if (fmt && *fmt) {
         va_list ap;
@@ -83,102 +312,166 @@ void article_log_with_latex(const FRONT_COMPIL_T *tree, const char *fmt, ...) {
         va_end(ap);
     }
 
-    FILE *article_file = differentiate_get_article_stream();
-    if (!article_file || !tree || !tree->root) return;
-
-    FRONT_COMPIL_T *mutable_tree = (FRONT_COMPIL_T *) tree;
-    char *latex = latex_dump(mutable_tree);
-    if (!latex) return;
+    if (!tree || !tree->root) return;
 
-    if (fmt && *fmt) fprintf(article_file, "%s\n\n", prompt_buf);
-    if (latex_too_long(latex)) {
-        log_placeholder(article_file, "Формула опущена: слишком длинное выражение", strlen(latex));
-        FREE(latex);
-        fflush(article_file);
-        return;
-    }
-    fprintf(article_file, "\\begin{dmath*}\n%s\n\\end{dmath*}\n\n", latex);
-    FREE(latex);
-    fflush(article_file);
+    char before[sizeof(prompt_buf) + 32] = "";
+    snprintf(before, sizeof(before), "%s%s\\begin{dmath*}\n", prompt_buf, (fmt && *fmt) ? "\n\n" : "");
+    article_log_formula(session, before, tree, nullptr, nullptr, "\n\\end{dmath*}\n\n");
 }
 
-void article_log_transition(const char *phrase, char *before_latex, char *after_latex) {
-    FILE *article_file = differentiate_get_article_stream();
-    if (!article_file) {
-        if (before_latex) FREE(before_latex);
-        if (after_latex) FREE(after_latex);
-        return;
+void article_log_transition(session_t *session, const char *phrase, char *before_latex, char *after_latex) {
+    char *text = nullptr;
+    size_t text_len = 0;
+    FILE *stream = open_memstream(&text, &text_len);
+    if (stream) {
+        if (phrase && *phrase) fprintf(stream, "%s\n\n", phrase);
+
+        if (before_latex && after_latex)
+            fprintf(stream, "\\begin{dmath*}\n%s \\Rightarrow %s\n\\end{dmath*}\n\n", before_latex, after_latex);
+        else if (after_latex)
+            fprintf(stream, "\\begin{dmath*}\n%s\n\\end{dmath*}\n\n", after_latex);
+        else if (before_latex)
+            fprintf(stream, "\\begin{dmath*}\n%s\n\\end{dmath*}\n\n", before_latex);
+        fclose(stream);
+        article_log_formula(session, text, nullptr, nullptr, nullptr, nullptr);
+        free(text);
     }
-    if (phrase && *phrase) fprintf(article_file, "%s\n\n", phrase);
-
-    if (before_latex && after_latex)
-        fprintf(article_file, "\\begin{dmath*}\n%s \\Rightarrow %s\n\\end{dmath*}\n\n", before_latex, after_latex);
-    else if (after_latex)
-        fprintf(article_file, "\\begin{dmath*}\n%s\n\\end{dmath*}\n\n", after_latex);
-    else if (before_latex)
-        fprintf(article_file, "\\begin{dmath*}\n%s\n\\end{dmath*}\n\n", before_latex);
 
     if (before_latex) FREE(before_latex);
     if (after_latex) FREE(after_latex);
-    fflush(article_file);
 }
 
-const char *article_phrase(const NODE_T *node) {
-    if (!node || node->type != OP_T) return nullptr;
-    return get_random_str_to_dif_op(node->value.opr);
-}
-
-void article_log_step(const NODE_T *node, NODE_T *result) {
-    if (!node || !result) return;
+// ================= Step trace =================
 
-    FILE *article_file = differentiate_get_article_stream();
-    const FRONT_COMPIL_T *current_tree = differentiate_get_article_tree();
-    if (!article_file || !current_tree) return;
+void article_trace_begin(session_t *session, const FRONT_COMPIL_T *src) {
+    if (!session) return;
+    differentiate_set_article_tree(session, src);
+    session->article.trace.count   = 0;
+    session->article.trace.skipped = 0;
+    session->article.tracing = src && differentiate_get_article_stream(session);
+}
 
-    FRONT_COMPIL_T source_eq = {};
-    source_eq.root = (NODE_T *) node;
-    source_eq.vars = current_tree->vars;
+void article_trace_step(session_t *session, const NODE_T *node, const NODE_T *result) {
+    if (!session || !session->article.tracing || !node || !result) return;
 
-    FRONT_COMPIL_T result_eq = {};
-    result_eq.root = result;
-    result_eq.vars = current_tree->vars;
+    article_trace_t *trace = &session->article.trace;
+    if (session->step_limit && session->step_counter >= session->step_limit) {
+        session->step_counter++;
+        trace->skipped++;
+        return;
+    }
+    session->step_counter++;
+
+    if (trace->count == trace->capacity) {
+        size_t new_capacity = trace->capacity ? trace->capacity * 2 : 256;
+        article_step_t *steps = (article_step_t *) realloc(trace->steps, new_capacity * sizeof(article_step_t));
+        if (!steps) {
+            trace->skipped++;
+            return;
+        }
+        trace->steps    = steps;
+        trace->capacity = new_capacity;
+    }
+    trace->steps[trace->count++] = {
+        .node   = node,
+        .result = result,
+        .rule   = node->type == OP_T ? (uint8_t) node->value.opr : ARTICLE_RULE_LEAF,
+    };
+}
 
-    char *source_latex = latex_dump(&source_eq);
-    char *result_latex = latex_dump(&result_eq);
+typedef struct {
+    const NODE_T **keys;
+    NODE_T       **values;
+    size_t         capacity;
+} node_map_t;
+
+function size_t node_map_slot(const node_map_t *map, const NODE_T *key) {
+    size_t mask = map->capacity - 1;
+    size_t slot = ((uintptr_t) key >> 4) * 0x9E3779B97F4A7C15ull & mask;
+    while (map->keys[slot] && map->keys[slot] != key)
+        slot = (slot + 1) & mask;
+    return slot;
+}
 
-    if (g_step_limit && g_step_counter >= g_step_limit) {
-        if (g_step_counter == g_step_limit) {
-            log_placeholder(article_file, "Оставшиеся шаги дифференцирования опущены", 0);
-        }
-        if (source_latex) FREE(source_latex);
-        if (result_latex) FREE(result_latex);
-        g_step_counter++;
-        return;
+// copy_subtree that remembers where every source node went, so trace records can be moved onto the copy
+function NODE_T *copy_mapped(const NODE_T *node, node_map_t *map) {
+    NODE_T *left = node->left ? copy_mapped(node->left, map) : nullptr;
+    if (node->left && !left) return nullptr;
+    NODE_T *right = node->right ? copy_mapped(node->right, map) : nullptr;
+    if (node->right && !right) {
+        destruct(left);
+        return nullptr;
+    }
+    NODE_T *copy = new_node(node->type, node->value, left, right);
+    if (!copy) {
+        destruct(left);
+        destruct(right);
+        return nullptr;
     }
+    size_t slot = node_map_slot(map, node);
+    map->keys  [slot] = node;
+    map->values[slot] = copy;
+    return copy;
+}
 
-    size_t src_len = source_latex ? strlen(source_latex) : 0;
-    size_t res_len = result_latex ? strlen(result_latex) : 0;
-    if (latex_too_long(source_latex) || latex_too_long(result_latex)) {
-        log_placeholder(article_file, "Шаг пропущен: громоздкое выражение", src_len + res_len);
-        if (source_latex) FREE(source_latex);
-        if (result_latex) FREE(result_latex);
-        g_step_counter++;
-        return;
+// The job takes the raw result (step results point into it) and a mapped copy of the source tree;
+// the caller gets a fresh copy of the result to simplify in parallel with rendering.
+function NODE_T *hand_off_trace(session_t *session, FILE *file, NODE_T *root) {
+    const FRONT_COMPIL_T *src = session->article.tree;
+    article_trace_t *trace = &session->article.trace;
+
+    size_t nodes = src->root->elements + 1;
+    node_map_t map = {};
+    map.capacity = 16;
+    while (map.capacity < nodes * 2) map.capacity <<= 1;
+    map.keys   = TYPED_CALLOC(map.capacity, const NODE_T *);
+    map.values = TYPED_CALLOC(map.capacity, NODE_T *);
+
+    article_job_t *job = TYPED_CALLOC(1, article_job_t);
+    NODE_T *result_copy = nullptr;
+    if (map.keys && map.values && job) {
+        job->lhs.root = copy_mapped(src->root, &map);
+        if (job->lhs.root)
+            result_copy = copy_subtree(root);
+    }
+    if (!result_copy) {
+        if (job) free_job(job);
+        FREE(map.keys);
+        FREE(map.values);
+        return nullptr;
     }
 
-    const char *phrase = article_phrase(node);
-    if (phrase && phrase[0] != '\0')
-        fprintf(article_file, "%s\n\n", phrase);
+    for (size_t i = 0; i < trace->count; ++i)
+        trace->steps[i].node = map.values[node_map_slot(&map, trace->steps[i].node)];
+    FREE(map.keys);
+    FREE(map.values);
+
+    job->type     = ARTICLE_JOB_TRACE;
+    job->file     = file;
+    job->lhs.vars = varlist::retain(src->vars);
+    job->rhs.root = root;
+    job->trace    = *trace;
+    *trace = {};
+    enqueue_job(session, job);
+    return result_copy;
+}
 
-    if (source_latex && result_latex)
-        fprintf(article_file, "\\begin{dmath*}\n(%s)' = %s\n\\end{dmath*}\n\n", source_latex, result_latex);
-    else if (source_latex)
-        fprintf(article_file, "\\begin{dmath*}\n(%s)' = ?\n\\end{dmath*}\n\n", source_latex);
+NODE_T *article_trace_render(session_t *session, NODE_T *root) {
+    if (!session || !session->article.tracing) return root;
+    session->article.tracing = false;
 
-    if (source_latex) FREE(source_latex);
-    if (result_latex) FREE(result_latex);
+    // A failed differentiation has already freed the step results
+    FILE *article_file = differentiate_get_article_stream(session);
+    const FRONT_COMPIL_T *current_tree = differentiate_get_article_tree(session);
+    if (!root || !article_file || !current_tree) return root;
 
-    g_step_counter++;
+    if (session->article.async) {
+        NODE_T *result_copy = hand_off_trace(session, article_file, root);
+        if (result_copy) return result_copy;
+        article_flush(session);
+    }
 
+    render_trace(session, article_file, current_tree, &session->article.trace, &session->article.cache);
     fflush(article_file);
-}
\ No newline at end of file
+    return root;
+}
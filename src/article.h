@@ -1,23 +1,75 @@
 #ifndef ARTICLE_H
 #define ARTICLE_H
 
+#include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
+
 #include "differentiator.h"
+#include "latex.h"
+
+typedef struct session_t session_t;
+
+typedef struct {
+    const NODE_T *node;     // Узел исходного дерева
+    const NODE_T *result;   // Его производная, поддерево корня результата
+    uint8_t       rule;     // OPERATOR узла или ARTICLE_RULE_LEAF
+} article_step_t;
+
+typedef struct {
+    article_step_t *steps;
+    size_t          count;
+    size_t          capacity;
+    size_t          skipped;   // Шаги сверх лимита: только считаются
+} article_trace_t;
+
+typedef struct article_job_t article_job_t;
+
+// Состояние статьи одной сессии; заполняется функциями ниже, напрямую не трогать
+typedef struct {
+    FILE                 *file;
+    const FRONT_COMPIL_T *tree;
+    latex_cache_t         cache;     // Фрагменты узлов tree и результатов шагов; чистится при смене tree
+    article_trace_t       trace;
+    bool                  tracing;
+
+    bool                  async;
+    pthread_t             worker;
+    pthread_mutex_t       lock;
+    pthread_cond_t        job_ready;
+    pthread_cond_t        idle;
+    article_job_t        *head;
+    article_job_t        *tail;
+    bool                  busy;
+    bool                  stop;
+} ArticleContext;
+
+// Все функции ниже принимают session == NULL и тогда ничего не делают
 
 bool latex_too_long(const char *latex);
 void log_placeholder(FILE *article_file, const char *message, size_t len);
-void differentiate_set_article_file(FILE *file);
-void differentiate_set_article_tree(const FRONT_COMPIL_T *tree);
-FILE *differentiate_get_article_stream(void);
-const FRONT_COMPIL_T *differentiate_get_article_tree(void);
-void article_log_text(const char *fmt, ...);
-void article_log_with_latex(const FRONT_COMPIL_T *tree, const char *fmt, ...);
-void article_log_transition(const char *phrase, char *before_latex, char *after_latex);
-const char *article_phrase(const NODE_T *node);
-void article_log_step(const NODE_T *node, NODE_T *result);
-
-extern size_t g_step_counter;
-extern size_t g_step_limit;
-extern size_t g_requested_step_limit;
-
-#endif
\ No newline at end of file
+void differentiate_set_article_file(session_t *session, FILE *file);
+void differentiate_set_article_tree(session_t *session, const FRONT_COMPIL_T *tree);
+void article_release_cache(session_t *session);
+FILE *differentiate_get_article_stream(session_t *session);
+const FRONT_COMPIL_T *differentiate_get_article_tree(session_t *session);
+void article_log_text(session_t *session, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+void article_log_with_latex(session_t *session, const FRONT_COMPIL_T *tree, const char *fmt, ...) __attribute__((format (printf, 3, 4)));
+void article_log_transition(session_t *session, const char *phrase, char *before_latex, char *after_latex);
+void article_log_formula(session_t *session, const char *before, const FRONT_COMPIL_T *lhs,
+                         const char *mid, const FRONT_COMPIL_T *rhs, const char *after);
+
+// Трасса шагов: differentiate_node только дописывает записи (узел, результат, правило),
+// статья по ним рендерится уже после обхода
+void article_trace_begin(session_t *session, const FRONT_COMPIL_T *src);
+void article_trace_step(session_t *session, const NODE_T *node, const NODE_T *result);
+// Рендерит трассу и возвращает корень для дальнейшей работы. В асинхронном режиме сам root
+// уходит фоновому потоку вместе с трассой, а вызывающий получает его копию.
+NODE_T *article_trace_render(session_t *session, NODE_T *root);
+
+// Фоновый рендер статьи: весь текст идет через одну очередь в порядке вызовов
+bool article_set_async(session_t *session, bool enabled);
+// Дожидается записи всего поставленного в очередь
+void article_flush(session_t *session);
+
+#endif
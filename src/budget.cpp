@@ -0,0 +1,101 @@
+#include <time.h>
+
+#include "budget.h"
+#include "util.h"
+#include "base.h"
+
+// The clock and the cancel flag are read once per this many polls / charged nodes
+const size_t BUDGET_CHECK_PERIOD = 256;
+
+// new_node and copy_subtree have no context argument, so the active budget is per thread
+global thread_local budget_t *current_budget = nullptr;
+
+void cancel_token_cancel(cancel_token_t *token) {
+    if (token) __atomic_store_n(&token->cancelled, 1, __ATOMIC_RELEASE);
+}
+
+void cancel_token_reset(cancel_token_t *token) {
+    if (token) __atomic_store_n(&token->cancelled, 0, __ATOMIC_RELEASE);
+}
+
+bool cancel_token_cancelled(const cancel_token_t *token) {
+    return token && __atomic_load_n(&token->cancelled, __ATOMIC_ACQUIRE);
+}
+
+void budget_init(budget_t *budget, size_t max_nodes, size_t max_bytes, double timeout, cancel_token_t *cancel) {
+    *budget = {};
+    budget->max_nodes = max_nodes;
+    budget->max_bytes = max_bytes;
+    budget->cancel    = cancel;
+    if (timeout > 0) budget->deadline_ns = monotonic_ns() + (uint64_t) (timeout * 1e9);
+}
+
+function bool check_slow(budget_t *budget) {
+    if (cancel_token_cancelled(budget->cancel)) budget->status = BUDGET_CANCELLED;
+    else if (budget->deadline_ns && monotonic_ns() >= budget->deadline_ns) budget->status = BUDGET_DEADLINE;
+    return budget->status == BUDGET_OK;
+}
+
+void budget_begin(budget_t *budget) {
+    budget->prev = current_budget;
+    current_budget = budget;
+    // Polls look at the token and the clock only every BUDGET_CHECK_PERIOD, so an operation
+    // shorter than that would otherwise run to the end on an already cancelled or expired budget
+    if (budget->status == BUDGET_OK) check_slow(budget);
+}
+
+void budget_end(budget_t *budget) {
+    if (current_budget == budget) current_budget = budget->prev;
+    budget->prev = nullptr;
+}
+
+function bool tick(budget_t *budget) {
+    if (budget->status != BUDGET_OK) return false;
+    if (++budget->polls % BUDGET_CHECK_PERIOD) return true;
+    return check_slow(budget);
+}
+
+bool budget_poll(void) {
+    budget_t *budget = current_budget;
+    return !budget || tick(budget);
+}
+
+bool budget_charge_node(size_t bytes) {
+    budget_t *budget = current_budget;
+    if (!budget) return true;
+    if (!tick(budget)) return false;
+    if (budget->max_nodes && budget->nodes >= budget->max_nodes) {
+        budget->status = BUDGET_NODES;
+        return false;
+    }
+    if (budget->max_bytes && budget->bytes + bytes > budget->max_bytes) {
+        budget->status = BUDGET_BYTES;
+        return false;
+    }
+    budget->nodes++;
+    budget->bytes += bytes;
+    if (budget->bytes > budget->peak_bytes) budget->peak_bytes = budget->bytes;
+    return true;
+}
+
+void budget_release_node(size_t bytes) {
+    budget_t *budget = current_budget;
+    if (!budget) return;
+    // Nodes allocated before budget_begin are freed under it too
+    budget->bytes = budget->bytes > bytes ? budget->bytes - bytes : 0;
+}
+
+BUDGET_STATUS budget_current_status(void) {
+    return current_budget ? current_budget->status : BUDGET_OK;
+}
+
+const char *budget_status_str(BUDGET_STATUS status) {
+    switch (status) {
+        case BUDGET_OK:        return "ok";
+        case BUDGET_NODES:     return "node limit exceeded";
+        case BUDGET_BYTES:     return "memory limit exceeded";
+        case BUDGET_DEADLINE:  return "deadline exceeded";
+        case BUDGET_CANCELLED: return "cancelled";
+        default:               return "unknown";
+    }
+}
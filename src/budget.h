@@ -0,0 +1,80 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Флаг отмены, который можно взвести из любого потока.
+ */
+typedef struct {
+    int cancelled;
+} cancel_token_t;
+
+void cancel_token_cancel(cancel_token_t *token);
+void cancel_token_reset (cancel_token_t *token);
+bool cancel_token_cancelled(const cancel_token_t *token);
+
+typedef enum {
+    BUDGET_OK = 0,
+    BUDGET_NODES,       // Создано больше max_nodes узлов
+    BUDGET_BYTES,       // Живые узлы заняли больше max_bytes
+    BUDGET_DEADLINE,
+    BUDGET_CANCELLED,
+} BUDGET_STATUS;
+
+/**
+ * @brief Ограничения одной операции (дифференцирование, упрощение, Тейлор).
+ *
+ * Бюджет ставится текущим для потока парой budget_begin / budget_end.
+ * Пока он текущий, new_node считает созданные и живые узлы, а
+ * differentiate_node, copy_subtree и simplify_tree проверяют отмену и дедлайн.
+ * Первое превышение запоминается в status: дальше любое создание узла
+ * отказывает, недостроенные поддеревья освобождаются по обычным путям ошибок,
+ * и операция возвращает nullptr вместо частичного дерева.
+ *
+ * Нулевой лимит - без ограничения. Бюджеты вложенные: budget_end возвращает
+ * предыдущий текущий.
+ */
+typedef struct budget_t {
+    size_t          max_nodes;
+    size_t          max_bytes;
+    uint64_t        deadline_ns;    // CLOCK_MONOTONIC, 0 - без дедлайна
+    cancel_token_t *cancel;
+
+    size_t          nodes;          // Создано за операцию
+    size_t          bytes;          // Живые узлы, созданные за операцию
+    size_t          peak_bytes;
+    size_t          polls;
+    BUDGET_STATUS   status;
+
+    struct budget_t *prev;
+} budget_t;
+
+/**
+ * @param timeout Секунды от момента вызова, 0 - без дедлайна.
+ * @param cancel  Может быть nullptr.
+ */
+void budget_init(budget_t *budget, size_t max_nodes, size_t max_bytes, double timeout, cancel_token_t *cancel);
+
+// Сразу проверяет отмену и дедлайн: уже отмененный бюджет останавливает операцию на первом узле
+void budget_begin(budget_t *budget);
+void budget_end  (budget_t *budget);
+
+/**
+ * @brief Проверка отмены и дедлайна для текущего бюджета потока.
+ *
+ * @return false, если операцию пора прекращать.
+ */
+bool budget_poll(void);
+
+// Учет узлов из new_node / destruct; без текущего бюджета ничего не делают
+bool budget_charge_node(size_t bytes);
+void budget_release_node(size_t bytes);
+
+// Статус текущего бюджета потока (BUDGET_OK, если его нет)
+BUDGET_STATUS budget_current_status(void);
+
+const char *budget_status_str(BUDGET_STATUS status);
+
+#endif // BUDGET_H
@@ -0,0 +1,270 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capi.h"
+#include "differentiator.h"
+#include "compile.h"
+#include "budget.h"
+#include "intern.h"
+#include "base.h"
+
+// diff_expr is FRONT_COMPIL_T behind an opaque name; programs need their own box
+struct diff_program {
+    compile::Program program;
+};
+
+// Every live diff_expr holds the intern arena; once the last one is freed an arena past this is reset
+const size_t CAPI_NAMES_LIMIT = 1 << 20;
+
+struct diff_cancel_token {
+    cancel_token_t token;
+};
+
+function FRONT_COMPIL_T *as_tree(diff_expr *expr) {
+    return (FRONT_COMPIL_T *) expr;
+}
+
+function const FRONT_COMPIL_T *as_tree(const diff_expr *expr) {
+    return (const FRONT_COMPIL_T *) expr;
+}
+
+function diff_expr *as_expr(FRONT_COMPIL_T *tree) {
+    return (diff_expr *) tree;
+}
+
+function diff_status find_var(const FRONT_COMPIL_T *tree, const char *var, size_t *idx) {
+    if (!var || !*var) return DIFF_ERR_ARGUMENT;
+    mystr::mystr_t name = mystr::construct(var);
+    *idx = varlist::find_index(tree->vars, &name);
+    return *idx == varlist::NPOS ? DIFF_ERR_UNKNOWN_VARIABLE : DIFF_OK;
+}
+
+// With no limits the budget is never made current, so the call costs nothing extra
+function void limits_begin(budget_t *budget, const diff_limits *limits) {
+    if (!limits) return;
+    budget_init(budget, limits->max_nodes, limits->max_bytes, limits->timeout,
+                limits->cancel ? &limits->cancel->token : nullptr);
+    budget_begin(budget);
+}
+
+function diff_status limits_end(budget_t *budget, const diff_limits *limits, diff_status status) {
+    if (!limits) return status;
+    budget_end(budget);
+    switch (budget->status) {
+        case BUDGET_NODES:
+        case BUDGET_BYTES:     return DIFF_ERR_LIMIT;
+        case BUDGET_DEADLINE:  return DIFF_ERR_TIMEOUT;
+        case BUDGET_CANCELLED: return DIFF_ERR_CANCELLED;
+        case BUDGET_OK:
+        default:               return status;
+    }
+}
+
+int diff_api_version(void) {
+    return DIFF_API_VERSION;
+}
+
+const char *diff_status_str(diff_status status) {
+    switch (status) {
+        case DIFF_OK:                   return "ok";
+        case DIFF_ERR_ARGUMENT:         return "invalid argument";
+        case DIFF_ERR_PARSE:            return "parse error";
+        case DIFF_ERR_NO_MEMORY:        return "out of memory";
+        case DIFF_ERR_UNKNOWN_VARIABLE: return "unknown variable";
+        case DIFF_ERR_FAILED:           return "operation failed";
+        case DIFF_ERR_LIMIT:            return "resource limit exceeded";
+        case DIFF_ERR_TIMEOUT:          return "timeout";
+        case DIFF_ERR_CANCELLED:        return "cancelled";
+        default:                        return "unknown status";
+    }
+}
+
+diff_status diff_parse(const char *text, size_t len, diff_expr **out) {
+    if (!text || !out) return DIFF_ERR_ARGUMENT;
+    *out = nullptr;
+    intern::acquire();
+    FRONT_COMPIL_T *tree = load_tree_from_string(text, len, "expression");
+    if (!tree) {
+        intern::release(CAPI_NAMES_LIMIT);
+        return DIFF_ERR_PARSE;
+    }
+    *out = as_expr(tree);
+    return DIFF_OK;
+}
+
+void diff_free(diff_expr *expr) {
+    if (!expr) return;
+    destruct(as_tree(expr));
+    intern::release(CAPI_NAMES_LIMIT);
+}
+
+diff_status diff_copy(const diff_expr *expr, diff_expr **out) {
+    if (!expr || !out) return DIFF_ERR_ARGUMENT;
+    *out = nullptr;
+    FRONT_COMPIL_T *copy = copy_tree(as_tree(expr));
+    if (!copy) return DIFF_ERR_NO_MEMORY;
+    intern::acquire();
+    *out = as_expr(copy);
+    return DIFF_OK;
+}
+
+diff_status diff_simplify(diff_expr *expr) {
+    return diff_simplify_limited(expr, nullptr);
+}
+
+// A stopped simplification leaves a valid, partially simplified tree
+diff_status diff_simplify_limited(diff_expr *expr, const diff_limits *limits) {
+    if (!expr) return DIFF_ERR_ARGUMENT;
+    budget_t budget = {};
+    limits_begin(&budget, limits);
+    simplify_tree(nullptr, as_tree(expr));
+    return limits_end(&budget, limits, DIFF_OK);
+}
+
+diff_status diff_differentiate(const diff_expr *expr, const char *var, size_t order, diff_expr **out) {
+    return diff_differentiate_limited(expr, var, order, nullptr, out);
+}
+
+function diff_status differentiate_n(const FRONT_COMPIL_T *src, size_t idx, size_t order, diff_expr **out) {
+    FRONT_COMPIL_T **array = differentiate_to_n(nullptr, src, order, idx);
+    if (!array) return DIFF_ERR_FAILED;
+    // Keep the last order, drop the intermediate ones
+    *out = as_expr(array[order]);
+    array[order] = nullptr;
+    destruct(array);
+    FREE(array);
+    intern::acquire();
+    return DIFF_OK;
+}
+
+diff_status diff_differentiate_limited(const diff_expr *expr, const char *var, size_t order,
+                                       const diff_limits *limits, diff_expr **out) {
+    if (!expr || !out || !order) return DIFF_ERR_ARGUMENT;
+    *out = nullptr;
+    const FRONT_COMPIL_T *src = as_tree(expr);
+    size_t idx = 0;
+    diff_status status = find_var(src, var, &idx);
+    if (status != DIFF_OK) return status;
+
+    budget_t budget = {};
+    limits_begin(&budget, limits);
+    status = differentiate_n(src, idx, order, out);
+    return limits_end(&budget, limits, status);
+}
+
+diff_status diff_taylor(const diff_expr *expr, const char *var, double point, size_t order, diff_expr **out) {
+    return diff_taylor_limited(expr, var, point, order, nullptr, out);
+}
+
+function diff_status taylor_n(const FRONT_COMPIL_T *src, size_t idx, double point, size_t order, diff_expr **out) {
+    FRONT_COMPIL_T **array = differentiate_to_n(nullptr, src, order, idx);
+    if (!array) return DIFF_ERR_FAILED;
+    FRONT_COMPIL_T *taylor = tailor_formula(nullptr, array, order, point, idx);
+    destruct(array);
+    FREE(array);
+    if (!taylor) return DIFF_ERR_FAILED;
+    intern::acquire();
+    *out = as_expr(taylor);
+    return DIFF_OK;
+}
+
+diff_status diff_taylor_limited(const diff_expr *expr, const char *var, double point, size_t order,
+                                const diff_limits *limits, diff_expr **out) {
+    if (!expr || !out) return DIFF_ERR_ARGUMENT;
+    *out = nullptr;
+    const FRONT_COMPIL_T *src = as_tree(expr);
+    size_t idx = 0;
+    diff_status status = find_var(src, var, &idx);
+    if (status != DIFF_OK) return status;
+
+    budget_t budget = {};
+    limits_begin(&budget, limits);
+    status = taylor_n(src, idx, point, order, out);
+    return limits_end(&budget, limits, status);
+}
+
+diff_cancel_token *diff_cancel_token_new(void) {
+    return TYPED_CALLOC(1, diff_cancel_token);
+}
+
+void diff_cancel(diff_cancel_token *token) {
+    if (token) cancel_token_cancel(&token->token);
+}
+
+void diff_cancel_token_reset(diff_cancel_token *token) {
+    if (token) cancel_token_reset(&token->token);
+}
+
+void diff_cancel_token_free(diff_cancel_token *token) {
+    free(token);
+}
+
+size_t diff_var_count(const diff_expr *expr) {
+    return expr && as_tree(expr)->vars ? varlist::size(as_tree(expr)->vars) : 0;
+}
+
+const char *diff_var_name(const diff_expr *expr, size_t index) {
+    if (index >= diff_var_count(expr)) return nullptr;
+    const mystr::mystr_t *name = varlist::get(as_tree(expr)->vars, index);
+    return name ? name->str : nullptr;
+}
+
+diff_status diff_eval(const diff_expr *expr, const double *values, size_t count, double *result) {
+    if (!expr || !result) return DIFF_ERR_ARGUMENT;
+    size_t vars_count = diff_var_count(expr);
+    if (count < vars_count || (vars_count && !values)) return DIFF_ERR_ARGUMENT;
+    EQ_POINT_T point = {.tree = as_tree(expr), .point = (double *) values, .vars_count = vars_count, .result = 0};
+    calc_in_point(&point);
+    *result = point.result;
+    return DIFF_OK;
+}
+
+diff_status diff_to_string(const diff_expr *expr, char **out) {
+    if (!expr || !out) return DIFF_ERR_ARGUMENT;
+    *out = nullptr;
+    char *buf = nullptr;
+    size_t len = 0;
+    FILE *stream = open_memstream(&buf, &len);
+    if (!stream) return DIFF_ERR_NO_MEMORY;
+    print_infix(stream, as_tree(expr));
+    if (fclose(stream) != 0 || !buf) {
+        free(buf);
+        return DIFF_ERR_NO_MEMORY;
+    }
+    *out = buf;
+    return DIFF_OK;
+}
+
+void diff_string_free(char *str) {
+    free(str);
+}
+
+diff_status diff_compile(const diff_expr *expr, diff_program **out) {
+    if (!expr || !out) return DIFF_ERR_ARGUMENT;
+    *out = nullptr;
+    diff_program *program = TYPED_CALLOC(1, diff_program);
+    if (!program) return DIFF_ERR_NO_MEMORY;
+    if (!compile::build(&program->program, as_tree(expr))) {
+        free(program);
+        return DIFF_ERR_FAILED;
+    }
+    *out = program;
+    return DIFF_OK;
+}
+
+size_t diff_program_var_count(const diff_program *program) {
+    return program ? program->program.vars_count : 0;
+}
+
+diff_status diff_program_eval(const diff_program *program, const double *points, size_t n, double *out) {
+    if (!program || !out || (n && program->program.vars_count && !points)) return DIFF_ERR_ARGUMENT;
+    if (!n) return DIFF_OK;
+    return compile::eval_many(&program->program, points, n, out) ? DIFF_OK : DIFF_ERR_NO_MEMORY;
+}
+
+void diff_program_free(diff_program *program) {
+    if (!program) return;
+    compile::destruct(&program->program);
+    free(program);
+}
@@ -0,0 +1,109 @@
+#ifndef DIFFERENTIATOR_CAPI_H
+#define DIFFERENTIATOR_CAPI_H
+
+/*
+ * Стабильный C-интерфейс libdifferentiator.
+ *
+ * Только вычисления: ни одна функция не пишет в файлы, stdout, stderr, лог или
+ * статью, ошибки сообщаются только кодом diff_status.
+ * Отчеты (LaTeX, HTML, Graphviz) остаются в C++-слое поверх session_t.
+ * Все объекты непрозрачны и освобождаются своими *_free. Разные объекты можно
+ * использовать из разных потоков, один объект - из одного потока за раз.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define DIFF_API __attribute__((visibility("default")))
+#else
+#define DIFF_API
+#endif
+
+#define DIFF_API_VERSION 2
+
+typedef struct diff_expr    diff_expr;
+typedef struct diff_program diff_program;
+typedef struct diff_cancel_token diff_cancel_token;
+
+typedef enum {
+    DIFF_OK = 0,
+    DIFF_ERR_ARGUMENT,          // nullptr, пустая строка, мало значений
+    DIFF_ERR_PARSE,
+    DIFF_ERR_NO_MEMORY,
+    DIFF_ERR_UNKNOWN_VARIABLE,
+    DIFF_ERR_FAILED,            // Не удалось продифференцировать или разложить
+    // С версии 2
+    DIFF_ERR_LIMIT,             // Превышен max_nodes или max_bytes
+    DIFF_ERR_TIMEOUT,
+    DIFF_ERR_CANCELLED,
+} diff_status;
+
+/*
+ * Ограничения одной операции (версия 2). Нулевое поле - без ограничения.
+ * max_nodes - сколько узлов операция может создать, max_bytes - сколько памяти
+ * под узлы может быть занято одновременно, timeout - секунды от начала вызова.
+ * При срабатывании все созданное освобождается, *out остается NULL.
+ */
+typedef struct {
+    size_t             max_nodes;
+    size_t             max_bytes;
+    double             timeout;
+    diff_cancel_token *cancel;
+} diff_limits;
+
+DIFF_API int diff_api_version(void);
+DIFF_API const char *diff_status_str(diff_status status);
+
+// Разбирает инфиксное выражение ("sin(x) * y ^ 2"), len - длина без терминатора
+DIFF_API diff_status diff_parse(const char *text, size_t len, diff_expr **out);
+DIFF_API void        diff_free(diff_expr *expr);
+DIFF_API diff_status diff_copy(const diff_expr *expr, diff_expr **out);
+
+DIFF_API diff_status diff_simplify(diff_expr *expr);
+
+// Производная порядка order >= 1 по переменной var (результат уже упрощен)
+DIFF_API diff_status diff_differentiate(const diff_expr *expr, const char *var, size_t order, diff_expr **out);
+
+// Многочлен Тейлора порядка order в точке var = point (остальные переменные равны 0)
+DIFF_API diff_status diff_taylor(const diff_expr *expr, const char *var, double point, size_t order, diff_expr **out);
+
+// *_limited - то же с ограничениями; limits == NULL - без них
+DIFF_API diff_status diff_simplify_limited(diff_expr *expr, const diff_limits *limits);
+DIFF_API diff_status diff_differentiate_limited(const diff_expr *expr, const char *var, size_t order,
+                                                const diff_limits *limits, diff_expr **out);
+DIFF_API diff_status diff_taylor_limited(const diff_expr *expr, const char *var, double point, size_t order,
+                                         const diff_limits *limits, diff_expr **out);
+
+// Токен отмены: diff_cancel можно вызвать из любого потока, пока идет операция
+DIFF_API diff_cancel_token *diff_cancel_token_new(void);
+DIFF_API void               diff_cancel(diff_cancel_token *token);
+DIFF_API void               diff_cancel_token_reset(diff_cancel_token *token);
+DIFF_API void               diff_cancel_token_free(diff_cancel_token *token);
+
+// Переменные в порядке появления; их индексы задают порядок значений в diff_eval
+DIFF_API size_t      diff_var_count(const diff_expr *expr);
+DIFF_API const char *diff_var_name(const diff_expr *expr, size_t index);
+
+// values - не меньше diff_var_count(expr) значений
+DIFF_API diff_status diff_eval(const diff_expr *expr, const double *values, size_t count, double *result);
+
+// Инфиксная запись, которую снова принимает diff_parse; освобождать diff_string_free
+DIFF_API diff_status diff_to_string(const diff_expr *expr, char **out);
+DIFF_API void        diff_string_free(char *str);
+
+// Линейная программа для многократного вычисления (те же значения, что diff_eval)
+DIFF_API diff_status diff_compile(const diff_expr *expr, diff_program **out);
+DIFF_API size_t      diff_program_var_count(const diff_program *program);
+// points - n точек по diff_program_var_count значений подряд, out - n результатов
+DIFF_API diff_status diff_program_eval(const diff_program *program, const double *points, size_t n, double *out);
+DIFF_API void        diff_program_free(diff_program *program);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DIFFERENTIATOR_CAPI_H
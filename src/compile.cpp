@@ -0,0 +1,419 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compile.h"
+#include "io_utils.h"
+#include "util.h"
+#include "base.h"
+
+namespace compile {
+
+typedef struct {
+    const NODE_T *node;
+    bool          expanded;
+} frame_t;
+
+function bool push_frame(frame_t **stack, size_t *top, size_t *capacity, frame_t frame) {
+    if (*top == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        frame_t *grown = (frame_t *) realloc(*stack, new_capacity * sizeof(frame_t));
+        if (!grown) return false;
+        *stack = grown;
+        *capacity = new_capacity;
+    }
+    (*stack)[(*top)++] = frame;
+    return true;
+}
+
+function bool emit(Program *prog, size_t *capacity, instr_t instr) {
+    if (prog->count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        instr_t *grown = (instr_t *) realloc(prog->code, new_capacity * sizeof(instr_t));
+        if (!grown) return false;
+        prog->code = grown;
+        *capacity = new_capacity;
+    }
+    prog->code[prog->count++] = instr;
+    return true;
+}
+
+// Same evaluation order as eval_node: left, then right (if present), then the operator
+function bool emit_node(Program *prog, size_t *capacity, size_t *depth, const NODE_T *node) {
+    instr_t instr = {};
+    switch (node->type) {
+        case NUM_T:
+            instr.code = PUSH_NUM;
+            instr.arg.num = node->value.num;
+            ++*depth;
+            break;
+        case VAR_T:
+            instr.code = PUSH_VAR;
+            instr.arg.var = node->value.var;
+            if (node->value.var >= prog->vars_count) prog->vars_count = node->value.var + 1;
+            ++*depth;
+            break;
+        case OP_T:
+            // A missing left operand was pushed as 0 by emit_missing_left before the right subtree
+            instr.opr = node->value.opr;
+            if (node->right) {
+                instr.code = APPLY_BINARY;
+                --*depth;
+            }
+            else {
+                instr.code = APPLY_UNARY;
+            }
+            break;
+        default:
+            // Compilation runs inside the C API, so a broken tree is reported by the return value only
+            return false;
+    }
+    if (*depth > prog->max_depth) prog->max_depth = *depth;
+    return emit(prog, capacity, instr);
+}
+
+// eval_node reads a missing left operand as 0, and it has to sit below the right one on the stack
+function bool emit_missing_left(Program *prog, size_t *capacity, size_t *depth) {
+    if (!emit(prog, capacity, {.code = PUSH_NUM, .opr = ADD, .arg = {.num = 0}})) return false;
+    if (++*depth > prog->max_depth) prog->max_depth = *depth;
+    return true;
+}
+
+bool build(Program *prog, const FRONT_COMPIL_T *eqtree) {
+    *prog = {};
+    if (!eqtree || !eqtree->root) return false;
+    if (eqtree->vars) prog->vars_count = varlist::size(eqtree->vars);
+
+    size_t code_capacity = 0, stack_capacity = 0, top = 0, depth = 0;
+    frame_t *stack = nullptr;
+    bool ok = push_frame(&stack, &top, &stack_capacity, {.node = eqtree->root, .expanded = false});
+    while (ok && top) {
+        frame_t *frame = &stack[top - 1];
+        const NODE_T *node = frame->node;
+        if (!frame->expanded && node->type == OP_T) {
+            frame->expanded = true;
+            if (!node->left) ok = emit_missing_left(prog, &code_capacity, &depth);
+            if (ok && node->right) ok = push_frame(&stack, &top, &stack_capacity, {.node = node->right, .expanded = false});
+            if (ok && node->left) ok = push_frame(&stack, &top, &stack_capacity, {.node = node->left, .expanded = false});
+            continue;
+        }
+        --top;
+        ok = emit_node(prog, &code_capacity, &depth, node);
+    }
+    free(stack);
+
+    if (!ok) {
+        destruct(prog);
+        return false;
+    }
+    return true;
+}
+
+void destruct(Program *prog) {
+    if (!prog) return;
+    FREE(prog->code);
+    *prog = {};
+}
+
+double eval(const Program *prog, const double *vals, double *stack) {
+    size_t top = 0;
+    const instr_t *code = prog->code;
+    for (size_t i = 0; i < prog->count; ++i) {
+        const instr_t *instr = &code[i];
+        switch (instr->code) {
+            case PUSH_NUM:
+                stack[top++] = instr->arg.num;
+                break;
+            case PUSH_VAR:
+                stack[top++] = vals[instr->arg.var];
+                break;
+            case APPLY_UNARY:
+                stack[top - 1] = apply_operator(instr->opr, stack[top - 1], 0);
+                break;
+            case APPLY_BINARY:
+                --top;
+                stack[top - 1] = apply_operator(instr->opr, stack[top - 1], stack[top]);
+                break;
+        }
+    }
+    return top ? stack[0] : 0;
+}
+
+bool eval_many(const Program *prog, const double *points, size_t n, double *out) {
+    if (!prog || !prog->code || (!points && prog->vars_count) || !out) return false;
+    double small_stack[64] = {};
+    double *stack = small_stack;
+    if (prog->max_depth > ARRAY_COUNT(small_stack)) {
+        stack = TYPED_CALLOC(prog->max_depth, double);
+        if (!stack) return false;
+    }
+    for (size_t i = 0; i < n; ++i)
+        out[i] = eval(prog, points ? points + i * prog->vars_count : nullptr, stack);
+    if (stack != small_stack) free(stack);
+    return true;
+}
+
+// ---- Multi-root program ----
+
+typedef struct {
+    MultiProgram *prog;
+    size_t        capacity;
+    size_t       *table;            // Open addressing: register + 1, 0 - empty slot
+    size_t        table_capacity;   // Power of two, at most half full
+} multi_builder_t;
+
+// Numbers are keyed by bit pattern (num_bits): 0 and -0 give different results under 1 / x
+function uint64_t instr_hash(const reg_instr_t *instr) {
+    uint64_t h = mix(((uint64_t) instr->code << 8) ^ (uint64_t) instr->opr);
+    switch (instr->code) {
+        case PUSH_NUM:     return mix(h ^ num_bits(instr->arg.num));
+        case PUSH_VAR:     return mix(h ^ instr->arg.var);
+        case APPLY_UNARY:  return mix(h ^ instr->left);
+        case APPLY_BINARY: return mix(mix(h ^ instr->left) ^ instr->right);
+    }
+    return h;
+}
+
+function bool instr_equal(const reg_instr_t *a, const reg_instr_t *b) {
+    if (a->code != b->code) return false;
+    switch (a->code) {
+        case PUSH_NUM:     return num_bits(a->arg.num) == num_bits(b->arg.num);
+        case PUSH_VAR:     return a->arg.var == b->arg.var;
+        case APPLY_UNARY:  return a->opr == b->opr && a->left == b->left;
+        case APPLY_BINARY: return a->opr == b->opr && a->left == b->left && a->right == b->right;
+    }
+    return false;
+}
+
+function bool grow_table(multi_builder_t *b) {
+    size_t capacity = b->table_capacity ? b->table_capacity * 2 : 256;
+    size_t *table = TYPED_CALLOC(capacity, size_t);
+    if (!table) return false;
+    for (size_t reg = 0; reg < b->prog->count; ++reg) {
+        size_t slot = (size_t) instr_hash(&b->prog->code[reg]) & (capacity - 1);
+        while (table[slot]) slot = (slot + 1) & (capacity - 1);
+        table[slot] = reg + 1;
+    }
+    free(b->table);
+    b->table = table;
+    b->table_capacity = capacity;
+    return true;
+}
+
+// Register holding instr: an existing one for an equal subexpression or a new one
+function bool intern_instr(multi_builder_t *b, const reg_instr_t *instr, size_t *reg) {
+    MultiProgram *prog = b->prog;
+    if ((prog->count + 1) * 2 > b->table_capacity && !grow_table(b)) return false;
+    size_t mask = b->table_capacity - 1;
+    size_t slot = (size_t) instr_hash(instr) & mask;
+    for (; b->table[slot]; slot = (slot + 1) & mask) {
+        if (instr_equal(&prog->code[b->table[slot] - 1], instr)) {
+            *reg = b->table[slot] - 1;
+            return true;
+        }
+    }
+    if (prog->count == b->capacity) {
+        size_t capacity = b->capacity ? b->capacity * 2 : 64;
+        reg_instr_t *grown = (reg_instr_t *) realloc(prog->code, capacity * sizeof(reg_instr_t));
+        if (!grown) return false;
+        prog->code = grown;
+        b->capacity = capacity;
+    }
+    *reg = prog->count;
+    prog->code[prog->count++] = *instr;
+    b->table[slot] = *reg + 1;
+    return true;
+}
+
+// Post-order walk like build; finished children leave their registers on regs_stack
+function bool add_root(multi_builder_t *b, const NODE_T *root, size_t *root_reg) {
+    size_t frames_top = 0, frames_capacity = 0, regs_top = 0, regs_capacity = 0;
+    frame_t *frames = nullptr;
+    size_t  *regs = nullptr;
+    bool ok = push_frame(&frames, &frames_top, &frames_capacity, {.node = root, .expanded = false});
+    while (ok && frames_top) {
+        frame_t *frame = &frames[frames_top - 1];
+        const NODE_T *node = frame->node;
+        if (!frame->expanded && node->type == OP_T) {
+            frame->expanded = true;
+            if (node->right) ok = push_frame(&frames, &frames_top, &frames_capacity, {.node = node->right, .expanded = false});
+            if (ok && node->left) ok = push_frame(&frames, &frames_top, &frames_capacity, {.node = node->left, .expanded = false});
+            continue;
+        }
+        --frames_top;
+        b->prog->nodes++;
+
+        reg_instr_t instr = {};
+        switch (node->type) {
+            case NUM_T:
+                instr.code = PUSH_NUM;
+                instr.arg.num = node->value.num;
+                break;
+            case VAR_T:
+                instr.code = PUSH_VAR;
+                instr.arg.var = node->value.var;
+                if (node->value.var >= b->prog->vars_count) b->prog->vars_count = node->value.var + 1;
+                break;
+            case OP_T:
+                instr.opr = node->value.opr;
+                instr.code = node->right ? APPLY_BINARY : APPLY_UNARY;
+                if (node->right) instr.right = regs[--regs_top];
+                if (node->left) {
+                    instr.left = regs[--regs_top];
+                }
+                else {
+                    // eval_node reads a missing operand as 0
+                    reg_instr_t zero = {.code = PUSH_NUM, .opr = ADD, .left = 0, .right = 0, .arg = {.num = 0}};
+                    ok = intern_instr(b, &zero, &instr.left);
+                }
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        size_t reg = 0;
+        ok = ok && intern_instr(b, &instr, &reg);
+        if (ok && regs_top == regs_capacity) {
+            size_t capacity = regs_capacity ? regs_capacity * 2 : 64;
+            size_t *grown = (size_t *) realloc(regs, capacity * sizeof(size_t));
+            ok = grown != nullptr;
+            if (ok) {
+                regs = grown;
+                regs_capacity = capacity;
+            }
+        }
+        if (ok) regs[regs_top++] = reg;
+    }
+    if (ok) *root_reg = regs[0];
+    free(frames);
+    free(regs);
+    return ok;
+}
+
+// Moves variable-free instructions to the front; relative order (and so dependencies) is kept
+function bool hoist_constants(MultiProgram *prog) {
+    size_t *remap = TYPED_CALLOC(prog->count ? prog->count : 1, size_t);
+    bool   *is_const = TYPED_CALLOC(prog->count ? prog->count : 1, bool);
+    reg_instr_t *code = TYPED_CALLOC(prog->count ? prog->count : 1, reg_instr_t);
+    bool ok = remap && is_const && code;
+    if (ok) {
+        for (size_t i = 0; i < prog->count; ++i) {
+            const reg_instr_t *instr = &prog->code[i];
+            switch (instr->code) {
+                case PUSH_NUM:     is_const[i] = true; break;
+                case PUSH_VAR:     is_const[i] = false; break;
+                case APPLY_UNARY:  is_const[i] = is_const[instr->left]; break;
+                case APPLY_BINARY: is_const[i] = is_const[instr->left] && is_const[instr->right]; break;
+            }
+            if (is_const[i]) remap[i] = prog->const_count++;
+        }
+        size_t next = prog->const_count;
+        for (size_t i = 0; i < prog->count; ++i)
+            if (!is_const[i]) remap[i] = next++;
+        for (size_t i = 0; i < prog->count; ++i) {
+            reg_instr_t instr = prog->code[i];
+            if (instr.code == APPLY_UNARY || instr.code == APPLY_BINARY) {
+                instr.left  = remap[instr.left];
+                instr.right = instr.code == APPLY_BINARY ? remap[instr.right] : 0;
+            }
+            code[remap[i]] = instr;
+        }
+        for (size_t r = 0; r < prog->roots_count; ++r)
+            if (prog->roots[r] != NPOS) prog->roots[r] = remap[prog->roots[r]];
+        free(prog->code);
+        prog->code = code;
+        code = nullptr;
+    }
+    free(remap);
+    free(is_const);
+    free(code);
+    return ok;
+}
+
+// Other lists are accepted when they name the same variables in the same order
+function bool same_vars(const varlist::VarList *a, const varlist::VarList *b) {
+    if (a == b) return true;
+    size_t n = varlist::size(a);
+    if (n != varlist::size(b)) return false;
+    for (size_t i = 0; i < n; ++i) {
+        const mystr::mystr_t *na = varlist::get(a, i), *nb = varlist::get(b, i);
+        if (!na || !nb || strcmp(na->str, nb->str) != 0) return false;
+    }
+    return true;
+}
+
+bool build_multi(MultiProgram *prog, const FRONT_COMPIL_T *const *trees, size_t count) {
+    *prog = {};
+    if (!trees || !count) return false;
+    const varlist::VarList *vars = nullptr;
+    for (size_t t = 0; t < count; ++t) {
+        if (!trees[t] || !trees[t]->root) continue;
+        if (!vars) vars = trees[t]->vars;
+        else if (!same_vars(vars, trees[t]->vars)) return false;
+    }
+    if (vars) prog->vars_count = varlist::size(vars);
+
+    prog->roots = TYPED_CALLOC(count, size_t);
+    if (!prog->roots) return false;
+    prog->roots_count = count;
+
+    multi_builder_t builder = {.prog = prog, .capacity = 0, .table = nullptr, .table_capacity = 0};
+    bool ok = true;
+    for (size_t t = 0; ok && t < count; ++t) {
+        prog->roots[t] = NPOS;
+        if (trees[t] && trees[t]->root) ok = add_root(&builder, trees[t]->root, &prog->roots[t]);
+    }
+    free(builder.table);
+    ok = ok && hoist_constants(prog);
+    if (!ok) {
+        destruct(prog);
+        return false;
+    }
+    return true;
+}
+
+void destruct(MultiProgram *prog) {
+    if (!prog) return;
+    FREE(prog->code);
+    FREE(prog->roots);
+    *prog = {};
+}
+
+function void run(const MultiProgram *prog, size_t from, size_t to, const double *vals, double *regs) {
+    const reg_instr_t *code = prog->code;
+    for (size_t i = from; i < to; ++i) {
+        const reg_instr_t *instr = &code[i];
+        switch (instr->code) {
+            case PUSH_NUM:     regs[i] = instr->arg.num; break;
+            case PUSH_VAR:     regs[i] = vals[instr->arg.var]; break;
+            case APPLY_UNARY:  regs[i] = apply_operator(instr->opr, regs[instr->left], 0); break;
+            case APPLY_BINARY: regs[i] = apply_operator(instr->opr, regs[instr->left], regs[instr->right]); break;
+        }
+    }
+}
+
+function void collect(const MultiProgram *prog, const double *regs, double *out) {
+    for (size_t r = 0; r < prog->roots_count; ++r)
+        out[r] = prog->roots[r] == NPOS ? NAN : regs[prog->roots[r]];
+}
+
+void eval_multi(const MultiProgram *prog, const double *vals, double *regs, double *out) {
+    run(prog, 0, prog->count, vals, regs);
+    collect(prog, regs, out);
+}
+
+bool eval_multi_many(const MultiProgram *prog, const double *points, size_t n, double *out) {
+    if (!prog || !prog->roots || (!points && prog->vars_count && n) || !out) return false;
+    double *regs = TYPED_CALLOC(prog->count ? prog->count : 1, double);
+    if (!regs) return false;
+    // Constants first: the per-point loop starts after them
+    run(prog, 0, prog->const_count, nullptr, regs);
+    for (size_t i = 0; i < n; ++i) {
+        run(prog, prog->const_count, prog->count, points ? points + i * prog->vars_count : nullptr, regs);
+        collect(prog, regs, out + i * prog->roots_count);
+    }
+    free(regs);
+    return true;
+}
+
+} // namespace compile
@@ -0,0 +1,124 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+
+namespace compile {
+
+typedef enum {
+    PUSH_NUM,
+    PUSH_VAR,
+    APPLY_UNARY,
+    APPLY_BINARY,
+} OPCODE;
+
+typedef struct {
+    OPCODE   code;
+    OPERATOR opr;
+    union {
+        double num;
+        size_t var;
+    } arg;
+} instr_t;
+
+/**
+ * @brief Дерево, развернутое в линейную программу стековой машины.
+ *
+ * Инструкции идут в post-order, так что вычисление - один проход по массиву
+ * без рекурсии и переходов по указателям. Результаты совпадают с calc_in_point
+ * бит в бит (одни и те же операции в том же порядке).
+ */
+typedef struct {
+    instr_t *code;
+    size_t   count;
+    size_t   max_depth;     // Сколько double нужно под стек
+    size_t   vars_count;    // Сколько значений ожидает eval
+} Program;
+
+/**
+ * @brief Компилирует дерево.
+ *
+ * @return false при нехватке памяти или битом дереве (программа остается пустой).
+ */
+bool build(Program *prog, const FRONT_COMPIL_T *eqtree);
+
+void destruct(Program *prog);
+
+// stack - не меньше prog->max_depth элементов, vals - prog->vars_count значений
+double eval(const Program *prog, const double *vals, double *stack);
+
+/**
+ * @brief Считает программу в n точках.
+ *
+ * @param points Точки подряд, по prog->vars_count значений в каждой.
+ * @param out    n результатов.
+ */
+bool eval_many(const Program *prog, const double *points, size_t n, double *out);
+
+// ---- Несколько деревьев с общими подвыражениями ----
+
+/**
+ * @brief Инструкция регистровой программы: результат кладется в регистр с ее номером.
+ *
+ * Для APPLY_* операнды - номера регистров (left, right); у унарных right не используется.
+ */
+typedef struct {
+    OPCODE   code;
+    OPERATOR opr;
+    size_t   left, right;
+    union {
+        double num;
+        size_t var;
+    } arg;
+} reg_instr_t;
+
+/**
+ * @brief Несколько деревьев, вычисляемых одним проходом.
+ *
+ * Каждое различное подвыражение всех корней (f, f', f'', Тейлор) считается
+ * один раз: структурно равные поддеревья разных деревьев получают один
+ * регистр. Подвыражения без переменных вынесены в начало (первые const_count
+ * инструкций) и в eval_multi_many считаются один раз на все точки.
+ * Результаты совпадают с calc_in_point каждого дерева бит в бит.
+ */
+typedef struct {
+    reg_instr_t *code;          // Инструкция i пишет регистр i
+    size_t       count;
+    size_t       const_count;
+    size_t      *roots;         // Регистр результата каждого дерева, NPOS - пустое дерево
+    size_t       roots_count;
+    size_t       vars_count;
+    size_t       nodes;         // Узлов во всех деревьях; count / nodes - доля, оставшаяся после CSE
+} MultiProgram;
+
+const size_t NPOS = (size_t) -1;
+
+/**
+ * @brief Компилирует count деревьев в одну программу.
+ *
+ * Деревья должны нумеровать переменные одинаково (общий VarList, как у
+ * производных и ряда Тейлора одного выражения). nullptr и пустые деревья
+ * допускаются: их результат - NAN.
+ *
+ * @return false при нехватке памяти, разных списках переменных или битом дереве.
+ */
+bool build_multi(MultiProgram *prog, const FRONT_COMPIL_T *const *trees, size_t count);
+
+void destruct(MultiProgram *prog);
+
+// regs - не меньше prog->count элементов, out - prog->roots_count результатов
+void eval_multi(const MultiProgram *prog, const double *vals, double *regs, double *out);
+
+/**
+ * @brief Считает все деревья в n точках.
+ *
+ * @param out n * prog->roots_count результатов, по строке на точку.
+ */
+bool eval_multi_many(const MultiProgram *prog, const double *points, size_t n, double *out);
+
+} // namespace compile
+
+#endif // COMPILE_H
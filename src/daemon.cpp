@@ -0,0 +1,616 @@
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "daemon.h"
+#include "budget.h"
+#include "compile.h"
+#include "structhash.h"
+#include "intern.h"
+#include "io_utils.h"
+#include "base.h"
+
+extern NODE_T *copy_subtree(const NODE_T *node);
+
+typedef enum {
+    FORM_DERIVATIVE,    // order 0 is the simplified expression itself
+    FORM_TAYLOR,
+} FORM_KIND;
+
+typedef struct form_t {
+    FORM_KIND         kind;
+    size_t            var;
+    size_t            order;
+    double            point;
+    FRONT_COMPIL_T   *tree;
+    compile::Program  program;
+    bool              compiled;
+    struct form_t    *next;
+} form_t;
+
+// The cache lock guards the table, the LRU list and refs; lock guards forms.
+// An evicted entry lives on until the last request using it drops its reference
+struct daemon_entry_t {
+    uint64_t         key;
+    FRONT_COMPIL_T  *source;        // as parsed, compared on lookup
+    form_t          *forms;
+    daemon_entry_t  *bucket_next;
+    daemon_entry_t  *newer, *older;
+    size_t           refs;          // the cache's own reference plus one per request
+    pthread_mutex_t  lock;
+};
+
+// Names from clients go to the process-wide intern arena; past this the cache is dropped so the arena can reset
+const size_t DAEMON_NAMES_LIMIT = 4 << 20;
+
+bool daemon_cache_init(daemon_cache_t *cache, size_t capacity) {
+    *cache = {};
+    cache->capacity = capacity ? capacity : 1;
+    cache->limits = (daemon_limits_t) {
+        .max_nodes = DAEMON_DEFAULT_MAX_NODES,
+        .max_bytes = DAEMON_DEFAULT_MAX_BYTES,
+        .timeout   = DAEMON_DEFAULT_TIMEOUT,
+        .max_order = DAEMON_DEFAULT_MAX_ORDER,
+    };
+    cache->buckets_count = 16;
+    while (cache->buckets_count < cache->capacity * 2) cache->buckets_count <<= 1;
+    cache->buckets = TYPED_CALLOC(cache->buckets_count, daemon_entry_t *);
+    if (!cache->buckets) return false;
+    pthread_mutex_init(&cache->lock, nullptr);
+    return true;
+}
+
+function void free_form(form_t *form) {
+    compile::destruct(&form->program);
+    destruct(form->tree);
+    free(form);
+}
+
+function void free_entry(daemon_entry_t *entry) {
+    for (form_t *form = entry->forms; form; ) {
+        form_t *next = form->next;
+        free_form(form);
+        form = next;
+    }
+    destruct(entry->source);
+    pthread_mutex_destroy(&entry->lock);
+    free(entry);
+    intern::release(DAEMON_NAMES_LIMIT);
+}
+
+void daemon_cache_destruct(daemon_cache_t *cache) {
+    if (!cache || !cache->buckets) return;
+    for (daemon_entry_t *entry = cache->newest; entry; ) {
+        daemon_entry_t *older = entry->older;
+        free_entry(entry);
+        entry = older;
+    }
+    FREE(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+    *cache = {};
+}
+
+// ---------------- LRU ----------------
+
+function void lru_unlink(daemon_cache_t *cache, daemon_entry_t *entry) {
+    if (entry->newer) entry->newer->older = entry->older;
+    else              cache->newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else              cache->oldest = entry->newer;
+    entry->newer = entry->older = nullptr;
+}
+
+function void lru_push_front(daemon_cache_t *cache, daemon_entry_t *entry) {
+    entry->older = cache->newest;
+    entry->newer = nullptr;
+    if (cache->newest) cache->newest->newer = entry;
+    cache->newest = entry;
+    if (!cache->oldest) cache->oldest = entry;
+}
+
+function void bucket_remove(daemon_cache_t *cache, daemon_entry_t *entry) {
+    daemon_entry_t **link = &cache->buckets[entry->key & (cache->buckets_count - 1)];
+    while (*link && *link != entry) link = &(*link)->bucket_next;
+    if (*link) *link = entry->bucket_next;
+}
+
+// Called with the cache lock held; the entry is freed here only if no request holds it
+function void evict_oldest(daemon_cache_t *cache) {
+    daemon_entry_t *victim = cache->oldest;
+    if (!victim) return;
+    lru_unlink(cache, victim);
+    bucket_remove(cache, victim);
+    cache->count--;
+    cache->evictions++;
+    if (!--victim->refs) free_entry(victim);
+}
+
+function void put_entry(daemon_cache_t *cache, daemon_entry_t *entry) {
+    pthread_mutex_lock(&cache->lock);
+    bool last = !--entry->refs;
+    pthread_mutex_unlock(&cache->lock);
+    if (last) free_entry(entry);
+}
+
+function bool same_vars(const FRONT_COMPIL_T *a, const FRONT_COMPIL_T *b) {
+    size_t count = varlist::size(a->vars);
+    if (count != varlist::size(b->vars)) return false;
+    for (size_t i = 0; i < count; ++i)
+        if (!varlist::get(a->vars, i)->is_same(varlist::get(b->vars, i))) return false;
+    return true;
+}
+
+// Called with the cache lock held; a found entry gets a reference for the caller
+function daemon_entry_t *find_entry(daemon_cache_t *cache, uint64_t key, const FRONT_COMPIL_T *parsed) {
+    for (daemon_entry_t *entry = cache->buckets[key & (cache->buckets_count - 1)]; entry; entry = entry->bucket_next) {
+        if (entry->key != key || !same_vars(entry->source, parsed) || !structhash::equal(entry->source->root, parsed->root))
+            continue;
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+        entry->refs++;
+        return entry;
+    }
+    return nullptr;
+}
+
+// Simplifies outside the cache lock under the request's budget; nullptr if it ran out
+function daemon_entry_t *new_entry(FRONT_COMPIL_T *parsed, uint64_t key) {
+    daemon_entry_t *entry = TYPED_CALLOC(1, daemon_entry_t);
+    form_t *base = TYPED_CALLOC(1, form_t);
+    FRONT_COMPIL_T *simplified = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    if (!entry || !base || !simplified) {
+        FREE(entry);
+        FREE(base);
+        FREE(simplified);
+        return nullptr;
+    }
+    *simplified = *parsed;
+    simplified->root = copy_subtree(parsed->root);
+    simplified->vars = varlist::retain(parsed->vars);
+    if (simplified->root) simplify_tree(nullptr, simplified);
+    // A stopped simplification leaves a valid but half-done tree, which must not be cached
+    if (!simplified->root || budget_current_status() != BUDGET_OK) {
+        destruct(simplified);
+        FREE(entry);
+        FREE(base);
+        return nullptr;
+    }
+
+    base->kind = FORM_DERIVATIVE;
+    base->var = varlist::NPOS;
+    base->tree = simplified;
+    entry->key = key;
+    entry->source = parsed;
+    entry->forms = base;
+    pthread_mutex_init(&entry->lock, nullptr);
+    intern::acquire();
+    return entry;
+}
+
+// Takes ownership of parsed; the result holds a reference to be dropped with put_entry
+function daemon_entry_t *lookup_or_insert(daemon_cache_t *cache, FRONT_COMPIL_T *parsed) {
+    uint64_t key = structhash::hash_expression(parsed);
+    pthread_mutex_lock(&cache->lock);
+    daemon_entry_t *entry = find_entry(cache, key, parsed);
+    if (entry) cache->hits++;
+    else       cache->misses++;
+    pthread_mutex_unlock(&cache->lock);
+    if (entry) {
+        destruct(parsed);
+        return entry;
+    }
+
+    daemon_entry_t *fresh = new_entry(parsed, key);
+    if (!fresh) {
+        destruct(parsed);
+        return nullptr;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    // Another request may have inserted the same expression meanwhile
+    entry = find_entry(cache, key, parsed);
+    if (!entry) {
+        if (cache->count >= cache->capacity) evict_oldest(cache);
+        size_t bucket = key & (cache->buckets_count - 1);
+        fresh->bucket_next = cache->buckets[bucket];
+        cache->buckets[bucket] = fresh;
+        fresh->refs = 2;
+        lru_push_front(cache, fresh);
+        cache->count++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    if (entry) {
+        free_entry(fresh);
+        return entry;
+    }
+    return fresh;
+}
+
+// ---------------- forms ----------------
+
+function form_t *find_form(daemon_entry_t *entry, FORM_KIND kind, size_t var, size_t order, double point) {
+    for (form_t *form = entry->forms; form; form = form->next) {
+        if (form->kind != kind || form->order != order) continue;
+        if (order == 0 && kind == FORM_DERIVATIVE) return form;
+        if (form->var == var && (kind != FORM_TAYLOR || memcmp(&form->point, &point, sizeof(point)) == 0))
+            return form;
+    }
+    return nullptr;
+}
+
+function form_t *add_form(daemon_entry_t *entry, FORM_KIND kind, size_t var, size_t order, double point, FRONT_COMPIL_T *tree) {
+    form_t *form = TYPED_CALLOC(1, form_t);
+    if (!form) {
+        destruct(tree);
+        return nullptr;
+    }
+    form->kind  = kind;
+    form->var   = var;
+    form->order = order;
+    form->point = point;
+    form->tree  = tree;
+    // Keep the base expression first; new forms go right after it
+    form->next = entry->forms->next;
+    entry->forms->next = form;
+    return form;
+}
+
+// Continues from the highest order already cached for this variable
+function form_t *get_derivative(daemon_entry_t *entry, size_t var, size_t order) {
+    form_t *form = find_form(entry, FORM_DERIVATIVE, var, order, 0);
+    if (form) return form;
+
+    size_t have = order;
+    form_t *prev = nullptr;
+    while (!prev) prev = find_form(entry, FORM_DERIVATIVE, var, --have, 0);
+
+    for (size_t k = have + 1; k <= order; ++k) {
+        FRONT_COMPIL_T *dif = differentiate(nullptr, prev->tree, var);
+        if (!dif) return nullptr;
+        prev = add_form(entry, FORM_DERIVATIVE, var, k, 0, dif);
+        if (!prev) return nullptr;
+    }
+    return prev;
+}
+
+function form_t *get_taylor(daemon_entry_t *entry, size_t var, double point, size_t order) {
+    form_t *form = find_form(entry, FORM_TAYLOR, var, order, point);
+    if (form) return form;
+
+    FRONT_COMPIL_T **array = TYPED_CALLOC(order + 2, FRONT_COMPIL_T *);
+    if (!array) return nullptr;
+    for (size_t k = 0; k <= order; ++k) {
+        form_t *dif = get_derivative(entry, var, k);
+        if (!dif) {
+            FREE(array);
+            return nullptr;
+        }
+        array[k] = dif->tree;
+    }
+    FRONT_COMPIL_T *taylor = tailor_formula(nullptr, array, order, point, var);
+    FREE(array);
+    if (!taylor) return nullptr;
+    return add_form(entry, FORM_TAYLOR, var, order, point, taylor);
+}
+
+function const compile::Program *get_program(form_t *form) {
+    if (!form->compiled) {
+        if (!compile::build(&form->program, form->tree)) return nullptr;
+        form->compiled = true;
+    }
+    return &form->program;
+}
+
+// ---------------- protocol ----------------
+
+typedef struct {
+    const char *begin;
+    size_t      len;
+} field_t;
+
+function field_t trim(const char *begin, const char *end) {
+    while (begin < end && isspace((unsigned char) *begin)) ++begin;
+    while (end > begin && isspace((unsigned char) end[-1])) --end;
+    return {begin, (size_t) (end - begin)};
+}
+
+// Splits "a ; b ; c" into fields; returns how many were found (up to max)
+function size_t split_fields(const char *text, field_t *fields, size_t max) {
+    size_t count = 0;
+    const char *cur = text;
+    while (count < max) {
+        const char *sep = strchr(cur, ';');
+        const char *end = sep ? sep : cur + strlen(cur);
+        fields[count++] = trim(cur, end);
+        if (!sep) break;
+        cur = sep + 1;
+    }
+    return count;
+}
+
+function size_t resolve_var(const daemon_entry_t *entry, const char *name, size_t len) {
+    char buf[128] = "";
+    if (len >= sizeof(buf)) return varlist::NPOS;
+    memcpy(buf, name, len);
+    mystr::mystr_t str = mystr::construct(buf);
+    return varlist::find_index(entry->source->vars, &str);
+}
+
+// "x=1 y=2" -> vals (unlisted variables are 0)
+function bool parse_point(const daemon_entry_t *entry, field_t field, double *vals, size_t vals_count, FILE *out) {
+    for (size_t i = 0; i < vals_count; ++i) vals[i] = 0;
+    const char *cur = field.begin, *end = field.begin + field.len;
+    while (cur < end) {
+        while (cur < end && isspace((unsigned char) *cur)) ++cur;
+        if (cur >= end) break;
+        const char *eq = cur;
+        while (eq < end && *eq != '=' && !isspace((unsigned char) *eq)) ++eq;
+        if (eq >= end || *eq != '=') {
+            fprintf(out, "err expected name=value in point '%.*s'\n", (int) field.len, field.begin);
+            return false;
+        }
+        size_t var = resolve_var(entry, cur, (size_t) (eq - cur));
+        if (var == varlist::NPOS || var >= vals_count) {
+            fprintf(out, "err unknown variable '%.*s'\n", (int) (eq - cur), cur);
+            return false;
+        }
+        char *num_end = nullptr;
+        vals[var] = strtod(eq + 1, &num_end);
+        if (num_end == eq + 1) {
+            fprintf(out, "err bad number for '%.*s'\n", (int) (eq - cur), cur);
+            return false;
+        }
+        cur = num_end;
+    }
+    return true;
+}
+
+function void reply_values(daemon_entry_t *entry, form_t *form, const field_t *points, size_t points_count, FILE *out) {
+    const compile::Program *prog = get_program(form);
+    if (!prog) {
+        fprintf(out, "err failed to compile expression\n");
+        return;
+    }
+    size_t vars_count = prog->vars_count ? prog->vars_count : 1;
+    double *vals = TYPED_CALLOC(vars_count * points_count, double);
+    double *results = TYPED_CALLOC(points_count, double);
+    if (!vals || !results) {
+        fprintf(out, "err out of memory\n");
+        FREE(vals);
+        FREE(results);
+        return;
+    }
+    bool ok = true;
+    for (size_t i = 0; ok && i < points_count; ++i)
+        ok = parse_point(entry, points[i], vals + i * prog->vars_count, prog->vars_count, out);
+    if (ok && compile::eval_many(prog, vals, points_count, results)) {
+        fputs("ok", out);
+        for (size_t i = 0; i < points_count; ++i) fprintf(out, " %.17g", results[i]);
+        fputc('\n', out);
+    }
+    else if (ok) {
+        fprintf(out, "err evaluation failed\n");
+    }
+    FREE(vals);
+    FREE(results);
+}
+
+function void reply_tree(form_t *form, FILE *out) {
+    fputs("ok ", out);
+    print_infix(out, form->tree);
+    fputc('\n', out);
+}
+
+function bool copy_field(field_t field, char *buf, size_t size) {
+    if (field.len >= size) return false;
+    memcpy(buf, field.begin, field.len);
+    buf[field.len] = '\0';
+    return true;
+}
+
+function bool check_var_order(const daemon_cache_t *cache, const daemon_entry_t *entry, const char *name, long long order, size_t *var, FILE *out) {
+    *var = resolve_var(entry, name, strlen(name));
+    if (*var == varlist::NPOS) {
+        fprintf(out, "err unknown variable '%s'\n", name);
+        return false;
+    }
+    if (order < 1 || order > (long long) cache->limits.max_order) {
+        fprintf(out, "err order must be in 1..%zu\n", cache->limits.max_order);
+        return false;
+    }
+    return true;
+}
+
+// A tripped budget is the reason worth reporting; otherwise the generic message
+function void reply_failure(const budget_t *budget, const char *what, FILE *out) {
+    if (budget->status != BUDGET_OK) fprintf(out, "err %s\n", budget_status_str(budget->status));
+    else                             fprintf(out, "err %s\n", what);
+}
+
+function void handle_request(daemon_cache_t *cache, const char *cmd, size_t cmd_len, const char *args, FILE *out) {
+#define IS_CMD(name) (cmd_len == sizeof(name) - 1 && strncmp(cmd, name, cmd_len) == 0)
+    if (IS_CMD("stats")) {
+        pthread_mutex_lock(&cache->lock);
+        fprintf(out, "ok entries=%zu capacity=%zu hits=%zu misses=%zu evictions=%zu\n",
+                cache->count, cache->capacity, cache->hits, cache->misses, cache->evictions);
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+    bool known = IS_CMD("eval") || IS_CMD("diff") || IS_CMD("deval") || IS_CMD("taylor");
+    if (!known) {
+        fprintf(out, "err unknown command '%.*s'\n", (int) cmd_len, cmd);
+        return;
+    }
+
+    const size_t MAX_FIELDS = 1024;
+    field_t *fields = TYPED_CALLOC(MAX_FIELDS, field_t);
+    if (!fields) {
+        fprintf(out, "err out of memory\n");
+        return;
+    }
+    size_t count = split_fields(args, fields, MAX_FIELDS);
+    FRONT_COMPIL_T *parsed = fields[0].len ? load_tree_from_string(fields[0].begin, fields[0].len, "daemon") : nullptr;
+    if (!parsed) {
+        fprintf(out, "err cannot parse expression\n");
+        FREE(fields);
+        return;
+    }
+
+    // Derivatives grow exponentially with the order: one request must not take the server down
+    budget_t budget = {};
+    budget_init(&budget, cache->limits.max_nodes, cache->limits.max_bytes, cache->limits.timeout, nullptr);
+    budget_begin(&budget);
+    daemon_entry_t *entry = lookup_or_insert(cache, parsed);
+    if (!entry) {
+        reply_failure(&budget, "out of memory", out);
+        budget_end(&budget);
+        FREE(fields);
+        return;
+    }
+    // Requests for other expressions go on in parallel; the same one waits here
+    pthread_mutex_lock(&entry->lock);
+
+    char spec[256] = "";
+    char name[128] = "";
+    long long order = 1;
+    double point = 0;
+    size_t var = 0;
+    if (IS_CMD("eval")) {
+        if (count < 2) fprintf(out, "err eval needs at least one point\n");
+        else           reply_values(entry, entry->forms, fields + 1, count - 1, out);
+    }
+    else if (IS_CMD("diff") || IS_CMD("deval")) {
+        bool is_diff = IS_CMD("diff");
+        int n_scanned = (count >= 2 && copy_field(fields[1], spec, sizeof(spec))) ? sscanf(spec, "%127s %lld", name, &order) : 0;
+        if (n_scanned < (is_diff ? 1 : 2) || (is_diff ? count != 2 : count < 3))
+            fprintf(out, is_diff ? "err usage: diff EXPR ; VAR [ORDER]\n"
+                                 : "err usage: deval EXPR ; VAR ORDER ; POINT [; POINT ...]\n");
+        else if (check_var_order(cache, entry, name, order, &var, out)) {
+            form_t *form = get_derivative(entry, var, (size_t) order);
+            if (!form)        reply_failure(&budget, "differentiation failed", out);
+            else if (is_diff) reply_tree(form, out);
+            else              reply_values(entry, form, fields + 2, count - 2, out);
+        }
+    }
+    else if (IS_CMD("taylor")) {
+        int n_scanned = (count == 2 && copy_field(fields[1], spec, sizeof(spec))) ? sscanf(spec, "%127s %lf %lld", name, &point, &order) : 0;
+        if (n_scanned != 3 || !isfinite(point))
+            fprintf(out, "err usage: taylor EXPR ; VAR POINT ORDER\n");
+        else if (check_var_order(cache, entry, name, order, &var, out)) {
+            form_t *form = get_taylor(entry, var, point, (size_t) order);
+            if (form) reply_tree(form, out);
+            else      reply_failure(&budget, "taylor expansion failed", out);
+        }
+    }
+    pthread_mutex_unlock(&entry->lock);
+    budget_end(&budget);
+    put_entry(cache, entry);
+    FREE(fields);
+#undef IS_CMD
+}
+
+bool daemon_handle_line(daemon_cache_t *cache, const char *line, FILE *out) {
+    while (isspace((unsigned char) *line)) ++line;
+    const char *cmd_end = line;
+    while (*cmd_end && !isspace((unsigned char) *cmd_end)) ++cmd_end;
+    size_t cmd_len = (size_t) (cmd_end - line);
+    if (!cmd_len) return true;
+    if (cmd_len == 4 && strncmp(line, "quit", 4) == 0) return false;
+
+    // The request holds the arena, so the reset waits until nothing points into it
+    intern::acquire();
+    if (intern::bytes() > DAEMON_NAMES_LIMIT) {
+        pthread_mutex_lock(&cache->lock);
+        while (cache->oldest) evict_oldest(cache);
+        pthread_mutex_unlock(&cache->lock);
+    }
+    handle_request(cache, line, cmd_len, cmd_end, out);
+    intern::release(DAEMON_NAMES_LIMIT);
+    return true;
+}
+
+int daemon_serve_stream(daemon_cache_t *cache, FILE *in, FILE *out) {
+    char *line = nullptr;
+    size_t capacity = 0;
+    ssize_t len = 0;
+    while ((len = getline(&line, &capacity, in)) >= 0) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) line[--len] = '\0';
+        bool go_on = daemon_handle_line(cache, line, out);
+        fflush(out);
+        if (!go_on) break;
+    }
+    free(line);
+    return 0;
+}
+
+typedef struct {
+    daemon_cache_t *cache;
+    int             fd;
+} connection_t;
+
+function void *serve_connection(void *arg) {
+    connection_t conn = *(connection_t *) arg;
+    free(arg);
+    int out_fd = dup(conn.fd);
+    FILE *in  = fdopen(conn.fd, "r");
+    FILE *out = out_fd >= 0 ? fdopen(out_fd, "w") : nullptr;
+    if (in && out) daemon_serve_stream(conn.cache, in, out);
+    if (in) fclose(in);
+    else    close(conn.fd);
+    if (out) fclose(out);
+    else if (out_fd >= 0) close(out_fd);
+    return nullptr;
+}
+
+int daemon_serve_socket(daemon_cache_t *cache, const char *path) {
+    struct sockaddr_un addr = {};
+    if (!path || strlen(path) >= sizeof(addr.sun_path)) {
+        ERROR_MSG("daemon: bad socket path\n");
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        ERROR_MSG("daemon: socket: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+        ERROR_MSG("daemon: cannot listen on %s: %s\n", path, strerror(errno));
+        close(listen_fd);
+        return -1;
+    }
+
+    for (;;) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            ERROR_MSG("daemon: accept: %s\n", strerror(errno));
+            break;
+        }
+        connection_t *conn = TYPED_CALLOC(1, connection_t);
+        pthread_t thread = {};
+        if (!conn) {
+            close(fd);
+            continue;
+        }
+        conn->cache = cache;
+        conn->fd = fd;
+        if (pthread_create(&thread, nullptr, serve_connection, conn) != 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    close(listen_fd);
+    unlink(path);
+    return -1;
+}
@@ -0,0 +1,83 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "differentiator.h"
+
+typedef struct daemon_entry_t daemon_entry_t;
+
+/**
+ * @brief Ограничения одного запроса (0 - без ограничения, кроме max_order).
+ *
+ * Размер производной растет с порядком экспоненциально, поэтому каждый запрос
+ * считается под своим budget_t: при превышении он получает
+ * "err <budget_status_str>", а недостроенное освобождается.
+ */
+typedef struct {
+    size_t max_nodes;               // Узлов, созданных за запрос
+    size_t max_bytes;               // Живых байт узлов, созданных за запрос
+    double timeout;                 // Секунды на запрос
+    size_t max_order;               // Наибольший порядок в diff, deval и taylor
+} daemon_limits_t;
+
+const size_t DAEMON_DEFAULT_MAX_NODES = 20000000;
+const size_t DAEMON_DEFAULT_MAX_BYTES = (size_t) 1 << 30;
+const double DAEMON_DEFAULT_TIMEOUT   = 10;
+const size_t DAEMON_DEFAULT_MAX_ORDER = 8;
+
+/**
+ * @brief LRU-кэш разобранных выражений для долгоживущего сервера.
+ *
+ * Ключ - структурный хэш выражения вместе с именами переменных
+ * (structhash::hash_expression), совпадение проверяется точным сравнением
+ * деревьев. Запись хранит упрощенное выражение, уже посчитанные производные,
+ * многочлены Тейлора и скомпилированные программы для них.
+ */
+typedef struct {
+    daemon_entry_t **buckets;
+    size_t           buckets_count;     // степень двойки
+    daemon_entry_t  *newest;            // голова LRU-списка
+    daemon_entry_t  *oldest;
+    size_t           count;
+    size_t           capacity;          // максимум записей
+
+    size_t           hits;
+    size_t           misses;
+    size_t           evictions;
+
+    daemon_limits_t  limits;            // daemon_cache_init ставит DAEMON_DEFAULT_*
+
+    // Только таблица, LRU и счетчики: считает запрос под замком своей записи,
+    // так что запросы к разным выражениям идут параллельно
+    pthread_mutex_t  lock;
+} daemon_cache_t;
+
+bool daemon_cache_init(daemon_cache_t *cache, size_t capacity);
+void daemon_cache_destruct(daemon_cache_t *cache);
+
+/**
+ * @brief Выполняет одну строку протокола и пишет одну строку ответа.
+ *
+ * Запросы (аргументы разделяются ';'):
+ *   eval   EXPR ; x=1 y=2 [; x=3 y=4 ...]    значения в точках
+ *   diff   EXPR ; VAR [ORDER]                производная в инфиксной записи
+ *   deval  EXPR ; VAR ORDER ; x=1 [; ...]    значения производной
+ *   taylor EXPR ; VAR POINT ORDER            многочлен Тейлора
+ *   stats                                    состояние кэша
+ * Ответ: "ok ..." или "err сообщение".
+ *
+ * @return false, если пришел quit и соединение нужно закрыть.
+ */
+bool daemon_handle_line(daemon_cache_t *cache, const char *line, FILE *out);
+
+// Обслуживает поток строк до EOF или quit
+int daemon_serve_stream(daemon_cache_t *cache, FILE *in, FILE *out);
+
+// Слушает Unix domain socket, каждое соединение - отдельный поток с общим кэшем
+int daemon_serve_socket(daemon_cache_t *cache, const char *path);
+
+#endif // DAEMON_H
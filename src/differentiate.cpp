@@ -2,15 +2,24 @@
 #include <string.h>
 #include <stdarg.h>
 #include <math.h>
+#include <time.h>
 
 #include "differentiator.h"
+#include "util.h"
 #include "base.h"
 #include "io_utils.h"
 #include "logger.h"
 #include "article.h"
+#include "intern.h"
+#include "session.h"
+#include "diskcache.h"
+#include "budget.h"
+#include "stats.h"
+#include "trace.h"
+#include "growth.h"
 
 NODE_T *copy_subtree(const NODE_T *node) {
-    if (!node) return nullptr;
+    if (!node || !budget_poll()) return nullptr;
     NODE_T *left = node->left ? copy_subtree(node->left) : nullptr;
     if (node->left && !left) return nullptr;
     NODE_T *right = node->right ? copy_subtree(node->right) : nullptr;
@@ -30,27 +39,41 @@ NODE_T *copy_subtree(const NODE_T *node) {
     return copy;
 }
 
+FRONT_COMPIL_T *copy_tree(const FRONT_COMPIL_T *src) {
+    if (!src) return nullptr;
+    FRONT_COMPIL_T *copy = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    if (!copy) return nullptr;
+    *copy = *src;
+    copy->root = copy_subtree(src->root);
+    copy->vars = varlist::retain(src->vars);
+    if (src->root && !copy->root) {
+        destruct(copy);
+        return nullptr;
+    }
+    return copy;
+}
+
 function NODE_T *make_number(double value) {
     return new_node(NUM_T, (NODE_VALUE_T) {.num = value}, nullptr, nullptr);
 }
 
+// A missing operand means the subexpression failed (no memory, budget): free the other one, never build a partial tree
 function NODE_T *make_binary(OPERATOR op, NODE_T *left, NODE_T *right) {
-    NODE_T *node = new_node(OP_T, (NODE_VALUE_T) {.opr = op}, left, right);
+    NODE_T *node = (left && right) ? new_node(OP_T, (NODE_VALUE_T) {.opr = op}, left, right) : nullptr;
     if (!node) {
         destruct(left);
         destruct(right);
+        return nullptr;
     }
-    if (node) {
-        if (node->left ) node->left ->parent = node;
-        if (node->right) node->right->parent = node;
-    }
+    node->left ->parent = node;
+    node->right->parent = node;
     return node;
 }
 
 function NODE_T *make_unary(OPERATOR op, NODE_T *arg) {
-    NODE_T *node = new_node(OP_T, (NODE_VALUE_T) {.opr = op}, arg, nullptr);
-    if (!node) { destruct(node); return nullptr; }
-    if (node && node->left) node->left->parent = node;
+    NODE_T *node = arg ? new_node(OP_T, (NODE_VALUE_T) {.opr = op}, arg, nullptr) : nullptr;
+    if (!node) { destruct(arg); return nullptr; }
+    node->left->parent = node;
     return node;
 }
 
@@ -63,11 +86,9 @@ function NODE_T *make_variable(size_t var_idx) {
 #define CREATE_NEW_EQ_TREE()                                \
     FRONT_COMPIL_T *new_eq_tree = TYPED_CALLOC(1, FRONT_COMPIL_T);    \
     VERIFY(new_eq_tree, destruct(root); return nullptr;);   \
-    new_eq_tree->name = get_new_name(src, diff_var_idx);    \
     new_eq_tree->root = root;                               \
-    new_eq_tree->vars = vars_copy;                          \
-    new_eq_tree->owns_vars = vars_copy != nullptr;          \
-    new_eq_tree->owns_name = true;
+    new_eq_tree->vars = varlist::retain(src->vars);         \
+    set_derivative_label(new_eq_tree, src, diff_var_idx, 1);
 
 #define ADD(L, R) make_binary(ADD, (L), (R))
 #define SUB(L, R) make_binary(SUB, (L), (R))
@@ -96,13 +117,13 @@ function NODE_T *make_variable(size_t var_idx) {
 
 #define l node->left
 #define r node->right
-#define dl differentiate_node(node->left, diff_var_idx)
-#define dr differentiate_node(node->right, diff_var_idx)
+#define dl differentiate_node(session, node->left, diff_var_idx)
+#define dr differentiate_node(session, node->right, diff_var_idx)
 #define cl copy_subtree(node->left)
 #define cr copy_subtree(node->right)
 
 //! Barabanschikov ne zabudu compound func
-#define BBNZCF(DEQ) MUL(differentiate_node(node->left, diff_var_idx), DEQ)
+#define BBNZCF(DEQ) MUL(differentiate_node(session, node->left, diff_var_idx), DEQ)
 
 #define RES(x) {result = (x); break;}
 
@@ -134,8 +155,8 @@ function bool subtree_contains_var(const NODE_T *node, size_t diff_var_idx) {
     return subtree_contains_var(node->left, diff_var_idx) || subtree_contains_var(node->right, diff_var_idx);
 }
 
-function NODE_T *differentiate_node(const NODE_T *node, size_t diff_var_idx) {
-    if (!node) return nullptr;
+function NODE_T *differentiate_node(session_t *session, const NODE_T *node, size_t diff_var_idx) {
+    if (!node || !budget_poll()) return nullptr;
     NODE_T *result = nullptr;
     switch (node->type) {
         case NUM_T: RES(ZERO);
@@ -169,102 +190,171 @@ function NODE_T *differentiate_node(const NODE_T *node, size_t diff_var_idx) {
         default: return nullptr;
     }
     if (!result) return nullptr;
-    article_log_step(node, result);
+    article_trace_step(session, node, result);
     return result;
 }
 
-function char *get_new_name(const FRONT_COMPIL_T *src, size_t diff_var_idx) {
-    const char *original_name = (src->name && *src->name) ? src->name : "equation";
-    const mystr::mystr_t *var_entry = (src->vars && diff_var_idx < varlist::size(src->vars))
-                                      ? varlist::get(src->vars, diff_var_idx)
-                                      : nullptr;
-    const char *var_name = (var_entry && var_entry->str && *var_entry->str)
-                           ? var_entry->str
-                           : "unknown variable";
-    const char *prefix = "derivative of ";
-    const char *infix = " with respect to ";
-    size_t label_len = strlen(prefix)
-                     + strlen(original_name)
-                     + strlen(infix)
-                     + strlen(var_name);
-    char *label = TYPED_CALLOC(label_len + 1, char);
-    if (!label) {
-        return nullptr;
+// The label stays (source name, variable, order); a mixed derivative starts a new chain from the full label.
+function void set_derivative_label(FRONT_COMPIL_T *dst, const FRONT_COMPIL_T *src, size_t diff_var_idx, size_t order) {
+    dst->diff_var = diff_var_idx;
+    if (!src->diff_order || src->diff_var == diff_var_idx) {
+        dst->name       = src->name;
+        dst->diff_order = src->diff_order + order;
+        return;
     }
-    snprintf(label, label_len + 1, "%s%s%s%s", prefix, original_name, infix, var_name);
-    return label;
+    char label[512] = "";
+    format_tree_label(src, label, sizeof(label));
+    dst->name       = intern::get(label);
+    dst->diff_order = order;
 }
 
-FRONT_COMPIL_T *differentiate(const FRONT_COMPIL_T *src, size_t diff_var_idx) {
-    if (!src || !src->root) return nullptr;
-    const FRONT_COMPIL_T *prev_tree = differentiate_get_article_tree();
-    differentiate_set_article_tree(src);
-    FILE *article_file = differentiate_get_article_stream();
-    size_t limit = g_requested_step_limit ? g_requested_step_limit : 200;
-    g_requested_step_limit = 0;
-    g_step_counter = 0;
-    g_step_limit = limit;
-
-    char *origin_latex = latex_dump((FRONT_COMPIL_T *) src);
-    article_log_text("Исходное выражение: \n\\begin{dmath*}f(x) = %s\\end{dmath*}", origin_latex);
-    article_log_text("Продифференцируем это чудо...\n\n");
-    FREE(origin_latex);
-
-    NODE_T *root = differentiate_node(src->root, diff_var_idx);
-    differentiate_set_article_tree(prev_tree);
+// The LaTeX article shows every derivation step, so a step that goes into it always computes.
+// The HTML log alone does not count: differentiate_get_article_stream falls back to it, and it is always open
+function bool use_disk_cache(session_t *session) {
+    return diskcache_enabled() && !(session && session->article.file);
+}
+
+function FRONT_COMPIL_T *cached_derivative(const FRONT_COMPIL_T *src, uint64_t key, size_t diff_var_idx, size_t order) {
+    NODE_T *root = diskcache_lookup(src, key, diff_var_idx, order);
     if (!root) return nullptr;
-    root->parent = nullptr;
-    varlist::VarList *vars_copy = src->vars ? varlist::clone(src->vars) : nullptr;
+    FRONT_COMPIL_T *new_eq_tree = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    VERIFY(new_eq_tree, destruct(root); return nullptr;);
+    new_eq_tree->root = root;
+    new_eq_tree->vars = varlist::retain(src->vars);
+    set_derivative_label(new_eq_tree, src, diff_var_idx, order);
+    return new_eq_tree;
+}
 
-    VERIFY(!(src->vars && !vars_copy), destruct(root); return nullptr;)
+// row (may be nullptr) gets the size before simplification and the time of both halves
+function FRONT_COMPIL_T *differentiate_uncached(session_t *session, const FRONT_COMPIL_T *src, size_t diff_var_idx, growth_row_t *row) {
+    const FRONT_COMPIL_T *prev_tree = differentiate_get_article_tree(session);
+    if (session) {
+        size_t limit = session->requested_step_limit ? session->requested_step_limit : 200;
+        session->requested_step_limit = 0;
+        session->step_counter = 0;
+        session->step_limit = limit;
+    }
 
+    trace_span_t span = trace_begin("differentiate");
+    article_log_formula(session, "Исходное выражение: \n\\begin{dmath*}f(x) = ", src, nullptr, nullptr, "\\end{dmath*}\n\n");
+    article_log_text(session, "Продифференцируем это чудо...\n\n");
+
+    article_trace_begin(session, src);
+    stats_timer_t timer = stats_phase_begin(STATS_DIFFERENTIATE);
+    double t0 = row ? now_seconds() : 0;
+    NODE_T *root = differentiate_node(session, src->root, diff_var_idx);
+    if (row) {
+        row->diff_seconds = now_seconds() - t0;
+        growth_tree_shape(root, &row->raw_nodes, nullptr);
+    }
+    stats_phase_end(&timer);
+    root = article_trace_render(session, root);
+    differentiate_set_article_tree(session, prev_tree);
+    if (!root) {
+        trace_end(&span);
+        return nullptr;
+    }
+    root->parent = nullptr;
     CREATE_NEW_EQ_TREE();
-    article_log_with_latex(new_eq_tree, "Получили производную. Теперь упростим это выражение:");
-    simplify_tree(new_eq_tree);
+    article_log_with_latex(session, new_eq_tree, "Получили производную. Теперь упростим это выражение:");
+    t0 = row ? now_seconds() : 0;
+    simplify_tree(session, new_eq_tree);
+    if (row) row->simplify_seconds = now_seconds() - t0;
+    if (!budget_poll()) {
+        destruct(new_eq_tree);
+        trace_end(&span);
+        return nullptr;
+    }
 
-    char *latex_res = latex_dump(new_eq_tree), *latex_src = latex_dump((FRONT_COMPIL_T *) src);
-    article_log_text("\\begin{dmath*} \\frac{\\mathrm{d}}{\\mathrm{dx}} %s = %s \\end{dmath*}", latex_src, latex_res);
-    FREE(latex_res);
-    FREE(latex_src);
+    article_log_formula(session, "\\begin{dmath*} \\frac{\\mathrm{d}}{\\mathrm{dx}} ", src, " = ", new_eq_tree, " \\end{dmath*}\n\n");
+    trace_end(&span);
     return new_eq_tree;
 }
 
+FRONT_COMPIL_T *differentiate(session_t *session, const FRONT_COMPIL_T *src, size_t diff_var_idx) {
+    if (!src || !src->root) return nullptr;
+    if (!use_disk_cache(session)) return differentiate_uncached(session, src, diff_var_idx, nullptr);
+
+    uint64_t key = diskcache_key(src);
+    FRONT_COMPIL_T *result = cached_derivative(src, key, diff_var_idx, 1);
+    if (result) {
+        if (session) session->requested_step_limit = 0;
+        return result;
+    }
+    result = differentiate_uncached(session, src, diff_var_idx, nullptr);
+    if (result) diskcache_store(src, key, diff_var_idx, 1, result);
+    return result;
+}
+
 // Вернет указатель на динамический массив деревьев, где на i-том индексе лежит i-тая производная выражения
 // (на 0 лежит само исходное выражение)
 // на n+1 индексе лежит nullptr как терминальный элемент конца массива
-FRONT_COMPIL_T **differentiate_to_n(const FRONT_COMPIL_T *src, size_t n, size_t diff_var_idx) {
+FRONT_COMPIL_T **differentiate_to_n(session_t *session, const FRONT_COMPIL_T *src, size_t n, size_t diff_var_idx) {
     FRONT_COMPIL_T **array = TYPED_CALLOC(n + 2, FRONT_COMPIL_T *);
+    if (!array) return nullptr;
     array[0] = (FRONT_COMPIL_T *) src;
 
     FILE *prev_file = nullptr;
+    uint64_t key = 0;
+    bool have_key = false;
     for (size_t i = 1; i <= n; ++i) {
         if (i >= 4) {
-            if (!prev_file) prev_file = differentiate_get_article_stream();
-            differentiate_set_article_file(nullptr);
+            if (!prev_file) prev_file = differentiate_get_article_stream(session);
+            differentiate_set_article_file(session, nullptr);
+        }
+        // One span per order, cache hits included, to show how the cost grows with n
+        trace_span_t span = trace_begin_arg("derivative order", "order", (long long) i);
+        article_log_text(session, "\\bigskip\\hrule\\bigskip\n\\subsection*{%zu производная}", i);
+        FRONT_COMPIL_T *dif = nullptr;
+        growth_row_t *row = session && session->growth ? growth_add(session->growth, i) : nullptr;
+        bool cacheable = use_disk_cache(session);
+        if (cacheable) {
+            // Keyed by the source and the full order, not by the previous derivative
+            if (!have_key) key = diskcache_key(src);
+            have_key = true;
+            dif = cached_derivative(src, key, diff_var_idx, i);
+            if (row) row->cached = dif != nullptr;
+        }
+        if (!dif) {
+            if (session) session->requested_step_limit = (i == 1) ? 120 : 60;
+            dif = differentiate_uncached(session, array[i-1], diff_var_idx, row);
+            if (dif && cacheable) diskcache_store(src, key, diff_var_idx, i, dif);
         }
-        article_log_text("\\bigskip\\hrule\\bigskip\n\\subsection*{%zu производная}", i);
-        g_requested_step_limit = (i == 1) ? 120 : 60;
-        FRONT_COMPIL_T *dif = differentiate(array[i-1], diff_var_idx);
         if (dif == nullptr) {
-            ERROR_MSG("Не смог взять %zu-тую производную\n", i);
+            // Without a session the caller reports the failure (C API status, daemon reply)
+            if (session) {
+                BUDGET_STATUS status = budget_current_status();
+                if (status != BUDGET_OK) ERROR_MSG("Не смог взять %zu-тую производную: %s\n", i, budget_status_str(status));
+                else                     ERROR_MSG("Не смог взять %zu-тую производную\n", i);
+            }
+            if (prev_file) differentiate_set_article_file(session, prev_file);
+            trace_end(&span);
             destruct(array);
             FREE(array);
             return nullptr;
         }
         array[i] = dif;
+        growth_measure(row, dif);
+        trace_end(&span);
     }
 
     if (prev_file)
-        differentiate_set_article_file(prev_file);
+        differentiate_set_article_file(session, prev_file);
 
     return array;
 }
 
 function NODE_T *tailor_k_term(FRONT_COMPIL_T *k_dif, size_t k, double point, size_t var_idx) {
     double koef = 0;
-    double point_values[1] = {point};
-    EQ_POINT_T calc_point = {.tree = k_dif, .point = point_values, .vars_count = 1};
+    // Other variables are taken at zero; the expansion is in var_idx only
+    size_t vars_count = k_dif->vars ? varlist::size(k_dif->vars) : 0;
+    if (vars_count <= var_idx) vars_count = var_idx + 1;
+    double *point_values = TYPED_CALLOC(vars_count, double);
+    if (!point_values) return nullptr;
+    point_values[var_idx] = point;
+    EQ_POINT_T calc_point = {.tree = k_dif, .point = point_values, .vars_count = vars_count};
     calc_in_point(&calc_point);
+    FREE(point_values);
     koef = calc_point.result / tgamma(k + 1); // gamma(x) = (x - 1)!
     return MUL(make_number(koef), POW(SUB(make_variable(var_idx), make_number(point)), make_number(k)));
 }
@@ -272,7 +362,7 @@ function NODE_T *tailor_k_term(FRONT_COMPIL_T *k_dif, size_t k, double point, si
 function NODE_T *build_taylor_expression(FRONT_COMPIL_T **diff_array, size_t n, double point, size_t var_idx) {
     NODE_T *expr = nullptr;
     for (size_t k = 0; k <= n; ++k) {
-        NODE_T *term = tailor_k_term(diff_array[k], k, point, var_idx);
+        NODE_T *term = budget_poll() ? tailor_k_term(diff_array[k], k, point, var_idx) : nullptr;
         if (!term) {
             destruct(expr);
             return nullptr;
@@ -283,11 +373,7 @@ function NODE_T *build_taylor_expression(FRONT_COMPIL_T **diff_array, size_t n,
             continue;
         }
         NODE_T *sum = make_binary(ADD, expr, term);
-        if (!sum) {
-            destruct(term);
-            destruct(expr);
-            return nullptr;
-        }
+        if (!sum) return nullptr;
         expr->parent = sum;
         term->parent = sum;
         expr = sum;
@@ -295,8 +381,10 @@ function NODE_T *build_taylor_expression(FRONT_COMPIL_T **diff_array, size_t n,
     return expr;
 }
 
-FRONT_COMPIL_T *tailor_formula(FRONT_COMPIL_T **diff_array, size_t n, double point, size_t var_idx) {
+FRONT_COMPIL_T *tailor_formula(session_t *session, FRONT_COMPIL_T **diff_array, size_t n, double point, size_t var_idx) {
+    trace_span_t span = trace_begin("taylor terms");
     NODE_T *root = build_taylor_expression(diff_array, n, point, var_idx);
+    trace_end(&span);
     if (!root) return nullptr;
 
     FRONT_COMPIL_T *tailor_tree = TYPED_CALLOC(1, FRONT_COMPIL_T);
@@ -306,12 +394,11 @@ FRONT_COMPIL_T *tailor_formula(FRONT_COMPIL_T **diff_array, size_t n, double poi
     }
 
     tailor_tree->root = root;
-    tailor_tree->name = strdup(diff_array[0]->name);
-    tailor_tree->vars = varlist::clone(diff_array[0]->vars);
-    tailor_tree->owns_name = true;
-    tailor_tree->owns_vars = true;
+    tailor_tree->name = diff_array[0]->name;
+    tailor_tree->vars = varlist::retain(diff_array[0]->vars);
+    tailor_tree->diff_var = varlist::NPOS;
 
-    simplify_tree(tailor_tree);
+    simplify_tree(session, tailor_tree);
 
     return tailor_tree;
 }
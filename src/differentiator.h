@@ -41,12 +41,13 @@ typedef struct NODE_T {
                     *parent;
 } NODE_T;
 
+// Имя производной не строится строкой: хранится имя источника, переменная и порядок
 typedef struct FRONT_COMPIL_T {
-    const char       *name;
+    const char       *name;             // Имя исходного выражения из intern::get
     NODE_T           *root;
-    varlist::VarList *vars;
-    bool              owns_vars;
-    bool              owns_name;
+    varlist::VarList *vars;             // Разделяемый список (refcount), дерево держит одну ссылку
+    size_t            diff_var;         // Переменная дифференцирования (varlist::NPOS у исходного выражения)
+    size_t            diff_order;       // Порядок производной (0 у исходного выражения)
 } FRONT_COMPIL_T;
 
 typedef enum {
@@ -66,16 +67,34 @@ NODE_T *new_node(NODE_TYPE type, NODE_VALUE_T value, NODE_T *left, NODE_T *right
 FRONT_COMPIL_T *load_tree_from_file(const char *filename, varlist::VarList *vars, graph_range_t *range);
 FRONT_COMPIL_T *load_tree_from_file(const char *filename, const char *eq_tree_name, varlist::VarList *vars, graph_range_t *range);
 
+// Разбирает одно инфиксное выражение из памяти (без строки имени и диапазонов графика);
+// дерево единолично владеет своим списком переменных
+FRONT_COMPIL_T *load_tree_from_string(const char *text, size_t len, const char *eq_tree_name);
+
+// Читает префиксный формат с nil-листьями: `(op (left) (right))`, без рекурсии
+FRONT_COMPIL_T *load_tree_from_prefix_file(const char *filename, varlist::VarList *vars);
+FRONT_COMPIL_T *load_tree_from_prefix_file(const char *filename, const char *eq_tree_name, varlist::VarList *vars);
+// Потоково пишет дерево в том же префиксном формате (первая строка - имя дерева)
+void save_tree_to_prefix_file(FILE *file, const FRONT_COMPIL_T *eqtree);
+
 // Отчищает массив выражений (0 выражение не очищается, последний элемент должен быть nullptr)
 void destruct(FRONT_COMPIL_T **eq_arr);
 void destruct(FRONT_COMPIL_T  *eqtree);
 void destruct(NODE_T     *node);
 
+// Копия дерева со своими узлами и общим (retain) списком переменных; nullptr при нехватке памяти или бюджета
+FRONT_COMPIL_T *copy_tree(const FRONT_COMPIL_T *src);
+
 bool node_type_from_token(const char *token, NODE_TYPE *out);
 const char *node_type_name(const NODE_T *node);
 
 bool operator_from_token(const char *token, OPERATOR *op);
 const char *operator_symbol(OPERATOR op);
+// Число операндов: 2 у бинарных (левый и правый), 1 у унарных (только левый)
+size_t operator_arity(OPERATOR op);
+
+// Пишет отображаемое имя дерева: "derivative of order 2 of Test with respect to x"
+void format_tree_label(const FRONT_COMPIL_T *eqtree, char *buf, size_t size);
 
 void format_node_value(const FRONT_COMPIL_T *eqtree, const NODE_T *node, char *buf, size_t size);
 
@@ -89,36 +108,69 @@ typedef struct {
 EQ_POINT_T  read_point_data(const FRONT_COMPIL_T *eqtree);
 EQ_POINT_T *calc_in_point  (EQ_POINT_T *point);
 
+// Значение оператора от уже посчитанных операндов (у унарных r не используется)
+double apply_operator(OPERATOR op, double l, double r);
+
+// ---- Binary ----
+// Компактный бинарный формат: заголовок, таблица имен переменных и post-order поток узлов
+// (varint-кодированные операторы и индексы), в конце контрольная сумма.
+
+// Кодирует дерево в буфер, который нужно освободить вызывающему
+bool serialize_tree(const FRONT_COMPIL_T *eqtree, char **out, size_t *out_len);
+// Восстанавливает дерево из образа; дерево владеет своим именем и списком переменных
+FRONT_COMPIL_T *deserialize_tree(const void *data, size_t len);
+
 void save_tree_to_file(FILE *file, FRONT_COMPIL_T *eqtree);
+// Отображает файл в память (mmap) и собирает дерево без разбора текста
+FRONT_COMPIL_T *load_tree_from_binary(const char *filename);
 
 bool verifier(FRONT_COMPIL_T *eqtree);
 
+// Печатает дерево в инфиксной записи, которую снова принимает load_tree_from_file
 void print(FRONT_COMPIL_T *eqtree);
+void print(FILE *file, const FRONT_COMPIL_T *eqtree);
+// Только само выражение, без имени и перевода строки
+void print_infix(FILE *file, const FRONT_COMPIL_T *eqtree);
 
 bool is_leaf(const NODE_T *node);
 
-bool simplify_tree(FRONT_COMPIL_T *eqtree);
+// Сессия (session.h) несет статью, лог и счетчики; session == NULL - считать молча, без отчетов
+typedef struct session_t session_t;
+
+bool simplify_tree(session_t *session, FRONT_COMPIL_T *eqtree);
+
+// Только свертка поддеревьев без переменных в числа, без отчетов; значения в любой точке не меняются
+bool fold_constants(FRONT_COMPIL_T *eqtree);
 
-FRONT_COMPIL_T *differentiate(const FRONT_COMPIL_T *src, size_t diff_var_idx);
-FRONT_COMPIL_T **differentiate_to_n(const FRONT_COMPIL_T *src, size_t n, size_t diff_var_idx);
+FRONT_COMPIL_T *differentiate(session_t *session, const FRONT_COMPIL_T *src, size_t diff_var_idx);
+FRONT_COMPIL_T **differentiate_to_n(session_t *session, const FRONT_COMPIL_T *src, size_t n, size_t diff_var_idx);
 
-FRONT_COMPIL_T *tailor_formula(FRONT_COMPIL_T **diff_array, size_t n, double point, size_t diff_var_idx);
+FRONT_COMPIL_T *tailor_formula(session_t *session, FRONT_COMPIL_T **diff_array, size_t n, double point, size_t diff_var_idx);
 
 // ---- Dump ----
 
+// Ограничения дампа (session_t::dump_limits): дерево больше max_nodes или глубже max_depth рисуется
+// сокращенно - глубже max_depth или сверх бюджета поддеревья сворачиваются в узел-сводку, повторы
+// рисуются один раз
+typedef struct {
+    size_t max_depth;           // 0 - без ограничения
+    size_t max_nodes;           // 0 - всегда рисовать дерево целиком
+    bool   share_subtrees;
+} dump_limits_t;
+
 // typedef struct {
 //     NODE_T node;
 //     char   *params;
 // } DUMP_CONF_T;
 
 // Полный дамп со всеми полями и указателями
-void full_dump(FRONT_COMPIL_T *node);
-void full_dump(FRONT_COMPIL_T *node, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+void full_dump(session_t *session, FRONT_COMPIL_T *node);
+void full_dump(session_t *session, FRONT_COMPIL_T *node, const char *fmt, ...) __attribute__((format (printf, 3, 4)));
 // void full_dump(NODE_T node, DUMP_CONF_T *node_confs, char *fmt, ...) __attribute__((format (printf, 3, 4)));
 
 // Дамп только содержимого (если нет никаких проблем с указателями)
-void simple_dump(FRONT_COMPIL_T *node);
-void simple_dump(FRONT_COMPIL_T *node, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+void simple_dump(session_t *session, FRONT_COMPIL_T *node);
+void simple_dump(session_t *session, FRONT_COMPIL_T *node, const char *fmt, ...) __attribute__((format (printf, 3, 4)));
 // void simple_dump(NODE_T node, DUMP_CONF_T *node_confs, char *fmt, ...) __attribute__((format (printf, 3, 4)));
 
 // Возвращает указатель на строку, содержащую latex выражение
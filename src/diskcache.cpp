@@ -0,0 +1,305 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "diskcache.h"
+#include "structhash.h"
+#include "io_utils.h"
+#include "util.h"
+#include "base.h"
+
+// File layout: header (native endianness, the cache is local to the machine),
+// then serialize_tree() of the input and of the derivative, each with its own checksum.
+typedef struct {
+    char     magic[4];
+    uint8_t  version;
+    uint8_t  reserved[3];
+    uint64_t key;
+    uint64_t var;
+    uint64_t order;
+    uint64_t input_len;
+    uint64_t output_len;
+} diskcache_header_t;
+
+const char    DISKCACHE_MAGIC[4]  = {'D', 'C', 'C', 'H'};
+const uint8_t DISKCACHE_VERSION   = 1;
+const char   *DISKCACHE_EXT       = ".dcache";
+
+typedef struct {
+    char              dir[512];
+    size_t            max_bytes;
+    bool              open;
+    size_t            tmp_counter;
+    diskcache_stats_t stats;
+} DiskCache;
+
+global DiskCache DISK_CACHE = {};
+global pthread_mutex_t DISK_CACHE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    char     name[256];
+    size_t   size;
+    int64_t  mtime_ns;
+} cache_file_t;
+
+function int compare_by_mtime(const void *a, const void *b) {
+    int64_t lhs = ((const cache_file_t *) a)->mtime_ns, rhs = ((const cache_file_t *) b)->mtime_ns;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+function bool has_cache_ext(const char *name) {
+    size_t len = strlen(name), ext_len = strlen(DISKCACHE_EXT);
+    return len > ext_len && strcmp(name + len - ext_len, DISKCACHE_EXT) == 0;
+}
+
+// Rescans the directory; when over the limit, drops least recently read files down to 3/4 of it.
+// Caller holds DISK_CACHE_LOCK.
+function void rescan_and_evict(void) {
+    DIR *dir = opendir(DISK_CACHE.dir);
+    if (!dir) return;
+    cache_file_t *files = nullptr;
+    size_t count = 0, capacity = 0, total = 0;
+    for (struct dirent *entry = readdir(dir); entry; entry = readdir(dir)) {
+        if (!has_cache_ext(entry->d_name) || strlen(entry->d_name) >= sizeof(files->name)) continue;
+        char path[1024] = "";
+        snprintf(path, sizeof(path), "%s%s", DISK_CACHE.dir, entry->d_name);
+        struct stat st = {};
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            cache_file_t *grown = (cache_file_t *) realloc(files, new_capacity * sizeof(cache_file_t));
+            if (!grown) break;
+            files = grown;
+            capacity = new_capacity;
+        }
+        cache_file_t *file = &files[count++];
+        strcpy(file->name, entry->d_name);
+        file->size     = (size_t) st.st_size;
+        file->mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        total += file->size;
+    }
+    closedir(dir);
+
+    if (DISK_CACHE.max_bytes && total > DISK_CACHE.max_bytes) {
+        qsort(files, count, sizeof(cache_file_t), compare_by_mtime);
+        size_t target = DISK_CACHE.max_bytes / 4 * 3;
+        for (size_t i = 0; i < count && total > target; ++i) {
+            char path[1024] = "";
+            snprintf(path, sizeof(path), "%s%s", DISK_CACHE.dir, files[i].name);
+            if (unlink(path) == 0) {
+                total -= files[i].size;
+                DISK_CACHE.stats.evictions++;
+            }
+        }
+    }
+    DISK_CACHE.stats.bytes = total;
+    free(files);
+}
+
+bool diskcache_open(const char *dir, size_t max_bytes) {
+    VERIFY(dir && *dir, ERROR_MSG("diskcache_open: empty directory\n"); return false;);
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    size_t len = strlen(dir);
+    bool slash = dir[len - 1] == '/';
+    if (len + 2 > sizeof(DISK_CACHE.dir)) {
+        pthread_mutex_unlock(&DISK_CACHE_LOCK);
+        ERROR_MSG("diskcache_open: directory path is too long\n");
+        return false;
+    }
+    DISK_CACHE = {};
+    snprintf(DISK_CACHE.dir, sizeof(DISK_CACHE.dir), "%s%s", dir, slash ? "" : "/");
+    create_folder_if_not_exists(DISK_CACHE.dir);
+    struct stat st = {};
+    if (stat(DISK_CACHE.dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        pthread_mutex_unlock(&DISK_CACHE_LOCK);
+        ERROR_MSG("diskcache_open: cannot create %s\n", DISK_CACHE.dir);
+        return false;
+    }
+    DISK_CACHE.max_bytes = max_bytes;
+    DISK_CACHE.open = true;
+    rescan_and_evict();
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+    return true;
+}
+
+void diskcache_close(void) {
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    DISK_CACHE.open = false;
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+}
+
+bool diskcache_enabled(void) {
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    bool open = DISK_CACHE.open;
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+    return open;
+}
+
+diskcache_stats_t diskcache_stats(void) {
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    diskcache_stats_t stats = DISK_CACHE.stats;
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+    return stats;
+}
+
+uint64_t diskcache_key(const FRONT_COMPIL_T *src) {
+    return structhash::hash_expression(src);
+}
+
+// Returns false when the cache is closed
+function bool entry_path(char *buf, size_t size, uint64_t key, size_t var, size_t order) {
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    bool open = DISK_CACHE.open;
+    if (open)
+        snprintf(buf, size, "%s%016llx-%zu-%zu%s", DISK_CACHE.dir, (unsigned long long) key, var, order, DISKCACHE_EXT);
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+    return open;
+}
+
+function void bump(size_t *counter) {
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    ++*counter;
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+}
+
+function bool same_var_names(const FRONT_COMPIL_T *a, const FRONT_COMPIL_T *b) {
+    size_t vars_count = varlist::size(a->vars);
+    if (vars_count != varlist::size(b->vars)) return false;
+    for (size_t i = 0; i < vars_count; ++i) {
+        const mystr::mystr_t *lhs = varlist::get(a->vars, i), *rhs = varlist::get(b->vars, i);
+        if (!lhs || !rhs || !lhs->is_same(rhs)) return false;
+    }
+    return true;
+}
+
+// Validates the mapped file and rebuilds the derivative; sets *corrupt for files that should be dropped
+function NODE_T *decode_entry(const uint8_t *image, size_t len, const FRONT_COMPIL_T *src,
+                              uint64_t key, size_t var, size_t order, bool *corrupt) {
+    diskcache_header_t header = {};
+    *corrupt = true;
+    if (len < sizeof(header)) return nullptr;
+    memcpy(&header, image, sizeof(header));
+    if (memcmp(header.magic, DISKCACHE_MAGIC, sizeof(DISKCACHE_MAGIC)) != 0 || header.version != DISKCACHE_VERSION
+        || header.input_len > len || header.output_len > len
+        || sizeof(header) + header.input_len + header.output_len != len)
+        return nullptr;
+    *corrupt = false;
+    if (header.key != key || header.var != var || header.order != order) return nullptr;
+
+    FRONT_COMPIL_T *input = deserialize_tree(image + sizeof(header), (size_t) header.input_len);
+    if (!input) {
+        *corrupt = true;
+        return nullptr;
+    }
+    // Same hash but a different expression: a genuine collision, the file itself is fine
+    bool same_input = same_var_names(input, src) && structhash::equal(input->root, src->root);
+    destruct(input);
+    if (!same_input) return nullptr;
+
+    FRONT_COMPIL_T *output = deserialize_tree(image + sizeof(header) + header.input_len, (size_t) header.output_len);
+    if (!output || !same_var_names(output, src)) {
+        *corrupt = true;
+        destruct(output);
+        return nullptr;
+    }
+    NODE_T *root = output->root;
+    output->root = nullptr;
+    destruct(output);
+    return root;
+}
+
+NODE_T *diskcache_lookup(const FRONT_COMPIL_T *src, uint64_t key, size_t var, size_t order) {
+    if (!src || !src->root) return nullptr;
+    char path[1024] = "";
+    if (!entry_path(path, sizeof(path), key, var, order)) return nullptr;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        bump(&DISK_CACHE.stats.misses);
+        return nullptr;
+    }
+    struct stat st = {};
+    void *image = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        image = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        bump(&DISK_CACHE.stats.misses);
+        return nullptr;
+    }
+
+    bool corrupt = false;
+    NODE_T *root = decode_entry((const uint8_t *) image, (size_t) st.st_size, src, key, var, order, &corrupt);
+    munmap(image, (size_t) st.st_size);
+
+    if (!root) {
+        if (corrupt) {
+            ERROR_MSG("diskcache: dropping damaged entry %s\n", path);
+            unlink(path);
+            bump(&DISK_CACHE.stats.rejected);
+        }
+        bump(&DISK_CACHE.stats.misses);
+        return nullptr;
+    }
+    // mtime is the recency used by eviction
+    utimensat(AT_FDCWD, path, nullptr, 0);
+    bump(&DISK_CACHE.stats.hits);
+    return root;
+}
+
+bool diskcache_store(const FRONT_COMPIL_T *src, uint64_t key, size_t var, size_t order, const FRONT_COMPIL_T *result) {
+    if (!src || !result || !result->root) return false;
+    char path[1024] = "";
+    if (!entry_path(path, sizeof(path), key, var, order)) return false;
+
+    char *input = nullptr, *output = nullptr;
+    size_t input_len = 0, output_len = 0;
+    if (!serialize_tree(src, &input, &input_len) || !serialize_tree(result, &output, &output_len)) {
+        FREE(input);
+        FREE(output);
+        return false;
+    }
+
+    diskcache_header_t header = {};
+    memcpy(header.magic, DISKCACHE_MAGIC, sizeof(DISKCACHE_MAGIC));
+    header.version    = DISKCACHE_VERSION;
+    header.key        = key;
+    header.var        = var;
+    header.order      = order;
+    header.input_len  = input_len;
+    header.output_len = output_len;
+
+    char tmp_path[1100] = "";
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    size_t tmp_id = DISK_CACHE.tmp_counter++;
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%ld.%zu", path, (long) getpid(), tmp_id);
+
+    // Readers only ever see complete files: write aside, then rename over
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    bool ok = fd >= 0
+           && write_all(fd, &header, sizeof(header))
+           && write_all(fd, input, input_len)
+           && write_all(fd, output, output_len);
+    if (fd >= 0 && close(fd) != 0) ok = false;
+    if (ok && rename(tmp_path, path) != 0) ok = false;
+    if (!ok && fd >= 0) unlink(tmp_path);
+    FREE(input);
+    FREE(output);
+    if (!ok) return false;
+
+    pthread_mutex_lock(&DISK_CACHE_LOCK);
+    DISK_CACHE.stats.stores++;
+    DISK_CACHE.stats.bytes += sizeof(header) + input_len + output_len;
+    if (DISK_CACHE.max_bytes && DISK_CACHE.stats.bytes > DISK_CACHE.max_bytes)
+        rescan_and_evict();
+    pthread_mutex_unlock(&DISK_CACHE_LOCK);
+    return true;
+}
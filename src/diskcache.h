@@ -0,0 +1,47 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+
+/**
+ * @brief Кэш производных в каталоге на диске, один на процесс.
+ *
+ * Ключ - structhash::hash_expression входного дерева, переменная и порядок.
+ * Файл хранит бинарные образы (serialize_tree) и входа, и результата: при
+ * чтении проверяются заголовок, контрольные суммы образов и точное совпадение
+ * сохраненного входа с запрошенным, так что коллизия хэша или битый файл
+ * дают промах, а не чужую производную. Запись атомарна (временный файл +
+ * rename), при превышении лимита удаляются давно не читанные файлы (по mtime).
+ * Потокобезопасен; пока кэш не открыт, все вызовы - промахи.
+ */
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t stores;
+    size_t rejected;    // Файлы, не прошедшие проверку
+    size_t evictions;
+    size_t bytes;       // Текущий размер каталога (оценка)
+} diskcache_stats_t;
+
+// max_bytes == 0 - без ограничения размера
+bool diskcache_open(const char *dir, size_t max_bytes);
+void diskcache_close(void);
+bool diskcache_enabled(void);
+
+uint64_t diskcache_key(const FRONT_COMPIL_T *src);
+
+/**
+ * @brief Ищет производную порядка order по переменной var.
+ *
+ * @return Корень нового дерева (переменные - индексы в src->vars) или nullptr.
+ */
+NODE_T *diskcache_lookup(const FRONT_COMPIL_T *src, uint64_t key, size_t var, size_t order);
+
+bool diskcache_store(const FRONT_COMPIL_T *src, uint64_t key, size_t var, size_t order, const FRONT_COMPIL_T *result);
+
+diskcache_stats_t diskcache_stats(void);
+
+#endif // DISKCACHE_H
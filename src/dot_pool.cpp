@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "dot_pool.h"
+#include "util.h"
+#include "base.h"
+#include "io_utils.h"
+#include "stats.h"
+#include "trace.h"
+
+extern char **environ;
+
+const size_t DOT_POOL_MAX_LIMIT = 32;
+
+typedef enum {
+    JOB_FREE,
+    JOB_RESERVED,       // Slot taken, dot is being spawned and fed outside the lock
+    JOB_RUNNING,
+    JOB_WAITED,         // A thread is blocked in waitpid on it outside the lock
+} JOB_STATE;
+
+typedef struct {
+    JOB_STATE state;
+    uint64_t  seq;      // Submission order: the oldest job is waited for first
+    pid_t     pid;
+    char      svg_path[512];
+} dot_job_t;
+
+typedef struct {
+    dot_job_t jobs[DOT_POOL_MAX_LIMIT];
+    size_t    used;     // Slots not JOB_FREE
+    size_t    limit;
+    size_t    failed;
+    uint64_t  next_seq;
+    bool      initialized;
+} DotPool;
+
+global DotPool DOT_POOL = {};
+// Sessions on different threads share one pool, so the bound holds for the whole process.
+// The lock only guards the slots: spawning, writing the text and blocking waits happen without it
+global pthread_mutex_t DOT_POOL_LOCK = PTHREAD_MUTEX_INITIALIZER;
+global pthread_cond_t  DOT_POOL_CHANGED = PTHREAD_COND_INITIALIZER;
+
+function size_t default_limit(void) {
+    // At least two, so that the caller keeps working while one dot renders even on a single core
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 2) return 2;
+    return (size_t) cpus < DOT_POOL_MAX_LIMIT ? (size_t) cpus : DOT_POOL_MAX_LIMIT;
+}
+
+function void dot_pool_init(void) {
+    if (DOT_POOL.initialized) return;
+    // A dot that dies before reading all of stdin must not take the whole process down with it
+    signal(SIGPIPE, SIG_IGN);
+    if (!DOT_POOL.limit) DOT_POOL.limit = default_limit();
+    DOT_POOL.initialized = true;
+}
+
+void dot_pool_set_limit(size_t limit) {
+    if (limit > DOT_POOL_MAX_LIMIT) limit = DOT_POOL_MAX_LIMIT;
+    pthread_mutex_lock(&DOT_POOL_LOCK);
+    DOT_POOL.limit = limit ? limit : default_limit();
+    pthread_mutex_unlock(&DOT_POOL_LOCK);
+}
+
+function void release_slot(dot_job_t *job, bool ok) {
+    if (!ok) {
+        ERROR_MSG("dot не смог отрисовать %s\n", job->svg_path);
+        DOT_POOL.failed++;
+    }
+    job->state = JOB_FREE;
+    DOT_POOL.used--;
+    pthread_cond_broadcast(&DOT_POOL_CHANGED);
+}
+
+function bool exited_ok(pid_t rc, int status) {
+    return rc > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+function void reap_finished(void) {
+    for (size_t i = 0; i < DOT_POOL_MAX_LIMIT; ++i) {
+        dot_job_t *job = &DOT_POOL.jobs[i];
+        if (job->state != JOB_RUNNING) continue;
+        int status = 0;
+        pid_t rc = 0;
+        do {
+            rc = waitpid(job->pid, &status, WNOHANG);
+        } while (rc < 0 && errno == EINTR);
+        if (rc != 0) release_slot(job, exited_ok(rc, status));
+    }
+}
+
+function dot_job_t *oldest_running(void) {
+    dot_job_t *oldest = nullptr;
+    for (size_t i = 0; i < DOT_POOL_MAX_LIMIT; ++i) {
+        dot_job_t *job = &DOT_POOL.jobs[i];
+        if (job->state == JOB_RUNNING && (!oldest || job->seq < oldest->seq)) oldest = job;
+    }
+    return oldest;
+}
+
+// Called with the lock held; returns with it held after one job has finished or the pool has changed
+function void wait_for_change(void) {
+    dot_job_t *job = oldest_running();
+    if (!job) {
+        // Every busy slot is being spawned or waited for by another thread
+        pthread_cond_wait(&DOT_POOL_CHANGED, &DOT_POOL_LOCK);
+        return;
+    }
+    job->state = JOB_WAITED;
+    pid_t pid = job->pid;
+    pthread_mutex_unlock(&DOT_POOL_LOCK);
+    int status = 0;
+    pid_t rc = 0;
+    do {
+        rc = waitpid(pid, &status, 0);
+    } while (rc < 0 && errno == EINTR);
+    pthread_mutex_lock(&DOT_POOL_LOCK);
+    release_slot(job, exited_ok(rc, status));
+}
+
+function dot_job_t *reserve_slot(void) {
+    dot_pool_init();
+    reap_finished();
+    while (DOT_POOL.used >= DOT_POOL.limit) {
+        wait_for_change();
+        reap_finished();
+    }
+    for (size_t i = 0; i < DOT_POOL_MAX_LIMIT; ++i) {
+        dot_job_t *job = &DOT_POOL.jobs[i];
+        if (job->state != JOB_FREE) continue;
+        job->state = JOB_RESERVED;
+        job->seq   = DOT_POOL.next_seq++;
+        DOT_POOL.used++;
+        return job;
+    }
+    return nullptr;
+}
+
+// The slot is ours until it leaves JOB_RESERVED, so it is filled in without the lock
+function bool spawn_dot(dot_job_t *job, const char *dot_text, size_t len, const char *svg_path) {
+    int fds[2] = {};
+    if (pipe2(fds, O_CLOEXEC) != 0) return false;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+
+    snprintf(job->svg_path, sizeof(job->svg_path), "%s", svg_path);
+    char *argv[] = {(char *) "dot", (char *) "-Tsvg", (char *) "-o", job->svg_path, nullptr};
+
+    int rc = posix_spawnp(&job->pid, "dot", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    if (rc != 0) {
+        close(fds[1]);
+        return false;
+    }
+    // A failed write still leaves a child to reap; dot then reports the truncated input itself
+    bool sent = write_all(fds[1], dot_text, len);
+    close(fds[1]);
+    return sent;
+}
+
+int dot_pool_submit(const char *dot_text, size_t len, const char *svg_path) {
+    if (!dot_text || !svg_path) return -1;
+    stats_timer_t timer = stats_phase_begin(STATS_DOT);
+    pthread_mutex_lock(&DOT_POOL_LOCK);
+    dot_job_t *job = reserve_slot();
+    pthread_mutex_unlock(&DOT_POOL_LOCK);
+    if (!job) {
+        stats_phase_end(&timer);
+        return -1;
+    }
+
+    job->pid = 0;
+    bool sent = spawn_dot(job, dot_text, len, svg_path);
+
+    pthread_mutex_lock(&DOT_POOL_LOCK);
+    if (job->pid > 0) {
+        job->state = JOB_RUNNING;
+        pthread_cond_broadcast(&DOT_POOL_CHANGED);
+    }
+    else {
+        job->state = JOB_FREE;
+        DOT_POOL.used--;
+        pthread_cond_broadcast(&DOT_POOL_CHANGED);
+    }
+    pthread_mutex_unlock(&DOT_POOL_LOCK);
+    stats_phase_end(&timer);
+    return sent ? 0 : -1;
+}
+
+size_t dot_pool_wait_all(void) {
+    stats_timer_t timer = stats_phase_begin(STATS_DOT);
+    trace_span_t span = trace_begin("dot_pool_wait_all");
+    pthread_mutex_lock(&DOT_POOL_LOCK);
+    while (DOT_POOL.used)
+        wait_for_change();
+    size_t failed = DOT_POOL.failed;
+    DOT_POOL.failed = 0;
+    pthread_mutex_unlock(&DOT_POOL_LOCK);
+    trace_end(&span);
+    stats_phase_end(&timer);
+    return failed;
+}
@@ -0,0 +1,33 @@
+#ifndef DOT_POOL_H
+#define DOT_POOL_H
+
+#include <stddef.h>
+
+/**
+ * @brief Ставит рендер DOT-текста в SVG в очередь процессов dot.
+ *
+ * Запускает `dot -Tsvg -o svg_path` через posix_spawnp и передает текст через
+ * stdin, временные файлы не создаются. Одновременно работает не больше
+ * dot_pool_set_limit() процессов: при заполнении пула вызов ждет самый старый.
+ * Пул один на процесс и потокобезопасен.
+ *
+ * @param dot_text Текст графа.
+ * @param len      Длина текста в байтах.
+ * @param svg_path Куда dot запишет картинку.
+ * @return 0, если процесс запущен и получил текст, иначе -1.
+ */
+int dot_pool_submit(const char *dot_text, size_t len, const char *svg_path);
+
+/**
+ * @brief Максимум одновременно работающих dot (0 - по числу процессоров).
+ */
+void dot_pool_set_limit(size_t limit);
+
+/**
+ * @brief Дожидается всех запущенных dot.
+ *
+ * @return Количество процессов, завершившихся с ошибкой.
+ */
+size_t dot_pool_wait_all(void);
+
+#endif // DOT_POOL_H
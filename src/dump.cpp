@@ -2,12 +2,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <math.h>
 
 #include "io_utils.h"
 #include "differentiator.h"
 #include "base.h"
 #include "logger.h"
 #include "const_strings.h"
+#include "article.h"
+#include "dot_pool.h"
+#include "structhash.h"
+#include "session.h"
+#include "trace.h"
 
 const char *node_type_name(const NODE_T *node) {
     if (!node) return "UNKNOWN";
@@ -93,10 +99,152 @@ void format_node_value(const FRONT_COMPIL_T *eqtree, const NODE_T *node, char *b
     }
 }
 
-function int write_node_full(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp, int *id_counter) {
-    if (!subtree || !fp || !id_counter) return -1;
-    int my_id = (*id_counter)++;
+void format_tree_label(const FRONT_COMPIL_T *eqtree, char *buf, size_t size) {
+    if (!buf || !size) return;
+    const char *name = (eqtree && eqtree->name && *eqtree->name) ? eqtree->name : "equation";
+    if (!eqtree || !eqtree->diff_order) {
+        snprintf(buf, size, "%s", name);
+        return;
+    }
+    const mystr::mystr_t *var = varlist::get(eqtree->vars, eqtree->diff_var);
+    const char *var_name = (var && var->str && *var->str) ? var->str : "unknown variable";
+    if (eqtree->diff_order == 1)
+        snprintf(buf, size, "derivative of %s with respect to %s", name, var_name);
+    else
+        snprintf(buf, size, "derivative of order %zu of %s with respect to %s", eqtree->diff_order, name, var_name);
+}
+
+function void write_value_token(FILE *file, const FRONT_COMPIL_T *eqtree, const NODE_T *node) {
+    switch (node->type) {
+        case NUM_T:
+            fprintf(file, "%.17g", node->value.num);
+            break;
+        case OP_T:
+            fputs(operator_symbol(node->value.opr), file);
+            break;
+        case VAR_T: {
+            const mystr::mystr_t *name = varlist::get(eqtree->vars, node->value.var);
+            fputs((name && name->str) ? name->str : "var", file);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+typedef struct {
+    const NODE_T *node;
+    int           state;
+} prefix_cursor_t;
+
+void save_tree_to_prefix_file(FILE *file, const FRONT_COMPIL_T *eqtree) {
+    VERIFY(file && eqtree, ERROR_MSG("save_tree_to_prefix_file: file or tree is nullptr\n"); return;);
+    char label[512] = "";
+    format_tree_label(eqtree, label, sizeof(label));
+    fprintf(file, "%s\n", label);
+    if (!eqtree->root) return;
+
+    size_t depth = 0, capacity = 64;
+    prefix_cursor_t *stack = TYPED_CALLOC(capacity, prefix_cursor_t);
+    VERIFY(stack != nullptr, ERROR_MSG("save_tree_to_prefix_file: no memory\n"); return;);
+    stack[depth++] = (prefix_cursor_t) {eqtree->root, 0};
+    while (depth) {
+        prefix_cursor_t *top = &stack[depth - 1];
+        const NODE_T *child = nullptr;
+        switch (top->state++) {
+            case 0:
+                fputc('(', file);
+                write_value_token(file, eqtree, top->node);
+                continue;
+            case 1:
+                child = top->node->left;
+                break;
+            case 2:
+                child = top->node->right;
+                break;
+            default:
+                fputc(')', file);
+                --depth;
+                continue;
+        }
+        fputc(' ', file);
+        if (!child) {
+            fputs("nil", file);
+            continue;
+        }
+        if (depth == capacity) {
+            prefix_cursor_t *grown = (prefix_cursor_t *) realloc(stack, 2 * capacity * sizeof(prefix_cursor_t));
+            if (!grown) {
+                ERROR_MSG("save_tree_to_prefix_file: no memory\n");
+                break;
+            }
+            stack = grown;
+            capacity *= 2;
+        }
+        stack[depth++] = (prefix_cursor_t) {child, 0};
+    }
+    fputc('\n', file);
+    FREE(stack);
+}
+
+function int infix_prec(const NODE_T *node) {
+    if (!node || node->type != OP_T) return 4;
+    switch (node->value.opr) {
+        case ADD:
+        case SUB:   return 1;
+        case MUL:
+        case DIV:   return 2;
+        case POW:   return 3;
+        default:    return 4;
+    }
+}
+
+// Wraps operands so that get_grammar rebuilds exactly the same tree (left-associative +-*/, primary-only ^).
+function void write_infix(FILE *file, const FRONT_COMPIL_T *eqtree, const NODE_T *node, int parent_prec, bool right_side) {
+    if (!node) return;
+    int  prec = infix_prec(node);
+    bool wrap = (node->type == NUM_T && signbit(node->value.num))
+             || prec < parent_prec
+             || (prec == parent_prec && (right_side || prec == 3));
+    if (wrap) fputc('(', file);
+    if (node->type != OP_T)
+        write_value_token(file, eqtree, node);
+    else if (prec < 4) {
+        write_infix(file, eqtree, node->left, prec, false);
+        fprintf(file, " %s ", operator_symbol(node->value.opr));
+        write_infix(file, eqtree, node->right, prec, true);
+    }
+    else {
+        fprintf(file, "%s(", operator_symbol(node->value.opr));
+        write_infix(file, eqtree, node->left, 0, false);
+        if (node->right) {
+            fputs(", ", file);
+            write_infix(file, eqtree, node->right, 0, false);
+        }
+        fputc(')', file);
+    }
+    if (wrap) fputc(')', file);
+}
 
+void print(FILE *file, const FRONT_COMPIL_T *eqtree) {
+    VERIFY(file && eqtree, ERROR_MSG("print: file or tree is nullptr\n"); return;);
+    char label[512] = "";
+    format_tree_label(eqtree, label, sizeof(label));
+    fprintf(file, "%s\n", label);
+    write_infix(file, eqtree, eqtree->root, 0, false);
+    fputc('\n', file);
+}
+
+void print(FRONT_COMPIL_T *eqtree) {
+    print(stdout, eqtree);
+}
+
+void print_infix(FILE *file, const FRONT_COMPIL_T *eqtree) {
+    VERIFY(file && eqtree, ERROR_MSG("print_infix: file or tree is nullptr\n"); return;);
+    write_infix(file, eqtree, eqtree->root, 0, false);
+}
+
+function void write_full_label(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp, int my_id) {
     char value_buf[64] = "";
     format_node_value(eqtree, subtree, value_buf, sizeof(value_buf));
 
@@ -126,26 +274,9 @@ function int write_node_full(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp,
                 (void *)subtree->right,
                 (void *)subtree->parent,
                 color);
-
-    if (subtree->left) {
-        int left_id = write_node_full(eqtree, subtree->left, fp, id_counter);
-        if (left_id >= 0)
-            fprintf(fp, "\tnode%d -> node%d [color=\"#0c0ccc\", label=\"L\", constraint=true];\n", my_id, left_id);
-    }
-
-    if (subtree->right) {
-        int right_id = write_node_full(eqtree, subtree->right, fp, id_counter);
-        if (right_id >= 0)
-            fprintf(fp, "\tnode%d -> node%d [color=\"#3dad3d\", label=\"R\", constraint=true];\n", my_id, right_id);
-    }
-
-    return my_id;
 }
 
-function int write_node_simple(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp, int *id_counter) {
-    if (!subtree || !fp || !id_counter) return -1;
-    int my_id = (*id_counter)++;
-
+function void write_simple_label(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp, int my_id) {
     char value_buf[64] = "";
     format_node_value(eqtree, subtree, value_buf, sizeof(value_buf));
 
@@ -161,23 +292,200 @@ function int write_node_simple(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp
             color,
             fontsize
         );
+}
+
+function void write_edge(FILE *fp, int from, int to, bool is_left) {
+    if (is_left)
+        fprintf(fp, "\tnode%d -> node%d [color=\"#0c0ccc\", label=\"L\", constraint=true];\n", from, to);
+    else
+        fprintf(fp, "\tnode%d -> node%d [color=\"#3dad3d\", label=\"R\", constraint=true];\n", from, to);
+}
+
+function int write_node_full(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp, int *id_counter) {
+    if (!subtree || !fp || !id_counter) return -1;
+    int my_id = (*id_counter)++;
+    write_full_label(eqtree, subtree, fp, my_id);
+
+    if (subtree->left) {
+        int left_id = write_node_full(eqtree, subtree->left, fp, id_counter);
+        if (left_id >= 0)
+            write_edge(fp, my_id, left_id, true);
+    }
+
+    if (subtree->right) {
+        int right_id = write_node_full(eqtree, subtree->right, fp, id_counter);
+        if (right_id >= 0)
+            write_edge(fp, my_id, right_id, false);
+    }
+
+    return my_id;
+}
+
+function int write_node_simple(FRONT_COMPIL_T *eqtree, NODE_T *subtree, FILE *fp, int *id_counter) {
+    if (!subtree || !fp || !id_counter) return -1;
+    int my_id = (*id_counter)++;
+    write_simple_label(eqtree, subtree, fp, my_id);
 
     if (subtree->left) {
         int left_id = write_node_simple(eqtree, subtree->left, fp, id_counter);
         if (left_id >= 0)
-            fprintf(fp, "\tnode%d -> node%d [color=\"#0c0ccc\", label=\"L\", constraint=true];\n", my_id, left_id);
+            write_edge(fp, my_id, left_id, true);
     }
 
     if (subtree->right) {
         int right_id = write_node_simple(eqtree, subtree->right, fp, id_counter);
         if (right_id >= 0)
-            fprintf(fp, "\tnode%d -> node%d [color=\"#3dad3d\", label=\"R\", constraint=true];\n", my_id, right_id);
+            write_edge(fp, my_id, right_id, false);
+    }
+
+    return my_id;
+}
+
+// ================= Summarized dump =================
+
+const size_t DUMP_SHARE_MIN_NODES   = 4;
+const size_t DUMP_SUMMARY_MIN_NODES = 8;    // a summary box is no smaller than what it replaces
+
+typedef struct {
+    FRONT_COMPIL_T     *eqtree;
+    const dump_limits_t *limits;
+    FILE               *fp;
+    bool                is_simple;
+    structhash::Index   index;
+    int                *drawn;      // id класса -> номер уже нарисованного узла или -1
+    int                 id_counter;
+    size_t              emitted;
+} summary_ctx_t;
+
+function void format_count(size_t value, char *buf, size_t size) {
+    char digits[32] = "";
+    int len = snprintf(digits, sizeof(digits), "%zu", value);
+    size_t pos = 0;
+    for (int i = 0; i < len && pos + 1 < size; ++i) {
+        if (i && (len - i) % 3 == 0 && pos + 2 < size) buf[pos++] = ',';
+        buf[pos++] = digits[i];
+    }
+    buf[pos] = '\0';
+}
+
+// "subtree: 12,345 nodes\nops: *x40, +x12, ..." with the four most frequent operators
+function int write_summary_node(summary_ctx_t *ctx, const NODE_T *subtree) {
+    size_t op_counts[CTH + 1] = {};
+    size_t nodes = 0;
+
+    size_t top = 0, capacity = 64;
+    const NODE_T **stack = TYPED_CALLOC(capacity, const NODE_T *);
+    if (stack) stack[top++] = subtree;
+    while (top) {
+        const NODE_T *node = stack[--top];
+        ++nodes;
+        if (node->type == OP_T && node->value.opr <= CTH) op_counts[node->value.opr]++;
+        if (top + 2 > capacity) {
+            const NODE_T **grown = (const NODE_T **) realloc(stack, capacity * 2 * sizeof(*stack));
+            if (!grown) break;
+            stack = grown;
+            capacity *= 2;
+        }
+        if (node->right) stack[top++] = node->right;
+        if (node->left)  stack[top++] = node->left;
+    }
+    free(stack);
+
+    char count_buf[32] = "";
+    format_count(nodes, count_buf, sizeof(count_buf));
+    char label[256] = "";
+    int len = snprintf(label, sizeof(label), "subtree: %s nodes\\nops:", count_buf);
+    for (size_t shown = 0; shown < 4 && len > 0 && (size_t) len < sizeof(label); ++shown) {
+        size_t best = 0;
+        for (size_t op = 1; op <= CTH; ++op)
+            if (op_counts[op] > op_counts[best]) best = op;
+        if (!op_counts[best]) break;
+        format_count(op_counts[best], count_buf, sizeof(count_buf));
+        len += snprintf(label + len, sizeof(label) - (size_t) len, "%s %s x%s", shown ? "," : "",
+                        operator_symbol((OPERATOR) best), count_buf);
+        op_counts[best] = 0;
     }
 
+    int my_id = ctx->id_counter++;
+    fprintf(ctx->fp, "\tnode%d [label=\"%s\", shape=box, style=\"filled,dashed\", fillcolor=\"#e6e6e6\"];\n",
+            my_id, label);
+    ctx->emitted++;
+    return my_id;
+}
+
+// Number of an already drawn node structurally equal to subtree, or -1
+function int shared_node(summary_ctx_t *ctx, const NODE_T *subtree) {
+    if (!ctx->drawn) return -1;
+    size_t class_id = structhash::id(&ctx->index, subtree);
+    if (class_id == structhash::NPOS || ctx->index.sizes[class_id] < DUMP_SHARE_MIN_NODES) return -1;
+    return ctx->drawn[class_id];
+}
+
+function void remember_drawn(summary_ctx_t *ctx, const NODE_T *subtree, int my_id) {
+    if (!ctx->drawn) return;
+    size_t class_id = structhash::id(&ctx->index, subtree);
+    if (class_id != structhash::NPOS && ctx->drawn[class_id] < 0)
+        ctx->drawn[class_id] = my_id;
+}
+
+function int write_node_summarized(summary_ctx_t *ctx, NODE_T *subtree, size_t depth) {
+    bool is_small = subtree->elements + 1 < DUMP_SUMMARY_MIN_NODES;
+    bool over_depth  = ctx->limits->max_depth && depth >= ctx->limits->max_depth;
+    bool over_budget = ctx->limits->max_nodes && ctx->emitted >= ctx->limits->max_nodes;
+    if (!is_small && (over_depth || over_budget)) {
+        int summary_id = write_summary_node(ctx, subtree);
+        remember_drawn(ctx, subtree, summary_id);
+        return summary_id;
+    }
+
+    int my_id = ctx->id_counter++;
+    ctx->emitted++;
+    if (ctx->is_simple) write_simple_label(ctx->eqtree, subtree, ctx->fp, my_id);
+    else                write_full_label  (ctx->eqtree, subtree, ctx->fp, my_id);
+    remember_drawn(ctx, subtree, my_id);
+
+    NODE_T *children[2] = {subtree->left, subtree->right};
+    for (size_t i = 0; i < 2; ++i) {
+        if (!children[i]) continue;
+        int child_id = shared_node(ctx, children[i]);
+        if (child_id >= 0) {
+            fprintf(ctx->fp, "\tnode%d -> node%d [color=\"#888888\", style=dashed, label=\"%s\", constraint=false];\n",
+                    my_id, child_id, i == 0 ? "L" : "R");
+            continue;
+        }
+        child_id = write_node_summarized(ctx, children[i], depth + 1);
+        write_edge(ctx->fp, my_id, child_id, i == 0);
+    }
     return my_id;
 }
 
-function void generate_dot_dump(FRONT_COMPIL_T *eqtree, bool is_simple, FILE *fp) {
+function void write_tree_summarized(FRONT_COMPIL_T *eqtree, bool is_simple, const dump_limits_t *limits, FILE *fp) {
+    summary_ctx_t ctx = {};
+    ctx.eqtree    = eqtree;
+    ctx.limits    = limits;
+    ctx.fp        = fp;
+    ctx.is_simple = is_simple;
+
+    // Without the index repeated subtrees are simply drawn again; the budgets still bound the output
+    if (limits->share_subtrees && structhash::build(&ctx.index, eqtree->root)) {
+        ctx.drawn = TYPED_CALLOC(ctx.index.distinct ? ctx.index.distinct : 1, int);
+        if (ctx.drawn) memset(ctx.drawn, -1, (ctx.index.distinct ? ctx.index.distinct : 1) * sizeof(int));
+    }
+
+    write_node_summarized(&ctx, eqtree->root, 0);
+
+    free(ctx.drawn);
+    structhash::destruct(&ctx.index);
+}
+
+// Whether some node lies at depth max_depth or below (the root is at 0); never walks past that depth
+function bool reaches_depth(const NODE_T *node, size_t depth, size_t max_depth) {
+    if (!node) return false;
+    if (depth >= max_depth) return true;
+    return reaches_depth(node->left, depth + 1, max_depth) || reaches_depth(node->right, depth + 1, max_depth);
+}
+
+function void generate_dot_dump(FRONT_COMPIL_T *eqtree, bool is_simple, const dump_limits_t *limits, FILE *fp) {
     if (!fp) return;
     fprintf(fp,
             "digraph EquationTree {\n"
@@ -193,32 +501,36 @@ function void generate_dot_dump(FRONT_COMPIL_T *eqtree, bool is_simple, FILE *fp
     }
 
     int id_counter = 0;
-    if (is_simple)
+    bool summarize = eqtree->root &&
+                     ((limits->max_nodes && eqtree->root->elements + 1 > limits->max_nodes) ||
+                      (limits->max_depth && reaches_depth(eqtree->root, 0, limits->max_depth)));
+    if (summarize)
+        write_tree_summarized(eqtree, is_simple, limits, fp);
+    else if (is_simple)
         write_node_simple(eqtree, eqtree->root, fp, &id_counter);
     else
         write_node_full(eqtree, eqtree->root, fp, &id_counter);
     fprintf(fp, "}\n");
 }
 
-function int generate_files(FRONT_COMPIL_T *eqtree, bool is_simple, const char *dir, char *out_basename, size_t out_size) {
-    local size_t dump_counter = 0;
+function int generate_files(session_t *session, FRONT_COMPIL_T *eqtree, bool is_simple, const char *dir, char *out_basename, size_t out_size) {
     const char *outdir = (dir && dir[0] != '\0') ? dir : ".";
     size_t outdir_len = strlen(outdir);
 
-    char dot_path[512] = "";
-    if (outdir_len && outdir[outdir_len - 1] == '/')
-        snprintf(dot_path, sizeof(dot_path), "%stree_dump_%zu.dot.tmp", outdir, dump_counter);
-    else
-        snprintf(dot_path, sizeof(dot_path), "%s/tree_dump_%zu.dot.tmp", outdir, dump_counter);
-
-    FILE *fp = fopen(dot_path, "w");
-    if (!fp) return -1;
+    trace_span_t span = trace_begin_arg("graphviz", "dump", (long long) session->dump_counter);
+    char *dot_text = nullptr;
+    size_t dot_len = 0;
+    FILE *fp = open_memstream(&dot_text, &dot_len);
+    if (!fp) {
+        trace_end(&span);
+        return -1;
+    }
 
-    generate_dot_dump(eqtree, is_simple, fp);
+    generate_dot_dump(eqtree, is_simple, &session->dump_limits, fp);
     fclose(fp);
 
     char image_basename[256] = "";
-    snprintf(image_basename, sizeof(image_basename), "tree_dump_%zu.svg", dump_counter);
+    snprintf(image_basename, sizeof(image_basename), "tree_dump_%zu.svg", session->dump_counter);
 
     char svg_path[512] = "";
     if (outdir_len && outdir[outdir_len - 1] == '/')
@@ -226,331 +538,80 @@ function int generate_files(FRONT_COMPIL_T *eqtree, bool is_simple, const char *
     else
         snprintf(svg_path, sizeof(svg_path), "%s/%s", outdir, image_basename);
 
-    char command[1024] = "";
-    snprintf(command, sizeof(command), "dot -Tsvg %s -o %s", dot_path, svg_path);
-    (void) system(command);
+    // dot renders in the background; the <img> tag resolves once dot_pool_wait_all() has returned
+    int rc = dot_pool_submit(dot_text, dot_len, svg_path);
+    free(dot_text);
+    trace_end(&span);
+    if (rc != 0) return -1;
 
     if (out_basename && out_size > 0) {
         strncpy(out_basename, image_basename, out_size);
         out_basename[out_size - 1] = '\0';
     }
 
-    ++dump_counter;
+    ++session->dump_counter;
     return 0;
 }
 
-function void dump_internal(FRONT_COMPIL_T *eqtree, bool is_simple, const char *fmt, va_list ap) {
-    const char *dir = logger_get_active_dir();
+function void dump_internal(session_t *session, FRONT_COMPIL_T *eqtree, bool is_simple, const char *fmt, va_list ap) {
+    if (!session) return;
+    Logger *logger = &session->logger;
+    const char *dir = logger_get_active_dir(logger);
     char basename[256] = "";
-    int rc = generate_files(eqtree, is_simple, dir, basename, sizeof(basename));
+    int rc = generate_files(session, eqtree, is_simple, dir, basename, sizeof(basename));
 
-    FILE *log_file = logger_get_file();
-    if (!log_file)
+    if (!logger_get_file(logger))
         return;
 
+    // Article text may be queued for the same log file; keep it above this dump
+    article_flush(session);
+
     if (fmt != nullptr) {
-        fprintf(log_file, "<p>");
-        vfprintf(log_file, fmt, ap);
-        fprintf(log_file, "</p>\n");
-        fflush(log_file);
+        char message[1024] = "";
+        vsnprintf(message, sizeof(message), fmt, ap);
+        logger_printf(logger, "<p>%s</p>\n", message);
     }
     else {
-        fprintf(log_file, "<p>Dump of %s</p>", eqtree->name);
-        fflush(log_file);
+        char label[512] = "";
+        format_tree_label(eqtree, label, sizeof(label));
+        logger_printf(logger, "<p>Dump of %s</p>", label);
     }
 
     if (rc == 0 && basename[0] != '\0')
-        fprintf(log_file, "<img src=\"%s\">\n", basename);
+        logger_printf(logger, "<img src=\"%s\">\n", basename);
     else
-        fprintf(log_file, "<p>SVG not generated</p>\n");
-
-    fflush(log_file);
+        logger_write(logger, "<p>SVG not generated</p>\n", sizeof("<p>SVG not generated</p>\n") - 1);
 }
 
-void full_dump(FRONT_COMPIL_T *node) {
+void full_dump(session_t *session, FRONT_COMPIL_T *node) {
     va_list ap = {};
-    dump_internal(node, false, nullptr, ap);
+    dump_internal(session, node, false, nullptr, ap);
 }
 
-void full_dump(FRONT_COMPIL_T *node, const char *fmt, ...) {
+void full_dump(session_t *session, FRONT_COMPIL_T *node, const char *fmt, ...) {
     va_list ap = {};
     va_start(ap, fmt);
-    dump_internal(node, false, fmt, ap);
+    dump_internal(session, node, false, fmt, ap);
     va_end(ap);
 }
 
-void simple_dump(FRONT_COMPIL_T *node) {
+void simple_dump(session_t *session, FRONT_COMPIL_T *node) {
     va_list ap = {};
-    dump_internal(node, true, nullptr, ap);
+    dump_internal(session, node, true, nullptr, ap);
 }
 
-void simple_dump(FRONT_COMPIL_T *node, const char *fmt, ...) {
+void simple_dump(session_t *session, FRONT_COMPIL_T *node, const char *fmt, ...) {
     va_list ap = {};
     va_start(ap, fmt);
-    dump_internal(node, true, fmt, ap);
+    dump_internal(session, node, true, fmt, ap);
     va_end(ap);
 }
 
-function int latex_prec_op(OPERATOR op) {
-    switch (op) {
-        case ADD:
-        case SUB:   return 1;
-        case MUL:
-        case DIV:   return 2;
-        case POW:   return 3;
-        default:    return 4;
-    }
-}
-
-function int latex_prec(const NODE_T *node) {
-    if (!node || node->type != OP_T) return 5;
-    return latex_prec_op(node->value.opr);
-}
-
-function bool need_parens(OPERATOR parent, const NODE_T *child, bool right_side) {
-    if (!child || child->type != OP_T) return false;
-    if (parent == DIV) return false;
-    int parent_prec = latex_prec_op(parent);
-    int child_prec  = latex_prec(child);
-    if (parent == POW) {
-        return right_side ? (child_prec <= parent_prec) : (child_prec < parent_prec);
-    }
-    if (child_prec < parent_prec) return true;
-    if (child_prec > parent_prec) return false;
-    if (parent == SUB && right_side) return true;
-    return false;
-}
-
-function const char *latex_func_name(OPERATOR op) {
-    switch (op) {
-        case LN:   return "\\ln";
-        case SIN:  return "\\sin";
-        case COS:  return "\\cos";
-        case TAN:  return "\\tan";
-        case CTG:  return "\\cot";
-        case ASIN: return "\\arcsin";
-        case ACOS: return "\\arccos";
-        case ATAN: return "\\arctan";
-        case ACTG: return "\\arccot";
-        case SINH: return "\\sinh";
-        case COSH: return "\\cosh";
-        case TANH: return "\\tanh";
-        case CTH:  return "\\coth";
-        default:   return nullptr;
-    }
-}
-
-function size_t latex_size(FRONT_COMPIL_T *tree, NODE_T *node) {
-    if (!tree || !node) return 0;
-    switch (node->type) {
-        case NUM_T:
-            return 48;
-        case VAR_T: {
-            const mystr::mystr_t *name = tree->vars ? varlist::get(tree->vars, node->value.var) : nullptr;
-            return (name && name->str) ? strlen(name->str) : 0;
-        }
-        case OP_T: {
-            size_t left_len = node->left ? latex_size(tree, node->left) : 0;
-            size_t right_len = node->right ? latex_size(tree, node->right) : 0;
-            switch (node->value.opr) {
-                case DIV:
-                    return left_len + right_len + 9;
-                case ADD:
-                case SUB: {
-                    size_t extra = (need_parens(node->value.opr, node->left, false) ? 2 : 0) +
-                                   (need_parens(node->value.opr, node->right, true) ? 2 : 0);
-                    return left_len + right_len + extra + 3;
-                }
-                case MUL: {
-                    size_t extra = (need_parens(node->value.opr, node->left, false) ? 2 : 0) +
-                                   (need_parens(node->value.opr, node->right, true) ? 2 : 0);
-                    return left_len + right_len + extra + 7;
-                }
-                case POW: {
-                    size_t extra = (need_parens(node->value.opr, node->left, false) ? 2 : 0);
-                    size_t exp_extra = (need_parens(node->value.opr, node->right, true) ? 2 : 0);
-                    if (right_len == 0) return left_len + extra;
-                    return left_len + right_len + extra + exp_extra + 3;
-                }
-                case LOG: {
-                    size_t base_part = 0;
-                    if (node->right && right_len) base_part = 3 + right_len; // _{ base }
-                    return 4 + base_part + 2 + left_len;
-                }
-                case LN:
-                case SIN:
-                case COS:
-                case TAN:
-                case CTG:
-                case ASIN:
-                case ACOS:
-                case ATAN:
-                case ACTG:
-                case SINH:
-                case COSH:
-                case TANH:
-                case CTH: {
-                    const char *name = latex_func_name(node->value.opr);
-                    size_t name_len = name ? strlen(name) : 0;
-                    return name_len + 2 + left_len;
-                }
-                case SQRT:
-                    return 6 + left_len + 1;
-                default:
-                    return left_len + right_len;
-            }
-        }
-        default:
-            return 0;
-    }
-}
-
-function void append_char(char **dst, char ch) {
-    if (!dst || !*dst) return;
-    **dst = ch;
-    ++(*dst);
-}
-
-function void append_str(char **dst, const char *src) {
-    if (!dst || !*dst || !src) return;
-    size_t len = strlen(src);
-    memcpy(*dst, src, len);
-    *dst += len;
-}
-
-function void latex_emit(FRONT_COMPIL_T *tree, NODE_T *node, char **out) {
-    if (!tree || !node || !out || !*out) return;
-    switch (node->type) {
-        case NUM_T: {
-            if (node->value.num < 0)
-                append_char(out, '(');
-            char raw[64] = "";
-            int written = snprintf(raw, sizeof(raw), "%.15g", node->value.num);
-            if (written <= 0) break;
-            char *exp = strchr(raw, 'e');
-            if (!exp) exp = strchr(raw, 'E');
-            if (!exp) {
-                append_str(out, raw);
-                if (node->value.num < 0)
-                    append_char(out, ')');
-                break;
-            }
-            int exponent = atoi(exp + 1);
-            *exp = '\0';
-            bool drop_mantissa = (strcmp(raw, "1") == 0);
-            if (!drop_mantissa) {
-                append_str(out, raw);
-                append_str(out, " \\cdot ");
-            }
-            append_str(out, "10^{");
-            char exp_buf[16] = "";
-            snprintf(exp_buf, sizeof(exp_buf), "%d", exponent);
-            append_str(out, exp_buf);
-            append_char(out, '}');
-            if (node->value.num < 0)
-                    append_char(out, ')');
-            break;
-        }
-        case VAR_T: {
-            const mystr::mystr_t *name = tree->vars ? varlist::get(tree->vars, node->value.var) : nullptr;
-            if (name && name->str) append_str(out, name->str);
-            break;
-        }
-        case OP_T: {
-            switch (node->value.opr) {
-                case DIV:
-                    append_str(out, "\\frac{");
-                    latex_emit(tree, node->left, out);
-                    append_str(out, "}{");
-                    latex_emit(tree, node->right, out);
-                    append_char(out, '}');
-                    return;
-                case POW: {
-                    bool wrap_left = need_parens(node->value.opr, node->left, false);
-                    bool wrap_right = need_parens(node->value.opr, node->right, true);
-                    if (wrap_left) append_char(out, '(');
-                    latex_emit(tree, node->left, out);
-                    if (wrap_left) append_char(out, ')');
-                    if (node->right) {
-                        append_str(out, "^{");
-                        if (wrap_right) append_char(out, '(');
-                        latex_emit(tree, node->right, out);
-                        if (wrap_right) append_char(out, ')');
-                        append_char(out, '}');
-                    }
-                    return;
-                }
-                case LOG:
-                    append_str(out, "\\log");
-                    if (node->right) {
-                        append_str(out, "_{");
-                        latex_emit(tree, node->right, out);
-                        append_char(out, '}');
-                    }
-                    append_char(out, '{');
-                    latex_emit(tree, node->left, out);
-                    append_char(out, '}');
-                    return;
-                case SQRT:
-                    append_str(out, "\\sqrt{");
-                    latex_emit(tree, node->left, out);
-                    append_char(out, '}');
-                    return;
-                default: {
-                    const char *func = latex_func_name(node->value.opr);
-                    if (func) {
-                        append_str(out, func);
-                        append_char(out, '{');
-                        bool wrap_arg = node->left && node->left->type == OP_T;
-                        if (wrap_arg) append_char(out, '(');
-                        latex_emit(tree, node->left, out);
-                        if (wrap_arg) append_char(out, ')');
-                        append_char(out, '}');
-                        return;
-                    }
-                }
-            }
-            bool wrap_left = need_parens(node->value.opr, node->left, false);
-            bool wrap_right = need_parens(node->value.opr, node->right, true);
-            if (wrap_left) append_char(out, '(');
-            latex_emit(tree, node->left, out);
-            if (wrap_left) append_char(out, ')');
-            switch (node->value.opr) {
-                case ADD: append_str(out, " + "); break;
-                case SUB: append_str(out, " - "); break;
-                case MUL: append_str(out, " \\cdot "); break;
-                default: break;
-            }
-            if (wrap_right) append_char(out, '(');
-            latex_emit(tree, node->right, out);
-            if (wrap_right) append_char(out, ')');
-            break;
-        }
-        default:
-            break;
-    }
-}
-
-// U need to free the returned string
-char *latex_dump(FRONT_COMPIL_T *node) {
-    if (!node || !node->root) {
-        ERROR_MSG("latex_dump: node or node->root is nullptr");
-        return nullptr;
-    }
-    size_t len = latex_size(node, node->root);
-    char *buf = TYPED_CALLOC(len + 1, char);
-    if (!buf) return nullptr;
-    char *cursor = buf;
-    latex_emit(node, node->root, &cursor);
-    if (cursor) *cursor = '\0';
-    return buf;
-}
-
-const char *get_random_str_to_dif_op(OPERATOR op) {
-    int is_op_string = randint(0, 2); // Если 1 то выдает строку оператора, иначе глобальную
+const char *get_random_str_to_dif_op(session_t *session, OPERATOR op) {
+    int is_op_string = session_randint(session, 0, 2); // Если 1 то выдает строку оператора, иначе глобальную
     if (is_op_string == 0)
     switch (op) {
-#define CASE_(OPR) case OPR: return OPR##_FUNC_STR[randint(0, ARRAY_COUNT(OPR##_FUNC_STR))]
+#define CASE_(OPR) case OPR: return OPR##_FUNC_STR[session_randint(session, 0, ARRAY_COUNT(OPR##_FUNC_STR))]
             CASE_(ADD);
             CASE_(SUB);
             CASE_(MUL);
@@ -572,13 +633,13 @@ const char *get_random_str_to_dif_op(OPERATOR op) {
             CASE_(TANH);
             CASE_(CTH);
             default:
-                return STEPS_STR[randint(0, ARRAY_COUNT(STEPS_STR))];
+                return STEPS_STR[session_randint(session, 0, ARRAY_COUNT(STEPS_STR))];
 #undef CASE_
         }
     else if (is_op_string == 1) {
-        return STEPS_STR[randint(0, ARRAY_COUNT(STEPS_STR))];
+        return STEPS_STR[session_randint(session, 0, ARRAY_COUNT(STEPS_STR))];
     }
     else /*if (is_op_string == 2)*/ {
-        return COMPLEX_FUNC_STR[randint(0, ARRAY_COUNT(COMPLEX_FUNC_STR))];
+        return COMPLEX_FUNC_STR[session_randint(session, 0, ARRAY_COUNT(COMPLEX_FUNC_STR))];
     }
 }
\ No newline at end of file
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gen.h"
+#include "intern.h"
+#include "util.h"
+#include "base.h"
+
+namespace gen {
+
+const size_t MAX_ATOM_DEPTH = 8;
+const size_t VAR_X = 0;
+const size_t VAR_Y = 1;
+
+const char *SHAPE_NAMES[SHAPE_COUNT] = {"pow_log", "wide_sum", "trig", "mixed"};
+const char *RANDOM_VAR_NAMES[RANDOM_MAX_VARS] = {"x", "y", "z", "t", "u", "v", "w", "s"};
+
+const OPERATOR UNARY_OPS[]  = {LN, SIN, COS, TAN, CTG, ASIN, ACOS, ATAN, ACTG, SQRT, SINH, COSH, TANH, CTH};
+const OPERATOR BINARY_OPS[] = {ADD, SUB, MUL, DIV, POW, LOG};
+
+typedef struct {
+    uint64_t rng;
+    size_t   nodes;
+} gen_t;
+
+// Same generator as session_randint; the state must never be zero
+function uint64_t next(gen_t *g) {
+    return xorshift64s(&g->rng);
+}
+
+function size_t pick(gen_t *g, size_t n) {
+    return (size_t) ((next(g) >> 33) % n);
+}
+
+// A failed node frees its children, so callers just propagate nullptr
+function NODE_T *counted(gen_t *g, NODE_T *result, NODE_T *left, NODE_T *right) {
+    if (!result) {
+        destruct(left);
+        destruct(right);
+        return nullptr;
+    }
+    g->nodes++;
+    return result;
+}
+
+function NODE_T *num(gen_t *g, double value) {
+    return counted(g, new_node(NUM_T, (NODE_VALUE_T) {.num = value}, nullptr, nullptr), nullptr, nullptr);
+}
+
+function NODE_T *var(gen_t *g, size_t idx) {
+    return counted(g, new_node(VAR_T, (NODE_VALUE_T) {.var = idx}, nullptr, nullptr), nullptr, nullptr);
+}
+
+function NODE_T *op(gen_t *g, OPERATOR opr, NODE_T *left, NODE_T *right) {
+    NODE_T *result = left && right ? new_node(OP_T, (NODE_VALUE_T) {.opr = opr}, left, right) : nullptr;
+    return counted(g, result, left, right);
+}
+
+function NODE_T *unary(gen_t *g, OPERATOR opr, NODE_T *arg) {
+    NODE_T *result = arg ? new_node(OP_T, (NODE_VALUE_T) {.opr = opr}, arg, nullptr) : nullptr;
+    return counted(g, result, arg, nullptr);
+}
+
+// Halves and small integers: %.17g prints them exactly
+function NODE_T *small_const(gen_t *g) {
+    return num(g, (double) (pick(g, 8) + 1) * 0.5);
+}
+
+function NODE_T *any_var(gen_t *g) {
+    return var(g, pick(g, 4) ? VAR_X : VAR_Y);
+}
+
+// Argument evaluation order is unspecified, so every random draw below is its own statement:
+// the same seed has to give the same tree whatever the compiler
+function NODE_T *pow_log_atom(gen_t *g) {
+    NODE_T *e = any_var(g);
+    size_t depth = pick(g, MAX_ATOM_DEPTH) + 1;
+    for (size_t level = 0; e && level < depth; ++level) {
+        NODE_T *a = nullptr, *b = nullptr;
+        switch (pick(g, 5)) {
+            case 0:
+                a = small_const(g);
+                b = num(g, (double) (pick(g, 2) + 2));
+                e = op(g, POW, op(g, ADD, e, a), b);
+                break;
+            case 1:
+                a = small_const(g);
+                b = any_var(g);
+                e = op(g, LOG, a, op(g, ADD, e, b));
+                break;
+            case 2:
+                a = any_var(g);
+                b = small_const(g);
+                e = unary(g, LN, op(g, ADD, op(g, MUL, e, a), b));
+                break;
+            case 3:
+                a = small_const(g);
+                e = op(g, POW, a, e);
+                break;
+            default:
+                a = any_var(g);
+                b = small_const(g);
+                e = op(g, POW, e, op(g, MUL, a, b));
+                break;
+        }
+    }
+    return e;
+}
+
+function NODE_T *trig_atom(gen_t *g) {
+    const OPERATOR FUNCS[] = {SIN, COS, TAN, ATAN, SINH, COSH, TANH};
+    NODE_T *e = any_var(g);
+    size_t depth = pick(g, MAX_ATOM_DEPTH) + 1;
+    for (size_t level = 0; e && level < depth; ++level) {
+        if (pick(g, 3) == 0) {
+            NODE_T *k = small_const(g);
+            NODE_T *shift = any_var(g);
+            e = op(g, ADD, op(g, MUL, k, e), shift);
+        }
+        e = unary(g, FUNCS[pick(g, ARRAY_COUNT(FUNCS))], e);
+    }
+    return e;
+}
+
+function NODE_T *monomial(gen_t *g) {
+    NODE_T *k = small_const(g);
+    switch (pick(g, 3)) {
+        case 0: {
+            NODE_T *x = var(g, VAR_X);
+            return op(g, MUL, k, op(g, POW, x, num(g, (double) (pick(g, 6) + 1))));
+        }
+        case 1: {
+            NODE_T *x = var(g, VAR_X);
+            return op(g, MUL, k, op(g, MUL, x, var(g, VAR_Y)));
+        }
+        default:
+            return op(g, MUL, k, any_var(g));
+    }
+}
+
+function NODE_T *atom(gen_t *g, SHAPE shape) {
+    if (shape == SHAPE_MIXED) shape = (SHAPE) pick(g, SHAPE_MIXED);
+    switch (shape) {
+        case SHAPE_POW_LOG:  return pow_log_atom(g);
+        case SHAPE_TRIG:     return trig_atom(g);
+        case SHAPE_WIDE_SUM:
+        default:             return monomial(g);
+    }
+}
+
+function NODE_T *join(gen_t *g, SHAPE shape, NODE_T *left, NODE_T *right) {
+    if (shape == SHAPE_WIDE_SUM) return op(g, pick(g, 4) ? ADD : SUB, left, right);
+    switch (pick(g, 6)) {
+        case 0:  return op(g, MUL, left, right);
+        case 1:  return op(g, SUB, left, right);
+        default: return op(g, ADD, left, right);
+    }
+}
+
+function void destruct_atoms(NODE_T **atoms, size_t count) {
+    for (size_t i = 0; i < count; ++i)
+        destruct(atoms[i]);
+    free(atoms);
+}
+
+// Pairwise joins keep the depth at log2(atoms) above the deepest atom
+function NODE_T *join_balanced(gen_t *g, SHAPE shape, NODE_T **atoms, size_t count) {
+    while (count > 1) {
+        size_t out = 0;
+        for (size_t i = 0; i < count; i += 2) {
+            if (i + 1 == count) {
+                atoms[out++] = atoms[i];
+                continue;
+            }
+            NODE_T *joined = join(g, shape, atoms[i], atoms[i + 1]);
+            if (!joined) {
+                // The failed join has freed its pair; free what was joined and what is left
+                for (size_t j = 0; j < out; ++j)
+                    destruct(atoms[j]);
+                for (size_t j = i + 2; j < count; ++j)
+                    destruct(atoms[j]);
+                return nullptr;
+            }
+            atoms[out++] = joined;
+        }
+        count = out;
+    }
+    return atoms[0];
+}
+
+// Every leaf and operator counts against budget, so the tree has exactly budget nodes unless max_depth cuts it
+function NODE_T *random_node(gen_t *g, const random_options_t *opts, size_t depth, size_t budget) {
+    if (budget <= 1 || depth >= opts->max_depth) {
+        if (pick(g, 5) < 3) return var(g, pick(g, opts->vars_count));
+        return small_const(g);
+    }
+    size_t ops_count = ARRAY_COUNT(UNARY_OPS) + ARRAY_COUNT(BINARY_OPS);
+    size_t choice = pick(g, ops_count);
+    // Two nodes left fit only a unary operator over a leaf
+    if (budget == 2 || choice < ARRAY_COUNT(UNARY_OPS)) {
+        OPERATOR opr = UNARY_OPS[choice % ARRAY_COUNT(UNARY_OPS)];
+        return unary(g, opr, random_node(g, opts, depth + 1, budget - 1));
+    }
+    OPERATOR opr = BINARY_OPS[choice - ARRAY_COUNT(UNARY_OPS)];
+    size_t left_budget = 1 + pick(g, budget - 2);
+    NODE_T *left = random_node(g, opts, depth + 1, left_budget);
+    if (!left) return nullptr;
+    NODE_T *right = random_node(g, opts, depth + 1, budget - 1 - left_budget);
+    return op(g, opr, left, right);
+}
+
+FRONT_COMPIL_T *random_expression(const random_options_t *options, uint64_t seed) {
+    if (!options) return nullptr;
+    random_options_t opts = *options;
+    if (!opts.target_nodes) opts.target_nodes = 1;
+    if (!opts.max_depth)    opts.max_depth = 1;
+    if (!opts.vars_count)   opts.vars_count = 1;
+    if (opts.vars_count > RANDOM_MAX_VARS) opts.vars_count = RANDOM_MAX_VARS;
+
+    gen_t g = {.rng = seed * 0x9E3779B97F4A7C15ull + 0xD1B54A32D192ED03ull, .nodes = 0};
+    if (!g.rng) g.rng = 1;
+    NODE_T *root = random_node(&g, &opts, 1, opts.target_nodes);
+    if (!root) return nullptr;
+    root->parent = nullptr;
+
+    varlist::VarList *vars = varlist::create();
+    FRONT_COMPIL_T *tree = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    bool ok = vars && tree;
+    for (size_t i = 0; ok && i < opts.vars_count; ++i) {
+        mystr::mystr_t name = mystr::construct(RANDOM_VAR_NAMES[i]);
+        ok = varlist::add(vars, &name) == i;
+    }
+    if (!ok) {
+        free(tree);
+        varlist::release(vars);
+        destruct(root);
+        return nullptr;
+    }
+    char name[64] = "";
+    snprintf(name, sizeof(name), "random_%llu", (unsigned long long) seed);
+    tree->name     = intern::get(name);
+    tree->root     = root;
+    tree->vars     = vars;
+    tree->diff_var = varlist::NPOS;
+    return tree;
+}
+
+const char *shape_name(SHAPE shape) {
+    return shape < SHAPE_COUNT ? SHAPE_NAMES[shape] : "unknown";
+}
+
+bool shape_from_name(const char *name, SHAPE *shape) {
+    for (size_t i = 0; i < SHAPE_COUNT; ++i) {
+        if (strcmp(name, SHAPE_NAMES[i]) == 0) {
+            *shape = (SHAPE) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+FRONT_COMPIL_T *generate(SHAPE shape, size_t target_nodes, uint64_t seed) {
+    gen_t g = {.rng = seed * 0x9E3779B97F4A7C15ull + (uint64_t) shape + 1, .nodes = 0};
+    if (!g.rng) g.rng = 1;
+
+    NODE_T **atoms = nullptr;
+    size_t count = 0, capacity = 0;
+    // Every join adds one node, so stop once atoms plus the joins they need reach the target
+    while (!count || g.nodes + count - 1 < target_nodes) {
+        if (count == capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : 64;
+            NODE_T **grown = (NODE_T **) realloc(atoms, new_capacity * sizeof(NODE_T *));
+            if (!grown) {
+                destruct_atoms(atoms, count);
+                return nullptr;
+            }
+            atoms = grown;
+            capacity = new_capacity;
+        }
+        NODE_T *a = atom(&g, shape);
+        if (!a) {
+            destruct_atoms(atoms, count);
+            return nullptr;
+        }
+        atoms[count++] = a;
+    }
+
+    NODE_T *root = join_balanced(&g, shape, atoms, count);
+    free(atoms);
+    if (!root) return nullptr;
+    root->parent = nullptr;
+
+    varlist::VarList *vars = varlist::create();
+    mystr::mystr_t x = mystr::construct("x"), y = mystr::construct("y");
+    FRONT_COMPIL_T *tree = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    if (!vars || !tree || varlist::add(vars, &x) != VAR_X || varlist::add(vars, &y) != VAR_Y) {
+        free(tree);
+        varlist::release(vars);
+        destruct(root);
+        return nullptr;
+    }
+    char name[64] = "";
+    snprintf(name, sizeof(name), "%s_%zu", shape_name(shape), target_nodes);
+    tree->name     = intern::get(name);
+    tree->root     = root;
+    tree->vars     = vars;
+    tree->diff_var = varlist::NPOS;
+    return tree;
+}
+
+} // namespace gen
@@ -0,0 +1,63 @@
+#ifndef GEN_H
+#define GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+
+namespace gen {
+
+typedef enum {
+    SHAPE_POW_LOG,      // Вложенные степени и логарифмы
+    SHAPE_WIDE_SUM,     // Длинная сумма одночленов
+    SHAPE_TRIG,         // Цепочки тригонометрических и гиперболических функций
+    SHAPE_MIXED,        // Все три вперемешку
+    SHAPE_COUNT,
+} SHAPE;
+
+const char *shape_name(SHAPE shape);
+
+// shape_name наоборот; false, если имя неизвестно
+bool shape_from_name(const char *name, SHAPE *shape);
+
+/**
+ * @brief Строит выражение от x и y примерно из target_nodes узлов.
+ *
+ * Дерево собирается из небольших «атомов» выбранной формы (вложенность атома
+ * не больше восьми уровней), соединенных сбалансированно, так что глубина
+ * растет как логарифм размера и рекурсивные обходы не упираются в стек.
+ * Одинаковые (shape, target_nodes, seed) дают одно и то же дерево на любой
+ * машине. Константы - небольшие положительные числа, которые печатаются и
+ * разбираются обратно без потерь.
+ *
+ * @return Дерево с собственным списком переменных или nullptr при нехватке памяти.
+ */
+FRONT_COMPIL_T *generate(SHAPE shape, size_t target_nodes, uint64_t seed);
+
+const size_t RANDOM_MAX_VARS = 8;
+
+typedef struct {
+    size_t target_nodes;            // Сколько узлов построить, если позволит max_depth
+    size_t max_depth;               // Корень - глубина 1
+    size_t vars_count;              // 1..RANDOM_MAX_VARS: x, y, z, t, u, v, w, s
+} random_options_t;
+
+/**
+ * @brief Случайное корректное выражение над всеми операторами OPERATOR.
+ *
+ * В отличие от generate, форма не задается: каждый внутренний узел - любой
+ * оператор с равной вероятностью, размер делится между потомками случайно.
+ * Поэтому выражение может выходить из области определения (log отрицательного,
+ * asin(2)); проверяющий код пропускает такие точки. Константы положительные и
+ * печатаются без потерь, так что print_infix и разбор дают то же дерево.
+ * Одинаковые (options, seed) дают одно и то же дерево.
+ *
+ * @return Дерево со списком из options->vars_count переменных (даже не
+ *         встретившихся в выражении) или nullptr при нехватке памяти.
+ */
+FRONT_COMPIL_T *random_expression(const random_options_t *options, uint64_t seed);
+
+} // namespace gen
+
+#endif // GEN_H
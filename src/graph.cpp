@@ -1,12 +1,23 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "base.h"
+#include "compile.h"
 #include "differentiator.h"
 #include "graph.h"
 #include "io_utils.h"
 #include "var_list.h"
+#include "stats.h"
+#include "trace.h"
+
+extern char **environ;
 
 static double eval_tree_value(const FRONT_COMPIL_T *tree, size_t var_idx, double x) {
     if (!tree || !tree->root) return NAN;
@@ -24,7 +35,58 @@ static double eval_tree_value(const FRONT_COMPIL_T *tree, size_t var_idx, double
     return res;
 }
 
-void render_graphs(const FRONT_COMPIL_T *original,
+// gnuplot gets the script path as an argument, never through a shell; its output goes to /dev/null
+static int run_gnuplot(const char *script_path) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+
+    char *argv[] = {(char *) "gnuplot", (char *) script_path, nullptr};
+    pid_t pid = 0;
+    int rc = posix_spawnp(&pid, "gnuplot", &actions, nullptr, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (rc != 0) return -1;
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR) return -1;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+typedef enum {
+    CURVE_ORIGINAL,
+    CURVE_DERIVATIVE,
+    CURVE_TAYLOR,
+    CURVE_COUNT,
+} CURVE;
+
+// f, f' and the Taylor polynomial at every x in one pass: the derivative repeats most of f's subterms
+static double *eval_curves(const FRONT_COMPIL_T *const *trees, size_t var_idx, const double *xs, size_t n) {
+    double *out = TYPED_CALLOC(n * CURVE_COUNT, double);
+    if (!out) return nullptr;
+    compile::MultiProgram prog = {};
+    if (compile::build_multi(&prog, trees, CURVE_COUNT)) {
+        size_t vars_count = prog.vars_count;
+        double *points = nullptr;
+        if (vars_count) points = TYPED_CALLOC(n * vars_count, double);
+        bool ok = !vars_count || points;
+        for (size_t i = 0; points && var_idx < vars_count && i < n; ++i)
+            points[i * vars_count + var_idx] = xs[i];
+        ok = ok && compile::eval_multi_many(&prog, points, n, out);
+        free(points);
+        compile::destruct(&prog);
+        if (ok) return out;
+    }
+    // Without memory for the program, tree by tree
+    for (size_t i = 0; i < n; ++i)
+        for (size_t c = 0; c < CURVE_COUNT; ++c)
+            out[i * CURVE_COUNT + c] = eval_tree_value(trees[c], var_idx, xs[i]);
+    return out;
+}
+
+void render_graphs(const char *out_dir,
+                   const FRONT_COMPIL_T *original,
                    const FRONT_COMPIL_T *derivative,
                    const FRONT_COMPIL_T *taylor,
                    double center,
@@ -48,41 +110,65 @@ void render_graphs(const FRONT_COMPIL_T *original,
     //     y_min, y_max
     //  );
 
-    create_folder_if_not_exists("logs/");
+    if (!out_dir) out_dir = "logs/";
+    // The paths go into the script as '...' literals, which have no escape for a quote
+    if (strchr(out_dir, '\'')) {
+        ERROR_MSG("graph directory %s contains a quote, skipping graphs\n", out_dir);
+        return;
+    }
+    create_folder_if_not_exists(out_dir);
+
+    char data_path[512] = "", script_path[512] = "", png_path[512] = "";
+    snprintf(data_path, sizeof(data_path), "%sgraph_data.dat", out_dir);
+    snprintf(script_path, sizeof(script_path), "%sgraph_plot.gnu", out_dir);
+    snprintf(png_path, sizeof(png_path), "%sgraphs.png", out_dir);
 
     const size_t samples = 400;
     double step = (x_max - x_min) / (samples - 1);
     bool has_derivative = derivative && derivative->root;
     bool has_taylor = taylor && taylor->root;
-    double f_center = eval_tree_value(original, var_idx, center);
-    double slope = has_derivative ? eval_tree_value(derivative, var_idx, center) : NAN;
+
+    // Sample points, then the expansion center
+    double xs[samples + 1] = {};
+    for (size_t i = 0; i < samples; ++i) xs[i] = x_min + step * i;
+    xs[samples] = center;
+    const FRONT_COMPIL_T *trees[CURVE_COUNT] = {original, has_derivative ? derivative : nullptr, has_taylor ? taylor : nullptr};
+    double *values = eval_curves(trees, var_idx, xs, samples + 1);
+    if (!values) {
+        ERROR_MSG("no memory for graph values\n");
+        return;
+    }
+    double f_center = values[samples * CURVE_COUNT + CURVE_ORIGINAL];
+    double slope = values[samples * CURVE_COUNT + CURVE_DERIVATIVE];
     bool has_tangent = has_derivative && isfinite(f_center) && isfinite(slope);
 
-    FILE *data = fopen("logs/graph_data.dat", "w");
+    FILE *data = fopen(data_path, "w");
     if (!data) {
-        ERROR_MSG("failed to open logs/graph_data.dat\n");
+        ERROR_MSG("failed to open %s\n", data_path);
+        free(values);
         return;
     }
-    fprintf(data, "# x\tf(x)\ttangent(x)\ttaylor(x)\n");
+    fprintf(data, "# x\tf(x)\ttangent(x)\ttaylor(x)\tf'(x)\n");
     for (size_t i = 0; i < samples; ++i) {
-        double x = x_min + step * i;
-        double fx = eval_tree_value(original, var_idx, x);
+        const double *row = values + i * CURVE_COUNT;
+        double x = xs[i];
         double tangent = has_tangent ? f_center + slope * (x - center) : NAN;
-        double tx = has_taylor ? eval_tree_value(taylor, var_idx, x) : NAN;
         // printf("x = %lg, fx = %lg, tan = %lg, tx = %lg\n", x, fx, tangent, tx);
-        fprintf(data, "%.10g %.10g %.10g %.10g\n", x, fx, tangent, tx);
+        fprintf(data, "%.10g %.10g %.10g %.10g %.10g\n",
+                x, row[CURVE_ORIGINAL], tangent, row[CURVE_TAYLOR], row[CURVE_DERIVATIVE]);
     }
     fclose(data);
+    free(values);
 
-    FILE *script = fopen("logs/graph_plot.gnu", "w");
+    FILE *script = fopen(script_path, "w");
     if (!script) {
-        ERROR_MSG("failed to open logs/graph_plot.gnu\n");
+        ERROR_MSG("failed to open %s\n", script_path);
         return;
     }
     // if (!isfinite(y_min) || !isfinite(y_max))
     fprintf(script,
             "set terminal pngcairo size 1280,720\n"
-            "set output 'logs/graphs.png'\n"
+            "set output '%s'\n"
             "set title 'Графики функции и аппроксимаций'\n"
             "set xlabel 'x'\n"
             "set ylabel 'y'\n"
@@ -91,7 +177,7 @@ void render_graphs(const FRONT_COMPIL_T *original,
             "set pointsize 2\n"
             "set grid\n"
             "set key outside top center horizontal\n",
-            x_min, x_max, y_min, y_max);
+            png_path, x_min, x_max, y_min, y_max);
     // else
     // fprintf(script,
     //         "set terminal pngcairo size 1280,720\n"
@@ -106,24 +192,27 @@ void render_graphs(const FRONT_COMPIL_T *original,
 
     fprintf(script,
             "plot \\\n"
-            "  'logs/graph_data.dat' using 1:2 with lines lw 2 lc rgb '#1f77b4' title 'f(x)'");
+            "  '%s' using 1:2 with lines lw 2 lc rgb '#1f77b4' title 'f(x)'", data_path);
     if (has_tangent) {
         fprintf(script,
-                ", \\\n  'logs/graph_data.dat' using 1:3 with lines lw 2 lc rgb '#d62728' "
+                ", \\\n  '%s' using 1:3 with lines lw 2 lc rgb '#d62728' "
                 "title 'Касательная в x=%.3g', \"<echo '%lg %lg'\" with points",
-                center, center, f_center);
+                data_path, center, center, f_center);
     }
     if (has_taylor) {
         fprintf(script,
-                ", \\\n  'logs/graph_data.dat' using 1:4 with lines lw 2 lc rgb '#2ca02c' "
-                "title 'Полином Тейлора'");
+                ", \\\n  '%s' using 1:4 with lines lw 2 lc rgb '#2ca02c' "
+                "title 'Полином Тейлора'", data_path);
     }
     fprintf(script, "\n");
     fclose(script);
 
-    int status = system("gnuplot logs/graph_plot.gnu > /dev/null 2>&1");
+    stats_timer_t timer = stats_phase_begin(STATS_GNUPLOT);
+    trace_span_t span = trace_begin("gnuplot");
+    int status = run_gnuplot(script_path);
+    trace_end(&span);
+    stats_phase_end(&timer);
     if (status != 0) {
         ERROR_MSG("gnuplot exited with code %d\n", status);
     }
 }
-
@@ -3,7 +3,9 @@
 
 #include "differentiator.h"
 
-void render_graphs(const FRONT_COMPIL_T *original,
+// Файлы графика (graph_data.dat, graph_plot.gnu, graphs.png) пишутся в out_dir (оканчивается на '/')
+void render_graphs(const char *out_dir,
+                   const FRONT_COMPIL_T *original,
                    const FRONT_COMPIL_T *derivative,
                    const FRONT_COMPIL_T *taylor,
                    double center,
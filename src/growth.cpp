@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "growth.h"
+#include "latex.h"
+#include "structhash.h"
+#include "util.h"
+#include "base.h"
+
+void growth_init(growth_report_t *report) {
+    if (report) *report = (growth_report_t) {};
+}
+
+void growth_destruct(growth_report_t *report) {
+    if (!report) return;
+    FREE(report->rows);
+    report->count = report->capacity = 0;
+}
+
+growth_row_t *growth_add(growth_report_t *report, size_t order) {
+    if (!report) return nullptr;
+    if (report->count == report->capacity) {
+        size_t capacity = report->capacity ? report->capacity * 2 : 8;
+        growth_row_t *rows = (growth_row_t *) realloc(report->rows, capacity * sizeof(growth_row_t));
+        if (!rows) return nullptr;
+        report->rows = rows;
+        report->capacity = capacity;
+    }
+    growth_row_t *row = &report->rows[report->count++];
+    *row = (growth_row_t) {};
+    row->order = order;
+    return row;
+}
+
+function void shape(const NODE_T *node, size_t level, size_t *nodes, size_t *depth) {
+    for (; node; node = node->left, ++level) {
+        ++*nodes;
+        if (level > *depth) *depth = level;
+        if (node->right) shape(node->right, level + 1, nodes, depth);
+    }
+}
+
+void growth_tree_shape(const NODE_T *root, size_t *nodes, size_t *depth) {
+    size_t count = 0, max_depth = 0;
+    shape(root, 1, &count, &max_depth);
+    if (nodes) *nodes = count;
+    if (depth) *depth = max_depth;
+}
+
+void growth_measure(growth_row_t *row, const FRONT_COMPIL_T *tree) {
+    if (!row || !tree || !tree->root) return;
+    growth_tree_shape(tree->root, &row->nodes, &row->depth);
+
+    structhash::Index index = {};
+    if (structhash::build(&index, tree->root))
+        row->distinct = index.distinct;
+    structhash::destruct(&index);
+
+    // Straight to a sink rather than latex_dump: the report must not show up in the run's LaTeX counters
+    double t0 = now_seconds();
+    latex_sink_t sink = {};
+    latex_sink_init(&sink, nullptr);
+    latex_emit(&sink, tree, tree->root, nullptr);
+    row->latex_len = sink.error ? 0 : sink.len;
+    latex_sink_close(&sink);
+    row->latex_seconds = now_seconds() - t0;
+}
+
+// Nodes relative to the previous order; 0 for the first row
+function double ratio(const growth_report_t *report, size_t i) {
+    if (!i || !report->rows[i - 1].nodes) return 0;
+    return (double) report->rows[i].nodes / (double) report->rows[i - 1].nodes;
+}
+
+void growth_write_html(const growth_report_t *report, Logger *logger) {
+    if (!report || !report->count || !logger_get_file(logger)) return;
+    logger_printf(logger, "<h2>Рост производных</h2>\n<table border=\"1\" cellpadding=\"4\">\n"
+                          "<tr><th>порядок</th><th>узлов до упрощения</th><th>узлов</th><th>рост</th>"
+                          "<th>глубина</th><th>различных поддеревьев</th><th>LaTeX, символов</th>"
+                          "<th>дифф., мс</th><th>упрощение, мс</th><th>LaTeX, мс</th></tr>\n");
+    for (size_t i = 0; i < report->count; ++i) {
+        const growth_row_t *row = &report->rows[i];
+        if (row->cached)
+            logger_printf(logger, "<tr><td>%zu</td><td>кэш</td>", row->order);
+        else
+            logger_printf(logger, "<tr><td>%zu</td><td>%zu</td>", row->order, row->raw_nodes);
+        logger_printf(logger, "<td>%zu</td><td>%.2f</td><td>%zu</td><td>%zu</td><td>%zu</td>"
+                              "<td>%.3f</td><td>%.3f</td><td>%.3f</td></tr>\n",
+                      row->nodes, ratio(report, i), row->depth, row->distinct, row->latex_len,
+                      row->diff_seconds * 1e3, row->simplify_seconds * 1e3, row->latex_seconds * 1e3);
+    }
+    logger_printf(logger, "</table>\n");
+}
+
+bool growth_write_csv(const growth_report_t *report, const char *path) {
+    if (!report || !path) return false;
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "order,cached,raw_nodes,nodes,growth,depth,distinct,latex_len,diff_ms,simplify_ms,latex_ms\n");
+    for (size_t i = 0; i < report->count; ++i) {
+        const growth_row_t *row = &report->rows[i];
+        fprintf(file, "%zu,%d,%zu,%zu,%.4f,%zu,%zu,%zu,%.3f,%.3f,%.3f\n",
+                row->order, row->cached ? 1 : 0, row->raw_nodes, row->nodes, ratio(report, i),
+                row->depth, row->distinct, row->latex_len,
+                row->diff_seconds * 1e3, row->simplify_seconds * 1e3, row->latex_seconds * 1e3);
+    }
+    return fclose(file) == 0;
+}
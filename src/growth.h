@@ -0,0 +1,55 @@
+#ifndef GROWTH_H
+#define GROWTH_H
+
+#include <stddef.h>
+
+#include "differentiator.h"
+#include "logger.h"
+
+/**
+ * @brief Одна строка отчета о росте: производная порядка order.
+ *
+ * Размер до упрощения и время дифференцирования/упрощения известны только
+ * для посчитанных производных; у взятых из дискового кэша cached = true.
+ */
+typedef struct {
+    size_t order;
+    bool   cached;
+    size_t raw_nodes;               // До simplify_tree
+    size_t nodes;
+    size_t depth;
+    size_t distinct;                // Различных поддеревьев (structhash)
+    size_t latex_len;
+    double diff_seconds;            // differentiate_node
+    double simplify_seconds;
+    double latex_seconds;
+} growth_row_t;
+
+/**
+ * @brief Отчет differentiate_to_n о росте производных по порядкам.
+ *
+ * Заполняется, если session->growth не nullptr. По нему видно, с какого
+ * порядка символьные производные выходят из-под контроля.
+ */
+typedef struct {
+    growth_row_t *rows;
+    size_t        count;
+    size_t        capacity;
+} growth_report_t;
+
+void growth_init(growth_report_t *report);
+void growth_destruct(growth_report_t *report);
+
+// Новая обнуленная строка для порядка order или nullptr при нехватке памяти
+growth_row_t *growth_add(growth_report_t *report, size_t order);
+
+// Число узлов и глубина (лист - глубина 1)
+void growth_tree_shape(const NODE_T *root, size_t *nodes, size_t *depth);
+
+// Заполняет nodes, depth, distinct, latex_len и latex_seconds по готовой производной
+void growth_measure(growth_row_t *row, const FRONT_COMPIL_T *tree);
+
+void growth_write_html(const growth_report_t *report, Logger *logger);
+bool growth_write_csv(const growth_report_t *report, const char *path);
+
+#endif // GROWTH_H
@@ -0,0 +1,177 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "base.h"
+#include "memacct.h"
+
+namespace intern {
+
+const size_t CHUNK_SIZE = 64 * 1024;
+const size_t MIN_SLOTS  = 256;
+
+typedef struct chunk_t {
+    chunk_t *next;
+    size_t   used;
+    size_t   size;
+    char     data[];
+} chunk_t;
+
+typedef struct {
+    const char *str;
+    size_t      len;
+    size_t      hash;
+} entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    chunk_t        *chunks;
+    entry_t        *slots;
+    size_t          slots_capacity;
+    size_t          count;
+    size_t          bytes;
+    size_t          holders;
+} interner_t;
+
+global interner_t INTERNER = {PTHREAD_MUTEX_INITIALIZER, nullptr, nullptr, 0, 0, 0, 0};
+
+function size_t hash_bytes(const char *str, size_t len) {
+    size_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= (unsigned char) str[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+function size_t probe(const entry_t *slots, size_t capacity, const char *str, size_t len, size_t hash) {
+    size_t mask = capacity - 1;
+    size_t slot = hash & mask;
+    while (slots[slot].str) {
+        const entry_t *e = &slots[slot];
+        if (e->hash == hash && e->len == len && memcmp(e->str, str, len) == 0)
+            return slot;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+function bool grow_slots(interner_t *in) {
+    size_t capacity = in->slots_capacity ? in->slots_capacity * 2 : MIN_SLOTS;
+    entry_t *slots = TYPED_CALLOC_CAT(capacity, entry_t, MEM_NAMES);
+    if (!slots) return false;
+    for (size_t i = 0; i < in->slots_capacity; ++i) {
+        const entry_t *e = &in->slots[i];
+        if (e->str) slots[probe(slots, capacity, e->str, e->len, e->hash)] = *e;
+    }
+    mem_free(in->slots, MEM_NAMES);
+    in->slots = slots;
+    in->slots_capacity = capacity;
+    return true;
+}
+
+function char *arena_alloc(interner_t *in, size_t size) {
+    chunk_t *chunk = in->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        chunk = (chunk_t *) mem_malloc(sizeof(chunk_t) + chunk_size, MEM_NAMES);
+        if (!chunk) return nullptr;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        // Oversized strings get a private chunk behind the current one, so its free space is kept.
+        if (in->chunks && chunk_size > CHUNK_SIZE) {
+            chunk->next = in->chunks->next;
+            in->chunks->next = chunk;
+        }
+        else {
+            chunk->next = in->chunks;
+            in->chunks = chunk;
+        }
+        in->bytes += sizeof(chunk_t) + chunk_size;
+    }
+    char *mem = chunk->data + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+const char *get(const char *str, size_t len) {
+    if (!str) return nullptr;
+    interner_t *in = &INTERNER;
+    size_t hash = hash_bytes(str, len);
+    pthread_mutex_lock(&in->lock);
+    const char *result = nullptr;
+    if (2 * (in->count + 1) > in->slots_capacity && !grow_slots(in)) {
+        pthread_mutex_unlock(&in->lock);
+        return nullptr;
+    }
+    size_t slot = probe(in->slots, in->slots_capacity, str, len, hash);
+    if (in->slots[slot].str) {
+        result = in->slots[slot].str;
+    }
+    else {
+        char *copy = arena_alloc(in, len + 1);
+        if (copy) {
+            memcpy(copy, str, len);
+            copy[len] = '\0';
+            in->slots[slot] = (entry_t) {copy, len, hash};
+            ++in->count;
+            result = copy;
+        }
+    }
+    pthread_mutex_unlock(&in->lock);
+    return result;
+}
+
+const char *get(const char *str) {
+    return str ? get(str, strlen(str)) : nullptr;
+}
+
+size_t count() {
+    pthread_mutex_lock(&INTERNER.lock);
+    size_t res = INTERNER.count;
+    pthread_mutex_unlock(&INTERNER.lock);
+    return res;
+}
+
+size_t bytes() {
+    pthread_mutex_lock(&INTERNER.lock);
+    size_t res = INTERNER.bytes + INTERNER.slots_capacity * sizeof(entry_t);
+    pthread_mutex_unlock(&INTERNER.lock);
+    return res;
+}
+
+function void reset_locked(interner_t *in) {
+    while (in->chunks) {
+        chunk_t *next = in->chunks->next;
+        mem_free(in->chunks, MEM_NAMES);
+        in->chunks = next;
+    }
+    FREE_CAT(in->slots, MEM_NAMES);
+    in->slots_capacity = 0;
+    in->count = 0;
+    in->bytes = 0;
+}
+
+void reset() {
+    interner_t *in = &INTERNER;
+    pthread_mutex_lock(&in->lock);
+    reset_locked(in);
+    pthread_mutex_unlock(&in->lock);
+}
+
+void acquire() {
+    pthread_mutex_lock(&INTERNER.lock);
+    ++INTERNER.holders;
+    pthread_mutex_unlock(&INTERNER.lock);
+}
+
+void release(size_t max_bytes) {
+    interner_t *in = &INTERNER;
+    pthread_mutex_lock(&in->lock);
+    if (in->holders) --in->holders;
+    if (!in->holders && in->bytes + in->slots_capacity * sizeof(entry_t) > max_bytes) reset_locked(in);
+    pthread_mutex_unlock(&in->lock);
+}
+
+} // namespace intern
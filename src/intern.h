@@ -0,0 +1,50 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+
+namespace intern {
+
+/**
+ * @brief Возвращает единственную на процесс копию строки.
+ *
+ * Арена одна на процесс (общая для всех сессий и потоков). Строки живут до
+ * intern::reset() или сброса в release(), поэтому указатель стабилен, а
+ * одинаковые строки сравниваются равенством указателей. Потокобезопасно.
+ *
+ * @param str Указатель на строку (не обязательно завершенную нулем). NULL дает NULL.
+ * @param len Длина строки в байтах.
+ * @return Стабильный указатель на нуль-терминированную копию или NULL при нехватке памяти.
+ */
+const char *get(const char *str, size_t len);
+
+/**
+ * @brief То же для нуль-терминированной строки.
+ */
+const char *get(const char *str);
+
+/**
+ * @brief Количество различных строк и байт, занятых ареной.
+ */
+size_t count();
+size_t bytes();
+
+/**
+ * @brief Освобождает арену. Все выданные указатели становятся недействительными.
+ */
+void reset();
+
+/**
+ * @brief Держатели арены в долгоживущих процессах (сервер, C API).
+ *
+ * Пока держатель есть, выданные указатели действительны. Когда последний
+ * держатель отпускает арену и она занимает больше max_bytes, арена
+ * сбрасывается, так что имена от клиентов не копятся без ограничения.
+ * Интернировать в таком процессе можно только держа арену.
+ */
+void acquire();
+void release(size_t max_bytes);
+
+} // namespace intern
+
+#endif // INTERN_H
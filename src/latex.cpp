@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+#include "latex.h"
+#include "io_utils.h"
+#include "base.h"
+#include "stats.h"
+#include "memacct.h"
+
+const size_t LATEX_FILE_BUFFER = 64 * 1024;
+const size_t LATEX_CHUNK_SIZE  = 256 * 1024;
+const size_t LATEX_MIN_SLOTS   = 256;
+
+struct latex_entry_t {
+    const NODE_T *node;
+    const char   *frag;
+    size_t        len;
+};
+
+struct latex_chunk_t {
+    latex_chunk_t *next;
+    size_t         used;
+    size_t         size;
+    char           data[];
+};
+
+// ---- Sink ----
+
+void latex_sink_init(latex_sink_t *sink, FILE *file) {
+    if (!sink) return;
+    *sink = (latex_sink_t) {};
+    sink->file = file;
+}
+
+function bool sink_reserve(latex_sink_t *sink, size_t extra) {
+    if (sink->len + extra <= sink->cap) return true;
+    size_t cap = sink->cap ? sink->cap : (sink->file ? LATEX_FILE_BUFFER : 256);
+    while (cap < sink->len + extra) cap <<= 1;
+    char *data = (char *) mem_realloc(sink->data, cap, MEM_LATEX);
+    if (!data) {
+        sink->error = true;
+        return false;
+    }
+    sink->data = data;
+    sink->cap  = cap;
+    return true;
+}
+
+void latex_sink_flush(latex_sink_t *sink) {
+    if (!sink || !sink->file || !sink->len) return;
+    if (fwrite(sink->data, 1, sink->len, sink->file) != sink->len)
+        sink->error = true;
+    sink->len = 0;
+}
+
+void latex_sink_put(latex_sink_t *sink, const char *str, size_t len) {
+    if (!sink || !str || !len || sink->error) return;
+    if (sink->file) {
+        stats_latex_bytes(len);
+        if (sink->len + len > LATEX_FILE_BUFFER) latex_sink_flush(sink);
+        if (len > LATEX_FILE_BUFFER) {
+            if (fwrite(str, 1, len, sink->file) != len) sink->error = true;
+            return;
+        }
+    }
+    if (!sink_reserve(sink, len)) return;
+    memcpy(sink->data + sink->len, str, len);
+    sink->len += len;
+}
+
+void latex_sink_puts(latex_sink_t *sink, const char *str) {
+    if (str) latex_sink_put(sink, str, strlen(str));
+}
+
+function void sink_char(latex_sink_t *sink, char ch) {
+    latex_sink_put(sink, &ch, 1);
+}
+
+void latex_sink_close(latex_sink_t *sink) {
+    if (!sink) return;
+    latex_sink_flush(sink);
+    FREE_CAT(sink->data, MEM_LATEX);
+    sink->len = sink->cap = 0;
+}
+
+char *latex_sink_take(latex_sink_t *sink) {
+    if (!sink || sink->error || !sink_reserve(sink, 1)) {
+        if (sink) latex_sink_close(sink);
+        return nullptr;
+    }
+    sink->data[sink->len] = '\0';
+    // The caller frees the string with plain free, so it leaves the accounting here
+    mem_disown(sink->data, MEM_LATEX);
+    char *res = sink->data;
+    *sink = (latex_sink_t) {};
+    return res;
+}
+
+// ---- Cache ----
+
+void latex_cache_init(latex_cache_t *cache) {
+    if (!cache) return;
+    *cache = (latex_cache_t) {};
+    latex_sink_init(&cache->scratch, nullptr);
+}
+
+void latex_cache_clear(latex_cache_t *cache) {
+    if (!cache) return;
+    while (cache->chunks) {
+        latex_chunk_t *next = cache->chunks->next;
+        mem_free(cache->chunks, MEM_LATEX);
+        cache->chunks = next;
+    }
+    if (cache->slots && cache->count)
+        memset(cache->slots, 0, cache->slots_capacity * sizeof(latex_entry_t));
+    cache->count = 0;
+}
+
+void latex_cache_destroy(latex_cache_t *cache) {
+    if (!cache) return;
+    latex_cache_clear(cache);
+    FREE_CAT(cache->slots, MEM_LATEX);
+    cache->slots_capacity = 0;
+    latex_sink_close(&cache->scratch);
+}
+
+function size_t cache_probe(const latex_entry_t *slots, size_t capacity, const NODE_T *node) {
+    size_t mask = capacity - 1;
+    size_t slot = (size_t) (((uintptr_t) node >> 4) * 0x9E3779B97F4A7C15ull) & mask;
+    while (slots[slot].node && slots[slot].node != node)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+function const latex_entry_t *cache_find(const latex_cache_t *cache, const NODE_T *node) {
+    if (!cache || !cache->count) return nullptr;
+    const latex_entry_t *entry = &cache->slots[cache_probe(cache->slots, cache->slots_capacity, node)];
+    return entry->node ? entry : nullptr;
+}
+
+function bool cache_grow(latex_cache_t *cache) {
+    size_t capacity = cache->slots_capacity ? cache->slots_capacity * 2 : LATEX_MIN_SLOTS;
+    latex_entry_t *slots = TYPED_CALLOC_CAT(capacity, latex_entry_t, MEM_LATEX);
+    if (!slots) return false;
+    for (size_t i = 0; i < cache->slots_capacity; ++i)
+        if (cache->slots[i].node)
+            slots[cache_probe(slots, capacity, cache->slots[i].node)] = cache->slots[i];
+    mem_free(cache->slots, MEM_LATEX);
+    cache->slots = slots;
+    cache->slots_capacity = capacity;
+    return true;
+}
+
+function char *cache_alloc(latex_cache_t *cache, size_t size) {
+    latex_chunk_t *chunk = cache->chunks;
+    if (!chunk || chunk->size - chunk->used < size) {
+        size_t chunk_size = size > LATEX_CHUNK_SIZE ? size : LATEX_CHUNK_SIZE;
+        chunk = (latex_chunk_t *) mem_malloc(sizeof(latex_chunk_t) + chunk_size, MEM_LATEX);
+        if (!chunk) return nullptr;
+        chunk->used = 0;
+        chunk->size = chunk_size;
+        chunk->next = cache->chunks;
+        cache->chunks = chunk;
+    }
+    char *mem = chunk->data + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+// ---- Emitter ----
+
+function int latex_prec_op(OPERATOR op) {
+    switch (op) {
+        case ADD:
+        case SUB:   return 1;
+        case MUL:
+        case DIV:   return 2;
+        case POW:   return 3;
+        default:    return 4;
+    }
+}
+
+function int latex_prec(const NODE_T *node) {
+    if (!node || node->type != OP_T) return 5;
+    return latex_prec_op(node->value.opr);
+}
+
+function bool need_parens(OPERATOR parent, const NODE_T *child, bool right_side) {
+    if (!child || child->type != OP_T) return false;
+    if (parent == DIV) return false;
+    int parent_prec = latex_prec_op(parent);
+    int child_prec  = latex_prec(child);
+    if (parent == POW) {
+        return right_side ? (child_prec <= parent_prec) : (child_prec < parent_prec);
+    }
+    if (child_prec < parent_prec) return true;
+    if (child_prec > parent_prec) return false;
+    if (parent == SUB && right_side) return true;
+    return false;
+}
+
+function const char *latex_func_name(OPERATOR op) {
+    switch (op) {
+        case LN:   return "\\ln";
+        case SIN:  return "\\sin";
+        case COS:  return "\\cos";
+        case TAN:  return "\\tan";
+        case CTG:  return "\\cot";
+        case ASIN: return "\\arcsin";
+        case ACOS: return "\\arccos";
+        case ATAN: return "\\arctan";
+        case ACTG: return "\\arccot";
+        case SINH: return "\\sinh";
+        case COSH: return "\\cosh";
+        case TANH: return "\\tanh";
+        case CTH:  return "\\coth";
+        default:   return nullptr;
+    }
+}
+
+function void emit_number(latex_sink_t *out, double value) {
+    if (value < 0)
+        sink_char(out, '(');
+    char raw[64] = "";
+    int written = snprintf(raw, sizeof(raw), "%.15g", value);
+    if (written <= 0) return;
+    char *exp = strchr(raw, 'e');
+    if (!exp) exp = strchr(raw, 'E');
+    if (!exp) {
+        latex_sink_puts(out, raw);
+        if (value < 0)
+            sink_char(out, ')');
+        return;
+    }
+    int exponent = atoi(exp + 1);
+    *exp = '\0';
+    bool drop_mantissa = (strcmp(raw, "1") == 0);
+    if (!drop_mantissa) {
+        latex_sink_puts(out, raw);
+        latex_sink_puts(out, " \\cdot ");
+    }
+    latex_sink_puts(out, "10^{");
+    char exp_buf[16] = "";
+    snprintf(exp_buf, sizeof(exp_buf), "%d", exponent);
+    latex_sink_puts(out, exp_buf);
+    sink_char(out, '}');
+    if (value < 0)
+        sink_char(out, ')');
+}
+
+// Child subtrees that were rendered before are copied from the cache instead of being walked again.
+function void emit_child(latex_sink_t *out, const FRONT_COMPIL_T *tree, const NODE_T *node, latex_cache_t *cache) {
+    const latex_entry_t *hit = cache_find(cache, node);
+    if (hit) latex_sink_put(out, hit->frag, hit->len);
+    else     latex_emit(out, tree, node, cache);
+}
+
+void latex_emit(latex_sink_t *out, const FRONT_COMPIL_T *tree, const NODE_T *node, latex_cache_t *cache) {
+    if (!out || !tree || !node) return;
+    switch (node->type) {
+        case NUM_T:
+            emit_number(out, node->value.num);
+            break;
+        case VAR_T: {
+            const mystr::mystr_t *name = tree->vars ? varlist::get(tree->vars, node->value.var) : nullptr;
+            if (name && name->str) latex_sink_puts(out, name->str);
+            break;
+        }
+        case OP_T: {
+            switch (node->value.opr) {
+                case DIV:
+                    latex_sink_puts(out, "\\frac{");
+                    emit_child(out, tree, node->left, cache);
+                    latex_sink_puts(out, "}{");
+                    emit_child(out, tree, node->right, cache);
+                    sink_char(out, '}');
+                    return;
+                case POW: {
+                    bool wrap_left = need_parens(node->value.opr, node->left, false);
+                    bool wrap_right = need_parens(node->value.opr, node->right, true);
+                    if (wrap_left) sink_char(out, '(');
+                    emit_child(out, tree, node->left, cache);
+                    if (wrap_left) sink_char(out, ')');
+                    if (node->right) {
+                        latex_sink_puts(out, "^{");
+                        if (wrap_right) sink_char(out, '(');
+                        emit_child(out, tree, node->right, cache);
+                        if (wrap_right) sink_char(out, ')');
+                        sink_char(out, '}');
+                    }
+                    return;
+                }
+                case LOG:
+                    latex_sink_puts(out, "\\log");
+                    if (node->right) {
+                        latex_sink_puts(out, "_{");
+                        emit_child(out, tree, node->right, cache);
+                        sink_char(out, '}');
+                    }
+                    sink_char(out, '{');
+                    emit_child(out, tree, node->left, cache);
+                    sink_char(out, '}');
+                    return;
+                case SQRT:
+                    latex_sink_puts(out, "\\sqrt{");
+                    emit_child(out, tree, node->left, cache);
+                    sink_char(out, '}');
+                    return;
+                default: {
+                    const char *func = latex_func_name(node->value.opr);
+                    if (func) {
+                        latex_sink_puts(out, func);
+                        sink_char(out, '{');
+                        bool wrap_arg = node->left && node->left->type == OP_T;
+                        if (wrap_arg) sink_char(out, '(');
+                        emit_child(out, tree, node->left, cache);
+                        if (wrap_arg) sink_char(out, ')');
+                        sink_char(out, '}');
+                        return;
+                    }
+                }
+            }
+            bool wrap_left = need_parens(node->value.opr, node->left, false);
+            bool wrap_right = need_parens(node->value.opr, node->right, true);
+            if (wrap_left) sink_char(out, '(');
+            emit_child(out, tree, node->left, cache);
+            if (wrap_left) sink_char(out, ')');
+            switch (node->value.opr) {
+                case ADD: latex_sink_puts(out, " + "); break;
+                case SUB: latex_sink_puts(out, " - "); break;
+                case MUL: latex_sink_puts(out, " \\cdot "); break;
+                default: break;
+            }
+            if (wrap_right) sink_char(out, '(');
+            emit_child(out, tree, node->right, cache);
+            if (wrap_right) sink_char(out, ')');
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+const char *latex_fragment(latex_cache_t *cache, const FRONT_COMPIL_T *tree, const NODE_T *node, size_t *len) {
+    if (!cache || !tree || !node) return nullptr;
+    const latex_entry_t *hit = cache_find(cache, node);
+    if (hit) {
+        if (len) *len = hit->len;
+        return hit->frag;
+    }
+    if (2 * (cache->count + 1) > cache->slots_capacity && !cache_grow(cache))
+        return nullptr;
+
+    latex_sink_t *scratch = &cache->scratch;
+    scratch->len   = 0;
+    scratch->error = false;
+    latex_emit(scratch, tree, node, cache);
+    if (scratch->error) return nullptr;
+
+    char *frag = cache_alloc(cache, scratch->len + 1);
+    if (!frag) return nullptr;
+    if (scratch->len) memcpy(frag, scratch->data, scratch->len);
+    frag[scratch->len] = '\0';
+
+    latex_entry_t *entry = &cache->slots[cache_probe(cache->slots, cache->slots_capacity, node)];
+    *entry = (latex_entry_t) {node, frag, scratch->len};
+    ++cache->count;
+    if (len) *len = scratch->len;
+    return frag;
+}
+
+void latex_write(FILE *file, const FRONT_COMPIL_T *tree) {
+    if (!file || !tree || !tree->root) return;
+    stats_timer_t timer = stats_phase_begin(STATS_LATEX);
+    latex_sink_t sink = {};
+    latex_sink_init(&sink, file);
+    latex_emit(&sink, tree, tree->root, nullptr);
+    latex_sink_close(&sink);
+    stats_phase_end(&timer);
+}
+
+// U need to free the returned string
+char *latex_dump(FRONT_COMPIL_T *node) {
+    if (!node || !node->root) {
+        ERROR_MSG("latex_dump: node or node->root is nullptr");
+        return nullptr;
+    }
+    stats_timer_t timer = stats_phase_begin(STATS_LATEX);
+    latex_sink_t sink = {};
+    latex_sink_init(&sink, nullptr);
+    latex_emit(&sink, node, node->root, nullptr);
+    stats_latex_bytes(sink.len);
+    char *res = latex_sink_take(&sink);
+    stats_phase_end(&timer);
+    return res;
+}
@@ -0,0 +1,63 @@
+#ifndef LATEX_H
+#define LATEX_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "differentiator.h"
+
+/**
+ * @brief Буферизованный приемник LaTeX-текста.
+ *
+ * С file != NULL буфер фиксированного размера сбрасывается в файл по мере
+ * заполнения, иначе текст копится в растущем буфере (latex_sink_take).
+ */
+typedef struct {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+    FILE   *file;
+    bool    error;
+} latex_sink_t;
+
+/**
+ * @brief Кэш отрисованных фрагментов по адресу узла.
+ *
+ * Фрагменты лежат в арене и не перемещаются, поэтому указатели на них живут до
+ * latex_cache_clear. Ключ - адрес узла, так что кэш нужно чистить при любом
+ * изменении или освобождении узлов.
+ */
+typedef struct latex_chunk_t latex_chunk_t;
+typedef struct latex_entry_t latex_entry_t;
+
+typedef struct {
+    latex_entry_t *slots;
+    size_t         slots_capacity;
+    size_t         count;
+    latex_chunk_t *chunks;
+    latex_sink_t   scratch;
+} latex_cache_t;
+
+void   latex_sink_init (latex_sink_t *sink, FILE *file);
+void   latex_sink_put  (latex_sink_t *sink, const char *str, size_t len);
+void   latex_sink_puts (latex_sink_t *sink, const char *str);
+void   latex_sink_flush(latex_sink_t *sink);
+// Сбрасывает остаток в файл и освобождает буфер
+void   latex_sink_close(latex_sink_t *sink);
+// Отдает накопленный текст как нуль-терминированную строку (освобождает вызывающий)
+char  *latex_sink_take (latex_sink_t *sink);
+
+void latex_cache_init (latex_cache_t *cache);
+void latex_cache_clear(latex_cache_t *cache);
+void latex_cache_destroy(latex_cache_t *cache);
+
+// Пишет LaTeX поддерева в приемник; уже отрисованные потомки берутся из кэша (cache может быть NULL)
+void latex_emit(latex_sink_t *sink, const FRONT_COMPIL_T *tree, const NODE_T *node, latex_cache_t *cache);
+
+// Возвращает отрисованный фрагмент узла, запоминая его в кэше; строка принадлежит кэшу
+const char *latex_fragment(latex_cache_t *cache, const FRONT_COMPIL_T *tree, const NODE_T *node, size_t *len);
+
+// Потоково пишет LaTeX всего дерева в файл
+void latex_write(FILE *file, const FRONT_COMPIL_T *tree);
+
+#endif // LATEX_H
@@ -1,24 +1,177 @@
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "base.h"
 #include "logger.h"
 
-global Logger GLOBAL_LOGGER = {};
+const size_t LOGGER_RING_CAPACITY = 1 << 20;
+const long   LOGGER_IDLE_WAIT_NS  = 100 * 1000 * 1000;
 
-function Logger *get_global_logger() {
-    return &GLOBAL_LOGGER;
+// ================= Ring buffer =================
+// Producers are serialized by the stdio lock of logger->file, so the ring itself is single-producer,
+// single-consumer: head is published with release after the copy, tail likewise after the write-out.
+
+function void wake_writer(Logger *logger) {
+    pthread_mutex_lock(&logger->lock);
+    pthread_cond_signal(&logger->data_ready);
+    pthread_mutex_unlock(&logger->lock);
 }
 
-int init_logger(const char *log_dirname, const char *html_head_fmt, ...) {
-    Logger *logger = get_global_logger();
+function void wait_for_space(Logger *logger, size_t head) {
+    pthread_mutex_lock(&logger->lock);
+    pthread_cond_signal(&logger->data_ready);
+    while (head - __atomic_load_n(&logger->tail, __ATOMIC_ACQUIRE) == logger->ring_capacity)
+        pthread_cond_wait(&logger->space_ready, &logger->lock);
+    pthread_mutex_unlock(&logger->lock);
+}
 
-    if (log_dirname == nullptr || log_dirname[0] == '\0') return -1;
+function void ring_push(Logger *logger, const char *data, size_t len) {
+    size_t mask = logger->ring_capacity - 1;
+    while (len) {
+        size_t head = __atomic_load_n(&logger->head, __ATOMIC_RELAXED);
+        size_t tail = __atomic_load_n(&logger->tail, __ATOMIC_ACQUIRE);
+        size_t space = logger->ring_capacity - (head - tail);
+        if (!space) {
+            wait_for_space(logger, head);
+            continue;
+        }
 
-    if (logger->file != nullptr) {
+        size_t chunk  = len < space ? len : space;
+        size_t offset = head & mask;
+        size_t first  = chunk < logger->ring_capacity - offset ? chunk : logger->ring_capacity - offset;
+        memcpy(logger->ring + offset, data, first);
+        memcpy(logger->ring, data + first, chunk - first);
+        __atomic_store_n(&logger->head, head + chunk, __ATOMIC_RELEASE);
+
+        // Batch: the writer is only woken once a good part of the ring is waiting
+        size_t used = head + chunk - tail;
+        if (used >= logger->ring_capacity / 2 && used - chunk < logger->ring_capacity / 2)
+            wake_writer(logger);
+
+        data += chunk;
+        len  -= chunk;
+    }
+}
+
+function void ring_drain(Logger *logger) {
+    size_t mask = logger->ring_capacity - 1;
+    size_t tail = __atomic_load_n(&logger->tail, __ATOMIC_RELAXED);
+    size_t head = __atomic_load_n(&logger->head, __ATOMIC_ACQUIRE);
+    while (tail != head) {
+        size_t offset = tail & mask;
+        size_t chunk  = head - tail;
+        if (chunk > logger->ring_capacity - offset) chunk = logger->ring_capacity - offset;
+        fwrite(logger->ring + offset, 1, chunk, logger->output);
+        tail += chunk;
+        __atomic_store_n(&logger->tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_lock(&logger->lock);
+    pthread_cond_broadcast(&logger->space_ready);
+    pthread_mutex_unlock(&logger->lock);
+}
+
+function void *logger_writer(void *arg) {
+    Logger *logger = (Logger *) arg;
+    for (;;) {
+        pthread_mutex_lock(&logger->lock);
+        bool pending = __atomic_load_n(&logger->head, __ATOMIC_ACQUIRE) != logger->tail;
+        if (!pending && !logger->stop && logger->checkpoint_done == logger->checkpoint_requested) {
+            struct timespec deadline = {};
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOGGER_IDLE_WAIT_NS;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec  += 1;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&logger->data_ready, &logger->lock, &deadline);
+        }
+        size_t requested = logger->checkpoint_requested;
+        bool stop = logger->stop;
+        pthread_mutex_unlock(&logger->lock);
+
+        ring_drain(logger);
+
+        if (requested != logger->checkpoint_done || stop) {
+            fflush(logger->output);
+            pthread_mutex_lock(&logger->lock);
+            logger->checkpoint_done = requested;
+            pthread_cond_broadcast(&logger->space_ready);
+            pthread_mutex_unlock(&logger->lock);
+        }
+        if (stop && __atomic_load_n(&logger->head, __ATOMIC_ACQUIRE) == logger->tail) break;
+    }
+    return nullptr;
+}
+
+function ssize_t cookie_write(void *cookie, const char *data, size_t len) {
+    ring_push((Logger *) cookie, data, len);
+    return (ssize_t) len;
+}
+
+function int cookie_close(void *) {
+    return 0;
+}
+
+// ================= Public API =================
+
+function void stop_writer(Logger *logger) {
+    pthread_mutex_lock(&logger->lock);
+    logger->stop = true;
+    pthread_cond_signal(&logger->data_ready);
+    pthread_mutex_unlock(&logger->lock);
+    pthread_join(logger->writer, nullptr);
+
+    fclose(logger->file);
+    fclose(logger->output);
+    FREE(logger->ring);
+    pthread_mutex_destroy(&logger->lock);
+    pthread_cond_destroy(&logger->data_ready);
+    pthread_cond_destroy(&logger->space_ready);
+    logger->file   = nullptr;
+    logger->output = nullptr;
+}
+
+function int start_writer(Logger *logger) {
+    logger->ring = TYPED_CALLOC(LOGGER_RING_CAPACITY, char);
+    if (!logger->ring) return -1;
+    logger->ring_capacity = LOGGER_RING_CAPACITY;
+    logger->head = logger->tail = 0;
+    logger->checkpoint_requested = logger->checkpoint_done = 0;
+    logger->stop = false;
+
+    cookie_io_functions_t io = {};
+    io.write = cookie_write;
+    io.close = cookie_close;
+    logger->file = fopencookie(logger, "w", io);
+    if (!logger->file) {
+        FREE(logger->ring);
+        return -1;
+    }
+    // Every stdio write goes straight into the ring; the ring is the buffer
+    setvbuf(logger->file, nullptr, _IONBF, 0);
+
+    pthread_mutex_init(&logger->lock, nullptr);
+    pthread_cond_init(&logger->data_ready, nullptr);
+    pthread_cond_init(&logger->space_ready, nullptr);
+    if (pthread_create(&logger->writer, nullptr, logger_writer, logger) != 0) {
         fclose(logger->file);
         logger->file = nullptr;
+        FREE(logger->ring);
+        pthread_mutex_destroy(&logger->lock);
+        pthread_cond_destroy(&logger->data_ready);
+        pthread_cond_destroy(&logger->space_ready);
+        return -1;
     }
+    return 0;
+}
+
+int init_logger(Logger *logger, const char *log_dirname, const char *html_head_fmt, ...) {
+    if (logger == nullptr || log_dirname == nullptr || log_dirname[0] == '\0') return -1;
+
+    if (logger->file != nullptr)
+        stop_writer(logger);
 
     memset(logger->dir, 0, sizeof(logger->dir));
     memset(logger->filepath, 0, sizeof(logger->filepath));
@@ -39,8 +192,10 @@ int init_logger(const char *log_dirname, const char *html_head_fmt, ...) {
         return -1;
     }
 
-    logger->file = fopen(logger->filepath, "w");
-    if (logger->file == nullptr) {
+    logger->output = fopen(logger->filepath, "w");
+    if (logger->output == nullptr || start_writer(logger) != 0) {
+        if (logger->output) fclose(logger->output);
+        logger->output = nullptr;
         logger->dir[0] = '\0';
         logger->filepath[0] = '\0';
         return -1;
@@ -57,23 +212,21 @@ int init_logger(const char *log_dirname, const char *html_head_fmt, ...) {
     }
 
     fprintf(file, "\n</head>\n<body>\n<pre>\n");
-    fflush(logger->file);
 
     logger->dir_inited = true;
     return 0;
 }
 
-int init_logger(const char *log_dirname) {
-    return init_logger(log_dirname, nullptr);
+int init_logger(Logger *logger, const char *log_dirname) {
+    return init_logger(logger, log_dirname, nullptr);
 }
 
-void destruct_logger(void) {
-    Logger *logger = get_global_logger();
+void destruct_logger(Logger *logger) {
+    if (logger == nullptr) return;
 
     if (logger->file != nullptr) {
         fprintf(logger->file, "</pre>\n</body>\n</html>\n");
-        fclose(logger->file);
-        logger->file = nullptr;
+        stop_writer(logger);
     }
 
     logger->dir[0] = '\0';
@@ -81,12 +234,33 @@ void destruct_logger(void) {
     logger->dir_inited = false;
 }
 
-FILE *logger_get_file(void) {
-    Logger *logger = get_global_logger();
-    return logger->file;
+void logger_write(Logger *logger, const char *data, size_t len) {
+    if (!logger || !logger->file || !data || !len) return;
+    fwrite(data, 1, len, logger->file);
+}
+
+void logger_printf(Logger *logger, const char *fmt, ...) {
+    if (!logger || !logger->file || !fmt) return;
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(logger->file, fmt, args);
+    va_end(args);
+}
+
+void logger_checkpoint(Logger *logger) {
+    if (!logger || !logger->file) return;
+    pthread_mutex_lock(&logger->lock);
+    size_t ticket = ++logger->checkpoint_requested;
+    pthread_cond_signal(&logger->data_ready);
+    while (logger->checkpoint_done < ticket)
+        pthread_cond_wait(&logger->space_ready, &logger->lock);
+    pthread_mutex_unlock(&logger->lock);
+}
+
+FILE *logger_get_file(Logger *logger) {
+    return logger ? logger->file : nullptr;
 }
 
-const char *logger_get_active_dir(void) {
-    Logger *logger = get_global_logger();
-    return logger->dir_inited ? logger->dir : ".";
+const char *logger_get_active_dir(Logger *logger) {
+    return (logger && logger->dir_inited) ? logger->dir : ".";
 }
@@ -1,23 +1,52 @@
 #ifndef DIFFERENTIATION_LOGGER_H
 #define DIFFERENTIATION_LOGGER_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 
+/**
+ * @brief HTML-лог с кольцевым буфером и фоновым писателем.
+ *
+ * Записи копируются в кольцо и возвращаются сразу; поток-писатель сбрасывает
+ * их в файл пачками. На диск данные гарантированно попадают только в
+ * logger_checkpoint() и destruct_logger().
+ */
 typedef struct Logger {
-    char   dir[512];
-    bool   dir_inited;
-    FILE  *file;
-    char   filepath[512];
+    char             dir[512];
+    bool             dir_inited;
+    FILE            *file;          // Совместимый FILE* поверх кольца (fopencookie)
+    FILE            *output;        // Настоящий log.html, пишет только поток-писатель
+    char             filepath[512];
+
+    char            *ring;
+    size_t           ring_capacity; // степень двойки
+    size_t           head;          // пишут производители (под блокировкой file), читает писатель
+    size_t           tail;          // пишет писатель
+
+    pthread_t        writer;
+    pthread_mutex_t  lock;          // только для сна и пробуждения, данные идут мимо нее
+    pthread_cond_t   data_ready;
+    pthread_cond_t   space_ready;
+    size_t           checkpoint_requested;
+    size_t           checkpoint_done;
+    bool             stop;
 } Logger;
 
-int init_logger(const char *log_dirname);
-int init_logger(const char *log_dirname, const char *first_head_line, ...);
-void destruct_logger(void);
+// Все функции принимают logger == NULL и тогда ничего не делают
+int init_logger(Logger *logger, const char *log_dirname);
+int init_logger(Logger *logger, const char *log_dirname, const char *first_head_line, ...);
+void destruct_logger(Logger *logger);
 
-FILE *logger_get_file(void);
-const char *logger_get_active_dir(void);
+// Добавить текст в лог (потокобезопасно, без системных вызовов на горячем пути)
+void logger_write(Logger *logger, const char *data, size_t len);
+void logger_printf(Logger *logger, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
+// Дождаться, пока все добавленное до вызова окажется в файле
+void logger_checkpoint(Logger *logger);
 
-#endif // DIFFERENTIATION_LOGGER_H
+// Поток для кода, который пишет в лог через stdio; fflush на нем ничего не стоит
+FILE *logger_get_file(Logger *logger);
+const char *logger_get_active_dir(Logger *logger);
 
+#endif // DIFFERENTIATION_LOGGER_H
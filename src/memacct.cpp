@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+#include "memacct.h"
+#include "base.h"
+
+const char *MEM_CATEGORY_NAMES[MEM_CATEGORY_COUNT] = {"nodes", "varlists", "names", "latex"};
+
+// Allocation sites have no session at hand, so the account hangs off the thread like stats_t
+global thread_local mem_account_t *current_account = nullptr;
+
+function void raise_peak(int64_t *peak, int64_t value) {
+    int64_t seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (value > seen && !__atomic_compare_exchange_n(peak, &seen, value, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+function void account(void *ptr, MEM_CATEGORY category, int64_t sign) {
+    mem_account_t *acc = current_account;
+    if (!acc || !ptr) return;
+    int64_t bytes = sign * (int64_t) malloc_usable_size(ptr);
+    int64_t live  = __atomic_add_fetch(&acc->live[category], bytes, __ATOMIC_RELAXED);
+    int64_t total = __atomic_add_fetch(&acc->live_total, bytes, __ATOMIC_RELAXED);
+    if (sign < 0) return;
+    raise_peak(&acc->peak[category], live);
+    raise_peak(&acc->peak_total, total);
+    raise_peak(&acc->stage_peak, total);
+}
+
+mem_account_t *mem_attach(mem_account_t *account) {
+    mem_account_t *prev = current_account;
+    current_account = account;
+    return prev;
+}
+
+mem_account_t *mem_current(void) {
+    return current_account;
+}
+
+void *mem_calloc(size_t nmemb, size_t size, MEM_CATEGORY category) {
+    void *ptr = calloc(nmemb, size);
+    account(ptr, category, 1);
+    return ptr;
+}
+
+void *mem_malloc(size_t size, MEM_CATEGORY category) {
+    void *ptr = malloc(size);
+    account(ptr, category, 1);
+    return ptr;
+}
+
+void *mem_realloc(void *ptr, size_t size, MEM_CATEGORY category) {
+    // The old block's size is gone after realloc, so read it first and settle once the call succeeds
+    int64_t old_bytes = ptr ? (int64_t) malloc_usable_size(ptr) : 0;
+    void *res = realloc(ptr, size);
+    if (!res) return nullptr;
+    mem_account_t *acc = current_account;
+    if (acc) {
+        __atomic_sub_fetch(&acc->live[category], old_bytes, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&acc->live_total, old_bytes, __ATOMIC_RELAXED);
+        account(res, category, 1);
+    }
+    return res;
+}
+
+void mem_free(void *ptr, MEM_CATEGORY category) {
+    account(ptr, category, -1);
+    free(ptr);
+}
+
+void mem_disown(const void *ptr, MEM_CATEGORY category) {
+    account((void *) ptr, category, -1);
+}
+
+function size_t node_bytes(const NODE_T *node, size_t *count) {
+    size_t bytes = 0;
+    // Walks the left spine in a loop, so only right subtrees add stack depth
+    for (; node; node = node->left) {
+        ++*count;
+        bytes += malloc_usable_size((void *) node);
+        if (node->right) bytes += node_bytes(node->right, count);
+    }
+    return bytes;
+}
+
+void mem_tree_usage(const FRONT_COMPIL_T *tree, mem_usage_t *usage) {
+    if (!usage) return;
+    *usage = (mem_usage_t) {};
+    if (!tree) return;
+    usage->node_bytes = node_bytes(tree->root, &usage->nodes);
+    const varlist::VarList *vars = tree->vars;
+    if (vars) {
+        usage->varlist_bytes = (vars->heap ? malloc_usable_size((void *) vars) : 0)
+                             + (vars->data  ? malloc_usable_size(vars->data)  : 0)
+                             + (vars->slots ? malloc_usable_size(vars->slots) : 0);
+    }
+    usage->total = usage->node_bytes + usage->varlist_bytes;
+}
+
+void mem_stage_mark(mem_account_t *account, const char *name, size_t tree_bytes) {
+    if (!account) return;
+    int64_t live = __atomic_load_n(&account->live_total, __ATOMIC_RELAXED);
+    int64_t peak = __atomic_exchange_n(&account->stage_peak, live, __ATOMIC_RELAXED);
+    if (account->stages_count >= MEM_MAX_STAGES) return;
+    account->stages[account->stages_count++] = (mem_stage_t) {
+        .name       = name,
+        .tree_bytes = tree_bytes,
+        .live       = live,
+        .peak       = peak > live ? peak : live,
+    };
+}
+
+const char *mem_category_name(MEM_CATEGORY category) {
+    return category < MEM_CATEGORY_COUNT ? MEM_CATEGORY_NAMES[category] : "unknown";
+}
+
+function double mib(int64_t bytes) {
+    return (double) bytes / (1 << 20);
+}
+
+void mem_write_html(const mem_account_t *account, Logger *logger) {
+    if (!account || !logger_get_file(logger)) return;
+    logger_printf(logger, "<h2>Память</h2>\n<table border=\"1\" cellpadding=\"4\">\n"
+                          "<tr><th>категория</th><th>живые, МБ</th><th>пик, МБ</th></tr>\n");
+    for (size_t i = 0; i < MEM_CATEGORY_COUNT; ++i) {
+        logger_printf(logger, "<tr><td>%s</td><td>%.3f</td><td>%.3f</td></tr>\n",
+                      MEM_CATEGORY_NAMES[i], mib(account->live[i]), mib(account->peak[i]));
+    }
+    logger_printf(logger, "<tr><td>всего</td><td>%.3f</td><td>%.3f</td></tr>\n</table>\n",
+                  mib(account->live_total), mib(account->peak_total));
+
+    logger_printf(logger, "<table border=\"1\" cellpadding=\"4\">\n"
+                          "<tr><th>стадия</th><th>деревья, МБ</th><th>живые в конце, МБ</th><th>пик за стадию, МБ</th></tr>\n");
+    for (size_t i = 0; i < account->stages_count; ++i) {
+        const mem_stage_t *stage = &account->stages[i];
+        logger_printf(logger, "<tr><td>%s</td><td>%.3f</td><td>%.3f</td><td>%.3f</td></tr>\n",
+                      stage->name, mib((int64_t) stage->tree_bytes), mib(stage->live), mib(stage->peak));
+    }
+    logger_printf(logger, "</table>\n");
+}
+
+bool mem_write_json(const mem_account_t *account, const char *path) {
+    if (!account || !path) return false;
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "{\n  \"categories\": {");
+    for (size_t i = 0; i < MEM_CATEGORY_COUNT; ++i) {
+        fprintf(file, "%s\n    \"%s\": {\"live\": %lld, \"peak\": %lld}", i ? "," : "",
+                MEM_CATEGORY_NAMES[i], (long long) account->live[i], (long long) account->peak[i]);
+    }
+    fprintf(file, "\n  },\n  \"live\": %lld,\n  \"peak\": %lld,\n  \"stages\": [",
+            (long long) account->live_total, (long long) account->peak_total);
+    for (size_t i = 0; i < account->stages_count; ++i) {
+        const mem_stage_t *stage = &account->stages[i];
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"tree_bytes\": %zu, \"live\": %lld, \"peak\": %lld}",
+                i ? "," : "", stage->name, stage->tree_bytes, (long long) stage->live, (long long) stage->peak);
+    }
+    fprintf(file, "\n  ]\n}\n");
+    return fclose(file) == 0;
+}
@@ -0,0 +1,94 @@
+#ifndef MEMACCT_H
+#define MEMACCT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "differentiator.h"
+#include "logger.h"
+
+typedef enum {
+    MEM_NODES,
+    MEM_VARLISTS,
+    MEM_NAMES,          // Арена intern: общая на процесс, записывается на того, кто интернировал
+    MEM_LATEX,          // Буферы latex_sink_t и кэш фрагментов
+    MEM_CATEGORY_COUNT,
+} MEM_CATEGORY;
+
+const size_t MEM_MAX_STAGES = 16;
+
+typedef struct {
+    const char *name;               // Строковый литерал
+    size_t      tree_bytes;         // Деревья, построенные стадией (mem_tree_usage)
+    int64_t     live;               // Живые байты сессии в конце стадии
+    int64_t     peak;               // Пик живых байт за стадию
+} mem_stage_t;
+
+/**
+ * @brief Учет живой памяти сессии по категориям.
+ *
+ * Байты считаются по malloc_usable_size, то есть вместе с округлением
+ * аллокатора. Как и stats_t, счет идет только пока учет присоединен к потоку
+ * (mem_attach); один учет можно присоединить к нескольким потокам.
+ * Память, выделенная до присоединения и освобожденная под ним, уводит live
+ * в минус, поэтому поля знаковые.
+ */
+typedef struct {
+    int64_t     live[MEM_CATEGORY_COUNT];
+    int64_t     peak[MEM_CATEGORY_COUNT];
+    int64_t     live_total;
+    int64_t     peak_total;
+    int64_t     stage_peak;         // Пик live_total с последней mem_stage_mark
+
+    mem_stage_t stages[MEM_MAX_STAGES];
+    size_t      stages_count;
+} mem_account_t;
+
+typedef struct {
+    size_t nodes;
+    size_t node_bytes;
+    size_t varlist_bytes;           // Список переменных может разделяться с другими деревьями
+    size_t total;
+} mem_usage_t;
+
+// Присоединяет учет к текущему потоку (nullptr - отсоединить), возвращает прежний
+mem_account_t *mem_attach(mem_account_t *account);
+mem_account_t *mem_current(void);
+
+void *mem_calloc (size_t nmemb, size_t size, MEM_CATEGORY category);
+void *mem_malloc (size_t size, MEM_CATEGORY category);
+void *mem_realloc(void *ptr, size_t size, MEM_CATEGORY category);
+void  mem_free   (void *ptr, MEM_CATEGORY category);
+
+// Блок уходит из-под учета (владелец больше не освобождает его через mem_free)
+void  mem_disown (const void *ptr, MEM_CATEGORY category);
+
+#define TYPED_CALLOC_CAT(NMEMB, TYPE, CATEGORY) \
+    (TYPE *) mem_calloc((NMEMB), sizeof(TYPE), (CATEGORY))
+
+#define FREE_CAT(ptr, CATEGORY)         \
+    mem_free((ptr), (CATEGORY));        \
+    (ptr) = nullptr;
+
+/**
+ * @brief Сколько памяти держит дерево: узлы и список переменных.
+ *
+ * Обходит дерево, O(размера).
+ */
+void mem_tree_usage(const FRONT_COMPIL_T *tree, mem_usage_t *usage);
+
+/**
+ * @brief Закрывает стадию: запоминает live, пик за стадию и байты ее деревьев.
+ *
+ * Следующая стадия считает пик заново от текущего live.
+ */
+void mem_stage_mark(mem_account_t *account, const char *name, size_t tree_bytes);
+
+const char *mem_category_name(MEM_CATEGORY category);
+
+// Таблицы по категориям и стадиям в лог; JSON с теми же числами
+void mem_write_html(const mem_account_t *account, Logger *logger);
+bool mem_write_json(const mem_account_t *account, const char *path);
+
+#endif // MEMACCT_H
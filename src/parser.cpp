@@ -12,11 +12,13 @@
 #include "io_utils.h"
 #include "base.h"
 #include "var_list.h"
+#include "intern.h"
+#include "stats.h"
 
-#define PARSE_FAIL(p, ...)            \
-    do {                              \
-        (p)->error = true;            \
-        ERROR_MSG(__VA_ARGS__);       \
+#define PARSE_FAIL(p, ...)                          \
+    do {                                            \
+        (p)->error = true;                          \
+        if (!(p)->quiet) ERROR_MSG(__VA_ARGS__);    \
     } while (0)
 
 typedef struct {
@@ -25,10 +27,13 @@ typedef struct {
     size_t              pos;
     bool                error;
     varlist::VarList   *vars;
+    bool                quiet;          // Only the return value reports the error
 } parser_t;
 
+#ifdef PARSER_TRACE
 // Dumps parser state for verbose debugging output.
 function void debug_parse_print(const parser_t *p, const char *reason);
+#endif
 
 // Extracts the tree name from the parser buffer.
 function bool extract_tree_name(parser_t *p, const char **eq_tree_name, char **owned_name);
@@ -37,6 +42,9 @@ function bool extract_tree_name(parser_t *p, const char **eq_tree_name, char **o
 function void skip_spaces(parser_t *p);
 #define ss_ skip_spaces(p)
 
+// Non-recursive reader of the nil-padded prefix format.
+function NODE_T *get_prefix_tree(parser_t *p);
+
 // Recursive-descent entry points.
 function NODE_T *get_grammar   (parser_t *p);
 function NODE_T *get_expression(parser_t *p);
@@ -64,12 +72,12 @@ function bool extract_graph_range(parser_t *p, graph_range_t *range);
 
 #define CREATE_NEW_EQ_TREE()                                \
     FRONT_COMPIL_T *new_eq_tree = TYPED_CALLOC(1, FRONT_COMPIL_T);    \
-    VERIFY(new_eq_tree, destruct(root); return nullptr;);   \
-    new_eq_tree->name = eq_tree_name;                       \
+    VERIFY(new_eq_tree, destruct(root); FREE(owned_name); return nullptr;); \
+    new_eq_tree->name = intern::get(eq_tree_name);          \
     new_eq_tree->root = root;                               \
-    new_eq_tree->vars = vars;                               \
-    new_eq_tree->owns_name = owned_name != nullptr;         \
-    owned_name = nullptr;
+    new_eq_tree->vars = varlist::retain(vars);              \
+    new_eq_tree->diff_var = varlist::NPOS;                  \
+    FREE(owned_name);
 
 // Reads expression file into an equation tree structure.
 FRONT_COMPIL_T *load_tree_from_file(const char *filename, const char *eq_tree_name, varlist::VarList *vars, graph_range_t *range) {
@@ -82,7 +90,7 @@ FRONT_COMPIL_T *load_tree_from_file(const char *filename, const char *eq_tree_na
     }
     char *owned_name = nullptr;
     size_t buffer_len = strlen(buffer);
-    parser_t parser = {buffer, buffer_len, 0, false, nullptr};
+    parser_t parser = {buffer, buffer_len, 0, false, nullptr, false};
     if (!extract_tree_name(&parser, &eq_tree_name, &owned_name)) {
         FREE(owned_name);
         FREE(buffer);
@@ -95,7 +103,9 @@ FRONT_COMPIL_T *load_tree_from_file(const char *filename, const char *eq_tree_na
     }
     varlist::init(vars);
     parser.vars = vars;
+    stats_timer_t timer = stats_phase_begin(STATS_PARSE);
     NODE_T *root = get_grammar(&parser);
+    stats_phase_end(&timer);
     if (parser.error) {
         destruct(root);
         FREE(owned_name);
@@ -108,6 +118,69 @@ FRONT_COMPIL_T *load_tree_from_file(const char *filename, const char *eq_tree_na
     return new_eq_tree;
 }
 
+// Reads nil-padded prefix file `(op (left) (right))` into an equation tree structure.
+FRONT_COMPIL_T *load_tree_from_prefix_file(const char *filename, const char *eq_tree_name, varlist::VarList *vars) {
+    VERIFY(filename != nullptr, ERROR_MSG("filename is nullptr");  return nullptr;);
+    VERIFY(vars     != nullptr, ERROR_MSG("vars list is nullptr"); return nullptr;);
+    char *buffer = read_file_to_buf(filename, nullptr);
+    if (!buffer) {
+        ERROR_MSG("Can't read prefix file '%s'\n", filename);
+        return nullptr;
+    }
+    char *owned_name = nullptr;
+    parser_t parser = {buffer, strlen(buffer), 0, false, nullptr, false};
+    if (!extract_tree_name(&parser, &eq_tree_name, &owned_name)) {
+        FREE(owned_name);
+        FREE(buffer);
+        return nullptr;
+    }
+    varlist::init(vars);
+    parser.vars = vars;
+    stats_timer_t timer = stats_phase_begin(STATS_PARSE);
+    NODE_T *root = get_prefix_tree(&parser);
+    stats_phase_end(&timer);
+    if (parser.error) {
+        destruct(root);
+        FREE(owned_name);
+        FREE(buffer);
+        return nullptr;
+    }
+    FREE(buffer);
+
+    CREATE_NEW_EQ_TREE();
+    return new_eq_tree;
+}
+
+FRONT_COMPIL_T *load_tree_from_prefix_file(const char *filename, varlist::VarList *vars) {
+    return load_tree_from_prefix_file(filename, "New equation tree", vars);
+}
+
+// Parses a single infix expression from memory (no name line, no graph ranges).
+FRONT_COMPIL_T *load_tree_from_string(const char *text, size_t len, const char *eq_tree_name) {
+    VERIFY(text != nullptr, ERROR_MSG("text is nullptr"); return nullptr;);
+    if (!eq_tree_name) eq_tree_name = "New equation tree";
+    varlist::VarList *vars = varlist::create();
+    if (!vars) return nullptr;
+    // Library and server input: a bad expression is an ordinary result, not something to print
+    parser_t parser = {text, len, 0, false, vars, true};
+    stats_timer_t timer = stats_phase_begin(STATS_PARSE);
+    NODE_T *root = get_grammar(&parser);
+    stats_phase_end(&timer);
+    if (parser.error || !root) {
+        destruct(root);
+        varlist::release(vars);
+        return nullptr;
+    }
+
+    FRONT_COMPIL_T *new_eq_tree = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    VERIFY(new_eq_tree, destruct(root); varlist::release(vars); return nullptr;);
+    new_eq_tree->name = intern::get(eq_tree_name);
+    new_eq_tree->root = root;
+    new_eq_tree->vars = vars;
+    new_eq_tree->diff_var = varlist::NPOS;
+    return new_eq_tree;
+}
+
 #undef CREATE_NEW_EQ_TREE
 
 // Extracts the tree name from the parser buffer.
@@ -529,9 +602,162 @@ function NODE_T *get_grammar(parser_t *p) {
     return root;
 }
 
+typedef struct {
+    NODE_TYPE     type;
+    NODE_VALUE_T  value;
+    NODE_T       *child[2];
+    int           filled;
+} prefix_frame_t;
+
+// Copies the next token (up to whitespace or a bracket) and classifies it.
+function bool get_prefix_token(parser_t *p, prefix_frame_t *frame, bool *is_nil) {
+    ss_;
+    size_t start = p->pos;
+    while (!is_at_end(p) && !isspace((unsigned char) p->buf[p->pos]) && p->buf[p->pos] != '(' && p->buf[p->pos] != ')')
+        ++p->pos;
+    size_t span = p->pos - start;
+    if (!span) {
+        PARSE_FAIL(p, "Token expected at offset %zu\n", start);
+        return false;
+    }
+    *is_nil = span == 3 && strncmp(p->buf + start, "nil", 3) == 0;
+    if (*is_nil)
+        return true;
+
+    char  local_buf[64] = "";
+    char *token = local_buf;
+    if (span >= sizeof(local_buf)) token = TYPED_CALLOC(span + 1, char);
+    if (!token) {
+        PARSE_FAIL(p, "No memory for token\n");
+        return false;
+    }
+    memcpy(token, p->buf + start, span);
+    token[span] = '\0';
+
+    bool ok = node_type_from_token(token, &frame->type);
+    if (ok && frame->type == OP_T)
+        ok = operator_from_token(token, &frame->value.opr);
+    else if (ok && frame->type == NUM_T)
+        frame->value.num = strtod(token, nullptr);
+    else if (ok && frame->type == VAR_T) {
+        mystr::mystr_t name = mystr::construct(token);
+        frame->value.var = varlist::add(p->vars, &name);
+        ok = frame->value.var != varlist::NPOS;
+    }
+    if (!ok)
+        PARSE_FAIL(p, "Bad token '%s' at offset %zu\n", token, start);
+    if (token != local_buf)
+        FREE(token);
+    return ok;
+}
+
+// Uses an explicit frame stack, so depth of the tree is limited only by memory.
+function NODE_T *get_prefix_tree(parser_t *p) {
+    size_t          depth    = 0;
+    size_t          capacity = 64;
+    prefix_frame_t *frames   = TYPED_CALLOC(capacity, prefix_frame_t);
+    NODE_T         *root     = nullptr;
+    if (!frames) {
+        PARSE_FAIL(p, "No memory for prefix stack\n");
+        return nullptr;
+    }
+    ss_;
+    if (peek_char(p) != '(')
+        PARSE_FAIL(p, "Expected '(' at offset %zu\n", p->pos);
+
+    while (!p->error && !root) {
+        ss_;
+        char c = peek_char(p);
+        if (c == '(') {
+            ++p->pos;
+            if (depth && frames[depth - 1].filled >= 2) {
+                PARSE_FAIL(p, "Node has more than two children at offset %zu\n", p->pos);
+                break;
+            }
+            if (depth == capacity) {
+                prefix_frame_t *grown = (prefix_frame_t *) realloc(frames, 2 * capacity * sizeof(prefix_frame_t));
+                if (!grown) {
+                    PARSE_FAIL(p, "No memory for prefix stack\n");
+                    break;
+                }
+                frames = grown;
+                capacity *= 2;
+            }
+            prefix_frame_t *frame = &frames[depth];
+            *frame = (prefix_frame_t) {};
+            bool is_nil = false;
+            if (!get_prefix_token(p, frame, &is_nil))
+                break;
+            if (is_nil) {
+                PARSE_FAIL(p, "'nil' can't be a node value at offset %zu\n", p->pos);
+                break;
+            }
+            ++depth;
+        }
+        else if (c == ')') {
+            ++p->pos;
+            if (!depth) {
+                PARSE_FAIL(p, "Unbalanced ')' at offset %zu\n", p->pos);
+                break;
+            }
+            prefix_frame_t *frame = &frames[depth - 1];
+            if (frame->filled != 2) {
+                PARSE_FAIL(p, "Node needs exactly two children at offset %zu\n", p->pos);
+                break;
+            }
+            // Like the infix parser: a leaf has no operands, a unary operator only the left one
+            size_t arity = frame->type == OP_T ? operator_arity(frame->value.opr) : 0;
+            if ((frame->child[0] != nullptr) != (arity >= 1) || (frame->child[1] != nullptr) != (arity == 2)) {
+                PARSE_FAIL(p, "Node expects %zu operand(s) at offset %zu\n", arity, p->pos);
+                break;
+            }
+            NODE_T *node = new_node(frame->type, frame->value, frame->child[0], frame->child[1]);
+            if (!node) {
+                PARSE_FAIL(p, "Failed to allocate prefix node\n");
+                break;
+            }
+            --depth;
+            if (depth) frames[depth - 1].child[frames[depth - 1].filled++] = node;
+            else       root = node;
+        }
+        else if (c == '\0' || !depth) {
+            PARSE_FAIL(p, "Unexpected end of prefix tree at offset %zu\n", p->pos);
+        }
+        else {
+            prefix_frame_t scratch = {};
+            bool is_nil = false;
+            if (!get_prefix_token(p, &scratch, &is_nil))
+                break;
+            if (!is_nil || frames[depth - 1].filled >= 2) {
+                PARSE_FAIL(p, "Expected 'nil' or '(' at offset %zu\n", p->pos);
+                break;
+            }
+            frames[depth - 1].child[frames[depth - 1].filled++] = nullptr;
+        }
+    }
+    for (size_t i = 0; i < depth; ++i) {
+        destruct(frames[i].child[0]);
+        destruct(frames[i].child[1]);
+    }
+    FREE(frames);
+    if (p->error) {
+        destruct(root);
+        return nullptr;
+    }
+    ss_;
+    if (!is_at_end(p)) {
+        PARSE_FAIL(p, "Unexpected trailing data at offset %zu\n", p->pos);
+        destruct(root);
+        return nullptr;
+    }
+    return root;
+}
+
 // Registers variable name and stores its index.
 function bool store_variable(parser_t *p, NODE_T *node, char *token) {
+#ifdef PARSER_TRACE
     debug_parse_print(p, "store_variable");
+#endif
     if (!p->vars)
         return false;
     mystr::mystr_t name = mystr::construct(token);
@@ -539,6 +765,7 @@ function bool store_variable(parser_t *p, NODE_T *node, char *token) {
     return idx != varlist::NPOS ? (node->value.var = idx, true) : false;
 }
 
+#ifdef PARSER_TRACE
 // Dumps parser state for verbose debugging output.
 function void debug_parse_print(const parser_t *p, const char *reason) {
     size_t pos = p->pos < p->len ? p->pos : p->len;
@@ -550,5 +777,6 @@ function void debug_parse_print(const parser_t *p, const char *reason) {
     }
     putchar('\n');
 }
+#endif
 
 #undef ss_
\ No newline at end of file
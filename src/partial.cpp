@@ -0,0 +1,209 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "partial.h"
+#include "budget.h"
+#include "trace.h"
+#include "util.h"
+#include "base.h"
+
+namespace partial {
+
+struct entry_t {
+    uint64_t     hash;
+    binding_t   *key;           // Отсортирован по var
+    size_t       key_count;
+    Specialized  value;
+};
+
+// Same shape as copy_subtree, with bound variables turned into numbers
+function NODE_T *substitute(const NODE_T *node, const double *vals, const bool *bound) {
+    if (!node || !budget_poll()) return nullptr;
+    if (node->type == VAR_T && bound[node->value.var])
+        return new_node(NUM_T, (NODE_VALUE_T) {.num = vals[node->value.var]}, nullptr, nullptr);
+    NODE_T *left = node->left ? substitute(node->left, vals, bound) : nullptr;
+    if (node->left && !left) return nullptr;
+    NODE_T *right = node->right ? substitute(node->right, vals, bound) : nullptr;
+    if (node->right && !right) {
+        ::destruct(left);
+        return nullptr;
+    }
+    NODE_T *copy = new_node(node->type, node->value, left, right);
+    if (!copy) {
+        ::destruct(left);
+        ::destruct(right);
+    }
+    return copy;
+}
+
+// VAR_T indices are only checked against the list when the tree is built, so a bad one is caught here
+function bool vars_in_range(const NODE_T *node, size_t vars_count) {
+    for (; node; node = node->left) {
+        if (node->type == VAR_T && node->value.var >= vars_count) return false;
+        if (node->right && !vars_in_range(node->right, vars_count)) return false;
+    }
+    return true;
+}
+
+FRONT_COMPIL_T *specialize(const FRONT_COMPIL_T *src, const binding_t *bindings, size_t count) {
+    if (!src || !src->root || (count && !bindings)) return nullptr;
+    size_t vars_count = src->vars ? varlist::size(src->vars) : 0;
+    if (!vars_in_range(src->root, vars_count)) return nullptr;
+
+    double *vals  = TYPED_CALLOC(vars_count ? vars_count : 1, double);
+    bool   *bound = TYPED_CALLOC(vars_count ? vars_count : 1, bool);
+    bool ok = vals && bound;
+    // Like compile, reports bad bindings by the return value only
+    for (size_t i = 0; ok && i < count; ++i) {
+        size_t var = bindings[i].var;
+        ok = var < vars_count && !bound[var];
+        if (ok) {
+            bound[var] = true;
+            vals[var]  = bindings[i].value;
+        }
+    }
+
+    FRONT_COMPIL_T *result = nullptr;
+    if (ok) {
+        trace_span_t span = trace_begin("specialize");
+        NODE_T *root = substitute(src->root, vals, bound);
+        if (root) result = TYPED_CALLOC(1, FRONT_COMPIL_T);
+        if (result) {
+            root->parent       = nullptr;
+            result->root       = root;
+            result->name       = src->name;
+            result->vars       = varlist::retain(src->vars);
+            result->diff_var   = src->diff_var;
+            result->diff_order = src->diff_order;
+            fold_constants(result);
+        }
+        else {
+            ::destruct(root);
+        }
+        trace_end(&span);
+    }
+    free(vals);
+    free(bound);
+    return result;
+}
+
+// ---- Cache ----
+
+function int compare_bindings(const void *a, const void *b) {
+    size_t va = ((const binding_t *) a)->var;
+    size_t vb = ((const binding_t *) b)->var;
+    return (va > vb) - (va < vb);
+}
+
+function uint64_t key_hash(const binding_t *key, size_t count) {
+    uint64_t h = mix(count + 1);
+    for (size_t i = 0; i < count; ++i)
+        h = mix(h ^ mix(key[i].var + 0x9E3779B97F4A7C15ull) ^ num_bits(key[i].value));
+    return h;
+}
+
+function bool key_equal(const entry_t *entry, uint64_t hash, const binding_t *key, size_t count) {
+    if (entry->hash != hash || entry->key_count != count) return false;
+    for (size_t i = 0; i < count; ++i) {
+        if (entry->key[i].var != key[i].var || num_bits(entry->key[i].value) != num_bits(key[i].value))
+            return false;
+    }
+    return true;
+}
+
+function void free_entry(entry_t *entry) {
+    if (!entry) return;
+    compile::destruct(&entry->value.prog);
+    ::destruct(entry->value.tree);
+    free(entry->key);
+    free(entry);
+}
+
+function void clear(Cache *cache) {
+    for (size_t i = 0; i < cache->capacity; ++i) {
+        free_entry(cache->slots[i]);
+        cache->slots[i] = nullptr;
+    }
+    cache->count = 0;
+}
+
+function entry_t **find_slot(entry_t **slots, size_t capacity, uint64_t hash, const binding_t *key, size_t count) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (!slots[i] || key_equal(slots[i], hash, key, count)) return &slots[i];
+    }
+}
+
+function bool grow(Cache *cache) {
+    size_t capacity = cache->capacity ? cache->capacity * 2 : 16;
+    entry_t **slots = TYPED_CALLOC(capacity, entry_t *);
+    if (!slots) return false;
+    for (size_t i = 0; i < cache->capacity; ++i) {
+        entry_t *entry = cache->slots[i];
+        if (entry) *find_slot(slots, capacity, entry->hash, entry->key, entry->key_count) = entry;
+    }
+    free(cache->slots);
+    cache->slots    = slots;
+    cache->capacity = capacity;
+    return true;
+}
+
+void init(Cache *cache, const FRONT_COMPIL_T *src, size_t max_entries) {
+    if (!cache) return;
+    *cache = {};
+    cache->src         = src;
+    cache->max_entries = max_entries;
+}
+
+void destruct(Cache *cache) {
+    if (!cache) return;
+    if (cache->slots) clear(cache);
+    free(cache->slots);
+    *cache = {};
+}
+
+const Specialized *get(Cache *cache, const binding_t *bindings, size_t count) {
+    if (!cache || !cache->src || (count && !bindings)) return nullptr;
+
+    // The key does not depend on the order the caller listed the variables in
+    binding_t *key = TYPED_CALLOC(count ? count : 1, binding_t);
+    if (!key) return nullptr;
+    if (count) memcpy(key, bindings, count * sizeof(binding_t));
+    qsort(key, count, sizeof(binding_t), compare_bindings);
+    uint64_t hash = key_hash(key, count);
+
+    if (cache->capacity) {
+        entry_t *entry = *find_slot(cache->slots, cache->capacity, hash, key, count);
+        if (entry) {
+            ++cache->hits;
+            free(key);
+            return &entry->value;
+        }
+    }
+    ++cache->misses;
+
+    entry_t *entry = TYPED_CALLOC(1, entry_t);
+    if (!entry) {
+        free(key);
+        return nullptr;
+    }
+    entry->hash      = hash;
+    entry->key       = key;
+    entry->key_count = count;
+    entry->value.tree = specialize(cache->src, key, count);
+    if (!entry->value.tree || !compile::build(&entry->value.prog, entry->value.tree)) {
+        free_entry(entry);
+        return nullptr;
+    }
+
+    if (cache->max_entries && cache->count >= cache->max_entries) clear(cache);
+    if ((cache->count + 1) * 2 > cache->capacity && !grow(cache)) {
+        free_entry(entry);
+        return nullptr;
+    }
+    *find_slot(cache->slots, cache->capacity, hash, key, count) = entry;
+    ++cache->count;
+    return &entry->value;
+}
+
+} // namespace partial
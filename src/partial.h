@@ -0,0 +1,69 @@
+#ifndef PARTIAL_H
+#define PARTIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+#include "compile.h"
+
+namespace partial {
+
+typedef struct {
+    size_t var;                 // Индекс в VarList дерева
+    double value;
+} binding_t;
+
+/**
+ * @brief Частичное вычисление: подставляет значения связанных переменных и сворачивает константы.
+ *
+ * Результат - новое дерево в оставшихся переменных с тем же списком
+ * переменных (индексы не перенумеровываются, связанные просто не
+ * встречаются). В любой точке оно дает те же значения, что исходное с
+ * подставленными bindings, бит в бит: свертка считает те же операции, что
+ * calc_in_point.
+ *
+ * @return nullptr при нехватке памяти, индексе вне списка или повторе переменной.
+ */
+FRONT_COMPIL_T *specialize(const FRONT_COMPIL_T *src, const binding_t *bindings, size_t count);
+
+typedef struct {
+    FRONT_COMPIL_T   *tree;
+    compile::Program  prog;     // Программа tree; eval ждет значения по старым индексам, связанные не читаются
+} Specialized;
+
+typedef struct entry_t entry_t;
+
+/**
+ * @brief Кэш специализаций одного дерева по наборам значений.
+ *
+ * Ключ - набор (переменная, значение) без учета порядка; значения сравниваются
+ * побитово, так что 0 и -0 (и разные NaN) - разные наборы. Повторный батч с
+ * теми же значениями не строит и не компилирует дерево заново.
+ */
+typedef struct {
+    const FRONT_COMPIL_T  *src;           // Не принадлежит кэшу и должно его пережить
+    entry_t              **slots;         // Открытая адресация, степень двойки
+    size_t                 capacity;
+    size_t                 count;
+    size_t                 max_entries;   // При переполнении кэш очищается целиком; 0 - без ограничения
+
+    size_t                 hits;
+    size_t                 misses;
+} Cache;
+
+void init(Cache *cache, const FRONT_COMPIL_T *src, size_t max_entries);
+void destruct(Cache *cache);
+
+/**
+ * @brief Специализация src для набора значений: из кэша или построенная и сохраненная.
+ *
+ * Указатель живет до следующего промаха (он может очистить кэш) или destruct.
+ *
+ * @return nullptr в тех же случаях, что specialize, и при ошибке компиляции.
+ */
+const Specialized *get(Cache *cache, const binding_t *bindings, size_t count);
+
+} // namespace partial
+
+#endif // PARTIAL_H
@@ -0,0 +1,354 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "differentiator.h"
+#include "io_utils.h"
+#include "base.h"
+#include "var_list.h"
+#include "intern.h"
+
+// Формат (все целые - LEB128 varint, если не сказано иное):
+//   magic "DIFT" | version u8 | reserved u8[3]
+//   name_len | байты имени | diff_var + 1 (0 - нет) | diff_order
+//   var_count | { name_len | байты имени } * var_count
+//   node_count | { tag | payload } * node_count     -- post-order
+//   checksum u32 (FNV-1a по всему, что выше, little endian)
+// tag = (kind << 2) | (has_left << 1) | has_right, kind: 0 - число, 1 - переменная, 2 + op - оператор.
+// У листьев детей нет, у унарного оператора только левый, у бинарного оба.
+// У числа payload - сырые 8 байт double, у переменной - ее индекс в таблице.
+
+const char     BIN_MAGIC[4]  = {'D', 'I', 'F', 'T'};
+const uint8_t  BIN_VERSION   = 2;
+const size_t   BIN_HEADER    = 8;
+const uint64_t BIN_KIND_NUM  = 0;
+const uint64_t BIN_KIND_VAR  = 1;
+const uint64_t BIN_KIND_OP   = 2;
+const uint64_t BIN_MAX_OP    = CTH;
+
+typedef struct {
+    char   *data;
+    size_t  len;
+    size_t  cap;
+    bool    error;
+} bin_writer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t         len;
+    size_t         pos;
+    bool           error;
+} bin_reader_t;
+
+function uint32_t fnv1a(const void *data, size_t len) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+function bool writer_reserve(bin_writer_t *w, size_t extra) {
+    if (w->error) return false;
+    if (w->len + extra <= w->cap) return true;
+    size_t cap = w->cap ? w->cap : 256;
+    while (cap < w->len + extra) cap <<= 1;
+    char *data = (char *) realloc(w->data, cap);
+    if (!data) {
+        w->error = true;
+        return false;
+    }
+    w->data = data;
+    w->cap  = cap;
+    return true;
+}
+
+function void write_bytes(bin_writer_t *w, const void *src, size_t len) {
+    if (!writer_reserve(w, len)) return;
+    memcpy(w->data + w->len, src, len);
+    w->len += len;
+}
+
+function void write_varint(bin_writer_t *w, uint64_t value) {
+    if (!writer_reserve(w, 10)) return;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value) byte |= 0x80;
+        w->data[w->len++] = (char) byte;
+    } while (value);
+}
+
+function void write_string(bin_writer_t *w, const char *str) {
+    size_t len = str ? strlen(str) : 0;
+    write_varint(w, len);
+    if (len) write_bytes(w, str, len);
+}
+
+function uint64_t read_varint(bin_reader_t *r) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (r->pos >= r->len) break;
+        uint8_t byte = r->data[r->pos++];
+        value |= (uint64_t) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return value;
+    }
+    r->error = true;
+    return 0;
+}
+
+function const char *read_span(bin_reader_t *r, size_t len) {
+    if (r->error || len > r->len - r->pos) {
+        r->error = true;
+        return nullptr;
+    }
+    const char *span = (const char *) r->data + r->pos;
+    r->pos += len;
+    return span;
+}
+
+function size_t count_nodes(const NODE_T *root) {
+    return root ? root->elements + 1 : 0;
+}
+
+// Пишет узлы в post-order без рекурсии: дети всегда идут раньше родителя.
+function bool write_nodes(bin_writer_t *w, const NODE_T *root) {
+    size_t capacity = count_nodes(root);
+    write_varint(w, capacity);
+    if (!root) return !w->error;
+
+    const NODE_T **stack = TYPED_CALLOC(capacity, const NODE_T *);
+    if (!stack) return false;
+    size_t depth = 0, written = 0;
+    const NODE_T *last = nullptr, *cur = root;
+    while ((cur || depth) && !w->error) {
+        if (cur) {
+            if (depth == capacity) { w->error = true; break; }
+            stack[depth++] = cur;
+            cur = cur->left;
+            continue;
+        }
+        const NODE_T *top = stack[depth - 1];
+        if (top->right && last != top->right) {
+            cur = top->right;
+            continue;
+        }
+        uint64_t kind = top->type == NUM_T ? BIN_KIND_NUM
+                      : top->type == VAR_T ? BIN_KIND_VAR
+                      : BIN_KIND_OP + (uint64_t) top->value.opr;
+        write_varint(w, (kind << 2) | ((uint64_t) (top->left != nullptr) << 1) | (top->right != nullptr));
+        if (top->type == NUM_T)
+            write_bytes(w, &top->value.num, sizeof(double));
+        else if (top->type == VAR_T)
+            write_varint(w, top->value.var);
+        ++written;
+        last = top;
+        --depth;
+    }
+    FREE(stack);
+    if (written != capacity) w->error = true; // elements устарел
+    return !w->error;
+}
+
+bool serialize_tree(const FRONT_COMPIL_T *eqtree, char **out, size_t *out_len) {
+    VERIFY(eqtree && out && out_len, ERROR_MSG("serialize_tree: invalid arguments\n"); return false;);
+    bin_writer_t w = {};
+    write_bytes(&w, BIN_MAGIC, sizeof(BIN_MAGIC));
+    uint8_t version[4] = {BIN_VERSION, 0, 0, 0};
+    write_bytes(&w, version, sizeof(version));
+    write_string(&w, eqtree->name);
+    write_varint(&w, eqtree->diff_var == varlist::NPOS ? 0 : (uint64_t) eqtree->diff_var + 1);
+    write_varint(&w, eqtree->diff_order);
+
+    size_t vars_count = varlist::size(eqtree->vars);
+    write_varint(&w, vars_count);
+    for (size_t i = 0; i < vars_count; ++i) {
+        const mystr::mystr_t *name = varlist::get(eqtree->vars, i);
+        write_string(&w, name ? name->str : nullptr);
+    }
+
+    if (!write_nodes(&w, eqtree->root) || w.error) {
+        ERROR_MSG("serialize_tree: failed to encode tree\n");
+        FREE(w.data);
+        return false;
+    }
+    uint32_t checksum = fnv1a(w.data, w.len);
+    uint8_t tail[4] = {(uint8_t) checksum, (uint8_t) (checksum >> 8), (uint8_t) (checksum >> 16), (uint8_t) (checksum >> 24)};
+    write_bytes(&w, tail, sizeof(tail));
+    if (w.error) {
+        FREE(w.data);
+        return false;
+    }
+    *out     = w.data;
+    *out_len = w.len;
+    return true;
+}
+
+function bool read_vars(bin_reader_t *r, varlist::VarList *vars) {
+    uint64_t count = read_varint(r);
+    for (uint64_t i = 0; i < count && !r->error; ++i) {
+        uint64_t len = read_varint(r);
+        const char *span = read_span(r, len);
+        if (!span) return false;
+        char *copy = TYPED_CALLOC(len + 1, char);
+        if (!copy) return false;
+        memcpy(copy, span, len);
+        mystr::mystr_t name = mystr::construct(copy);
+        size_t idx = varlist::add(vars, &name);
+        FREE(copy);
+        if (idx != i) return false; // дубликат или не удалось вставить
+    }
+    return !r->error;
+}
+
+// Собирает дерево из post-order потока на явном стеке. Ошибку отмечает в r->error:
+// nullptr без ошибки - пустое дерево.
+function NODE_T *read_nodes(bin_reader_t *r, size_t vars_count) {
+    uint64_t count = read_varint(r);
+    if (r->error || !count) return nullptr;
+    if (count > r->len - r->pos) { r->error = true; return nullptr; } // каждый узел занимает хотя бы байт
+    NODE_T **stack = TYPED_CALLOC(count, NODE_T *);
+    if (!stack) { r->error = true; return nullptr; }
+    size_t depth = 0;
+    for (uint64_t i = 0; i < count && !r->error; ++i) {
+        uint64_t tag  = read_varint(r);
+        uint64_t kind = tag >> 2;
+        bool has_left  = tag & 2;
+        bool has_right = tag & 1;
+        if (depth < (size_t) has_left + has_right) { r->error = true; break; }
+        NODE_T *right = has_right ? stack[--depth] : nullptr;
+        NODE_T *left  = has_left  ? stack[--depth] : nullptr;
+        NODE_TYPE    type  = OP_T;
+        NODE_VALUE_T value = {};
+        if (kind == BIN_KIND_NUM) {
+            type = NUM_T;
+            const char *span = read_span(r, sizeof(double));
+            if (span) memcpy(&value.num, span, sizeof(double));
+        }
+        else if (kind == BIN_KIND_VAR) {
+            type = VAR_T;
+            value.var = (size_t) read_varint(r);
+            if (value.var >= vars_count) r->error = true;
+        }
+        else if (kind - BIN_KIND_OP <= BIN_MAX_OP) {
+            value.opr = (OPERATOR) (kind - BIN_KIND_OP);
+        }
+        else r->error = true;
+        // Иначе образ с верной суммой дал бы оператор без операнда, а eval и compile разыменуют nullptr
+        size_t children = type == OP_T ? operator_arity(value.opr) : 0;
+        if ((size_t) has_left + has_right != children || (children && !has_left)) r->error = true;
+
+        NODE_T *node = r->error ? nullptr : new_node(type, value, left, right);
+        if (!node) {
+            r->error = true;
+            destruct(left);
+            destruct(right);
+            break;
+        }
+        stack[depth++] = node;
+    }
+    NODE_T *root = (!r->error && depth == 1) ? stack[0] : nullptr;
+    if (!root)
+        for (size_t i = 0; i < depth; ++i) destruct(stack[i]);
+    FREE(stack);
+    if (!root) r->error = true;
+    return root;
+}
+
+FRONT_COMPIL_T *deserialize_tree(const void *data, size_t len) {
+    VERIFY(data != nullptr, ERROR_MSG("deserialize_tree: data is nullptr\n"); return nullptr;);
+    if (len < BIN_HEADER + 4 || memcmp(data, BIN_MAGIC, sizeof(BIN_MAGIC)) != 0) {
+        ERROR_MSG("deserialize_tree: not a binary tree image\n");
+        return nullptr;
+    }
+    const uint8_t *bytes = (const uint8_t *) data;
+    if (bytes[4] != BIN_VERSION) {
+        ERROR_MSG("deserialize_tree: unsupported version %u\n", bytes[4]);
+        return nullptr;
+    }
+    size_t body_len = len - 4;
+    uint32_t stored = (uint32_t) bytes[body_len] | ((uint32_t) bytes[body_len + 1] << 8)
+                    | ((uint32_t) bytes[body_len + 2] << 16) | ((uint32_t) bytes[body_len + 3] << 24);
+    if (stored != fnv1a(bytes, body_len)) {
+        ERROR_MSG("deserialize_tree: checksum mismatch\n");
+        return nullptr;
+    }
+
+    bin_reader_t r = {bytes, body_len, BIN_HEADER, false};
+    uint64_t name_len = read_varint(&r);
+    const char *name_span = read_span(&r, name_len);
+    uint64_t diff_var   = read_varint(&r);
+    uint64_t diff_order = read_varint(&r);
+
+    FRONT_COMPIL_T *eqtree = TYPED_CALLOC(1, FRONT_COMPIL_T);
+    varlist::VarList *vars = varlist::create();
+    const char *name = name_span ? intern::get(name_span, name_len) : nullptr;
+    if (!eqtree || !vars || !name) {
+        FREE(eqtree);
+        varlist::release(vars);
+        ERROR_MSG("deserialize_tree: %s\n", r.error ? "truncated header" : "no memory");
+        return nullptr;
+    }
+    eqtree->name       = name;
+    eqtree->vars       = vars;
+    eqtree->diff_var   = diff_var ? (size_t) diff_var - 1 : varlist::NPOS;
+    eqtree->diff_order = (size_t) diff_order;
+
+    bool vars_ok = read_vars(&r, vars);
+    if (vars_ok) eqtree->root = read_nodes(&r, varlist::size(vars));
+    if (!vars_ok || r.error || r.pos != r.len) {
+        ERROR_MSG("deserialize_tree: corrupted node stream at offset %zu\n", r.pos);
+        destruct(eqtree);
+        return nullptr;
+    }
+    if (eqtree->diff_var != varlist::NPOS && eqtree->diff_var >= varlist::size(vars)) {
+        ERROR_MSG("deserialize_tree: differentiation variable out of range\n");
+        destruct(eqtree);
+        return nullptr;
+    }
+    return eqtree;
+}
+
+void save_tree_to_file(FILE *file, FRONT_COMPIL_T *eqtree) {
+    VERIFY(file != nullptr, ERROR_MSG("save_tree_to_file: file is nullptr\n"); return;);
+    char  *image = nullptr;
+    size_t len   = 0;
+    if (!serialize_tree(eqtree, &image, &len)) return;
+    if (fwrite(image, 1, len, file) != len)
+        ERROR_MSG("save_tree_to_file: short write\n");
+    FREE(image);
+}
+
+FRONT_COMPIL_T *load_tree_from_binary(const char *filename) {
+    VERIFY(filename != nullptr, ERROR_MSG("filename is nullptr\n"); return nullptr;);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        ERROR_MSG("Can't open binary tree file '%s'\n", filename);
+        return nullptr;
+    }
+    struct stat st = {};
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ERROR_MSG("Can't stat binary tree file '%s'\n", filename);
+        close(fd);
+        return nullptr;
+    }
+    size_t len = (size_t) st.st_size;
+    void *image = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        ERROR_MSG("Can't map binary tree file '%s'\n", filename);
+        return nullptr;
+    }
+    madvise(image, len, MADV_SEQUENTIAL);
+    FRONT_COMPIL_T *eqtree = deserialize_tree(image, len);
+    munmap(image, len);
+    return eqtree;
+}
@@ -0,0 +1,29 @@
+#include <string.h>
+
+#include "session.h"
+#include "util.h"
+#include "base.h"
+
+void session_init(session_t *session, uint64_t seed) {
+    if (!session) return;
+    memset(session, 0, sizeof(*session));
+    latex_cache_init(&session->article.cache);
+    session->dump_limits = {
+        .max_depth      = 24,
+        .max_nodes      = 400,
+        .share_subtrees = true,
+    };
+    // xorshift never leaves zero
+    session->rng_state = seed ? seed : 0x9E3779B97F4A7C15ull;
+}
+
+void session_destruct(session_t *session) {
+    if (!session) return;
+    article_set_async(session, false);
+    destruct_logger(&session->logger);
+    article_release_cache(session);
+}
+
+int session_randint(session_t *session, int min, int max) {
+    return (int) ((xorshift64s(&session->rng_state) >> 33) % (uint64_t) (max - min)) + min;
+}
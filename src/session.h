@@ -0,0 +1,49 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+#include "logger.h"
+#include "article.h"
+#include "stats.h"
+#include "memacct.h"
+#include "growth.h"
+
+/**
+ * @brief Все изменяемое состояние одного прогона: статья, счетчики шагов, лог,
+ * нумерация дампов, настройки дампов и генератор случайных фраз.
+ *
+ * Разные сессии не делят ничего, кроме потокобезопасных арены имен и пула dot,
+ * поэтому могут работать параллельно в разных потоках. Одна сессия - один поток
+ * (плюс ее собственные фоновые потоки статьи и лога).
+ */
+typedef struct session_t {
+    ArticleContext  article;
+    size_t          step_counter;
+    size_t          step_limit;
+    size_t          requested_step_limit;   // Лимит для следующего differentiate (0 - по умолчанию)
+
+    Logger          logger;
+    size_t          dump_counter;
+    dump_limits_t   dump_limits;
+
+    uint64_t        rng_state;
+
+    stats_t         *stats;                 // Счетчики прогона (nullptr - не собираются)
+    mem_account_t   *mem;                   // Учет памяти по категориям (nullptr - не ведется)
+    growth_report_t *growth;                // Рост производных в differentiate_to_n (nullptr - не пишется)
+} session_t;
+
+void session_init(session_t *session, uint64_t seed);
+
+/**
+ * @brief Останавливает фоновый рендер, закрывает лог и освобождает кэши сессии.
+ */
+void session_destruct(session_t *session);
+
+// Целое из [min, max) от генератора сессии (xorshift64*)
+int session_randint(session_t *session, int min, int max);
+
+#endif // SESSION_H
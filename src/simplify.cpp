@@ -4,6 +4,10 @@
 #include "base.h"
 #include "const_strings.h"
 #include "article.h"
+#include "budget.h"
+#include "stats.h"
+#include "trace.h"
+#include "memacct.h"
 
 const double EPSILON = 1e-12;
 
@@ -22,41 +26,6 @@ function bool subtree_constant(const NODE_T *node) {
     return left && right;
 }
 
-function double eval_constant(const NODE_T *node) {
-    if (!node) return 0.0;
-    switch (node->type) {
-        case NUM_T: return node->value.num;
-        case OP_T: {
-            double l = node->left ? eval_constant(node->left) : 0.0;
-            double r = node->right ? eval_constant(node->right) : 0.0;
-            switch (node->value.opr) {
-                case ADD:  return l + r;
-                case SUB:  return l - r;
-                case MUL:  return l * r;
-                case DIV:  return l / r;
-                case POW:  return pow(l, r);
-                case LOG:  return log(l) / log(r);
-                case LN:   return log(l);
-                case SIN:  return sin(l);
-                case COS:  return cos(l);
-                case TAN:  return tan(l);
-                case CTG:  return 1.0 / tan(l);
-                case ASIN: return asin(l);
-                case ACOS: return acos(l);
-                case ATAN: return atan(l);
-                case ACTG: return atan(1.0 / l);
-                case SQRT: return sqrt(l);
-                case SINH: return sinh(l);
-                case COSH: return cosh(l);
-                case TANH: return tanh(l);
-                case CTH:  return 1.0 / tanh(l);
-                default:   return 0.0;
-            }
-        }
-        default: return 0.0;
-    }
-}
-
 function void replace_with_number(NODE_T *node, double value) {
     NODE_T *l = node->left;
     NODE_T *r = node->right;
@@ -73,8 +42,11 @@ function bool fold_constants(NODE_T *node) {
     bool changed = false;
     if (node->left)  changed |= fold_constants(node->left);
     if (node->right) changed |= fold_constants(node->right);
+    // Children are folded first, so the operands of a constant node are numbers by now
     if (node->type == OP_T && subtree_constant(node)) {
-        replace_with_number(node, eval_constant(node));
+        double l = node->left  ? node->left->value.num  : 0.0;
+        double r = node->right ? node->right->value.num : 0.0;
+        replace_with_number(node, apply_operator(node->value.opr, l, r));
         changed = true;
     }
     return changed;
@@ -100,7 +72,9 @@ function void adopt_child(NODE_T *node, NODE_T *keep, NODE_T *drop) {
     node->parent = parent;
     if (node->left)  node->left->parent = node;
     if (node->right) node->right->parent = node;
-    FREE(keep);
+    FREE_CAT(keep, MEM_NODES);
+    budget_release_node(sizeof(NODE_T));
+    stats_node_freed();
 }
 
 function bool simplify_neutral(NODE_T *node) {
@@ -148,26 +122,40 @@ function size_t recount_elements(NODE_T *node) {
     return total;
 }
 
-bool simplify_tree(FRONT_COMPIL_T *eqtree) {
+bool fold_constants(FRONT_COMPIL_T *eqtree) {
     if (!eqtree || !eqtree->root) return false;
-    const FRONT_COMPIL_T *prev_tree = differentiate_get_article_tree();
-    differentiate_set_article_tree(eqtree);
+    if (!fold_constants(eqtree->root)) return false;
+    recount_elements(eqtree->root);
+    eqtree->root->parent = nullptr;
+    return true;
+}
+
+bool simplify_tree(session_t *session, FRONT_COMPIL_T *eqtree) {
+    if (!eqtree || !eqtree->root) return false;
+    const FRONT_COMPIL_T *prev_tree = differentiate_get_article_tree(session);
+    differentiate_set_article_tree(session, eqtree);
+    stats_timer_t timer = stats_phase_begin(STATS_SIMPLIFY);
+    trace_span_t span = trace_begin("simplify_tree");
     bool changed = false;
+    long long pass = 0;
     do {
         changed = false;
-        if (fold_constants(eqtree->root)) {
-            recount_elements(eqtree->root);
-            eqtree->root->parent = nullptr;
-            changed = true;
-        }
+        // Every pass leaves a valid tree, so a stop between passes needs no cleanup
+        if (!budget_poll()) break;
+        stats_simplify_pass();
+        trace_span_t pass_span = trace_begin_arg("simplify pass", "pass", pass++);
+        if (fold_constants(eqtree)) changed = true;
         if (simplify_neutral(eqtree->root)) {
             recount_elements(eqtree->root);
             eqtree->root->parent = nullptr;
             changed = true;
         }
+        trace_end(&pass_span);
     } while (changed);
-    article_log_with_latex(eqtree, "\\bigskip\\hrule\\bigskip\nПутем несложных математических преобразований получим упрощенное выражение:");
-    differentiate_set_article_tree(prev_tree);
+    trace_end(&span);
+    stats_phase_end(&timer);
+    article_log_with_latex(session, eqtree, "\\bigskip\\hrule\\bigskip\nПутем несложных математических преобразований получим упрощенное выражение:");
+    differentiate_set_article_tree(session, prev_tree);
     return changed;
 }
 
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "stats.h"
+#include "util.h"
+#include "base.h"
+
+const char *STATS_PHASE_NAMES[STATS_PHASE_COUNT] = {
+    "parse", "simplify", "differentiate", "latex", "dot", "gnuplot", "tectonic",
+};
+
+// new_node has no session to carry the counters, so they hang off the thread like budget_t
+global thread_local stats_t *current_stats = nullptr;
+
+// Thread CPU plus the children reaped so far (dot, gnuplot, tectonic)
+function uint64_t cpu_ns(void) {
+    struct rusage children = {};
+    getrusage(RUSAGE_CHILDREN, &children);
+    uint64_t children_ns = (uint64_t) (children.ru_utime.tv_sec + children.ru_stime.tv_sec) * 1000000000ull
+                         + (uint64_t) (children.ru_utime.tv_usec + children.ru_stime.tv_usec) * 1000ull;
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID) + children_ns;
+}
+
+function void add(size_t *counter, size_t value) {
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+stats_t *stats_attach(stats_t *stats) {
+    stats_t *prev = current_stats;
+    current_stats = stats;
+    return prev;
+}
+
+stats_t *stats_current(void) {
+    return current_stats;
+}
+
+stats_timer_t stats_phase_begin(STATS_PHASE phase) {
+    stats_timer_t timer = {.stats = current_stats, .phase = phase, .wall0 = 0, .cpu0 = 0};
+    if (!timer.stats) return timer;
+    timer.wall0 = monotonic_ns();
+    timer.cpu0  = cpu_ns();
+    return timer;
+}
+
+void stats_phase_end(stats_timer_t *timer) {
+    if (!timer || !timer->stats) return;
+    uint64_t wall = monotonic_ns() - timer->wall0;
+    uint64_t cpu  = cpu_ns() - timer->cpu0;
+    __atomic_add_fetch(&timer->stats->wall_ns[timer->phase], wall, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&timer->stats->cpu_ns [timer->phase], cpu,  __ATOMIC_RELAXED);
+    add(&timer->stats->calls[timer->phase], 1);
+    timer->stats = nullptr;
+}
+
+void stats_node_allocated(void) {
+    stats_t *stats = current_stats;
+    if (!stats) return;
+    size_t allocated = __atomic_add_fetch(&stats->nodes_allocated, 1, __ATOMIC_RELAXED);
+    size_t freed     = __atomic_load_n(&stats->nodes_freed, __ATOMIC_RELAXED);
+    // Nodes built before stats_attach can be freed under it, so live may dip below zero
+    if (allocated <= freed) return;
+    size_t live = allocated - freed;
+    size_t peak = __atomic_load_n(&stats->peak_live_nodes, __ATOMIC_RELAXED);
+    while (live > peak && !__atomic_compare_exchange_n(&stats->peak_live_nodes, &peak, live, true,
+                                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+void stats_node_freed(void) {
+    if (current_stats) add(&current_stats->nodes_freed, 1);
+}
+
+void stats_simplify_pass(void) {
+    if (current_stats) add(&current_stats->simplify_passes, 1);
+}
+
+void stats_latex_bytes(size_t bytes) {
+    if (current_stats) add(&current_stats->latex_bytes, bytes);
+}
+
+const char *stats_phase_name(STATS_PHASE phase) {
+    return phase < STATS_PHASE_COUNT ? STATS_PHASE_NAMES[phase] : "unknown";
+}
+
+void stats_write_html(const stats_t *stats, Logger *logger) {
+    if (!stats || !logger_get_file(logger)) return;
+    logger_printf(logger, "<h2>Статистика прогона</h2>\n<table border=\"1\" cellpadding=\"4\">\n"
+                          "<tr><th>фаза</th><th>вызовы</th><th>wall, мс</th><th>CPU, мс</th></tr>\n");
+    for (size_t i = 0; i < STATS_PHASE_COUNT; ++i) {
+        logger_printf(logger, "<tr><td>%s</td><td>%zu</td><td>%.3f</td><td>%.3f</td></tr>\n",
+                      STATS_PHASE_NAMES[i], stats->calls[i],
+                      (double) stats->wall_ns[i] * 1e-6, (double) stats->cpu_ns[i] * 1e-6);
+    }
+    logger_printf(logger, "</table>\n<table border=\"1\" cellpadding=\"4\">\n"
+                          "<tr><td>проходов упрощения</td><td>%zu</td></tr>\n"
+                          "<tr><td>узлов создано</td><td>%zu</td></tr>\n"
+                          "<tr><td>узлов освобождено</td><td>%zu</td></tr>\n"
+                          "<tr><td>пик живых узлов</td><td>%zu</td></tr>\n"
+                          "<tr><td>LaTeX, байт</td><td>%zu</td></tr>\n</table>\n",
+                  stats->simplify_passes, stats->nodes_allocated, stats->nodes_freed,
+                  stats->peak_live_nodes, stats->latex_bytes);
+}
+
+bool stats_write_json(const stats_t *stats, const char *path) {
+    if (!stats || !path) return false;
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "{\n  \"phases\": {");
+    for (size_t i = 0; i < STATS_PHASE_COUNT; ++i) {
+        fprintf(file, "%s\n    \"%s\": {\"calls\": %zu, \"wall_ms\": %.3f, \"cpu_ms\": %.3f}",
+                i ? "," : "", STATS_PHASE_NAMES[i], stats->calls[i],
+                (double) stats->wall_ns[i] * 1e-6, (double) stats->cpu_ns[i] * 1e-6);
+    }
+    fprintf(file, "\n  },\n"
+                  "  \"simplify_passes\": %zu,\n"
+                  "  \"nodes_allocated\": %zu,\n"
+                  "  \"nodes_freed\": %zu,\n"
+                  "  \"peak_live_nodes\": %zu,\n"
+                  "  \"latex_bytes\": %zu\n}\n",
+            stats->simplify_passes, stats->nodes_allocated, stats->nodes_freed,
+            stats->peak_live_nodes, stats->latex_bytes);
+    return fclose(file) == 0;
+}
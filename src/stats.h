@@ -0,0 +1,69 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "logger.h"
+
+typedef enum {
+    STATS_PARSE,
+    STATS_SIMPLIFY,
+    STATS_DIFFERENTIATE,
+    STATS_LATEX,
+    STATS_DOT,
+    STATS_GNUPLOT,
+    STATS_TECTONIC,
+    STATS_PHASE_COUNT,
+} STATS_PHASE;
+
+/**
+ * @brief Счетчики одного прогона: время по фазам, узлы, объем LaTeX.
+ *
+ * Счетчики пишутся только пока структура присоединена к потоку
+ * (stats_attach); без нее каждая точка замера - одна проверка указателя.
+ * Одну структуру можно присоединить к нескольким потокам (поток прогона и
+ * фоновый рендер статьи), поля обновляются атомарно.
+ *
+ * CPU фазы - время потока плюс время дочерних процессов, дождавшихся за фазу
+ * (dot, gnuplot, tectonic). При параллельных прогонах дочерние процессы
+ * одного задания могут попасть в фазу другого.
+ */
+typedef struct {
+    uint64_t wall_ns[STATS_PHASE_COUNT];
+    uint64_t cpu_ns [STATS_PHASE_COUNT];
+    size_t   calls  [STATS_PHASE_COUNT];
+
+    size_t   simplify_passes;
+    size_t   nodes_allocated;
+    size_t   nodes_freed;
+    size_t   peak_live_nodes;       // Максимум allocated - freed за прогон
+    size_t   latex_bytes;           // Выданный LaTeX: в файлы и строками latex_dump
+} stats_t;
+
+typedef struct {
+    stats_t     *stats;             // nullptr - замер выключен
+    STATS_PHASE  phase;
+    uint64_t     wall0;
+    uint64_t     cpu0;
+} stats_timer_t;
+
+// Присоединяет stats к текущему потоку (nullptr - отсоединить), возвращает прежнюю
+stats_t *stats_attach(stats_t *stats);
+stats_t *stats_current(void);
+
+stats_timer_t stats_phase_begin(STATS_PHASE phase);
+void          stats_phase_end(stats_timer_t *timer);
+
+void stats_node_allocated(void);
+void stats_node_freed(void);
+void stats_simplify_pass(void);
+void stats_latex_bytes(size_t bytes);
+
+const char *stats_phase_name(STATS_PHASE phase);
+
+// Сводная таблица в лог и JSON-файл с теми же числами
+void stats_write_html(const stats_t *stats, Logger *logger);
+bool stats_write_json(const stats_t *stats, const char *path);
+
+#endif // STATS_H
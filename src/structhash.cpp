@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "structhash.h"
+#include "util.h"
+#include "base.h"
+
+namespace structhash {
+
+struct node_slot_t {
+    const NODE_T *node;
+    size_t        id;
+};
+
+struct cons_slot_t {
+    size_t id_plus_one;     // 0 - пустой слот
+};
+
+typedef struct {
+    const NODE_T *node;
+    bool          expanded;
+} frame_t;
+
+function uint64_t value_bits(const NODE_T *node) {
+    switch (node->type) {
+        case NUM_T: return num_bits(node->value.num);
+        case OP_T:  return (uint64_t) node->value.opr;
+        case VAR_T: return (uint64_t) node->value.var;
+        default:    return 0;
+    }
+}
+
+function size_t capacity_for(size_t count) {
+    size_t capacity = 16;
+    while (capacity < count * 2) capacity <<= 1;
+    return capacity;
+}
+
+function size_t pointer_slot(const Index *index, const NODE_T *node) {
+    size_t mask = index->nodes_capacity - 1;
+    size_t slot = (size_t) mix((uintptr_t) node) & mask;
+    while (index->nodes[slot].node && index->nodes[slot].node != node)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+function size_t child_id(const Index *index, const NODE_T *child) {
+    return child ? index->nodes[pointer_slot(index, child)].id : NPOS;
+}
+
+// Two nodes are the same class when their own fields match and their children are already the same class
+function bool same_class(const Index *index, size_t id, const NODE_T *node, size_t left_id, size_t right_id) {
+    const NODE_T *other = index->canonical[id];
+    return other->type == node->type
+        && value_bits(other) == value_bits(node)
+        && child_id(index, other->left)  == left_id
+        && child_id(index, other->right) == right_id;
+}
+
+function size_t intern_node(Index *index, const NODE_T *node) {
+    size_t left_id  = child_id(index, node->left);
+    size_t right_id = child_id(index, node->right);
+    uint64_t left_hash  = node->left  ? index->hashes[left_id]  : 0;
+    uint64_t right_hash = node->right ? index->hashes[right_id] : 0;
+
+    uint64_t h = mix((uint64_t) node->type * 0x9E3779B97F4A7C15ull ^ value_bits(node));
+    h = mix(h ^ (left_hash  + 0x9E3779B97F4A7C15ull));
+    h = mix(h ^ (right_hash + 0xC2B2AE3D27D4EB4Full));
+
+    size_t mask = index->cons_capacity - 1;
+    size_t slot = (size_t) h & mask;
+    while (index->cons[slot].id_plus_one) {
+        size_t candidate = index->cons[slot].id_plus_one - 1;
+        if (index->hashes[candidate] == h && same_class(index, candidate, node, left_id, right_id))
+            return candidate;
+        slot = (slot + 1) & mask;
+    }
+
+    size_t new_id = index->distinct++;
+    index->cons[slot].id_plus_one = new_id + 1;
+    index->canonical[new_id] = node;
+    index->hashes[new_id]    = h;
+    index->sizes[new_id]     = 1 + (node->left  ? index->sizes[left_id]  : 0)
+                                 + (node->right ? index->sizes[right_id] : 0);
+    return new_id;
+}
+
+function bool push(frame_t **stack, size_t *top, size_t *capacity, frame_t frame) {
+    if (*top == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        frame_t *grown = (frame_t *) realloc(*stack, new_capacity * sizeof(frame_t));
+        if (!grown) return false;
+        *stack = grown;
+        *capacity = new_capacity;
+    }
+    (*stack)[(*top)++] = frame;
+    return true;
+}
+
+// Post-order node list: every node comes after both of its children
+function const NODE_T **post_order(const NODE_T *root, size_t *count) {
+    size_t order_capacity = 64, stack_capacity = 0, top = 0;
+    *count = 0;
+    const NODE_T **order = TYPED_CALLOC(order_capacity, const NODE_T *);
+    frame_t *stack = nullptr;
+    if (!order || !push(&stack, &top, &stack_capacity, {.node = root, .expanded = false}))
+        goto fail;
+
+    while (top) {
+        frame_t *frame = &stack[top - 1];
+        const NODE_T *node = frame->node;
+        if (!frame->expanded) {
+            frame->expanded = true;
+            if (node->right && !push(&stack, &top, &stack_capacity, {.node = node->right, .expanded = false})) goto fail;
+            if (node->left  && !push(&stack, &top, &stack_capacity, {.node = node->left,  .expanded = false})) goto fail;
+            continue;
+        }
+        --top;
+        if (*count == order_capacity) {
+            const NODE_T **grown = (const NODE_T **) realloc(order, order_capacity * 2 * sizeof(*order));
+            if (!grown) goto fail;
+            order = grown;
+            order_capacity *= 2;
+        }
+        order[(*count)++] = node;
+    }
+    free(stack);
+    return order;
+
+fail:
+    free(stack);
+    free(order);
+    *count = 0;
+    return nullptr;
+}
+
+bool build(Index *index, const NODE_T *root) {
+    *index = {};
+    if (!root) return true;
+
+    size_t count = 0;
+    const NODE_T **order = post_order(root, &count);
+    if (!order) return false;
+
+    index->count          = count;
+    index->nodes_capacity = capacity_for(count);
+    index->cons_capacity  = capacity_for(count);
+    index->nodes     = TYPED_CALLOC(index->nodes_capacity, node_slot_t);
+    index->cons      = TYPED_CALLOC(index->cons_capacity,  cons_slot_t);
+    index->canonical = TYPED_CALLOC(count, const NODE_T *);
+    index->hashes    = TYPED_CALLOC(count, uint64_t);
+    index->sizes     = TYPED_CALLOC(count, size_t);
+    if (!index->nodes || !index->cons || !index->canonical || !index->hashes || !index->sizes) {
+        free(order);
+        destruct(index);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const NODE_T *node = order[i];
+        size_t slot = pointer_slot(index, node);
+        size_t node_id = intern_node(index, node);
+        index->nodes[slot].node = node;
+        index->nodes[slot].id   = node_id;
+    }
+
+    free(order);
+    return true;
+}
+
+void destruct(Index *index) {
+    if (!index) return;
+    FREE(index->nodes);
+    FREE(index->cons);
+    FREE(index->canonical);
+    FREE(index->hashes);
+    FREE(index->sizes);
+    *index = {};
+}
+
+size_t id(const Index *index, const NODE_T *node) {
+    if (!index || !index->nodes || !node) return NPOS;
+    size_t slot = pointer_slot(index, node);
+    return index->nodes[slot].node ? index->nodes[slot].id : NPOS;
+}
+
+uint64_t hash(const Index *index, const NODE_T *node) {
+    size_t node_id = id(index, node);
+    return node_id == NPOS ? 0 : index->hashes[node_id];
+}
+
+uint64_t hash_tree(const NODE_T *root) {
+    Index index = {};
+    if (!build(&index, root)) return 0;
+    uint64_t h = hash(&index, root);
+    destruct(&index);
+    return h;
+}
+
+uint64_t hash_expression(const FRONT_COMPIL_T *eqtree) {
+    if (!eqtree) return 0;
+    uint64_t h = hash_tree(eqtree->root);
+    size_t vars_count = eqtree->vars ? varlist::size(eqtree->vars) : 0;
+    for (size_t i = 0; i < vars_count; ++i) {
+        const mystr::mystr_t *name = varlist::get(eqtree->vars, i);
+        // FNV-1a over the bytes: stable between runs, unlike anything address-based
+        uint64_t name_hash = 0xcbf29ce484222325ull;
+        for (const char *ch = (name && name->str) ? name->str : ""; *ch; ++ch)
+            name_hash = (name_hash ^ (unsigned char) *ch) * 0x100000001b3ull;
+        h = mix(h ^ (name_hash + i * 0x9E3779B97F4A7C15ull));
+    }
+    return h;
+}
+
+typedef struct {
+    const NODE_T *a, *b;
+} pair_t;
+
+bool equal(const NODE_T *a, const NODE_T *b) {
+    size_t top = 0, capacity = 64;
+    pair_t *stack = TYPED_CALLOC(capacity, pair_t);
+    if (!stack) return false;
+    bool same = true;
+    stack[top++] = {a, b};
+    while (top && same) {
+        pair_t pair = stack[--top];
+        if (!pair.a || !pair.b) {
+            same = pair.a == pair.b;
+            continue;
+        }
+        if (pair.a->type != pair.b->type || value_bits(pair.a) != value_bits(pair.b)) {
+            same = false;
+            continue;
+        }
+        if (top + 2 > capacity) {
+            pair_t *grown = (pair_t *) realloc(stack, capacity * 2 * sizeof(pair_t));
+            if (!grown) {
+                same = false;
+                break;
+            }
+            stack = grown;
+            capacity *= 2;
+        }
+        stack[top++] = {pair.a->right, pair.b->right};
+        stack[top++] = {pair.a->left,  pair.b->left};
+    }
+    free(stack);
+    return same;
+}
+
+} // namespace structhash
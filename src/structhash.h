@@ -0,0 +1,62 @@
+#ifndef STRUCTHASH_H
+#define STRUCTHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "differentiator.h"
+
+namespace structhash {
+
+const size_t NPOS = (size_t) -1;
+
+typedef struct node_slot_t node_slot_t;
+typedef struct cons_slot_t cons_slot_t;
+
+/**
+ * @brief Индекс структурно равных поддеревьев (hash-consing поверх готового дерева).
+ *
+ * Каждому узлу сопоставляется id класса: два узла получают один id тогда и
+ * только тогда, когда совпадают тип, значение и id обоих потомков, т.е.
+ * поддеревья равны структурно. Сравнение точное, коллизии хэша на id не влияют.
+ * Хэш класса не зависит от адресов и стабилен между запусками (переменные
+ * входят в него индексом в VarList дерева).
+ */
+typedef struct {
+    node_slot_t    *nodes;           // адрес узла -> id
+    size_t          nodes_capacity;
+    cons_slot_t    *cons;            // (тип, значение, id потомков) -> id
+    size_t          cons_capacity;
+    const NODE_T  **canonical;       // id -> первый встреченный узел класса
+    uint64_t       *hashes;          // id -> хэш класса
+    size_t         *sizes;           // id -> число узлов поддерева
+    size_t          count;           // узлов в дереве
+    size_t          distinct;        // различных поддеревьев
+} Index;
+
+/**
+ * @brief Строит индекс по дереву за O(n) без рекурсии.
+ *
+ * @return false при нехватке памяти (индекс остается пустым).
+ */
+bool build(Index *index, const NODE_T *root);
+
+void destruct(Index *index);
+
+// id класса узла или NPOS, если узла нет в индексе
+size_t id(const Index *index, const NODE_T *node);
+
+uint64_t hash(const Index *index, const NODE_T *node);
+
+// Хэш всего дерева без сохранения индекса
+uint64_t hash_tree(const NODE_T *root);
+
+// Хэш дерева вместе с именами его переменных: x + 1 и y + 1 различаются
+uint64_t hash_expression(const FRONT_COMPIL_T *eqtree);
+
+// Точное структурное сравнение двух деревьев (без рекурсии)
+bool equal(const NODE_T *a, const NODE_T *b);
+
+} // namespace structhash
+
+#endif // STRUCTHASH_H
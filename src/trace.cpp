@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+#include "util.h"
+#include "base.h"
+#include "io_utils.h"
+
+const size_t TRACE_MIN_EVENTS = 1024;
+const size_t TRACE_MAX_THREADS = 256;
+
+typedef struct {
+    const char *name;
+    const char *arg_name;
+    long long   arg;
+    uint64_t    ts_ns;
+    uint64_t    dur_ns;
+    pid_t       tid;
+} trace_event_t;
+
+typedef struct {
+    pid_t tid;
+    char  name[48];
+} trace_thread_t;
+
+typedef struct {
+    char           *path;
+    uint64_t        origin_ns;
+    trace_event_t  *events;
+    size_t          count;
+    size_t          capacity;
+    trace_thread_t  threads[TRACE_MAX_THREADS];
+    size_t          threads_count;
+} Trace;
+
+global Trace TRACE = {};
+global int TRACE_ON = 0;
+// Spans come from the pipeline, the article worker and batch workers at once
+global pthread_mutex_t TRACE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+global thread_local pid_t TRACE_TID = 0;
+
+function pid_t current_tid(void) {
+    if (!TRACE_TID) TRACE_TID = (pid_t) syscall(SYS_gettid);
+    return TRACE_TID;
+}
+
+bool trace_enabled(void) {
+    return __atomic_load_n(&TRACE_ON, __ATOMIC_ACQUIRE) != 0;
+}
+
+bool trace_open(const char *path) {
+    if (!path) return false;
+    pthread_mutex_lock(&TRACE_LOCK);
+    if (TRACE.path) {
+        pthread_mutex_unlock(&TRACE_LOCK);
+        ERROR_MSG("trace_open: trace is already open (%s)\n", TRACE.path);
+        return false;
+    }
+    TRACE.path = strdup(path);
+    if (!TRACE.path) {
+        pthread_mutex_unlock(&TRACE_LOCK);
+        return false;
+    }
+    TRACE.origin_ns = monotonic_ns();
+    __atomic_store_n(&TRACE_ON, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&TRACE_LOCK);
+    return true;
+}
+
+// Names are JSON strings; literals here never need more than quote and backslash escaping
+function void write_json_str(FILE *file, const char *str) {
+    fputc('"', file);
+    for (; *str; ++str) {
+        if (*str == '"' || *str == '\\') fputc('\\', file);
+        fputc(*str, file);
+    }
+    fputc('"', file);
+}
+
+function bool write_trace(FILE *file) {
+    pid_t pid = getpid();
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    bool first = true;
+    for (size_t i = 0; i < TRACE.threads_count; ++i) {
+        fprintf(file, "%s\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+                first ? "" : ",", (int) pid, (int) TRACE.threads[i].tid);
+        write_json_str(file, TRACE.threads[i].name);
+        fprintf(file, "}}");
+        first = false;
+    }
+    for (size_t i = 0; i < TRACE.count; ++i) {
+        const trace_event_t *ev = &TRACE.events[i];
+        fprintf(file, "%s\n{\"ph\": \"X\", \"cat\": \"diff\", \"name\": ", first ? "" : ",");
+        write_json_str(file, ev->name);
+        fprintf(file, ", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                (int) pid, (int) ev->tid, (double) ev->ts_ns * 1e-3, (double) ev->dur_ns * 1e-3);
+        if (ev->arg_name) {
+            fprintf(file, ", \"args\": {");
+            write_json_str(file, ev->arg_name);
+            fprintf(file, ": %lld}", ev->arg);
+        }
+        fputc('}', file);
+        first = false;
+    }
+    fprintf(file, "\n]}\n");
+    return !ferror(file);
+}
+
+bool trace_close(void) {
+    pthread_mutex_lock(&TRACE_LOCK);
+    __atomic_store_n(&TRACE_ON, 0, __ATOMIC_RELEASE);
+    if (!TRACE.path) {
+        pthread_mutex_unlock(&TRACE_LOCK);
+        return false;
+    }
+    bool ok = false;
+    FILE *file = fopen(TRACE.path, "w");
+    if (file) {
+        ok = write_trace(file);
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok) ERROR_MSG("Failed to write trace %s\n", TRACE.path);
+    free(TRACE.path);
+    free(TRACE.events);
+    TRACE = (Trace) {};
+    pthread_mutex_unlock(&TRACE_LOCK);
+    return ok;
+}
+
+trace_span_t trace_begin_arg(const char *name, const char *arg_name, long long arg) {
+    trace_span_t span = {.name = name, .arg_name = arg_name, .arg = arg, .start_ns = 0};
+    if (trace_enabled()) span.start_ns = monotonic_ns();
+    return span;
+}
+
+trace_span_t trace_begin(const char *name) {
+    return trace_begin_arg(name, nullptr, 0);
+}
+
+function bool reserve_event(void) {
+    if (TRACE.count < TRACE.capacity) return true;
+    size_t new_capacity = TRACE.capacity ? TRACE.capacity * 2 : TRACE_MIN_EVENTS;
+    trace_event_t *grown = (trace_event_t *) realloc(TRACE.events, new_capacity * sizeof(trace_event_t));
+    if (!grown) return false;
+    TRACE.events = grown;
+    TRACE.capacity = new_capacity;
+    return true;
+}
+
+void trace_end(trace_span_t *span) {
+    if (!span || !span->start_ns) return;
+    uint64_t end_ns = monotonic_ns();
+    pid_t tid = current_tid();
+    pthread_mutex_lock(&TRACE_LOCK);
+    // A span that straddles trace_close or started before trace_open is dropped
+    if (TRACE.path && span->start_ns >= TRACE.origin_ns && reserve_event()) {
+        TRACE.events[TRACE.count++] = (trace_event_t) {
+            .name     = span->name,
+            .arg_name = span->arg_name,
+            .arg      = span->arg,
+            .ts_ns    = span->start_ns - TRACE.origin_ns,
+            .dur_ns   = end_ns - span->start_ns,
+            .tid      = tid,
+        };
+    }
+    pthread_mutex_unlock(&TRACE_LOCK);
+    span->start_ns = 0;
+}
+
+void trace_thread_name(const char *name) {
+    if (!name || !trace_enabled()) return;
+    pid_t tid = current_tid();
+    pthread_mutex_lock(&TRACE_LOCK);
+    if (TRACE.path && TRACE.threads_count < TRACE_MAX_THREADS) {
+        trace_thread_t *thread = &TRACE.threads[TRACE.threads_count++];
+        thread->tid = tid;
+        snprintf(thread->name, sizeof(thread->name), "%s", name);
+    }
+    pthread_mutex_unlock(&TRACE_LOCK);
+}
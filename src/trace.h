@@ -0,0 +1,41 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Спан для трассы в формате Chrome trace-event.
+ *
+ * Спаны пишутся как полные события ("ph": "X") с id процесса и потока, так что
+ * вложенность и перекрытие между потоками видны в chrome://tracing и Perfetto.
+ * name и arg_name должны жить до trace_close (строковые литералы).
+ */
+typedef struct {
+    const char *name;
+    const char *arg_name;       // nullptr - без аргумента
+    long long   arg;
+    uint64_t    start_ns;       // 0 - запись выключена, trace_end ничего не делает
+} trace_span_t;
+
+/**
+ * @brief Включает запись трассы для всего процесса.
+ *
+ * События копятся в памяти и записываются в path при trace_close.
+ * Пока трасса не открыта, trace_begin и trace_end - одна проверка флага.
+ */
+bool trace_open(const char *path);
+
+// Пишет накопленные события в файл, указанный в trace_open, и выключает запись
+bool trace_close(void);
+
+bool trace_enabled(void);
+
+trace_span_t trace_begin(const char *name);
+trace_span_t trace_begin_arg(const char *name, const char *arg_name, long long arg);
+void         trace_end(trace_span_t *span);
+
+// Подпись текущего потока в просмотрщике (метаданные "thread_name")
+void trace_thread_name(const char *name);
+
+#endif // TRACE_H
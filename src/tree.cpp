@@ -12,9 +12,12 @@
 #include "io_utils.h"
 #include "base.h"
 #include "var_list.h"
+#include "budget.h"
+#include "memacct.h"
+#include "stats.h"
 
 NODE_T *alloc_new_node() {
-    NODE_T *new_node = TYPED_CALLOC(1, NODE_T);
+    NODE_T *new_node = TYPED_CALLOC_CAT(1, NODE_T, MEM_NODES);
     if (new_node == nullptr) {
         return nullptr;
     }
@@ -23,9 +26,12 @@ NODE_T *alloc_new_node() {
 }
 
 NODE_T *new_node(NODE_TYPE type, NODE_VALUE_T value, NODE_T *left, NODE_T *right) {
+    if (!budget_charge_node(sizeof(NODE_T)))
+        return nullptr;
     NODE_T *node = alloc_new_node();
     if (!node)
         return nullptr;
+    stats_node_allocated();
     node->type  = type;
     node->value = value;
     node->left  = left;
@@ -46,21 +52,18 @@ void destruct(NODE_T *node) {
         return;
     destruct(node->left);
     destruct(node->right);
-    FREE(node);
+    FREE_CAT(node, MEM_NODES);
+    budget_release_node(sizeof(NODE_T));
+    stats_node_freed();
 }
 
 void destruct(FRONT_COMPIL_T *eqtree) {
     if (!eqtree)
         return;
     destruct(eqtree->root);
-    if (eqtree->owns_name && eqtree->name)
-        free((void *) eqtree->name);
     eqtree->name = nullptr;
-    if (eqtree->vars) {
-        varlist::destruct(eqtree->vars);
-        if (eqtree->owns_vars)
-            FREE(eqtree->vars);
-    }
+    varlist::release(eqtree->vars);
+    eqtree->vars = nullptr;
     FREE(eqtree);
 }
 
@@ -140,10 +143,50 @@ bool operator_from_token(const char *token, OPERATOR *op) {
     return false;
 }
 
+size_t operator_arity(OPERATOR op) {
+    switch (op) {
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case POW:
+        case LOG:
+            return 2;
+        default:
+            return 1;
+    }
+}
+
 bool is_leaf(const NODE_T *node) {
     return node && node->left && node->right;
 }
 
+double apply_operator(OPERATOR op, double l, double r) {
+    switch (op) {
+        case ADD:  return l + r;
+        case SUB:  return l - r;
+        case MUL:  return l * r;
+        case DIV:  return l / r;
+        case POW:  return pow(l, r);
+        case LOG:  return log(l) / log(r);
+        case LN:   return log(l);
+        case SIN:  return sin(l);
+        case COS:  return cos(l);
+        case TAN:  return tan(l);
+        case CTG:  return 1.0 / tan(l);
+        case ASIN: return asin(l);
+        case ACOS: return acos(l);
+        case ATAN: return atan(l);
+        case ACTG: return atan(1.0 / l);
+        case SQRT: return sqrt(l);
+        case SINH: return sinh(l);
+        case COSH: return cosh(l);
+        case TANH: return tanh(l);
+        case CTH:  return 1.0 / tanh(l);
+        default:   ERROR_MSG("eval_node: unknown operator: %d", op); return 0;
+    }
+}
+
 function double eval_node(const NODE_T *node, const double *vals, size_t vals_num) {
     if (!node) return 0;
     switch (node->type) {
@@ -155,29 +198,7 @@ function double eval_node(const NODE_T *node, const double *vals, size_t vals_nu
         case OP_T: {
             double l = node->left ? eval_node(node->left, vals, vals_num) : 0;
             double r = node->right ? eval_node(node->right, vals, vals_num) : 0;
-            switch (node->value.opr) {
-                case ADD:  return l + r;
-                case SUB:  return l - r;
-                case MUL:  return l * r;
-                case DIV:  return l / r;
-                case POW:  return pow(l, r);
-                case LOG:  return log(l) / log(r);
-                case LN:   return log(l);
-                case SIN:  return sin(l);
-                case COS:  return cos(l);
-                case TAN:  return tan(l);
-                case CTG:  return 1.0 / tan(l);
-                case ASIN: return asin(l);
-                case ACOS: return acos(l);
-                case ATAN: return atan(l);
-                case ACTG: return atan(1.0 / l);
-                case SQRT: return sqrt(l);
-                case SINH: return sinh(l);
-                case COSH: return cosh(l);
-                case TANH: return tanh(l);
-                case CTH:  return 1.0 / tanh(l);
-                default:   ERROR_MSG("eval_node: unknown operator: %d", node->value.opr); return 0;
-            }
+            return apply_operator(node->value.opr, l, r);
         }
     }
 }
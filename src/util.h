@@ -0,0 +1,83 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Мелкие помощники, общие для нескольких модулей и утилит.
+
+/**
+ * @brief Финализатор murmur3: перемешивает все биты h.
+ *
+ * На нем держатся структурные хэши (а значит, ключи дискового кэша), CSE в
+ * compile::build_multi и ключи кэша специализаций.
+ */
+static inline uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Биты double как ключ: 0 и -0 (и разные NaN) различаются, в отличие от ==
+static inline uint64_t num_bits(double num) {
+    uint64_t bits = 0;
+    memcpy(&bits, &num, sizeof(bits));
+    return bits;
+}
+
+// Секунды по CLOCK_MONOTONIC: для замеров длительности, не для времени суток
+static inline double now_seconds(void) {
+    struct timespec ts = {};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// Наносекунды по часам clock (CLOCK_THREAD_CPUTIME_ID для счетчиков CPU)
+static inline uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts = {};
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// Наносекунды по CLOCK_MONOTONIC: дедлайны бюджетов и метки трассировки
+static inline uint64_t monotonic_ns(void) {
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+// Шаг xorshift64*; из нулевого состояния генератор не выходит, так что state != 0
+static inline uint64_t xorshift64s(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+/**
+ * @brief Пишет все len байт, продолжая после частичной записи и EINTR.
+ *
+ * @return false при ошибке write (errno сохранен).
+ */
+static inline bool write_all(int fd, const void *data, size_t len) {
+    const char *cur = (const char *) data;
+    while (len) {
+        ssize_t written = write(fd, cur, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        cur += written;
+        len -= (size_t) written;
+    }
+    return true;
+}
+
+#endif // UTIL_H
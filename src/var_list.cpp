@@ -2,28 +2,33 @@
 #include <string.h>
 
 #include "var_list.h"
+#include "intern.h"
 #include "base.h"
+#include "memacct.h"
 
 namespace varlist {
 
 using mystr::mystr_t;
 
+const size_t MIN_SLOTS = 8;
+
 /**
- * @brief Находит позицию вставки для заданного хэша в массиве order.
+ * @brief Ищет слот таблицы для хэша: занятый этим именем или первый пустой.
  *
  * @param list Указатель на список.
- * @param hash Целевое значение хэша.
- * @return Индекс в массиве order.
+ * @param name Указатель на строку.
+ * @return Номер слота в массиве slots.
  */
-function size_t lower_bound(const VarList *list, unsigned long hash) {
-    size_t left = 0, right = list ? list->size : 0;
-    while (left < right) {
-        size_t mid = left + (right - left) / 2;
-        size_t idx = list->order[mid];
-        unsigned long cur = list->data[idx].hash;
-        if (cur < hash) left = mid + 1; else right = mid;
+function size_t probe(const VarList *list, const mystr_t *name) {
+    size_t mask = list->slots_capacity - 1;
+    size_t slot = name->hash & mask;
+    while (list->slots[slot]) {
+        size_t idx = list->slots[slot] - 1;
+        if (list->data[idx].hash == name->hash && (list->data[idx].str == name->str || list->data[idx].is_same(name)))
+            return slot;
+        slot = (slot + 1) & mask;
     }
-    return left;
+    return slot;
 }
 
 /**
@@ -31,20 +36,12 @@ function size_t lower_bound(const VarList *list, unsigned long hash) {
  *
  * @param list Указатель на список.
  * @param name Указатель на строку.
- * @return Индекс строки или VAR_LIST_NPOS.
+ * @return Индекс строки или NPOS.
  */
 function size_t find_internal(const VarList *list, const mystr_t *name) {
-    if (!list || !name || !list->size) return NPOS;
-    unsigned long hash = name->hash;
-    if (!hash) return NPOS;
-    size_t pos = lower_bound(list, hash);
-    while (pos < list->size) {
-        size_t idx = list->order[pos];
-        if (list->data[idx].hash != hash) break;
-        if (list->data[idx].is_same(name)) return idx;
-        ++pos;
-    }
-    return NPOS;
+    if (!list || !name || !list->size || !name->hash) return NPOS;
+    size_t stored = list->slots[probe(list, name)];
+    return stored ? stored - 1 : NPOS;
 }
 
 function int ensure_capacity(VarList *list, size_t need) {
@@ -52,60 +49,84 @@ function int ensure_capacity(VarList *list, size_t need) {
     if (list->capacity >= need) return 0;
     size_t cap = list->capacity ? list->capacity : 4;
     while (cap < need) cap <<= 1;
-    mystr_t *new_data = (mystr_t *) malloc(cap * sizeof(mystr_t));
+    mystr_t *new_data = (mystr_t *) mem_realloc(list->data, cap * sizeof(mystr_t), MEM_VARLISTS);
     if (!new_data) return -1;
-    size_t *new_order = (size_t *) malloc(cap * sizeof(size_t));
-    if (!new_order) {
-        free(new_data);
-        return -1;
-    }
-    if (list->data) memcpy(new_data, list->data, list->size * sizeof(mystr_t));
-    if (list->order) memcpy(new_order, list->order, list->size * sizeof(size_t));
-    free(list->data);
-    free(list->order);
     list->data = new_data;
-    list->order = new_order;
     list->capacity = cap;
     return 0;
 }
 
+// Keeps the load factor at most 1/2; rebuilding from data is O(n), indices do not move.
+function int ensure_slots(VarList *list, size_t need) {
+    if (list->slots_capacity >= 2 * need) return 0;
+    size_t cap = list->slots_capacity ? list->slots_capacity : MIN_SLOTS;
+    while (cap < 2 * need) cap <<= 1;
+    size_t *new_slots = TYPED_CALLOC_CAT(cap, size_t, MEM_VARLISTS);
+    if (!new_slots) return -1;
+    mem_free(list->slots, MEM_VARLISTS);
+    list->slots = new_slots;
+    list->slots_capacity = cap;
+    for (size_t i = 0; i < list->size; ++i)
+        list->slots[probe(list, &list->data[i])] = i + 1;
+    return 0;
+}
+
 void init(VarList *list) {
     if (!list) return;
     list->data = nullptr;
-    list->order = nullptr;
+    list->slots = nullptr;
     list->size = 0;
     list->capacity = 0;
+    list->slots_capacity = 0;
+    list->refcount = 1;
+    list->heap = false;
+}
+
+VarList *create() {
+    VarList *list = TYPED_CALLOC_CAT(1, VarList, MEM_VARLISTS);
+    if (!list) return nullptr;
+    init(list);
+    list->heap = true;
+    return list;
+}
+
+VarList *retain(VarList *list) {
+    if (list) __atomic_add_fetch(&list->refcount, 1, __ATOMIC_RELAXED);
+    return list;
+}
+
+void release(VarList *list) {
+    if (!list) return;
+    if (__atomic_sub_fetch(&list->refcount, 1, __ATOMIC_ACQ_REL) != 0) return;
+    bool heap = list->heap;
+    destruct(list);
+    if (heap) mem_free(list, MEM_VARLISTS);
 }
 
 void destruct(VarList *list) {
     if (!list) return;
-    for (size_t i = 0; i < list->size; ++i)
-        free(list->data[i].str);
-    free(list->data);
-    free(list->order);
-    list->data = nullptr;
-    list->order = nullptr;
-    list->size = 0;
-    list->capacity = 0;
+    mem_free(list->data, MEM_VARLISTS);
+    mem_free(list->slots, MEM_VARLISTS);
+    bool heap = list->heap;
+    init(list);
+    list->heap = heap;
 }
 
 size_t add(VarList *list, const mystr_t *name) {
     if (!list || !name || !name->hash)
         return NPOS;
-    size_t existing = find_internal(list, name);
-    if (existing != NPOS)
-        return existing;
-    if (ensure_capacity(list, list->size + 1))
+    if (ensure_capacity(list, list->size + 1) || ensure_slots(list, list->size + 1))
         return NPOS;
-    mystr_t copy = mystr::dupe(name);
-    if (!copy.str || !copy.hash)
+    size_t slot = probe(list, name);
+    if (list->slots[slot])
+        return list->slots[slot] - 1;
+    mystr_t copy = *name;
+    copy.str = (char *) intern::get(name->str);
+    if (!copy.str)
         return NPOS;
-    size_t insert_pos = lower_bound(list, copy.hash);
     size_t new_idx = list->size;
-    if (insert_pos < new_idx)
-        memmove(list->order + insert_pos + 1, list->order + insert_pos, (new_idx - insert_pos) * sizeof(size_t));
-    list->order[insert_pos] = new_idx;
     list->data[new_idx] = copy;
+    list->slots[slot] = new_idx + 1;
     list->size = new_idx + 1;
     return new_idx;
 }
@@ -129,18 +150,21 @@ size_t find_index(const VarList *list, const mystr_t *name) {
 
 VarList *clone(const VarList *list) {
     if (!list) return nullptr;
-    VarList *copy = TYPED_CALLOC(1, VarList);
+    VarList *copy = create();
     if (!copy) return nullptr;
-    init(copy);
-    for (size_t i = 0; i < list->size; ++i) {
-        if (add(copy, &list->data[i]) == NPOS) {
-            destruct(copy);
-            FREE(copy);
-            return nullptr;
-        }
+    if (!list->size) return copy;
+    copy->data  = TYPED_CALLOC_CAT(list->capacity, mystr_t, MEM_VARLISTS);
+    copy->slots = TYPED_CALLOC_CAT(list->slots_capacity, size_t, MEM_VARLISTS);
+    if (!copy->data || !copy->slots) {
+        release(copy);
+        return nullptr;
     }
+    copy->capacity = list->capacity;
+    copy->slots_capacity = list->slots_capacity;
+    memcpy(copy->slots, list->slots, list->slots_capacity * sizeof(size_t));
+    memcpy(copy->data, list->data, list->size * sizeof(mystr_t));
+    copy->size = list->size;
     return copy;
 }
 
 } // namespace varlist
-
@@ -13,15 +13,23 @@ const size_t NPOS = (size_t) -1;
 /**
  * @brief Структура для хранения уникальных имен переменных.
  *
- * Хранит копии строк и упорядоченные по хэшу индексы, что позволяет выполнять
- * бинпоиск по хэшам с проверкой строк. Значение 0 зарезервировано как poison,
+ * Хранит имена (строки из intern::get) в порядке добавления (индекс имени не меняется) и
+ * хэш-таблицу с открытой адресацией по mystr_t::hash, поэтому добавление и
+ * поиск выполняются в среднем за O(1). Значение 0 зарезервировано как poison,
  * поэтому внутри списка хэш всегда >= 1.
+ *
+ * Список разделяется между всеми деревьями, производными от одного источника:
+ * деревья держат ссылку (retain/release), а изменять можно только список с
+ * единственной ссылкой.
  */
 typedef struct {
-    mystr::mystr_t *data;           /**< Массив строк с именами переменных. */
-    size_t         *order;          /**< Индексы в data, отсортированные по хэшам. */
+    mystr::mystr_t *data;           /**< Имена переменных в порядке добавления, str указывает в арену intern. */
+    size_t         *slots;          /**< Таблица с линейным пробированием: индекс в data + 1, 0 - пустой слот. */
     size_t          size;           /**< Количество записанных имен. */
-    size_t          capacity;       /**< Общая емкость массивов data и order. */
+    size_t          capacity;       /**< Емкость массива data. */
+    size_t          slots_capacity; /**< Размер таблицы slots (степень двойки, заполнена не более чем наполовину). */
+    size_t          refcount;       /**< Число владельцев списка. */
+    bool            heap;           /**< Структура выделена create/clone и освобождается последним release. */
 } VarList;
 
 /**
@@ -31,6 +39,29 @@ typedef struct {
  */
 void init(VarList *list);
 
+/**
+ * @brief Создает пустой список в куче с одной ссылкой.
+ *
+ * @return Указатель на список или NULL при нехватке памяти.
+ */
+VarList *create();
+
+/**
+ * @brief Добавляет ссылку на список.
+ *
+ * @param list Указатель на список VarList. Допускается NULL.
+ * @return Тот же указатель list.
+ */
+VarList *retain(VarList *list);
+
+/**
+ * @brief Снимает ссылку; последняя ссылка освобождает имена, а для списков из
+ *        create/clone - и саму структуру.
+ *
+ * @param list Указатель на список VarList. Допускается NULL.
+ */
+void release(VarList *list);
+
 /**
  * @brief Освобождает все ресурсы списка и обнуляет его.
  *
@@ -42,6 +73,7 @@ void destruct(VarList *list);
  * @brief Добавляет имя переменной, возвращая ее индекс.
  *
  * При повторном добавлении уже существующего имени возвращает прежний индекс.
+ * Список не должен разделяться с другими владельцами.
  *
  * @param list Указатель на список VarList. Не может быть NULL.
  * @param name Указатель на строку mystr_t с именем переменной. Не может быть NULL.
@@ -81,7 +113,10 @@ size_t size(const VarList *list);
 size_t find_index(const VarList *list, const mystr::mystr_t *name);
 
 /**
- * @brief Создает копию списка переменных.
+ * @brief Создает копию списка переменных за O(n).
+ *
+ * Таблица slots и имена копируются целиком (memcpy), индексы имен сохраняются.
+ * Копия создается в куче с одной ссылкой.
  */
 VarList *clone(const VarList *list);
 